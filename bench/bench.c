@@ -0,0 +1,559 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Multithreaded throughput and latency benchmarks
+//Usage: benchmark [-t <numthreads>] [-n <numiter>] [-b <min>,<max>,<yield>]
+//                 [<workload>...]
+
+#include <getopt.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "p64_backoff.h"
+#include "p64_barrier.h"
+#include "p64_clhlock.h"
+#include "p64_hashtable.h"
+#include "p64_hazardptr.h"
+#include "p64_ringbuf.h"
+#include "p64_rwlock.h"
+#include "p64_brlock.h"
+#include "p64_spinlock.h"
+#include "p64_stats.h"
+#include "p64_timer.h"
+
+#define NKEYS 1024 //Hash table keys per thread
+#define NTIMERS 16 //Timers per thread
+#define WRITE_PERCENT 10 //Percentage of updates in read/write mixes
+
+static uint32_t
+xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static void
+check(bool cond, const char *what)
+{
+    if (!cond)
+    {
+	fprintf(stderr, "bench: %s failed\n", what), abort();
+    }
+}
+
+//Ring buffer ping-pong between pairs of threads
+//A thread without a partner bounces elements off its own ring buffer
+
+static p64_ringbuf_t *rings[CPU_SETSIZE];
+
+static void
+ringbuf_pingpong(bench_thread_t *bt)
+{
+    uint32_t me = bt->tidx;
+    uint32_t peer = me ^ 1;
+    if (peer >= bt->nthreads)
+    {
+	peer = me;
+    }
+    bool initiator = me <= peer;
+    void *elem = (void *)(uintptr_t)(me + 1);
+    for (uint32_t i = 0; i < bt->niter; i++)
+    {
+	uint32_t idx;
+	uint64_t start = bench_counter();
+	if (initiator)
+	{
+	    check(p64_ringbuf_enqueue(rings[peer], &elem, 1) == 1, "enqueue");
+	    check(p64_ringbuf_dequeue_wait(rings[me], &elem, 1, &idx, ~0ULL) == 1,
+		  "dequeue");
+	}
+	else
+	{
+	    check(p64_ringbuf_dequeue_wait(rings[me], &elem, 1, &idx, ~0ULL) == 1,
+		  "dequeue");
+	    check(p64_ringbuf_enqueue(rings[peer], &elem, 1) == 1, "enqueue");
+	}
+	bench_sample(bt, bench_counter() - start);
+    }
+}
+
+static void
+run_ringbuf(uint32_t nthreads, uint32_t niter)
+{
+    for (uint32_t i = 0; i < nthreads; i++)
+    {
+	rings[i] = p64_ringbuf_alloc(4, P64_RINGBUF_F_WAITDEQ, sizeof(void *));
+	check(rings[i] != NULL, "p64_ringbuf_alloc");
+    }
+    bench_run("ringbuf", ringbuf_pingpong, NULL, nthreads, niter);
+    for (uint32_t i = 0; i < nthreads; i++)
+    {
+	p64_ringbuf_free(rings[i]);
+    }
+}
+
+//Hash table read/write mix
+//Readers look up random keys, writers replace their own elements
+
+struct elem
+{
+    p64_hashelem_t next;
+    uint32_t key;
+};
+
+static p64_hashtable_t *ht;
+static struct elem **elems;
+
+static inline p64_hashvalue_t
+hash(uint32_t key)
+{
+    return (p64_hashvalue_t)key * 0x9E3779B97F4A7C15ULL;
+}
+
+static int
+compf(const p64_hashelem_t *he, const void *key)
+{
+    uint32_t k = *(const uint32_t *)key;
+    const struct elem *e = (const struct elem *)he;
+    return e->key < k ? -1 : e->key > k ? 1 : 0;
+}
+
+static struct elem *
+elem_alloc(uint32_t key)
+{
+    struct elem *e = malloc(sizeof(struct elem));
+    if (e == NULL)
+    {
+	perror("malloc"), exit(EXIT_FAILURE);
+    }
+    e->next.next = NULL;
+    e->next.hash = 0;
+    e->key = key;
+    return e;
+}
+
+static void
+hashtable_mix(bench_thread_t *bt)
+{
+    uint32_t rnd = bt->tidx * 2654435761U + 1;
+    uint32_t nkeys = bt->nthreads * NKEYS;
+    for (uint32_t i = 0; i < bt->niter; i++)
+    {
+	uint32_t r = xorshift32(&rnd);
+	uint64_t start = bench_counter();
+	if (r % 100 < WRITE_PERCENT)
+	{
+	    uint32_t key = bt->tidx * NKEYS + r / 100 % NKEYS;
+	    struct elem *old = elems[key];
+	    check(p64_hashtable_remove(ht, &old->next, hash(key)), "remove");
+	    p64_hazptr_retire(old, free);
+	    struct elem *new = elem_alloc(key);
+	    p64_hashtable_insert(ht, &new->next, hash(key));
+	    elems[key] = new;
+	}
+	else
+	{
+	    uint32_t key = r / 100 % nkeys;
+	    p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+	    p64_hashelem_t *he = p64_hashtable_lookup(ht, compf, &key,
+						      hash(key), &hp);
+	    check(he == NULL || ((struct elem *)he)->key == key, "lookup");
+	    p64_hazptr_release_ro(&hp);
+	}
+	bench_sample(bt, bench_counter() - start);
+    }
+    p64_hazptr_unregister();
+}
+
+static void
+run_hashtable(uint32_t nthreads, uint32_t niter)
+{
+    uint32_t nkeys = nthreads * NKEYS;
+    ht = p64_hashtable_alloc(nkeys);
+    elems = malloc(nkeys * sizeof(struct elem *));
+    check(ht != NULL && elems != NULL, "p64_hashtable_alloc");
+    for (uint32_t k = 0; k < nkeys; k++)
+    {
+	elems[k] = elem_alloc(k);
+	p64_hashtable_insert(ht, &elems[k]->next, hash(k));
+    }
+    bench_run("hashtable", hashtable_mix, NULL, nthreads, niter);
+    for (uint32_t k = 0; k < nkeys; k++)
+    {
+	check(p64_hashtable_remove(ht, &elems[k]->next, hash(k)), "remove");
+	free(elems[k]);
+    }
+    //Reclaim retired elements handed over by the benchmark threads
+    p64_hazptr_reclaim();
+    p64_hazptr_unregister();
+    p64_hashtable_free(ht);
+    free(elems);
+}
+
+//Lock handoff, all threads increment a shared counter inside the lock
+
+static union
+{
+    p64_spinlock_t spin;
+    p64_tktlock_t tkt;
+    p64_clhlock_t clh;
+    p64_rwlock_t rw;
+    p64_brlock_t *br;
+} lock;
+static uint64_t counter;
+
+static void
+spinlock_handoff(bench_thread_t *bt)
+{
+    for (uint32_t i = 0; i < bt->niter; i++)
+    {
+	uint64_t start = bench_counter();
+	p64_spinlock_acquire(&lock.spin);
+	counter++;
+	p64_spinlock_release(&lock.spin);
+	bench_sample(bt, bench_counter() - start);
+    }
+}
+
+static void
+tktlock_handoff(bench_thread_t *bt)
+{
+    for (uint32_t i = 0; i < bt->niter; i++)
+    {
+	uint64_t start = bench_counter();
+	p64_tktlock_acquire(&lock.tkt);
+	counter++;
+	p64_tktlock_release(&lock.tkt);
+	bench_sample(bt, bench_counter() - start);
+    }
+}
+
+static void
+clhlock_handoff(bench_thread_t *bt)
+{
+    p64_clhnode_t *node = NULL;
+    for (uint32_t i = 0; i < bt->niter; i++)
+    {
+	uint64_t start = bench_counter();
+	p64_clhlock_acquire(&lock.clh, &node);
+	counter++;
+	p64_clhlock_release(&node);
+	bench_sample(bt, bench_counter() - start);
+    }
+    free(node);
+}
+
+static void
+rwlock_mix(bench_thread_t *bt)
+{
+    uint32_t rnd = bt->tidx * 2654435761U + 1;
+    for (uint32_t i = 0; i < bt->niter; i++)
+    {
+	bool write = xorshift32(&rnd) % 100 < WRITE_PERCENT;
+	uint64_t start = bench_counter();
+	if (write)
+	{
+	    p64_rwlock_acquire_wr(&lock.rw);
+	    counter++;
+	    p64_rwlock_release_wr(&lock.rw);
+	}
+	else
+	{
+	    p64_rwlock_acquire_rd(&lock.rw);
+	    (void)__atomic_load_n(&counter, __ATOMIC_RELAXED);
+	    p64_rwlock_release_rd(&lock.rw);
+	}
+	bench_sample(bt, bench_counter() - start);
+    }
+}
+
+static void
+brlock_mix(bench_thread_t *bt)
+{
+    uint32_t rnd = bt->tidx * 2654435761U + 1;
+    for (uint32_t i = 0; i < bt->niter; i++)
+    {
+	bool write = xorshift32(&rnd) % 100 < WRITE_PERCENT;
+	uint64_t start = bench_counter();
+	if (write)
+	{
+	    p64_brlock_acquire_wr(lock.br);
+	    counter++;
+	    p64_brlock_release_wr(lock.br);
+	}
+	else
+	{
+	    p64_brlock_acquire_rd(lock.br);
+	    (void)__atomic_load_n(&counter, __ATOMIC_RELAXED);
+	    p64_brlock_release_rd(lock.br);
+	}
+	bench_sample(bt, bench_counter() - start);
+    }
+}
+
+static void
+run_spinlock(uint32_t nthreads, uint32_t niter)
+{
+    p64_spinlock_init(&lock.spin);
+    counter = 0;
+    bench_run("spinlock", spinlock_handoff, NULL, nthreads, niter);
+    check(counter == (uint64_t)nthreads * niter, "spinlock");
+}
+
+static void
+run_tktlock(uint32_t nthreads, uint32_t niter)
+{
+    p64_tktlock_init(&lock.tkt);
+    counter = 0;
+    bench_run("tktlock", tktlock_handoff, NULL, nthreads, niter);
+    check(counter == (uint64_t)nthreads * niter, "tktlock");
+}
+
+static void
+run_clhlock(uint32_t nthreads, uint32_t niter)
+{
+    p64_clhlock_init(&lock.clh);
+    counter = 0;
+    bench_run("clhlock", clhlock_handoff, NULL, nthreads, niter);
+    check(counter == (uint64_t)nthreads * niter, "clhlock");
+    p64_clhlock_fini(&lock.clh);
+}
+
+static void
+run_rwlock(uint32_t nthreads, uint32_t niter)
+{
+    p64_rwlock_init(&lock.rw);
+    counter = 0;
+    bench_run("rwlock", rwlock_mix, NULL, nthreads, niter);
+}
+
+static void
+run_brlock(uint32_t nthreads, uint32_t niter)
+{
+    lock.br = p64_brlock_alloc(nthreads);
+    check(lock.br != NULL, "brlock");
+    counter = 0;
+    bench_run("brlock", brlock_mix, NULL, nthreads, niter);
+    p64_brlock_free(lock.br);
+}
+
+//Barrier episodes, all threads repeatedly synchronise
+
+#define TREE_FANOUT 4
+
+static p64_barrier_t barrier;
+static p64_barrier_tree_t *tree;
+
+static void
+barrier_sync(bench_thread_t *bt)
+{
+    for (uint32_t i = 0; i < bt->niter; i++)
+    {
+	uint64_t start = bench_counter();
+	p64_barrier_wait(&barrier);
+	bench_sample(bt, bench_counter() - start);
+    }
+}
+
+static void
+treebarrier_sync(bench_thread_t *bt)
+{
+    for (uint32_t i = 0; i < bt->niter; i++)
+    {
+	uint64_t start = bench_counter();
+	p64_barrier_tree_wait(tree, bt->tidx);
+	bench_sample(bt, bench_counter() - start);
+    }
+}
+
+static void
+run_barrier(uint32_t nthreads, uint32_t niter)
+{
+    p64_barrier_init(&barrier, nthreads);
+    bench_run("barrier", barrier_sync, NULL, nthreads, niter);
+}
+
+static void
+run_treebarrier(uint32_t nthreads, uint32_t niter)
+{
+    tree = p64_barrier_tree_alloc(nthreads, TREE_FANOUT);
+    check(tree != NULL, "p64_barrier_tree_alloc");
+    bench_run("treebarrier", treebarrier_sync, NULL, nthreads, niter);
+    p64_barrier_tree_free(tree);
+}
+
+//Timer churn, all threads set and cancel their own timers
+//Thread 0 also advances time and expires timers
+
+static p64_timer_t timers[CPU_SETSIZE][NTIMERS];
+
+static void
+callback(p64_timer_t tim, p64_tick_t tmo, void *arg)
+{
+    (void)tim;
+    (void)tmo;
+    (void)arg;
+}
+
+static void
+timer_churn(bench_thread_t *bt)
+{
+    p64_timer_t *tims = timers[bt->tidx];
+    for (uint32_t i = 0; i < bt->niter; i++)
+    {
+	p64_timer_t tim = tims[i % NTIMERS];
+	uint64_t start = bench_counter();
+	if (bt->tidx == 0 && i % NTIMERS == 0)
+	{
+	    p64_timer_tick_set(p64_timer_tick_get() + 1);
+	    p64_timer_expire();
+	}
+	p64_tick_t tmo = p64_timer_tick_get() + 1 + i % 4;
+	if (p64_timer_set(tim, tmo))
+	{
+	    //Fails if timer has already expired
+	    (void)p64_timer_cancel(tim);
+	}
+	bench_sample(bt, bench_counter() - start);
+    }
+}
+
+static void
+run_timer(uint32_t nthreads, uint32_t niter)
+{
+    for (uint32_t t = 0; t < nthreads; t++)
+    {
+	for (uint32_t i = 0; i < NTIMERS; i++)
+	{
+	    timers[t][i] = p64_timer_alloc(callback, NULL);
+	    check(timers[t][i] != P64_TIMER_NULL, "p64_timer_alloc");
+	}
+    }
+    bench_run("timer", timer_churn, NULL, nthreads, niter);
+    //Expire any timers that are still active
+    p64_timer_tick_set(p64_timer_tick_get() + NTIMERS);
+    p64_timer_expire();
+    for (uint32_t t = 0; t < nthreads; t++)
+    {
+	for (uint32_t i = 0; i < NTIMERS; i++)
+	{
+	    p64_timer_free(timers[t][i]);
+	}
+    }
+}
+
+static const struct
+{
+    const char *name;
+    void (*run)(uint32_t nthreads, uint32_t niter);
+} workloads[] =
+{
+    { "ringbuf", run_ringbuf },
+    { "hashtable", run_hashtable },
+    { "spinlock", run_spinlock },
+    { "tktlock", run_tktlock },
+    { "clhlock", run_clhlock },
+    { "rwlock", run_rwlock },
+    { "brlock", run_brlock },
+    { "barrier", run_barrier },
+    { "treebarrier", run_treebarrier },
+    { "timer", run_timer },
+};
+#define NWORKLOADS (sizeof workloads / sizeof workloads[0])
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-t <numthreads>] [-n <numiter>] "
+		    "[-b <min>,<max>,<yield>] [<workload>...]\n", prog);
+    fprintf(stderr, "Workloads:");
+    for (uint32_t w = 0; w < NWORKLOADS; w++)
+    {
+	fprintf(stderr, " %s", workloads[w].name);
+    }
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    cpu_set_t cpus;
+    uint32_t nthreads = 1;
+    uint32_t niter = 10000;
+    //Default to one thread per available CPU
+    if (sched_getaffinity(0, sizeof cpus, &cpus) == 0)
+    {
+	nthreads = CPU_COUNT(&cpus);
+    }
+    int c;
+    while ((c = getopt(argc, argv, "b:n:t:")) != -1)
+    {
+	switch (c)
+	{
+	    case 'b' :
+	    {
+		p64_backoff_t bo;
+		if (sscanf(optarg, "%u,%u,%u", &bo.min, &bo.max, &bo.yield) != 3 ||
+		    bo.min > bo.max)
+		{
+		    usage(argv[0]);
+		}
+		p64_backoff_set(&bo);
+		break;
+	    }
+	    case 'n' :
+		niter = atoi(optarg);
+		break;
+	    case 't' :
+		nthreads = atoi(optarg);
+		break;
+	    default :
+		usage(argv[0]);
+	}
+    }
+    if (nthreads < 1 || nthreads > CPU_SETSIZE || niter < 1)
+    {
+	usage(argv[0]);
+    }
+    for (int i = optind; i < argc; i++)
+    {
+	bool found = false;
+	for (uint32_t w = 0; w < NWORKLOADS; w++)
+	{
+	    found |= strcmp(argv[i], workloads[w].name) == 0;
+	}
+	if (!found)
+	{
+	    fprintf(stderr, "Unknown workload %s\n", argv[i]);
+	    usage(argv[0]);
+	}
+    }
+
+    printf("%-16s %3s %14s %10s %10s %10s\n",
+	   "workload", "thr", "ops/s", "p50(ns)", "p99(ns)", "p999(ns)");
+    for (uint32_t w = 0; w < NWORKLOADS; w++)
+    {
+	bool selected = optind == argc;
+	for (int i = optind; i < argc; i++)
+	{
+	    selected |= strcmp(argv[i], workloads[w].name) == 0;
+	}
+	if (selected)
+	{
+	    workloads[w].run(nthreads, niter);
+	}
+    }
+    if (p64_stats_enabled())
+    {
+	p64_stats_dump(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,179 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "harness.h"
+#include "p64_barrier.h"
+
+struct thread_ctx
+{
+    bench_thread_t bt;
+    bench_func func;
+    p64_barrier_t *barrier;
+    uint64_t start;
+    uint64_t end;
+};
+
+static uint64_t
+time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t
+bench_counter_freq(void)
+{
+    static uint64_t freq = 0;
+    if (freq == 0)
+    {
+#if defined __aarch64__
+	__asm__ volatile("mrs %0, cntfrq_el0" : "=r" (freq));
+#else
+	//Calibrate TSC against the monotonic clock
+	uint64_t t0 = time_ns();
+	uint64_t c0 = bench_counter();
+	uint64_t t1;
+	do
+	{
+	    t1 = time_ns();
+	}
+	while (t1 - t0 < 20000000);
+	uint64_t c1 = bench_counter();
+	freq = (c1 - c0) * 1000000000ULL / (t1 - t0);
+#endif
+    }
+    return freq;
+}
+
+static void *
+entrypoint(void *arg)
+{
+    struct thread_ctx *ctx = arg;
+    p64_barrier_wait(ctx->barrier);
+    ctx->start = bench_counter();
+    ctx->func(&ctx->bt);
+    ctx->end = bench_counter();
+    return NULL;
+}
+
+static int
+compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static double
+percentile(const uint64_t *samples, uint64_t nsamples, uint32_t permille,
+	   uint64_t freq)
+{
+    if (nsamples == 0)
+    {
+	return 0.0;
+    }
+    uint64_t idx = nsamples * permille / 1000;
+    if (idx >= nsamples)
+    {
+	idx = nsamples - 1;
+    }
+    return (double)samples[idx] * 1e9 / freq;
+}
+
+void
+bench_run(const char *name,
+	  bench_func func,
+	  void *arg,
+	  uint32_t nthreads,
+	  uint32_t niter)
+{
+    cpu_set_t cpus;
+    if (sched_getaffinity(0, sizeof cpus, &cpus) != 0)
+    {
+	perror("sched_getaffinity"), exit(EXIT_FAILURE);
+    }
+    int32_t ncpus = CPU_COUNT(&cpus);
+    int32_t cpuid[CPU_SETSIZE];
+    for (int32_t c = 0, n = 0; c < CPU_SETSIZE && n < ncpus; c++)
+    {
+	if (CPU_ISSET(c, &cpus))
+	{
+	    cpuid[n++] = c;
+	}
+    }
+
+    struct thread_ctx *ctx = calloc(nthreads, sizeof(struct thread_ctx));
+    pthread_t *tids = calloc(nthreads, sizeof(pthread_t));
+    uint64_t *samples = malloc((size_t)nthreads * niter * sizeof(uint64_t));
+    if (ctx == NULL || tids == NULL || samples == NULL)
+    {
+	perror("malloc"), exit(EXIT_FAILURE);
+    }
+    p64_barrier_t barrier;
+    p64_barrier_init(&barrier, nthreads);
+    for (uint32_t i = 0; i < nthreads; i++)
+    {
+	ctx[i].bt.tidx = i;
+	ctx[i].bt.nthreads = nthreads;
+	ctx[i].bt.niter = niter;
+	ctx[i].bt.nsamples = 0;
+	ctx[i].bt.samples = samples + (size_t)i * niter;
+	ctx[i].bt.arg = arg;
+	ctx[i].func = func;
+	ctx[i].barrier = &barrier;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	cpu_set_t cpu;
+	CPU_ZERO(&cpu);
+	CPU_SET(cpuid[i % ncpus], &cpu);
+	if (pthread_attr_setaffinity_np(&attr, sizeof cpu, &cpu) != 0)
+	{
+	    perror("pthread_attr_setaffinity_np"), exit(EXIT_FAILURE);
+	}
+	if (pthread_create(&tids[i], &attr, entrypoint, &ctx[i]) != 0)
+	{
+	    perror("pthread_create"), exit(EXIT_FAILURE);
+	}
+	pthread_attr_destroy(&attr);
+    }
+    uint64_t start = ~(uint64_t)0, end = 0, nops = 0, nsamples = 0;
+    for (uint32_t i = 0; i < nthreads; i++)
+    {
+	pthread_join(tids[i], NULL);
+	if (ctx[i].start < start)
+	{
+	    start = ctx[i].start;
+	}
+	if (ctx[i].end > end)
+	{
+	    end = ctx[i].end;
+	}
+	nops += ctx[i].bt.niter;
+	//Compact samples from all threads
+	memmove(samples + nsamples, ctx[i].bt.samples,
+		ctx[i].bt.nsamples * sizeof(uint64_t));
+	nsamples += ctx[i].bt.nsamples;
+    }
+    qsort(samples, nsamples, sizeof(uint64_t), compare);
+
+    uint64_t freq = bench_counter_freq();
+    double secs = end > start ? (double)(end - start) / freq : 0.0;
+    printf("%-16s %3u %14.0f %10.1f %10.1f %10.1f\n",
+	   name, nthreads, secs != 0.0 ? nops / secs : 0.0,
+	   percentile(samples, nsamples, 500, freq),
+	   percentile(samples, nsamples, 990, freq),
+	   percentile(samples, nsamples, 999, freq));
+    fflush(stdout);
+    free(samples);
+    free(tids);
+    free(ctx);
+}
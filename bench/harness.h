@@ -0,0 +1,65 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Common harness for multithreaded throughput and latency benchmarks
+
+#ifndef _HARNESS_H
+#define _HARNESS_H
+
+#include <stdint.h>
+
+//Read the free running cycle counter
+static inline uint64_t
+bench_counter(void)
+{
+#if defined __aarch64__
+    uint64_t cnt;
+    __asm__ volatile("isb; mrs %0, cntvct_el0" : "=r" (cnt) : : "memory");
+    return cnt;
+#elif defined __x86_64__ || defined __i386__
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a" (lo), "=d" (hi) : : "memory");
+    return (uint64_t)hi << 32 | lo;
+#else
+#error Unsupported architecture
+#endif
+}
+
+//Return frequency (ticks per second) of bench_counter()
+uint64_t bench_counter_freq(void);
+
+typedef struct bench_thread
+{
+    uint32_t tidx;//Thread index, 0..nthreads-1
+    uint32_t nthreads;
+    uint32_t niter;//Number of operations to perform
+    uint32_t nsamples;
+    uint64_t *samples;
+    void *arg;
+} bench_thread_t;
+
+//Record the latency (in counter ticks) of one operation
+static inline void
+bench_sample(bench_thread_t *bt, uint64_t ticks)
+{
+    if (bt->nsamples < bt->niter)
+    {
+	bt->samples[bt->nsamples++] = ticks;
+    }
+}
+
+//Benchmark function executed by each thread
+//Perform bt->niter operations, call bench_sample() for each operation
+typedef void (*bench_func)(bench_thread_t *bt);
+
+//Run 'func' in 'nthreads' threads pinned to separate CPU's (as long as
+//there are enough CPU's), each thread performs 'niter' operations
+//Threads start simultaneously, print throughput and latency percentiles
+void bench_run(const char *name,
+	       bench_func func,
+	       void *arg,
+	       uint32_t nthreads,
+	       uint32_t niter);
+
+#endif
@@ -0,0 +1,88 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "p64_alloc.h"
+#include "p64_hashtable.h"
+#include "p64_hazardptr.h"
+#include "p64_ringbuf.h"
+#include "expect.h"
+
+#define HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+struct counters
+{
+    uint32_t nallocs;
+    uint32_t nfrees;
+    int32_t lastnode;
+    uint32_t lastflags;
+};
+
+static void *
+count_alloc(void *arg, size_t size, size_t align, int32_t node, uint32_t flags)
+{
+    struct counters *cnt = arg;
+    cnt->nallocs++;
+    cnt->lastnode = node;
+    cnt->lastflags = flags;
+    return aligned_alloc(align, (size + align - 1) & ~(align - 1));
+}
+
+static void
+count_free(void *arg, void *ptr)
+{
+    struct counters *cnt = arg;
+    cnt->nfrees++;
+    free(ptr);
+}
+
+int main(void)
+{
+    //Default allocator
+    void *ptr = p64_malloc(100, 256, P64_ALLOC_ANYNODE, 0);
+    EXPECT(ptr != NULL && (uintptr_t)ptr % 256 == 0);
+    p64_mfree(ptr);
+    ptr = p64_malloc(HUGE_PAGE_SIZE, 64, 0, P64_ALLOC_F_HUGEPAGE);
+    EXPECT(ptr != NULL && (uintptr_t)ptr % HUGE_PAGE_SIZE == 0);
+    p64_mfree(ptr);
+    p64_mfree(NULL);
+
+    //User defined allocator
+    struct counters cnt = { 0, 0, 0, 0 };
+    p64_set_allocator(count_alloc, count_free, &cnt);
+    p64_ringbuf_t *rb = p64_ringbuf_alloc_ex(1000, 0, sizeof(void *),
+					     1, P64_ALLOC_F_HUGEPAGE);
+    EXPECT(rb != NULL);
+    EXPECT(cnt.nallocs == 1);
+    EXPECT(cnt.lastnode == 1 && cnt.lastflags == P64_ALLOC_F_HUGEPAGE);
+    p64_ringbuf_free(rb);
+    EXPECT(cnt.nfrees == 1);
+
+    p64_hashtable_t *ht = p64_hashtable_alloc_ex(100, 2, P64_ALLOC_F_HUGEPAGE);
+    EXPECT(ht != NULL);
+    EXPECT(cnt.nallocs == 3);
+    //Resized table uses the same placement
+    cnt.lastnode = P64_ALLOC_ANYNODE;
+    EXPECT(p64_hashtable_resize(ht, 1000));
+    EXPECT(cnt.nallocs == 4);
+    EXPECT(cnt.lastnode == 2 && cnt.lastflags == P64_ALLOC_F_HUGEPAGE);
+    //Old table retired
+    EXPECT(p64_hazptr_reclaim());
+    EXPECT(cnt.nfrees == 2);
+    p64_hashtable_free(ht);
+    EXPECT(cnt.nfrees == 4);
+
+    //Restore default allocator
+    p64_set_allocator(NULL, NULL, NULL);
+    rb = p64_ringbuf_alloc(10, 0, sizeof(void *));
+    EXPECT(rb != NULL);
+    p64_ringbuf_free(rb);
+    EXPECT(cnt.nallocs == 4 && cnt.nfrees == 4);
+    p64_hazptr_unregister();
+
+    printf("alloc tests complete\n");
+    return 0;
+}
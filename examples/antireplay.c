@@ -9,6 +9,115 @@
 #include "p64_antireplay.h"
 #include "expect.h"
 
+#define NSNS 1000
+
+//Vector version must give same results as the scalar version
+static void
+test_vec(bool swizzle)
+{
+    p64_antireplay_t *ar1 = p64_antireplay_alloc(256, swizzle);
+    p64_antireplay_t *ar2 = p64_antireplay_alloc(256, swizzle);
+    EXPECT(ar1 != NULL && ar2 != NULL);
+    p64_antireplay_sn_t sns[NSNS];
+    p64_antireplay_result_t res1[NSNS], res2[NSNS];
+    uint32_t npass = 0;
+    //Mostly consecutive sequence numbers with some duplicates and stale
+    uint64_t sn = 1;
+    for (uint32_t i = 0; i < NSNS; i++)
+    {
+	uint32_t r = rand();
+	if (r % 8 == 0 && sn > 300)
+	{
+	    sns[i] = sn - r % 300;
+	}
+	else
+	{
+	    sns[i] = sn;
+	    sn += 1 + (r % 16 == 0);
+	}
+	res1[i] = p64_antireplay_test_and_set(ar1, sns[i]);
+	npass += res1[i] == p64_ar_pass;
+    }
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < NSNS; i += n)
+    {
+	//Varying burst sizes, some larger than internal batch size
+	n = 1 + rand() % 40;
+	n = i + n > NSNS ? NSNS - i : n;
+	npass -= p64_antireplay_test_and_set_vec(ar2, &sns[i], n, &res2[i]);
+    }
+    EXPECT(npass == 0);
+    for (uint32_t i = 0; i < NSNS; i++)
+    {
+	EXPECT(res1[i] == res2[i]);
+    }
+    //Windows must have been updated the same way
+    for (p64_antireplay_sn_t s = 0; s < sn + 256; s++)
+    {
+	EXPECT(p64_antireplay_test(ar1, s) == p64_antireplay_test(ar2, s));
+    }
+    p64_antireplay_free(ar1);
+    p64_antireplay_free(ar2);
+}
+
+static void
+test_bitmap(void)
+{
+    p64_antireplay_t *ar = p64_antireplay_alloc_bitmap(64);
+    EXPECT(ar != NULL);
+    EXPECT(p64_antireplay_test_and_set(ar, 100) == p64_ar_pass);
+    EXPECT(p64_antireplay_test_and_set(ar, 100) == p64_ar_replay);
+    EXPECT(p64_antireplay_test_and_set(ar, 101) == p64_ar_pass);
+    EXPECT(p64_antireplay_test(ar, 90) == p64_ar_pass);
+    EXPECT(p64_antireplay_test_and_set(ar, 90) == p64_ar_pass);
+    EXPECT(p64_antireplay_test_and_set(ar, 90) == p64_ar_replay);
+    //Advance window, block with 90 is rotated out
+    EXPECT(p64_antireplay_test_and_set(ar, 130) == p64_ar_pass);
+    EXPECT(p64_antireplay_test(ar, 90) == p64_ar_stale);
+    EXPECT(p64_antireplay_test_and_set(ar, 91) == p64_ar_stale);
+    EXPECT(p64_antireplay_test_and_set(ar, 100) == p64_ar_replay);
+    EXPECT(p64_antireplay_test_and_set(ar, 110) == p64_ar_pass);
+    //Jump far ahead, all old blocks become stale
+    EXPECT(p64_antireplay_test_and_set(ar, 1000) == p64_ar_pass);
+    EXPECT(p64_antireplay_test_and_set(ar, 110) == p64_ar_stale);
+    EXPECT(p64_antireplay_test_and_set(ar, 970) == p64_ar_pass);
+    EXPECT(p64_antireplay_test_and_set(ar, 959) == p64_ar_stale);
+    p64_antireplay_sn_t sns[4] = { 1001, 1001, 999, 1000 };
+    p64_antireplay_result_t res[4];
+    EXPECT(p64_antireplay_test_and_set_vec(ar, sns, 4, res) == 2);
+    EXPECT(res[0] == p64_ar_pass);
+    EXPECT(res[1] == p64_ar_replay);
+    EXPECT(res[2] == p64_ar_pass);
+    EXPECT(res[3] == p64_ar_replay);
+    p64_antireplay_free(ar);
+
+    //Replays are never accepted, unseen sequence numbers within window are
+    //always accepted
+    ar = p64_antireplay_alloc_bitmap(256);
+    EXPECT(ar != NULL);
+    static bool seen[NSNS];
+    p64_antireplay_sn_t max = 0;
+    for (uint32_t i = 0; i < 10 * NSNS; i++)
+    {
+	p64_antireplay_sn_t sn = 1 + (i / 10 + rand() % 64) % NSNS;
+	p64_antireplay_result_t r = p64_antireplay_test_and_set(ar, sn);
+	if (seen[sn - 1])
+	{
+	    EXPECT(r != p64_ar_pass);
+	}
+	else if (sn + 256 - 32 > max)
+	{
+	    EXPECT(r == p64_ar_pass);
+	}
+	if (r == p64_ar_pass)
+	{
+	    seen[sn - 1] = true;
+	    max = sn > max ? sn : max;
+	}
+    }
+    p64_antireplay_free(ar);
+}
+
 int main(void)
 {
     p64_antireplay_t *ar = p64_antireplay_alloc(256, false);
@@ -22,6 +131,23 @@ int main(void)
     EXPECT(p64_antireplay_test_and_set(ar, 356) == p64_ar_replay);
     p64_antireplay_free(ar);
 
+    ar = p64_antireplay_alloc(256, false);
+    EXPECT(ar != NULL);
+    p64_antireplay_sn_t sns[6] = { 100, 101, 100, 356, 101, 102 };
+    p64_antireplay_result_t res[6];
+    EXPECT(p64_antireplay_test_and_set_vec(ar, sns, 6, res) == 4);
+    EXPECT(res[0] == p64_ar_pass);
+    EXPECT(res[1] == p64_ar_pass);
+    EXPECT(res[2] == p64_ar_replay);
+    EXPECT(res[3] == p64_ar_pass);
+    EXPECT(res[4] == p64_ar_replay);
+    EXPECT(res[5] == p64_ar_pass);
+    p64_antireplay_free(ar);
+
+    test_vec(false);
+    test_vec(true);
+    test_bitmap();
+
     printf("antireplay tests complete\n");
     return 0;
 }
@@ -0,0 +1,102 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <pthread.h>
+#include <stdio.h>
+#include "p64_backoff.h"
+#include "p64_barrier.h"
+#include "expect.h"
+
+#define MAXTHREADS 8
+#define NEPISODES 1000
+
+static p64_barrier_t barrier;
+static p64_barrier_tree_t *tree;
+static uint32_t numthreads;
+static uint32_t counter;
+
+static void *
+thread_func(void *arg)
+{
+    uint32_t tidx = (uintptr_t)arg;
+    for (uint32_t ep = 0; ep < NEPISODES; ep++)
+    {
+	__atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+	if (tree != NULL)
+	{
+	    p64_barrier_tree_wait(tree, tidx);
+	}
+	else
+	{
+	    p64_barrier_wait(&barrier);
+	}
+	//All threads have incremented counter for this episode
+	EXPECT(__atomic_load_n(&counter, __ATOMIC_RELAXED) >= (ep + 1) * numthreads);
+	if (tree != NULL)
+	{
+	    p64_barrier_tree_wait(tree, tidx);
+	}
+	else
+	{
+	    p64_barrier_wait(&barrier);
+	}
+	//No thread has incremented counter for the next episode
+	EXPECT(__atomic_load_n(&counter, __ATOMIC_RELAXED) == (ep + 1) * numthreads);
+	if (tree != NULL)
+	{
+	    p64_barrier_tree_wait(tree, tidx);
+	}
+	else
+	{
+	    p64_barrier_wait(&barrier);
+	}
+    }
+    return NULL;
+}
+
+static void
+run_threads(uint32_t nthreads, uint32_t fanout)
+{
+    pthread_t tid[MAXTHREADS];
+    numthreads = nthreads;
+    counter = 0;
+    if (fanout != 0)
+    {
+	tree = p64_barrier_tree_alloc(nthreads, fanout);
+	EXPECT(tree != NULL);
+    }
+    else
+    {
+	tree = NULL;
+	p64_barrier_init(&barrier, nthreads);
+    }
+    for (uintptr_t i = 0; i < nthreads; i++)
+    {
+	EXPECT(pthread_create(&tid[i], NULL, thread_func, (void *)i) == 0);
+    }
+    for (uint32_t i = 0; i < nthreads; i++)
+    {
+	pthread_join(tid[i], NULL);
+    }
+    EXPECT(counter == nthreads * NEPISODES);
+    p64_barrier_tree_free(tree);
+}
+
+int main(void)
+{
+    //Yield after spinning for a while, this test may run with more threads
+    //than CPU's
+    p64_backoff_t bo = { .min = 0, .max = 0, .yield = 64 };
+    p64_backoff_set(&bo);
+    run_threads(4, 0);
+    run_threads(1, 2);
+    run_threads(2, 2);
+    run_threads(5, 2);
+    run_threads(7, 3);
+    run_threads(8, 4);
+    run_threads(8, 8);
+
+    printf("barrier tests complete\n");
+    return 0;
+}
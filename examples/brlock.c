@@ -0,0 +1,65 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <pthread.h>
+#include <stdio.h>
+#include "p64_brlock.h"
+#include "expect.h"
+
+#define NTHREADS 4
+#define NITER 10000
+
+static p64_brlock_t *lock;
+static uint32_t data[2] = { 0, 0 };
+
+static void *
+thread_func(void *arg)
+{
+    uintptr_t tidx = (uintptr_t)arg;
+    for (uint32_t i = 0; i < NITER; i++)
+    {
+	if (tidx == 0 && i % 16 == 0)
+	{
+	    p64_brlock_acquire_wr(lock);
+	    data[0]++;
+	    data[1]++;
+	    p64_brlock_release_wr(lock);
+	}
+	else
+	{
+	    p64_brlock_acquire_rd(lock);
+	    EXPECT(__atomic_load_n(&data[0], __ATOMIC_RELAXED) ==
+		   __atomic_load_n(&data[1], __ATOMIC_RELAXED));
+	    p64_brlock_release_rd(lock);
+	}
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    lock = p64_brlock_alloc(2);
+    EXPECT(lock != NULL);
+    p64_brlock_acquire_rd(lock);
+    p64_brlock_acquire_rd(lock);
+    p64_brlock_release_rd(lock);
+    p64_brlock_release_rd(lock);
+    p64_brlock_acquire_wr(lock);
+    p64_brlock_release_wr(lock);
+
+    pthread_t tid[NTHREADS];
+    for (uintptr_t i = 0; i < NTHREADS; i++)
+    {
+	EXPECT(pthread_create(&tid[i], NULL, thread_func, (void *)i) == 0);
+    }
+    for (uint32_t i = 0; i < NTHREADS; i++)
+    {
+	pthread_join(tid[i], NULL);
+    }
+    EXPECT(data[0] == NITER / 16);
+    p64_brlock_free(lock);
+
+    printf("brlock tests complete\n");
+    return 0;
+}
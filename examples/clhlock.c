@@ -2,10 +2,31 @@
 //
 //SPDX-License-Identifier:        BSD-3-Clause
 
+#include <pthread.h>
 #include <stdio.h>
 #include "p64_clhlock.h"
 #include "expect.h"
 
+#define NTHREADS 4
+#define NITER 10000
+
+static p64_clhcohort_t *cohort;
+static uint32_t counter = 0;
+
+static void *
+thread_func(void *arg)
+{
+    uint32_t node = (uintptr_t)arg % 2;
+    for (uint32_t i = 0; i < NITER; i++)
+    {
+	p64_clhcohort_acquire(cohort, node);
+	//Not atomic, protected by lock
+	counter++;
+	p64_clhcohort_release(cohort, node);
+    }
+    return NULL;
+}
+
 int main(void)
 {
     p64_clhlock_t lock;
@@ -18,6 +39,39 @@ int main(void)
     p64_clhlock_fini(&lock);
     free(node);
 
+    //Pooled nodes, nested locks
+    p64_clhlock_t lock2;
+    p64_clhnode_t *node2 = NULL;
+    p64_clhlock_init(&lock);
+    p64_clhlock_init(&lock2);
+    p64_clhlock_acquire_pooled(&lock, &node);
+    p64_clhlock_acquire_pooled(&lock2, &node2);
+    EXPECT(node != NULL && node2 != NULL && node != node2);
+    p64_clhlock_release_pooled(&node2);
+    p64_clhlock_release_pooled(&node);
+    EXPECT(node == NULL && node2 == NULL);
+    p64_clhlock_acquire_pooled(&lock2, &node2);
+    p64_clhlock_release_pooled(&node2);
+    p64_clhlock_fini(&lock);
+    p64_clhlock_fini(&lock2);
+
+    //Cohort lock
+    cohort = p64_clhcohort_alloc(2, 8);
+    EXPECT(cohort != NULL);
+    p64_clhcohort_acquire(cohort, 1);
+    p64_clhcohort_release(cohort, 1);
+    pthread_t tid[NTHREADS];
+    for (uintptr_t i = 0; i < NTHREADS; i++)
+    {
+	EXPECT(pthread_create(&tid[i], NULL, thread_func, (void *)i) == 0);
+    }
+    for (uint32_t i = 0; i < NTHREADS; i++)
+    {
+	pthread_join(tid[i], NULL);
+    }
+    EXPECT(counter == NTHREADS * NITER);
+    p64_clhcohort_free(cohort);
+
     printf("clhlock tests complete\n");
     return 0;
 }
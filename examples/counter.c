@@ -0,0 +1,117 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p64_counter.h"
+#include "build_config.h"
+#include "expect.h"
+
+#define NTHREADS 4
+#define NITER 100000
+
+//Packet, byte and drop counters
+#define CNT_PKTS 0
+#define CNT_BYTES 1
+#define CNT_DROPS 2
+//Reset while being updated
+#define CNT_EVENTS 3
+
+static p64_counter_t *cnt;
+
+static void *
+thread_func(void *arg)
+{
+    uint32_t tidx = (uintptr_t)arg;
+    for (uint32_t i = 0; i < NITER; i++)
+    {
+	uint64_t vals[2] = { 1, 64 + tidx };
+	p64_counter_add_vec(cnt, CNT_PKTS, vals, 2);
+	if (i % 16 == 0)
+	{
+	    p64_counter_add(cnt, CNT_DROPS, 1);
+	}
+	p64_counter_add(cnt, CNT_EVENTS, 1);
+    }
+    p64_counter_unregister();
+    return NULL;
+}
+
+//Short-lived thread, its slot index is recycled
+static void *
+churn_func(void *arg)
+{
+    (void)arg;
+    p64_counter_register();
+    p64_counter_add(cnt, CNT_PKTS, 1);
+    p64_counter_unregister();
+    return NULL;
+}
+
+int main(void)
+{
+    cnt = p64_counter_alloc(4);
+    EXPECT(cnt != NULL);
+    EXPECT(p64_counter_read(cnt, CNT_PKTS) == 0);
+    p64_counter_add(cnt, CNT_PKTS, 5);
+    EXPECT(p64_counter_read(cnt, CNT_PKTS) == 5);
+    EXPECT(p64_counter_read(cnt, CNT_BYTES) == 0);
+    p64_counter_reset(cnt, CNT_PKTS);
+    EXPECT(p64_counter_read(cnt, CNT_PKTS) == 0);
+    p64_counter_add(cnt, CNT_PKTS, 2);
+    EXPECT(p64_counter_read(cnt, CNT_PKTS) == 2);
+    p64_counter_reset(cnt, CNT_PKTS);
+
+    pthread_t tid[NTHREADS];
+    for (uintptr_t i = 0; i < NTHREADS; i++)
+    {
+	EXPECT(pthread_create(&tid[i], NULL, thread_func, (void *)i) == 0);
+    }
+    //Concurrent reads see monotonically increasing values
+    uint64_t prev = 0;
+    for (uint32_t i = 0; i < 1000; i++)
+    {
+	uint64_t pkts = p64_counter_read(cnt, CNT_PKTS);
+	EXPECT(pkts >= prev && pkts <= (uint64_t)NTHREADS * NITER);
+	prev = pkts;
+    }
+    //Concurrent resets, a read never wraps below zero
+    for (uint32_t i = 0; i < 1000; i++)
+    {
+	if (i % 8 == 0)
+	{
+	    p64_counter_reset(cnt, CNT_EVENTS);
+	}
+	uint64_t events = p64_counter_read(cnt, CNT_EVENTS);
+	EXPECT(events <= (uint64_t)NTHREADS * NITER);
+    }
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < NTHREADS; i++)
+    {
+	pthread_join(tid[i], NULL);
+	bytes += (uint64_t)NITER * (64 + i);
+    }
+    EXPECT(p64_counter_read(cnt, CNT_PKTS) == (uint64_t)NTHREADS * NITER);
+    EXPECT(p64_counter_read(cnt, CNT_BYTES) == bytes);
+    EXPECT(p64_counter_read(cnt, CNT_DROPS) ==
+	   (uint64_t)NTHREADS * ((NITER + 15) / 16));
+    p64_counter_reset(cnt, CNT_EVENTS);
+    EXPECT(p64_counter_read(cnt, CNT_EVENTS) == 0);
+
+    //More threads than MAXTHREADS over time, values of exited threads kept
+    p64_counter_reset(cnt, CNT_PKTS);
+    for (uint32_t i = 0; i < 2 * MAXTHREADS; i++)
+    {
+	pthread_t t;
+	EXPECT(pthread_create(&t, NULL, churn_func, NULL) == 0);
+	EXPECT(pthread_join(t, NULL) == 0);
+    }
+    EXPECT(p64_counter_read(cnt, CNT_PKTS) == 2 * MAXTHREADS);
+    p64_counter_free(cnt);
+
+    printf("counter tests complete\n");
+    return 0;
+}
@@ -0,0 +1,170 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p64_cuckooht.h"
+#include "p64_hazardptr.h"
+#include "expect.h"
+
+#define NELEMS 1365 //512 buckets with 3 cells each
+#define NCELLS 1536
+#define NSTATIC 1000
+#define NTHREADS 4
+#define NKEYS 80 //Keys per thread
+#define NITER 20000
+
+static p64_hashvalue_t
+hash(uint32_t k)
+{
+    uint64_t h = k;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+struct my_elem
+{
+    uint32_t key;
+};
+
+static struct my_elem *
+elem_alloc(uint32_t k)
+{
+    struct my_elem *me = malloc(sizeof(struct my_elem));
+    if (me == NULL)
+	perror("malloc"), exit(-1);
+    me->key = k;
+    return me;
+}
+
+static int
+compf(const void *elem, const void *key)
+{
+    const struct my_elem *me = elem;
+    uint32_t k = *(const uint32_t *)key;
+    return me->key < k ? -1 : me->key > k ? 1 : 0;
+}
+
+static struct my_elem *
+lookup(p64_cuckooht_t *ht, uint32_t k, p64_hazardptr_t *hp)
+{
+    return p64_cuckooht_lookup(ht, compf, &k, hash(k), hp);
+}
+
+static p64_cuckooht_t *ht;
+
+static void *
+thread_func(void *arg)
+{
+    uint32_t tidx = (uintptr_t)arg;
+    uint32_t rnd = tidx * 2654435761U + 1;
+    struct my_elem *elems[NKEYS] = { NULL };
+    p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+    for (uint32_t i = 0; i < NITER; i++)
+    {
+	rnd ^= rnd << 13;
+	rnd ^= rnd >> 17;
+	rnd ^= rnd << 5;
+	uint32_t idx = rnd % NKEYS;
+	//Keys owned by this thread
+	uint32_t k = NSTATIC + idx * NTHREADS + tidx;
+	//Elements owned by other threads may be moved concurrently but must
+	//always be found
+	struct my_elem *me = lookup(ht, k, &hp);
+	EXPECT(me == elems[idx]);
+	p64_hazptr_release_ro(&hp);
+	uint32_t s = (rnd >> 8) % NSTATIC;
+	me = lookup(ht, s, &hp);
+	EXPECT(me != NULL && me->key == s);
+	p64_hazptr_release_ro(&hp);
+	if (elems[idx] == NULL)
+	{
+	    elems[idx] = elem_alloc(k);
+	    EXPECT(p64_cuckooht_insert(ht, elems[idx], hash(k)));
+	}
+	else
+	{
+	    EXPECT(p64_cuckooht_remove(ht, elems[idx], hash(k)));
+	    p64_hazptr_retire(elems[idx], free);
+	    elems[idx] = NULL;
+	}
+    }
+    for (uint32_t idx = 0; idx < NKEYS; idx++)
+    {
+	if (elems[idx] != NULL)
+	{
+	    uint32_t k = NSTATIC + idx * NTHREADS + tidx;
+	    EXPECT(p64_cuckooht_remove(ht, elems[idx], hash(k)));
+	    p64_hazptr_retire(elems[idx], free);
+	}
+    }
+    p64_hazptr_unregister();
+    return NULL;
+}
+
+int main(void)
+{
+    p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+    struct my_elem *elems[NCELLS];
+    ht = p64_cuckooht_alloc(NELEMS);
+    EXPECT(ht != NULL);
+
+    //Fill the table until insertion fails
+    uint32_t n;
+    for (n = 0; n < NCELLS; n++)
+    {
+	elems[n] = elem_alloc(n);
+	if (!p64_cuckooht_insert(ht, elems[n], hash(n)))
+	{
+	    free(elems[n]);
+	    break;
+	}
+    }
+    printf("%u elements inserted, occupancy %.1f%%\n", n, 100.0 * n / NCELLS);
+    EXPECT(n >= NELEMS);
+    for (uint32_t k = 0; k < n; k++)
+    {
+	EXPECT(lookup(ht, k, &hp) == elems[k]);
+    }
+    EXPECT(lookup(ht, NCELLS, &hp) == NULL);
+    //Remove from the back, keep NSTATIC elements
+    for (uint32_t k = n; k-- > NSTATIC; )
+    {
+	EXPECT(p64_cuckooht_remove(ht, elems[k], hash(k)));
+	EXPECT(!p64_cuckooht_remove(ht, elems[k], hash(k)));
+	EXPECT(lookup(ht, k, &hp) == NULL);
+	free(elems[k]);
+    }
+    p64_hazptr_release_ro(&hp);
+
+    //Concurrent insertions, removals and lookups in an almost full table
+    pthread_t tid[NTHREADS];
+    for (uintptr_t i = 0; i < NTHREADS; i++)
+    {
+	EXPECT(pthread_create(&tid[i], NULL, thread_func, (void *)i) == 0);
+    }
+    for (uint32_t i = 0; i < NTHREADS; i++)
+    {
+	pthread_join(tid[i], NULL);
+    }
+
+    for (uint32_t k = 0; k < NSTATIC; k++)
+    {
+	EXPECT(lookup(ht, k, &hp) == elems[k]);
+	EXPECT(p64_cuckooht_remove(ht, elems[k], hash(k)));
+	free(elems[k]);
+    }
+    p64_hazptr_release_ro(&hp);
+    p64_cuckooht_free(ht);
+    p64_hazptr_unregister();
+
+    printf("cuckooht tests complete\n");
+    return 0;
+}
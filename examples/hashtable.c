@@ -3,12 +3,23 @@
 //SPDX-License-Identifier:        BSD-3-Clause
 
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <string.h>
+
 #include "p64_hashtable.h"
+#include "p64_hashtable_template.h"
+#include "p64_qsbr.h"
+#include "build_config.h"
 #include "expect.h"
 
+#if defined __aarch64__ && defined __ARM_FEATURE_CRC32
+#include <arm_acle.h>
+#endif
+
 uint32_t p64_hashtable_check(p64_hashtable_t *ht,
 			     uint64_t (*f)(p64_hashelem_t *));
 
@@ -46,6 +57,24 @@ keyf(p64_hashelem_t *he)
     return me->key;
 }
 
+struct trav_arg
+{
+    uint32_t num;
+    uint32_t keysum;
+    uint32_t minkey;//Remove elements with key >= minkey
+};
+
+static bool
+travf(void *arg, p64_hashelem_t *he, p64_hashvalue_t hash)
+{
+    struct trav_arg *ta = arg;
+    struct my_elem *me = (struct my_elem *)he;
+    EXPECT(hash == me->hash);
+    ta->num++;
+    ta->keysum += me->key;
+    return me->key >= ta->minkey;
+}
+
 static int
 compf(const p64_hashelem_t *he,
       const void *key)
@@ -55,6 +84,257 @@ compf(const p64_hashelem_t *he,
     return m->key < k ? -1 : m->key > k ? 1 : 0;
 }
 
+//5-tuple flow key, padded to 16 bytes
+struct flow_key
+{
+    uint32_t saddr;
+    uint32_t daddr;
+    uint16_t sport;
+    uint16_t dport;
+    uint8_t proto;
+    uint8_t pad[3];
+};
+
+struct flow
+{
+    p64_hashelem_t next;
+    struct flow_key key;
+};
+
+static inline uint32_t
+crc32c_u64(uint32_t crc, uint64_t data)
+{
+#if defined __SSE4_2__
+    return __builtin_ia32_crc32di(crc, data);
+#elif defined __aarch64__ && defined __ARM_FEATURE_CRC32
+    return __crc32cd(crc, data);
+#else
+    crc ^= (uint32_t)data;
+    for (uint32_t i = 0; i < 32; i++)
+    {
+	crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+    }
+    crc ^= (uint32_t)(data >> 32);
+    for (uint32_t i = 0; i < 32; i++)
+    {
+	crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+    }
+    return crc;
+#endif
+}
+
+static inline p64_hashvalue_t
+flow_hash(const struct flow_key *key)
+{
+    uint64_t w[2];
+    memcpy(w, key, sizeof w);
+    return crc32c_u64(crc32c_u64(~0U, w[0]), w[1]);
+}
+
+static inline bool
+flow_equal(const p64_hashelem_t *he, const struct flow_key *key)
+{
+    const struct flow *fl = (const struct flow *)he;
+    return memcmp(&fl->key, key, sizeof *key) == 0;
+}
+
+//Instantiate the hash table template using the 5-tuple as the key
+P64_HASHTABLE(flowtbl, struct flow_key, flow_hash, flow_equal)
+
+#define NFLOWS 100
+
+static struct flow_key
+flow_key(uint32_t i)
+{
+    struct flow_key key;
+    memset(&key, 0, sizeof key);
+    key.saddr = 0x0a000000 + i;
+    key.daddr = 0xc0a80001;
+    key.sport = 1024 + i;
+    key.dport = 80;
+    key.proto = 6;
+    return key;
+}
+
+static void
+test_template(void)
+{
+    p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+    struct flow *flows = malloc(NFLOWS * sizeof(struct flow));
+    if (flows == NULL)
+	perror("malloc"), exit(-1);
+    //Start small so that lists are used and the table is resized
+    p64_hashtable_t *ht = p64_hashtable_alloc(16);
+    EXPECT(ht != NULL);
+    for (uint32_t i = 0; i < NFLOWS; i++)
+    {
+	flows[i].key = flow_key(i);
+	flowtbl_insert(ht, &flows[i].next, &flows[i].key);
+	if (i == NFLOWS / 2)
+	{
+	    EXPECT(p64_hashtable_resize(ht, NFLOWS));
+	}
+    }
+    for (uint32_t i = 0; i < NFLOWS + 10; i++)
+    {
+	struct flow_key key = flow_key(i);
+	p64_hashelem_t *he = flowtbl_lookup(ht, &key, &hp);
+	EXPECT(he == (i < NFLOWS ? &flows[i].next : NULL));
+	p64_hazptr_release_ro(&hp);
+    }
+    for (uint32_t i = 0; i < NFLOWS; i += 2)
+    {
+	EXPECT(flowtbl_remove(ht, &flows[i].next, &flows[i].key));
+	EXPECT(!flowtbl_remove(ht, &flows[i].next, &flows[i].key));
+	struct flow_key key = flow_key(i + 1);
+	EXPECT(flowtbl_remove_by_key(ht, &key, &hp) == &flows[i + 1].next);
+	p64_hazptr_release_ro(&hp);
+	EXPECT(flowtbl_lookup(ht, &key, &hp) == NULL);
+    }
+    p64_hashtable_free(ht);
+    //Single bucket, most elements are found in lists
+    ht = p64_hashtable_alloc(1);
+    EXPECT(ht != NULL);
+    for (uint32_t i = 0; i < NFLOWS; i++)
+    {
+	flows[i].next.hash = 0;
+	flows[i].next.next = NULL;
+	flowtbl_insert(ht, &flows[i].next, &flows[i].key);
+    }
+    for (uint32_t i = 0; i < NFLOWS + 10; i++)
+    {
+	struct flow_key key = flow_key(i);
+	p64_hashelem_t *he = flowtbl_lookup(ht, &key, &hp);
+	EXPECT(he == (i < NFLOWS ? &flows[i].next : NULL));
+	p64_hazptr_release_ro(&hp);
+    }
+    for (uint32_t i = 0; i < NFLOWS + 10; i++)
+    {
+	struct flow_key key = flow_key(i);
+	p64_hashelem_t *he = flowtbl_remove_by_key(ht, &key, &hp);
+	EXPECT(he == (i < NFLOWS ? &flows[i].next : NULL));
+	p64_hazptr_release_ro(&hp);
+    }
+    p64_hashtable_stats_t st;
+    p64_hashtable_stats(ht, &st);
+    EXPECT(st.nelems == 0);
+    p64_hashtable_free(ht);
+    free(flows);
+}
+
+#define MT_NTHREADS 3
+#define MT_NKEYS 1000
+
+static p64_hashtable_t *mt_ht;
+static struct my_elem mt_elems[MT_NTHREADS][MT_NKEYS];
+static uint32_t mt_ndone = 0;
+
+static void
+mt_quiescent(uint32_t i)
+{
+#ifdef USE_HASHTABLE_QSBR
+    p64_qsbr_quiescent();
+#endif
+    if (i % 16 == 0)
+    {
+	sched_yield();
+    }
+}
+
+static struct my_elem *
+mt_lookup(uint32_t k)
+{
+    p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+    p64_hashelem_t *he = p64_hashtable_lookup(mt_ht, compf, &k, hash(k), &hp);
+    p64_hazptr_release_ro(&hp);
+    return (struct my_elem *)he;
+}
+
+//Insert, look up and remove our own keys while the table is being resized
+static void *
+mt_thread(void *arg)
+{
+    uint32_t tidx = (uintptr_t)arg;
+    struct my_elem *elems = mt_elems[tidx];
+#ifdef USE_HASHTABLE_QSBR
+    p64_qsbr_register();
+#endif
+    for (uint32_t i = 0; i < MT_NKEYS; i++)
+    {
+	struct my_elem *he = &elems[i];
+	he->next.hash = 0xDEADBABE;
+	he->next.next = NULL;
+	he->key = tidx * MT_NKEYS + i;
+	he->hash = hash(he->key);
+	EXPECT(mt_lookup(he->key) == NULL);
+	p64_hashtable_insert(mt_ht, &he->next, he->hash);
+	EXPECT(mt_lookup(he->key) == he);
+	mt_quiescent(i);
+    }
+    for (uint32_t i = 0; i < MT_NKEYS; i++)
+    {
+	struct my_elem *he = &elems[i];
+	EXPECT(mt_lookup(he->key) == he);
+	if (i % 2 == 0)
+	{
+	    EXPECT(p64_hashtable_remove(mt_ht, &he->next, he->hash));
+	    EXPECT(!p64_hashtable_remove(mt_ht, &he->next, he->hash));
+	}
+	else
+	{
+	    p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+	    EXPECT(p64_hashtable_remove_by_key(mt_ht, compf, &he->key,
+					       he->hash, &hp) == &he->next);
+	    p64_hazptr_release_ro(&hp);
+	}
+	EXPECT(mt_lookup(he->key) == NULL);
+	mt_quiescent(i);
+    }
+#ifdef USE_HASHTABLE_QSBR
+    p64_qsbr_unregister();
+#else
+    p64_hazptr_unregister();
+#endif
+    __atomic_fetch_add(&mt_ndone, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void
+test_mt_resize(void)
+{
+    pthread_t tid[MT_NTHREADS];
+    mt_ht = p64_hashtable_alloc(16);
+    EXPECT(mt_ht != NULL);
+    for (uint32_t i = 0; i < MT_NTHREADS; i++)
+    {
+	EXPECT(pthread_create(&tid[i], NULL, mt_thread,
+			      (void *)(uintptr_t)i) == 0);
+    }
+    //Alternately grow and shrink the table until all threads are done
+    uint32_t nresizes = 0;
+    while (__atomic_load_n(&mt_ndone, __ATOMIC_ACQUIRE) != MT_NTHREADS)
+    {
+	uint32_t nelems = nresizes % 2 == 0 ? 4 * MT_NKEYS : 64;
+	if (p64_hashtable_resize(mt_ht, nelems))
+	{
+	    nresizes++;
+	}
+	mt_quiescent(0);
+    }
+    for (uint32_t i = 0; i < MT_NTHREADS; i++)
+    {
+	EXPECT(pthread_join(tid[i], NULL) == 0);
+    }
+    printf("%u resizes while threads were running\n", nresizes);
+    EXPECT(nresizes != 0);
+    EXPECT(p64_hashtable_check(mt_ht, keyf) == 0);
+    p64_hashtable_stats_t st;
+    p64_hashtable_stats(mt_ht, &st);
+    EXPECT(st.nelems == 0);
+    EXPECT(st.nresizes == nresizes);
+    p64_hashtable_free(mt_ht);
+}
+
 int main(void)
 {
     p64_hashtable_t *ht = p64_hashtable_alloc(1);
@@ -80,12 +360,123 @@ int main(void)
     p64_hashtable_insert(ht, &h9->next, h9->hash);
     EXPECT(p64_hashtable_check(ht, keyf) == 6);
 
+    p64_hashtable_stats_t st;
+    p64_hashtable_stats(ht, &st);
+    EXPECT(st.nelems == 6);
+    EXPECT(st.nbkts == 1);
+    EXPECT(st.maxchain == 3);//Keys 2, 5 and 9
+    EXPECT(st.fill[P64_HASHTABLE_BKTSIZE] == 1);
+
+    printf("Resize to 16\n");
+    EXPECT(p64_hashtable_resize(ht, 16));
+    EXPECT(p64_hashtable_check(ht, keyf) == 6);
+    p64_hashtable_stats(ht, &st);
+    EXPECT(st.nelems == 6);
+    EXPECT(st.nresizes == 1);
+    EXPECT(st.nbkts == 4);
+    EXPECT(st.maxchain == 1);
+    //Bucket i holds 3 - i elements
+    for (uint32_t i = 0; i < 4; i++)
+    {
+	EXPECT(st.fill[i] == 1);
+    }
+    for (uint32_t k = 1; k <= 9; k++)
+    {
+	p64_hazardptr_t hpr = P64_HAZARDPTR_NULL;
+	p64_hashelem_t *he = p64_hashtable_lookup(ht, compf, &k, hash(k), &hpr);
+	EXPECT((he != NULL) == (k <= 5 || k == 9));
+	p64_hazptr_release_ro(&hpr);
+    }
+
+    struct trav_arg ta = { 0, 0, UINT32_MAX };
+    EXPECT(p64_hashtable_nbuckets(ht) == 4);
+    EXPECT(p64_hashtable_traverse(ht, travf, &ta, NULL) == 6);
+    EXPECT(ta.num == 6 && ta.keysum == 1 + 2 + 3 + 4 + 5 + 9);
+    //Partitions of the table together cover all elements
+    ta = (struct trav_arg){ 0, 0, UINT32_MAX };
+    uint32_t n0 = p64_hashtable_traverse_range(ht, 0, 1, travf, &ta, NULL);
+    uint32_t n1 = p64_hashtable_traverse_range(ht, 1, 3, travf, &ta, NULL);
+    uint32_t n2 = p64_hashtable_traverse_range(ht, 3, 100, travf, &ta, NULL);
+    EXPECT(n0 == 3 && n1 == 3 && n2 == 0);
+    EXPECT(ta.num == 6 && ta.keysum == 1 + 2 + 3 + 4 + 5 + 9);
+    //Resumable traversal, one bucket at a time
+    ta = (struct trav_arg){ 0, 0, UINT32_MAX };
+    uint32_t cursor = 0, nsteps = 1;
+    while (p64_hashtable_traverse_next(ht, &cursor, 1, travf, &ta, NULL))
+    {
+	nsteps++;
+    }
+    EXPECT(nsteps == 4 && cursor == 0);
+    EXPECT(ta.num == 6 && ta.keysum == 1 + 2 + 3 + 4 + 5 + 9);
+    //Remove elements in place from the callback
+    for (uint32_t k = 10; k < 30; k++)
+    {
+	struct my_elem *he = he_alloc(k);
+	p64_hashtable_insert(ht, &he->next, he->hash);
+    }
+    EXPECT(p64_hashtable_check(ht, keyf) == 26);
+    ta = (struct trav_arg){ 0, 0, 10 };
+    EXPECT(p64_hashtable_traverse(ht, travf, &ta, free) == 26);
+    EXPECT(p64_hashtable_check(ht, keyf) == 6);
+    ta = (struct trav_arg){ 0, 0, 10 };
+    EXPECT(p64_hashtable_traverse(ht, travf, &ta, NULL) == 6);
+    EXPECT(ta.keysum == 1 + 2 + 3 + 4 + 5 + 9);
+    p64_hashtable_stats(ht, &st);
+    EXPECT(st.nelems == 6);
+    //Removed elements are not referenced anymore
+#ifdef USE_HASHTABLE_QSBR
+    p64_qsbr_quiescent();
+    EXPECT(p64_qsbr_reclaim());
+#else
+    EXPECT(p64_hazptr_reclaim());
+#endif
+
+    const void *keys[3] = { &(uint32_t){2}, &(uint32_t){8}, &(uint32_t){9} };
+    p64_hashvalue_t hashes[3] = { hash(2), hash(8), hash(9) };
+    p64_hashelem_t *results[3];
+    p64_hazardptr_t hps[3];
+    EXPECT(p64_hashtable_lookup_vec(ht, compf, keys, hashes, 3, results, hps) == 2);
+    EXPECT(results[0] == &h2->next);
+    EXPECT(results[1] == NULL);
+    EXPECT(hps[1] == P64_HAZARDPTR_NULL);
+    EXPECT(results[2] == &h9->next);
+    for (uint32_t i = 0; i < 3; i++)
+    {
+	p64_hazptr_release_ro(&hps[i]);
+    }
+    EXPECT(p64_hashtable_lookup_vec(ht, compf, keys, hashes, 3, results, NULL) == 2);
+    EXPECT(results[0] == &h2->next);
+    EXPECT(results[1] == NULL);
+    EXPECT(results[2] == &h9->next);
+    //Burst wider than a handful of hazard pointers
+    uint32_t vkeys[16];
+    const void *vkeyps[16];
+    p64_hashvalue_t vhashes[16];
+    p64_hashelem_t *vresults[16];
+    p64_hazardptr_t vhps[16];
+    for (uint32_t i = 0; i < 16; i++)
+    {
+	vkeys[i] = i + 1;
+	vkeyps[i] = &vkeys[i];
+	vhashes[i] = hash(i + 1);
+    }
+    EXPECT(p64_hashtable_lookup_vec(ht, compf, vkeyps, vhashes, 16, vresults, vhps) == 6);
+    EXPECT(vresults[1] == &h2->next);
+    EXPECT(vresults[8] == &h9->next);
+    EXPECT(vresults[15] == NULL);
+    for (uint32_t i = 0; i < 16; i++)
+    {
+	EXPECT((vresults[i] != NULL) == (i < 5 || i == 8));
+	p64_hazptr_release_ro(&vhps[i]);
+    }
+
     p64_hazardptr_t hp;
     struct my_elem *me = (struct my_elem *)p64_hashtable_lookup(ht, compf, &(uint32_t){2}, hash(2), &hp);
     EXPECT(me != NULL);
     if (me != NULL)
     {
-	printf("Found key %u node %p hazp %p (%p)\n", me->key, me, hp, *hp);
+	printf("Found key %u node %p hazp %p (%p)\n", me->key, me, hp,
+	       hp != P64_HAZARDPTR_NULL ? *hp : NULL);
 	p64_hazptr_release_ro(&hp);
 	assert(hp == P64_HAZARDPTR_NULL);
     }
@@ -100,7 +491,8 @@ int main(void)
     EXPECT(me == NULL);
     if (me != NULL)
     {
-	printf("Found key %u node %p hazp %p (%p)\n", me->key, me, hp, *hp);
+	printf("Found key %u node %p hazp %p (%p)\n", me->key, me, hp,
+	       hp != P64_HAZARDPTR_NULL ? *hp : NULL);
 	p64_hazptr_release_ro(&hp);
 	assert(hp == P64_HAZARDPTR_NULL);
     }
@@ -115,7 +507,8 @@ int main(void)
     EXPECT(me != NULL);
     if (me != NULL)
     {
-	printf("Found key %u node %p hazp %p (%p)\n", me->key, me, hp, *hp);
+	printf("Found key %u node %p hazp %p (%p)\n", me->key, me, hp,
+	       hp != P64_HAZARDPTR_NULL ? *hp : NULL);
 	p64_hazptr_dump(stdout);
 	p64_hazptr_release_ro(&hp);
 	assert(hp == P64_HAZARDPTR_NULL);
@@ -142,6 +535,9 @@ int main(void)
     EXPECT(p64_hashtable_remove_by_key(ht, compf, &(uint32_t){4}, hash(4), &hp) == (p64_hashelem_t *)h4);
     EXPECT(p64_hashtable_remove_by_key(ht, compf, &(uint32_t){5}, hash(5), &hp) == (p64_hashelem_t *)h5);
     p64_hazptr_release_ro(&hp);
+    p64_hashtable_stats(ht, &st);
+    EXPECT(st.nelems == 0);
+    EXPECT(st.fill[0] == st.nbkts);
     p64_hashtable_free(ht);
     printf("p64_hazptr_num_free()=%u\n", p64_hazptr_dump(stdout));
     free(h1);
@@ -149,6 +545,10 @@ int main(void)
     free(h3);
     free(h4);
     free(h5);
+    free(h9);
+
+    test_template();
+    test_mt_resize();
 
     printf("hashtable test complete\n");
     return 0;
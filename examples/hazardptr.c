@@ -0,0 +1,104 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p64_hazardptr.h"
+#include "build_config.h"
+#include "expect.h"
+
+#define NOBJS 3000
+
+static uint32_t nfreed = 0;
+
+static void
+callback(void *ptr)
+{
+    (void)ptr;
+    nfreed++;
+}
+
+static void *
+retire_and_exit(void *arg)
+{
+    p64_hazptr_register();
+    p64_hazptr_retire(arg, callback);
+    //Referenced object is handed over to remaining threads
+    p64_hazptr_unregister();
+    return NULL;
+}
+
+static void
+test_handover(void)
+{
+    static char obj[64];
+    void *loc = obj;
+    p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+    uint32_t nfreed0 = nfreed;
+    EXPECT(p64_hazptr_acquire(&loc, &hp) == obj);
+    pthread_t tid;
+    EXPECT(pthread_create(&tid, NULL, retire_and_exit, obj) == 0);
+    EXPECT(pthread_join(tid, NULL) == 0);
+    EXPECT(nfreed == nfreed0);
+    EXPECT(!p64_hazptr_reclaim());
+    p64_hazptr_release_ro(&hp);
+    EXPECT(p64_hazptr_reclaim());
+    EXPECT(nfreed == nfreed0 + 1);
+}
+
+static void
+test_register(void)
+{
+    static char obj[64];
+    void *loc = obj;
+    p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+    uint32_t nfreed0 = nfreed;
+    p64_hazptr_unregister();
+    //Hazard area is recycled
+    p64_hazptr_register();
+    EXPECT(p64_hazptr_acquire(&loc, &hp) == obj);
+    p64_hazptr_retire(obj, callback);
+    EXPECT(!p64_hazptr_reclaim());
+    p64_hazptr_release(&hp);
+    //Unreferenced objects are reclaimed when thread unregisters
+    p64_hazptr_unregister();
+    EXPECT(nfreed == nfreed0 + 1);
+}
+
+int main(void)
+{
+    static char objs[NOBJS][64];
+    void *ptrs[NOBJS];
+    void *loc = &objs[0];
+    p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+    EXPECT(p64_hazptr_acquire(&loc, &hp) == &objs[0]);
+    //Retire a referenced object and some unreferenced objects
+    for (uint32_t i = 0; i < 10; i++)
+    {
+	ptrs[i] = &objs[i];
+    }
+    p64_hazptr_retire_vec(ptrs, 10, callback);
+    EXPECT(nfreed == 0);
+    EXPECT(p64_hazptr_reclaim());
+    EXPECT(nfreed == 9);
+    EXPECT(!p64_hazptr_reclaim());
+    //Retire enough objects to trigger garbage collection
+    for (uint32_t i = 10; i < NOBJS; i++)
+    {
+	ptrs[i] = &objs[i];
+    }
+    p64_hazptr_retire_vec(ptrs + 10, NOBJS - 10, callback);
+    EXPECT(nfreed >= 9 + HP_RETIRE_THRESHOLD);
+    EXPECT(nfreed < NOBJS - 1);
+    p64_hazptr_release_ro(&hp);
+    EXPECT(p64_hazptr_reclaim());
+    EXPECT(nfreed == NOBJS);
+    test_handover();
+    test_register();
+
+    printf("hazardptr test complete\n");
+    return 0;
+}
@@ -36,6 +36,47 @@ alloc_elem(uint32_t sn)
     return elem;
 }
 
+//User defined element occupying one cache line
+struct mydesc
+{
+    uint32_t sn;
+    uint32_t len;
+    struct mydesc *next;
+    char data[48];
+};
+
+static uint32_t mydesc_retired = 0;
+
+static void
+mydesc_callback(void *arg, p64_laxrob_elem_t **vec, uint32_t nitems)
+{
+    (void)arg;
+    for (uint32_t i = 0; i < nitems; i++)
+    {
+	struct mydesc *desc = (struct mydesc *)vec[i];
+	EXPECT(desc->next == NULL);
+	EXPECT(desc->len == desc->sn * 10);
+	EXPECT(desc->sn == mydesc_retired);
+	printf("Descriptor %u retired\n", desc->sn);
+	mydesc_retired++;
+	free(desc);
+    }
+}
+
+static void
+insert_mydesc(p64_laxrob_t *rb, uint32_t sn)
+{
+    struct mydesc *desc = malloc(sizeof(struct mydesc));
+    if (desc == NULL)
+    {
+	perror("malloc"), exit(EXIT_FAILURE);
+    }
+    desc->sn = sn;
+    desc->len = sn * 10;
+    desc->next = NULL;
+    p64_laxrob_insert(rb, (p64_laxrob_elem_t *)desc);
+}
+
 int main(void)
 {
     p64_laxrob_t *rb = p64_laxrob_alloc(4, 1, callback, NULL);
@@ -68,6 +109,67 @@ int main(void)
     EXPECT(last_sn == 5);
     p64_laxrob_free(rb);
 
+    //Time-based retirement of holes
+    rb = p64_laxrob_alloc_timeout(8, 4, 10, callback, NULL);
+    EXPECT(rb != NULL);
+    nretired = 0;
+    p64_laxrob_tick(rb, 100);
+    printf("Insert 1 @100\n");
+    p64_laxrob_insert(rb, alloc_elem(1));
+    p64_laxrob_tick(rb, 105);
+    printf("Insert 3 @105\n");
+    p64_laxrob_insert(rb, alloc_elem(3));
+    p64_laxrob_tick(rb, 109);
+    EXPECT(nretired == 0);
+    //Element 1 has been held 10 ticks, retire hole 0 and element 1
+    p64_laxrob_tick(rb, 110);
+    EXPECT(nretired == 1);
+    EXPECT(last_sn == 1);
+    //Straggler is retired immediately
+    printf("Insert 0 @110\n");
+    p64_laxrob_insert(rb, alloc_elem(0));
+    EXPECT(nretired == 2);
+    EXPECT(last_sn == 0);
+    printf("Insert 2 @110\n");
+    p64_laxrob_insert(rb, alloc_elem(2));
+    p64_laxrob_tick(rb, 114);
+    EXPECT(nretired == 2);
+    //Element 3 aged, retires 2 and 3 in order
+    p64_laxrob_tick(rb, 115);
+    EXPECT(nretired == 4);
+    EXPECT(last_sn == 3);
+    //Arrival of an element already retired by flush has no effect
+    printf("Insert 4 @120\n");
+    p64_laxrob_tick(rb, 120);
+    p64_laxrob_insert(rb, alloc_elem(4));
+    p64_laxrob_flush(rb, 1);
+    EXPECT(nretired == 5);
+    EXPECT(last_sn == 4);
+    printf("Insert 6 @125\n");
+    p64_laxrob_tick(rb, 125);
+    p64_laxrob_insert(rb, alloc_elem(6));
+    p64_laxrob_tick(rb, 130);
+    EXPECT(nretired == 5);
+    //Element 6 aged, retires hole 5 and element 6
+    p64_laxrob_tick(rb, 135);
+    EXPECT(nretired == 6);
+    EXPECT(last_sn == 6);
+    p64_laxrob_free(rb);
+
+    //User defined element layout
+    rb = p64_laxrob_alloc_layout(4, 2, offsetof(struct mydesc, next),
+				 offsetof(struct mydesc, sn),
+				 mydesc_callback, NULL);
+    EXPECT(rb != NULL);
+    insert_mydesc(rb, 1);
+    insert_mydesc(rb, 0);
+    insert_mydesc(rb, 3);
+    EXPECT(mydesc_retired == 0);
+    insert_mydesc(rb, 2);
+    p64_laxrob_flush(rb, 4);
+    EXPECT(mydesc_retired == 4);
+    p64_laxrob_free(rb);
+
     printf("laxrob tests complete\n");
     return 0;
 }
@@ -2,10 +2,16 @@
 //
 //SPDX-License-Identifier:        BSD-3-Clause
 
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "p64_lfring.h"
+#include "p64_hazardptr.h"
 
 #include "expect.h"
 
@@ -44,10 +50,230 @@ test_rb(void)
     p64_lfring_free(rb);
 }
 
+static void *
+producer(void *arg)
+{
+    p64_lfring_t *rb = arg;
+    //Give consumer time to go to sleep
+    nanosleep(&(struct timespec){ .tv_sec = 0, .tv_nsec = 10000000 }, NULL);
+    EXPECT(p64_lfring_enqueue(rb, (void *[]){ (void*)1 }, 1) == 1);
+    return NULL;
+}
+
+static void
+test_wait(void)
+{
+    void *vec[4];
+
+    p64_lfring_t *rb = p64_lfring_alloc_ex(4, P64_LFRING_F_WAITDEQ,
+					   P64_ALLOC_ANYNODE, 0);
+    EXPECT(rb != NULL);
+    EXPECT(p64_lfring_dequeue_wait(rb, vec, 4, 0) == 0);
+    EXPECT(p64_lfring_dequeue_wait(rb, vec, 4, 1000000) == 0);
+    EXPECT(p64_lfring_enqueue(rb, (void *[]){ (void*)2 }, 1) == 1);
+    EXPECT(p64_lfring_dequeue_wait(rb, vec, 4, ~(uint64_t)0) == 1);
+    EXPECT(vec[0] == (void*)2);
+    //Sleeping consumer is woken by producer
+    pthread_t tid;
+    EXPECT(pthread_create(&tid, NULL, producer, rb) == 0);
+    EXPECT(p64_lfring_dequeue_wait(rb, vec, 4, ~(uint64_t)0) == 1);
+    EXPECT(vec[0] == (void*)1);
+    EXPECT(pthread_join(tid, NULL) == 0);
+    p64_lfring_free(rb);
+}
+
+static void
+test_shared(void)
+{
+    void *vec[4];
+    size_t sz = p64_lfring_size(4, P64_LFRING_F_WAITDEQ);
+    int fd = memfd_create("lfring", 0);
+    EXPECT(fd >= 0);
+    EXPECT(ftruncate(fd, sz) == 0);
+    //Map same memory twice at different addresses
+    void *m0 = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    void *m1 = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    EXPECT(m0 != MAP_FAILED && m1 != MAP_FAILED && m0 != m1);
+    p64_lfring_t *rb0 = p64_lfring_init(m0, sz, 4, P64_LFRING_F_WAITDEQ);
+    p64_lfring_t *rb1 = p64_lfring_attach(m1);
+    EXPECT(p64_lfring_enqueue(rb0, (void *[]){ (void*)1, (void*)2 }, 2) == 2);
+    EXPECT(p64_lfring_dequeue_wait(rb1, vec, 4, 1000000) == 2);
+    EXPECT(vec[0] == (void*)1 && vec[1] == (void*)2);
+    EXPECT(p64_lfring_dequeue_wait(rb1, vec, 4, 1000000) == 0);
+    EXPECT(munmap(m0, sz) == 0);
+    EXPECT(munmap(m1, sz) == 0);
+    close(fd);
+}
+
+#define NPRODUCERS 3
+#define NCONSUMERS 2
+#define NFIFOELEMS 100000
+
+static uint32_t fifo_ndequeued;
+
+static void *
+fifo_producer(void *arg)
+{
+    p64_lfring_t *rb = arg;
+    static uint32_t next_id = 0;
+    uintptr_t id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    uintptr_t seq = 0;
+    while (seq < NFIFOELEMS)
+    {
+	void *vec[4];
+	uint32_t n = 0;
+	while (n < 4 && seq + n < NFIFOELEMS)
+	{
+	    //Element encodes producer id and sequence number
+	    vec[n] = (void *)((seq + n + 1) * NPRODUCERS + id);
+	    n++;
+	}
+	n = p64_lfring_enqueue(rb, vec, n);
+	if (n == 0)
+	{
+	    //Ring full, let other threads run
+	    sched_yield();
+	}
+	seq += n;
+    }
+    return NULL;
+}
+
+static void *
+fifo_consumer(void *arg)
+{
+    p64_lfring_t *rb = arg;
+    uintptr_t last[NPRODUCERS] = { 0 };
+    while (__atomic_load_n(&fifo_ndequeued, __ATOMIC_RELAXED) !=
+	   NPRODUCERS * NFIFOELEMS)
+    {
+	void *vec[4];
+	uint32_t n = p64_lfring_dequeue(rb, vec, 4);
+	if (n == 0)
+	{
+	    //Ring empty, let other threads run
+	    sched_yield();
+	}
+	for (uint32_t i = 0; i < n; i++)
+	{
+	    uintptr_t id = (uintptr_t)vec[i] % NPRODUCERS;
+	    uintptr_t seq = (uintptr_t)vec[i] / NPRODUCERS;
+	    //Elements from the same producer must be dequeued in order
+	    EXPECT(seq > last[id]);
+	    last[id] = seq;
+	}
+	__atomic_fetch_add(&fifo_ndequeued, n, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void
+test_fifo(void)
+{
+    void *vec[4];
+
+    p64_lfring_t *rb = p64_lfring_alloc_ex(4, P64_LFRING_F_STRICTFIFO,
+					   P64_ALLOC_ANYNODE, 0);
+    EXPECT(rb != NULL);
+    EXPECT(p64_lfring_dequeue(rb, vec, 1) == 0);
+    //Zero-length calls return immediately for both free and full slots
+    EXPECT(p64_lfring_enqueue(rb, vec, 0) == 0);
+    EXPECT(p64_lfring_dequeue(rb, vec, 0) == 0);
+    EXPECT(p64_lfring_enqueue(rb, (void *[]){ (void*)1, (void*)2, (void*)3 }, 3) == 3);
+    EXPECT(p64_lfring_enqueue(rb, vec, 0) == 0);
+    EXPECT(p64_lfring_dequeue(rb, vec, 0) == 0);
+    EXPECT(p64_lfring_enqueue(rb, (void *[]){ (void*)4, (void*)5 }, 2) == 1);
+    EXPECT(p64_lfring_dequeue(rb, vec, 2) == 2);
+    EXPECT(vec[0] == (void*)1 && vec[1] == (void*)2);
+    //Wrap around
+    EXPECT(p64_lfring_enqueue(rb, (void *[]){ (void*)5, (void*)6, (void*)7 }, 3) == 2);
+    EXPECT(p64_lfring_dequeue(rb, vec, 4) == 4);
+    EXPECT(vec[0] == (void*)3 && vec[1] == (void*)4);
+    EXPECT(vec[2] == (void*)5 && vec[3] == (void*)6);
+    EXPECT(p64_lfring_dequeue(rb, vec, 4) == 0);
+
+    p64_lfring_free(rb);
+
+    //Stress test with multiple producers and consumers
+    rb = p64_lfring_alloc_ex(64, P64_LFRING_F_STRICTFIFO, P64_ALLOC_ANYNODE, 0);
+    EXPECT(rb != NULL);
+    pthread_t tid[NPRODUCERS + NCONSUMERS];
+    for (uint32_t i = 0; i < NPRODUCERS; i++)
+    {
+	EXPECT(pthread_create(&tid[i], NULL, fifo_producer, rb) == 0);
+    }
+    for (uint32_t i = 0; i < NCONSUMERS; i++)
+    {
+	EXPECT(pthread_create(&tid[NPRODUCERS + i], NULL, fifo_consumer, rb) == 0);
+    }
+    for (uint32_t i = 0; i < NPRODUCERS + NCONSUMERS; i++)
+    {
+	EXPECT(pthread_join(tid[i], NULL) == 0);
+    }
+    EXPECT(p64_lfring_dequeue(rb, vec, 4) == 0);
+    p64_lfring_free(rb);
+}
+
+#define NSEGELEMS 100000
+
+static void *
+seg_producer(void *arg)
+{
+    p64_lfring_seg_t *lfs = arg;
+    for (uintptr_t i = 1; i <= NSEGELEMS; i++)
+    {
+	p64_lfring_seg_enqueue(lfs, (void *[]){ (void *)i }, 1);
+    }
+    p64_hazptr_unregister();
+    return NULL;
+}
+
+static void
+test_seg(void)
+{
+    void *vec[8];
+
+    p64_lfring_seg_t *lfs = p64_lfring_seg_alloc(2);
+    EXPECT(lfs != NULL);
+    EXPECT(p64_lfring_seg_dequeue(lfs, vec, 1) == 0);
+    p64_lfring_seg_enqueue(lfs, (void *[]){ (void*)1, (void*)2, (void*)3, (void*)4, (void*)5 }, 5);
+    EXPECT(p64_lfring_seg_dequeue(lfs, vec, 2) == 2);
+    EXPECT(vec[0] == (void*)1 && vec[1] == (void*)2);
+    p64_lfring_seg_enqueue(lfs, (void *[]){ (void*)6 }, 1);
+    EXPECT(p64_lfring_seg_dequeue(lfs, vec, 8) == 4);
+    EXPECT(vec[0] == (void*)3 && vec[3] == (void*)6);
+    EXPECT(p64_lfring_seg_dequeue(lfs, vec, 8) == 0);
+
+    //Concurrent producer, elements are dequeued in order
+    pthread_t tid;
+    EXPECT(pthread_create(&tid, NULL, seg_producer, lfs) == 0);
+    uintptr_t expected = 1;
+    while (expected <= NSEGELEMS)
+    {
+	uint32_t n = p64_lfring_seg_dequeue(lfs, vec, 8);
+	for (uint32_t i = 0; i < n; i++)
+	{
+	    EXPECT(vec[i] == (void *)expected);
+	    expected++;
+	}
+    }
+    EXPECT(pthread_join(tid, NULL) == 0);
+    EXPECT(p64_lfring_seg_dequeue(lfs, vec, 8) == 0);
+    p64_lfring_seg_free(lfs);
+}
+
 int main(void)
 {
     printf("testing lock-free ring\n");
     test_rb();
+    printf("testing lock-free ring wait\n");
+    test_wait();
+    printf("testing lock-free ring in shared memory\n");
+    test_shared();
+    printf("testing strict FIFO lock-free ring\n");
+    test_fifo();
+    printf("testing unbounded lock-free ring\n");
+    test_seg();
     printf("lock-free ring test complete\n");
     return 0;
 }
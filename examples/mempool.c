@@ -0,0 +1,128 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "p64_mempool.h"
+#include "expect.h"
+
+#define NOBJS 100
+#define NTHREADS 4
+#define NITER 10000
+#define NHELD 20
+//Enough objects for those held and cached by all threads
+#define NMTOBJS (NTHREADS * 64)
+
+struct obj
+{
+    uint32_t owner;
+    uint32_t seq;
+    char payload[16];
+};
+
+static p64_mempool_t *mp;
+
+static void *
+thread_func(void *arg)
+{
+    uint32_t tidx = (uintptr_t)arg;
+    struct obj *held[NHELD];
+    uint32_t nheld = 0;
+    uint32_t rnd = tidx * 2654435761U + 1;
+    for (uint32_t i = 0; i < NITER; i++)
+    {
+	rnd ^= rnd << 13;
+	rnd ^= rnd >> 17;
+	rnd ^= rnd << 5;
+	if (nheld < NHELD && (nheld == 0 || rnd % 2 == 0))
+	{
+	    struct obj *o = p64_mempool_get(mp);
+	    EXPECT(o != NULL);
+	    o->owner = tidx;
+	    o->seq = i;
+	    held[nheld++] = o;
+	}
+	else
+	{
+	    struct obj *o = held[--nheld];
+	    //No other thread may have been handed our object
+	    EXPECT(o->owner == tidx);
+	    p64_mempool_put(mp, o);
+	}
+    }
+    while (nheld != 0)
+    {
+	p64_mempool_put(mp, held[--nheld]);
+    }
+    p64_mempool_flush(mp);
+    return NULL;
+}
+
+static void
+get_all(struct obj *objs[], uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++)
+    {
+	objs[i] = p64_mempool_get(mp);
+	EXPECT(objs[i] != NULL);
+	EXPECT((uintptr_t)objs[i] % 32 == 0);
+	for (uint32_t j = 0; j < i; j++)
+	{
+	    EXPECT(objs[i] != objs[j]);
+	}
+    }
+    EXPECT(p64_mempool_get(mp) == NULL);
+}
+
+int main(void)
+{
+    static struct obj *objs[NMTOBJS];
+    mp = p64_mempool_alloc(NOBJS, sizeof(struct obj), 32,
+			   P64_ALLOC_ANYNODE);
+    EXPECT(mp != NULL);
+    get_all(objs, NOBJS);
+    for (uint32_t i = 0; i < NOBJS; i++)
+    {
+	p64_mempool_put(mp, objs[i]);
+    }
+    //Objects are still available after flushing the thread cache
+    p64_mempool_flush(mp);
+    get_all(objs, NOBJS);
+    for (uint32_t i = 0; i < NOBJS; i++)
+    {
+	p64_mempool_put(mp, objs[i]);
+    }
+    p64_mempool_flush(mp);
+    p64_mempool_free(mp);
+
+    mp = p64_mempool_alloc(NMTOBJS, sizeof(struct obj), 32,
+			   P64_ALLOC_ANYNODE);
+    EXPECT(mp != NULL);
+    pthread_t tid[NTHREADS];
+    for (uintptr_t i = 0; i < NTHREADS; i++)
+    {
+	EXPECT(pthread_create(&tid[i], NULL, thread_func, (void *)i) == 0);
+    }
+    for (uint32_t i = 0; i < NTHREADS; i++)
+    {
+	pthread_join(tid[i], NULL);
+    }
+    //All objects have been returned
+    get_all(objs, NMTOBJS);
+    p64_mempool_free(mp);
+
+    //Pool placed on NUMA node 0
+    mp = p64_mempool_alloc(NOBJS, sizeof(struct obj), 64, 0);
+    EXPECT(mp != NULL);
+    get_all(objs, NOBJS);
+    for (uint32_t i = 0; i < NOBJS; i++)
+    {
+	p64_mempool_put(mp, objs[i]);
+    }
+    p64_mempool_free(mp);
+
+    printf("mempool tests complete\n");
+    return 0;
+}
@@ -0,0 +1,119 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p64_mpscq.h"
+#include "expect.h"
+
+#define NPRODUCERS 3
+#define NITER 20000
+
+struct my_elem
+{
+    p64_mpscq_elem_t elem;
+    uint32_t prod;
+    uint32_t seq;
+};
+
+static p64_mpscq_t *q;
+static struct my_elem elems[NPRODUCERS][NITER];
+
+static void *
+producer(void *arg)
+{
+    uint32_t prod = (uintptr_t)arg;
+    for (uint32_t i = 0; i < NITER; i++)
+    {
+	elems[prod][i].prod = prod;
+	elems[prod][i].seq = i;
+	p64_mpscq_enqueue(q, &elems[prod][i].elem);
+    }
+    return NULL;
+}
+
+//Elements from each producer must be dequeued in FIFO order
+static void
+check_elem(p64_mpscq_elem_t *e, uint32_t next_seq[])
+{
+    struct my_elem *me = (struct my_elem *)e;
+    EXPECT(me->prod < NPRODUCERS);
+    EXPECT(me->seq == next_seq[me->prod]);
+    next_seq[me->prod]++;
+}
+
+int main(void)
+{
+    struct my_elem a = { .seq = 0 }, b = { .seq = 1 };
+    q = p64_mpscq_alloc();
+    EXPECT(q != NULL);
+    EXPECT(p64_mpscq_dequeue(q) == NULL);
+    EXPECT(p64_mpscq_dequeue_all(q) == NULL);
+    p64_mpscq_enqueue(q, &a.elem);
+    EXPECT(p64_mpscq_dequeue(q) == &a.elem);
+    EXPECT(p64_mpscq_dequeue(q) == NULL);
+    p64_mpscq_enqueue(q, &a.elem);
+    p64_mpscq_enqueue(q, &b.elem);
+    EXPECT(p64_mpscq_dequeue(q) == &a.elem);
+    p64_mpscq_enqueue(q, &a.elem);
+    p64_mpscq_elem_t *list = p64_mpscq_dequeue_all(q);
+    EXPECT(list == &b.elem);
+    EXPECT(list->next == &a.elem);
+    EXPECT(a.elem.next == NULL);
+    EXPECT(p64_mpscq_dequeue_all(q) == NULL);
+
+    //Concurrent producers, the consumer alternates between dequeueing single
+    //elements and batches
+    pthread_t tid[NPRODUCERS];
+    for (uintptr_t i = 0; i < NPRODUCERS; i++)
+    {
+	EXPECT(pthread_create(&tid[i], NULL, producer, (void *)i) == 0);
+    }
+    uint32_t next_seq[NPRODUCERS] = { 0 };
+    uint32_t ndeq = 0, nbatch = 0;
+    for (uint32_t iter = 0; ndeq != NPRODUCERS * NITER; iter++)
+    {
+	p64_mpscq_elem_t *e;
+	if (iter % 2 == 0)
+	{
+	    e = p64_mpscq_dequeue(q);
+	    if (e != NULL)
+	    {
+		check_elem(e, next_seq);
+		ndeq++;
+	    }
+	}
+	else
+	{
+	    e = p64_mpscq_dequeue_all(q);
+	    if (e != NULL)
+	    {
+		nbatch++;
+	    }
+	    for (; e != NULL; e = e->next)
+	    {
+		check_elem(e, next_seq);
+		ndeq++;
+	    }
+	}
+	if (iter % 64 == 63)
+	{
+	    //Let producers run also on a single CPU
+	    sched_yield();
+	}
+    }
+    for (uint32_t i = 0; i < NPRODUCERS; i++)
+    {
+	pthread_join(tid[i], NULL);
+	EXPECT(next_seq[i] == NITER);
+    }
+    EXPECT(p64_mpscq_dequeue(q) == NULL);
+    p64_mpscq_free(q);
+
+    printf("mpscq tests complete (%u batches)\n", nbatch);
+    return 0;
+}
@@ -0,0 +1,76 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "p64_msgring.h"
+
+#include "expect.h"
+
+static void
+test_mr(uint32_t flags)
+{
+    void *msgs[4];
+    uint32_t lens[4];
+    p64_msgring_result_t res;
+
+    p64_msgring_t *mr = p64_msgring_alloc(64, flags);
+    EXPECT(mr != NULL);
+    EXPECT(p64_msgring_dequeue_reserve(mr, msgs, lens, 4, &res) == 0);
+    //Message larger than maximum message length (half ring minus header)
+    EXPECT(!p64_msgring_enqueue(mr, "", 25));
+
+    EXPECT(p64_msgring_enqueue(mr, "hello", 6));
+    EXPECT(p64_msgring_enqueue_reserve(mr, (uint32_t[]){ 3, 12 }, 2, msgs, &res) == 2);
+    memcpy(msgs[0], "abc", 3);
+    memset(msgs[1], 'x', 12);
+    p64_msgring_enqueue_commit(mr, &res);
+    //Used 16 + 16 + 24 bytes, 8 bytes free
+    EXPECT(!p64_msgring_enqueue(mr, "", 1));
+
+    EXPECT(p64_msgring_dequeue_reserve(mr, msgs, lens, 2, &res) == 2);
+    EXPECT(lens[0] == 6 && strcmp(msgs[0], "hello") == 0);
+    EXPECT(lens[1] == 3 && memcmp(msgs[1], "abc", 3) == 0);
+    p64_msgring_dequeue_commit(mr, &res);
+
+    //8 bytes free at end of ring, message needs 32 bytes and wraps
+    EXPECT(p64_msgring_enqueue(mr, "0123456789abcdefghijklm", 24));
+    EXPECT(p64_msgring_enqueue_reserve(mr, (uint32_t[]){ 1 }, 1, msgs, &res) == 0);
+
+    EXPECT(p64_msgring_dequeue_reserve(mr, msgs, lens, 1, &res) == 1);
+    EXPECT(lens[0] == 12 && ((char *)msgs[0])[11] == 'x');
+    p64_msgring_dequeue_commit(mr, &res);
+    EXPECT(p64_msgring_dequeue_reserve(mr, msgs, lens, 4, &res) == 1);
+    EXPECT(lens[0] == 24 && strcmp(msgs[0], "0123456789abcdefghijklm") == 0);
+    p64_msgring_dequeue_commit(mr, &res);
+    EXPECT(p64_msgring_dequeue_reserve(mr, msgs, lens, 4, &res) == 0);
+
+    //Message of maximum length fits in empty ring at any offset
+    for (uint32_t i = 0; i < 8; i++)
+    {
+	EXPECT(p64_msgring_enqueue(mr, "", 0));
+	EXPECT(p64_msgring_dequeue_reserve(mr, msgs, lens, 4, &res) == 1);
+	p64_msgring_dequeue_commit(mr, &res);
+	EXPECT(p64_msgring_enqueue(mr, "0123456789abcdefghijklm", 24));
+	EXPECT(p64_msgring_dequeue_reserve(mr, msgs, lens, 4, &res) == 1);
+	EXPECT(lens[0] == 24 && strcmp(msgs[0], "0123456789abcdefghijklm") == 0);
+	p64_msgring_dequeue_commit(mr, &res);
+	//Dequeue any trailing padding
+	EXPECT(p64_msgring_dequeue_reserve(mr, msgs, lens, 4, &res) == 0);
+    }
+
+    p64_msgring_free(mr);
+}
+
+int main(void)
+{
+    printf("testing MPSC message ring\n");
+    test_mr(P64_MSGRING_F_MPENQ);
+    printf("testing SPSC message ring\n");
+    test_mr(P64_MSGRING_F_SPENQ);
+    printf("msgring test complete\n");
+    return 0;
+}
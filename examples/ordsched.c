@@ -0,0 +1,57 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <stdio.h>
+#include "p64_ordsched.h"
+#include "expect.h"
+
+//Elements encode 10 * (queue + 1) + sequence number
+static uint32_t next_elem[2] = { 10, 20 };
+
+static void callback(void *arg, void *elem, uint32_t sn)
+{
+    (void)arg;
+    if (elem != NULL)
+    {
+	uint32_t queue = (uintptr_t)elem / 10 - 1;
+	printf("Queue %u element %lu retired\n", queue, (uintptr_t)elem);
+	EXPECT(queue < 2);
+	EXPECT((uintptr_t)elem == next_elem[queue]);
+	EXPECT(sn == next_elem[queue] % 10);
+	next_elem[queue]++;
+    }
+}
+
+int main(void)
+{
+    uint32_t sn0, sn1;
+    p64_ordsched_t *os = p64_ordsched_alloc(2, 4, callback, NULL);
+    EXPECT(os != NULL);
+    EXPECT(p64_ordsched_queue(os, 0) == 0);
+    EXPECT(p64_ordsched_queue(os, 1) == 1);
+    EXPECT(p64_ordsched_queue(os, 3) == 1);
+    //Flow 0 element 0 is delayed
+    EXPECT(p64_ordsched_acquire(os, 0, 2, &sn0) == 2);
+    EXPECT(sn0 == 0);
+    EXPECT(p64_ordsched_acquire(os, 1, 2, &sn1) == 2);
+    EXPECT(sn1 == 0);
+    p64_ordsched_release(os, 0, 1, &(void *){(void *)11}, 1);
+    EXPECT(next_elem[0] == 10);
+    //Flow 1 is not blocked by flow 0
+    p64_ordsched_release(os, 1, 1, &(void *){(void *)21}, 1);
+    p64_ordsched_release(os, 1, 0, &(void *){(void *)20}, 1);
+    EXPECT(next_elem[1] == 22);
+    EXPECT(next_elem[0] == 10);
+    //Flow 2 maps to same queue as flow 0
+    EXPECT(p64_ordsched_acquire(os, 2, 1, &sn0) == 1);
+    EXPECT(sn0 == 2);
+    p64_ordsched_release(os, 2, 2, &(void *){(void *)12}, 1);
+    EXPECT(next_elem[0] == 10);
+    p64_ordsched_release(os, 0, 0, &(void *){(void *)10}, 1);
+    EXPECT(next_elem[0] == 13);
+    p64_ordsched_free(os);
+
+    printf("ordsched tests complete\n");
+    return 0;
+}
@@ -0,0 +1,60 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p64_qsbr.h"
+#include "build_config.h"
+#include "expect.h"
+
+#define NOBJS 3000
+
+static uint32_t nfreed = 0;
+
+static void
+callback(void *ptr)
+{
+    (void)ptr;
+    nfreed++;
+}
+
+int main(void)
+{
+    static char objs[NOBJS][64];
+    EXPECT(!p64_qsbr_reclaim());
+    p64_qsbr_register();
+    //Objects retired after our last quiescent state cannot be reclaimed
+    for (uint32_t i = 0; i < 10; i++)
+    {
+	p64_qsbr_retire(&objs[i], callback);
+    }
+    EXPECT(!p64_qsbr_reclaim());
+    EXPECT(nfreed == 0);
+    p64_qsbr_quiescent();
+    EXPECT(p64_qsbr_reclaim());
+    EXPECT(nfreed == 10);
+    EXPECT(!p64_qsbr_reclaim());
+    //Retire objects past the initial size of the retire list
+    for (uint32_t i = 10; i < NOBJS; i++)
+    {
+	p64_qsbr_retire(&objs[i], callback);
+	if (i == NOBJS / 2)
+	{
+	    p64_qsbr_quiescent();
+	}
+    }
+    EXPECT(nfreed < NOBJS);
+    p64_qsbr_quiescent();
+    EXPECT(p64_qsbr_reclaim());
+    EXPECT(nfreed == NOBJS);
+    //Unregister waits for retired objects to be reclaimed
+    p64_qsbr_retire(&objs[0], callback);
+    p64_qsbr_unregister();
+    EXPECT(nfreed == NOBJS + 1);
+
+    printf("qsbr test complete\n");
+    return 0;
+}
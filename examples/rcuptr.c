@@ -0,0 +1,172 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p64_rcuptr.h"
+#include "p64_hazardptr.h"
+#include "p64_qsbr.h"
+#include "expect.h"
+
+#define NREADERS 2
+#define NVERSIONS 1000
+
+struct config
+{
+    uint32_t version;
+    uint32_t check;
+};
+
+static p64_rcu_ptr_t cfg;
+static bool done;
+static uint32_t nfreed;
+
+static struct config *
+config_alloc(uint32_t version)
+{
+    struct config *c = malloc(sizeof(struct config));
+    if (c == NULL)
+	perror("malloc"), exit(-1);
+    c->version = version;
+    c->check = ~version;
+    return c;
+}
+
+static void
+config_free(void *ptr)
+{
+    struct config *c = ptr;
+    //Catch any access after reclamation
+    c->check = c->version;
+    free(c);
+    __atomic_fetch_add(&nfreed, 1, __ATOMIC_RELAXED);
+}
+
+static void *
+reader(void *arg)
+{
+    bool hazptr = (uintptr_t)arg;
+    p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+    uint32_t last = 0;
+    if (!hazptr)
+    {
+	p64_qsbr_register();
+    }
+    while (!__atomic_load_n(&done, __ATOMIC_RELAXED))
+    {
+	const struct config *c = hazptr ? p64_rcu_acquire(&cfg, &hp) :
+					   p64_rcu_deref(&cfg);
+	EXPECT(c != NULL);
+	EXPECT(c->check == ~c->version);
+	EXPECT(c->version >= last);
+	last = c->version;
+	if (hazptr)
+	{
+	    p64_hazptr_release_ro(&hp);
+	}
+	else
+	{
+	    p64_qsbr_quiescent();
+	}
+	sched_yield();
+    }
+    if (hazptr)
+    {
+	p64_hazptr_unregister();
+    }
+    else
+    {
+	p64_qsbr_unregister();
+    }
+    return NULL;
+}
+
+static void
+test_backend(uint32_t flags)
+{
+    bool hazptr = (flags & P64_RCU_F_HAZPTR) != 0;
+    nfreed = 0;
+    done = false;
+    p64_rcu_init(&cfg, config_alloc(0), flags);
+    if (!hazptr)
+    {
+	p64_qsbr_register();
+    }
+    pthread_t tid[NREADERS];
+    for (uint32_t i = 0; i < NREADERS; i++)
+    {
+	EXPECT(pthread_create(&tid[i], NULL, reader,
+			      (void *)(uintptr_t)hazptr) == 0);
+    }
+    for (uint32_t v = 1; v < NVERSIONS; v++)
+    {
+	if (v % 2 == 0)
+	{
+	    p64_rcu_assign(&cfg, config_alloc(v), config_free);
+	}
+	else
+	{
+	    //Copy and update
+	    struct config *old, *new = config_alloc(0);
+	    do
+	    {
+		if (hazptr)
+		{
+		    p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+		    old = p64_rcu_acquire(&cfg, &hp);
+		    new->version = old->version + 1;
+		    p64_hazptr_release_ro(&hp);
+		}
+		else
+		{
+		    old = p64_rcu_deref(&cfg);
+		    new->version = old->version + 1;
+		}
+		new->check = ~new->version;
+	    }
+	    while (!p64_rcu_replace(&cfg, old, new, config_free));
+	    EXPECT(new->version == v);
+	    //A stale object is not replaced
+	    EXPECT(!p64_rcu_replace(&cfg, old, NULL, config_free));
+	}
+	if (!hazptr)
+	{
+	    p64_qsbr_quiescent();
+	}
+	if (v % 64 == 0)
+	{
+	    sched_yield();
+	}
+    }
+    __atomic_store_n(&done, true, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < NREADERS; i++)
+    {
+	pthread_join(tid[i], NULL);
+    }
+    p64_rcu_assign(&cfg, NULL, config_free);
+    if (hazptr)
+    {
+	while (p64_hazptr_reclaim())
+	{
+	}
+	p64_hazptr_unregister();
+    }
+    else
+    {
+	p64_qsbr_unregister();
+    }
+    EXPECT(nfreed == NVERSIONS);
+}
+
+int main(void)
+{
+    test_backend(0);
+    test_backend(P64_RCU_F_HAZPTR);
+    printf("rcuptr tests complete\n");
+    return 0;
+}
@@ -35,6 +35,20 @@ alloc_frag(uint32_t hash,
     return frag;
 }
 
+//IPv6 fragment header offset and M flag
+static p64_fragment_t *
+alloc_frag6(uint64_t hash,
+	    uint32_t arrival,
+	    uint32_t offset,
+	    uint32_t len,
+	    bool more)
+{
+    p64_fragment_t *frag = alloc_frag(0, arrival, offset, len, more);
+    frag->hash = hash;
+    frag->fraginfo = p64_reassemble_fraginfo_ipv6(offset | (more ? 1 : 0));
+    return frag;
+}
+
 static void
 free_frag(p64_fragment_t *frag)
 {
@@ -58,9 +72,14 @@ length(p64_fragment_t *frag)
     return len;
 }
 
+static uint32_t ncomplete = 0;
+static uint32_t lastlength = 0;
+
 static void
 complete(void *arg, p64_fragment_t *frag)
 {
+    ncomplete++;
+    lastlength = length(frag);
     EXPECT(frag->nextfrag != NULL);
     p64_fragment_t *ff = frag->nextfrag;
     while (ff != NULL)
@@ -73,7 +92,35 @@ complete(void *arg, p64_fragment_t *frag)
     free_frag(frag);
 }
 
+static uint32_t lastnsegs = 0;
+
+static void
+complete_sg(void *arg,
+	    p64_fragment_t *frag,
+	    const p64_reassemble_seg_t segs[],
+	    uint32_t nsegs)
+{
+    (void)arg;
+    ncomplete++;
+    lastnsegs = nsegs;
+    //Segments must be contiguous and within their fragments
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < nsegs; i++)
+    {
+	EXPECT(segs[i].frag->hash == frag->hash);
+	EXPECT(segs[i].offset == offset);
+	EXPECT(segs[i].skip + segs[i].len <= segs[i].frag->len);
+	EXPECT(segs[i].offset ==
+	       (segs[i].frag->fraginfo & IP_FRAG_MASK) * 8U + segs[i].skip);
+	offset += segs[i].len;
+    }
+    lastlength = offset;
+    free_frag(frag);
+}
+
 static p64_fragment_t *lastfree = NULL;
+static uint64_t lasthash = 0;
+static uint32_t nstale = 0;
 static bool done = false;
 
 static void
@@ -86,10 +133,12 @@ stale(void *arg, p64_fragment_t *frag)
 	printf("%s fragment: hash %"PRIu64" arrival %u\n",
 	       done ? "Freeing" : "Stale",
 	       frag->hash, frag->arrival);
+	nstale++;
 	frag = frag->nextfrag;
     }
     EXPECT(lastfree != org);
     lastfree = org;
+    lasthash = org->hash;
     free_frag(org);
 }
 
@@ -117,6 +166,184 @@ int main(void)
     done = true;
     p64_reassemble_free(re);
     EXPECT(lastfree == f4);
+    done = false;
+
+    //IPv6 datagram larger than 64KB, 64-bit hash with high bits set
+    re = p64_reassemble_alloc(15, complete, stale, NULL);
+    EXPECT(re != NULL);
+    uint64_t hash6 = 0x123456789ABCDEF0ULL;
+    ncomplete = 0;
+    p64_reassemble_insert(re, alloc_frag6(hash6, 200, 65528, 1000, false));
+    p64_reassemble_insert(re, alloc_frag6(hash6, 200, 0, 32768, true));
+    EXPECT(ncomplete == 0);
+    p64_reassemble_insert(re, alloc_frag6(hash6, 201, 32768, 32760, true));
+    EXPECT(ncomplete == 1);
+    EXPECT(lastlength == 65528 + 1000);
+    p64_reassemble_free(re);
+
+    //Sharded table, fragments map to different shards
+    re = p64_reassemble_alloc_sharded(3, 4, complete, stale, NULL);
+    EXPECT(re != NULL);
+    EXPECT(p64_reassemble_shard(re, 1) == 0);
+    EXPECT(p64_reassemble_shard(re, 5) == 1);
+    EXPECT(p64_reassemble_shard(re, 11) == 3);
+    EXPECT(p64_reassemble_shard(re, 12) == 0);
+    ncomplete = 0;
+    lastfree = NULL;
+    for (uint32_t h = 0; h < 12; h++)
+    {
+	p64_reassemble_insert(re, alloc_frag(h, 300 + h, 0, 800, true));
+    }
+    for (uint32_t h = 0; h < 12; h += 2)
+    {
+	p64_reassemble_insert(re, alloc_frag(h, 300 + h, 800, 100, false));
+    }
+    EXPECT(ncomplete == 6);
+    //Expire odd hashes in shard 1 (hashes 3, 4, 5)
+    p64_reassemble_expire_shard(re, 1, 400);
+    EXPECT(lastfree != NULL);
+    EXPECT(lasthash == 3 || lasthash == 5);
+    p64_reassemble_expire(re, 400);
+    done = true;
+    p64_reassemble_free(re);
+
+    //Per-entry fragment limit, hashes 1 and 16 map to the same entry
+    re = p64_reassemble_alloc(15, complete, stale, NULL);
+    EXPECT(re != NULL);
+    p64_reassemble_limits_t lim = { .maxfrags = 3 };
+    p64_reassemble_set_limits(re, &lim);
+    done = false;
+    ncomplete = 0;
+    nstale = 0;
+    p64_reassemble_insert(re, alloc_frag(1, 500, 0, 800, true));
+    p64_reassemble_insert(re, alloc_frag(1, 501, 800, 800, true));
+    p64_reassemble_insert(re, alloc_frag(16, 510, 0, 800, true));
+    EXPECT(nstale == 0);
+    //Fourth fragment exceeds limit, oldest datagram (hash 1) is evicted
+    p64_reassemble_insert(re, alloc_frag(16, 511, 800, 800, true));
+    EXPECT(nstale == 2);
+    EXPECT(lasthash == 1);
+    lastfree = NULL;//Freed fragments may be reallocated
+    p64_reassemble_insert(re, alloc_frag(16, 512, 1600, 100, false));
+    EXPECT(ncomplete == 1);
+    EXPECT(lastlength == 1700);
+    EXPECT(nstale == 2);
+    p64_reassemble_free(re);
+
+    //Per-entry byte limit, the arriving fragment itself may be evicted
+    re = p64_reassemble_alloc(15, complete, stale, NULL);
+    EXPECT(re != NULL);
+    lim = (p64_reassemble_limits_t) { .maxbytes_bucket = 2000 };
+    p64_reassemble_set_limits(re, &lim);
+    nstale = 0;
+    p64_reassemble_insert(re, alloc_frag(2, 520, 0, 1600, true));
+    EXPECT(nstale == 0);
+    p64_reassemble_insert(re, alloc_frag(2, 521, 1600, 1600, true));
+    EXPECT(nstale == 2);
+    EXPECT(lasthash == 2);
+    lastfree = NULL;
+    p64_reassemble_free(re);
+    EXPECT(nstale == 2);
+
+    //Table byte limit, oldest fragment list is evicted
+    re = p64_reassemble_alloc(15, complete, stale, NULL);
+    EXPECT(re != NULL);
+    lim = (p64_reassemble_limits_t) { .maxbytes = 1000 };
+    p64_reassemble_set_limits(re, &lim);
+    ncomplete = 0;
+    nstale = 0;
+    p64_reassemble_insert(re, alloc_frag(3, 601, 0, 400, true));
+    p64_reassemble_insert(re, alloc_frag(2, 600, 0, 400, true));
+    EXPECT(nstale == 0);
+    p64_reassemble_insert(re, alloc_frag(4, 602, 0, 400, true));
+    EXPECT(nstale == 1);
+    EXPECT(lasthash == 2);
+    lastfree = NULL;
+    //Completed datagrams release their bytes
+    p64_reassemble_insert(re, alloc_frag(3, 603, 400, 100, false));
+    EXPECT(ncomplete == 1);
+    p64_reassemble_insert(re, alloc_frag(5, 604, 0, 400, true));
+    EXPECT(nstale == 1);
+    done = true;
+    p64_reassemble_free(re);
+    EXPECT(nstale == 3);
+
+    //Incremental expiration, 5 entries per call
+    re = p64_reassemble_alloc(15, complete, stale, NULL);
+    EXPECT(re != NULL);
+    done = false;
+    nstale = 0;
+    lastfree = NULL;
+    p64_reassemble_insert(re, alloc_frag(1, 700, 0, 800, true));
+    p64_reassemble_insert(re, alloc_frag(12, 700, 0, 800, true));
+    p64_reassemble_insert(re, alloc_frag(13, 710, 0, 800, true));
+    EXPECT(!p64_reassemble_expire_incr(re, 705, 5));
+    EXPECT(nstale == 1 && lasthash == 1);
+    EXPECT(!p64_reassemble_expire_incr(re, 705, 5));
+    EXPECT(nstale == 1);
+    EXPECT(p64_reassemble_expire_incr(re, 705, 5));
+    EXPECT(nstale == 2 && lasthash == 12);
+    //Budget larger than table wraps around and scans whole table once
+    lastfree = NULL;
+    EXPECT(p64_reassemble_expire_incr(re, 720, 100));
+    EXPECT(nstale == 3 && lasthash == 13);
+    p64_reassemble_free(re);
+
+    //Scatter-gather completion with duplicated and overlapping fragments
+    re = p64_reassemble_alloc(15, complete, stale, NULL);
+    EXPECT(re != NULL);
+    p64_reassemble_set_complete_sg(re, complete_sg);
+    ncomplete = 0;
+    nstale = 0;
+    p64_reassemble_insert(re, alloc_frag(7, 800, 0, 16, true));
+    p64_reassemble_insert(re, alloc_frag(7, 800, 8, 16, true));
+    p64_reassemble_insert(re, alloc_frag(7, 800, 0, 16, true));
+    p64_reassemble_insert(re, alloc_frag(7, 800, 8, 8, true));
+    EXPECT(ncomplete == 0);
+    p64_reassemble_insert(re, alloc_frag(7, 801, 24, 10, false));
+    EXPECT(ncomplete == 1);
+    EXPECT(lastnsegs == 3);
+    EXPECT(lastlength == 34);
+    //Many fragments
+    for (uint32_t i = 0; i < 100; i++)
+    {
+	p64_reassemble_insert(re, alloc_frag(8, 802, 8 * i, 8, true));
+    }
+    p64_reassemble_insert(re, alloc_frag(8, 802, 800, 1, false));
+    EXPECT(ncomplete == 2);
+    EXPECT(lastnsegs == 101);
+    EXPECT(lastlength == 801);
+    EXPECT(nstale == 0);
+    //Duplicated last fragment
+    p64_reassemble_insert(re, alloc_frag(9, 803, 16, 4, false));
+    p64_reassemble_insert(re, alloc_frag(9, 803, 16, 4, false));
+    p64_reassemble_insert(re, alloc_frag(9, 803, 0, 8, true));
+    EXPECT(ncomplete == 2);
+    p64_reassemble_insert(re, alloc_frag(9, 803, 8, 8, true));
+    EXPECT(ncomplete == 3);
+    EXPECT(lastnsegs == 3);
+    EXPECT(lastlength == 20);
+    //Data beyond a last fragment is not reassembled
+    p64_reassemble_insert(re, alloc_frag(10, 804, 16, 8, true));
+    p64_reassemble_insert(re, alloc_frag(10, 804, 0, 8, true));
+    p64_reassemble_insert(re, alloc_frag(10, 804, 8, 4, false));
+    EXPECT(ncomplete == 3);
+    //Too many segments for scatter-gather
+    lastfree = NULL;
+    for (uint32_t i = 0; i < P64_REASSEMBLE_SG_MAXSEGS; i++)
+    {
+	p64_reassemble_insert(re, alloc_frag(11, 805, 8 * i, 8, true));
+    }
+    p64_reassemble_insert(re, alloc_frag(11, 805,
+					 8 * P64_REASSEMBLE_SG_MAXSEGS,
+					 1, false));
+    EXPECT(ncomplete == 3);
+    EXPECT(nstale == P64_REASSEMBLE_SG_MAXSEGS + 1 && lasthash == 11);
+    nstale = 0;
+    lastfree = NULL;
+    done = true;
+    p64_reassemble_free(re);
+    EXPECT(nstale == 3 && lasthash == 10);
 
     printf("reassemble test complete\n");
     return 0;
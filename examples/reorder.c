@@ -24,6 +24,26 @@ static void callback(void *arg, void *elem, uint32_t sn)
     }
 }
 
+static uint32_t ncalls = 0;
+
+static void vec_callback(void *arg, void *vec[], uint32_t n)
+{
+    (void)arg;
+    EXPECT(n >= 1 && n <= 2);
+    ncalls++;
+    for (uint32_t i = 0; i < n; i++)
+    {
+	EXPECT(vec[i] != NULL && vec[i] != P64_REORDER_DUMMY);
+	printf("Element %lu retired (vector)\n", (uintptr_t)vec[i]);
+	if (next_elem == 102)
+	{
+	    next_elem++;//Skip dummy element
+	}
+	EXPECT((uintptr_t)vec[i] == next_elem);
+	next_elem++;
+    }
+}
+
 int main(void)
 {
     uint32_t sn;
@@ -47,6 +67,27 @@ int main(void)
     p64_reorder_release(rob, 4, &(void *){(void*)104}, 1);
     p64_reorder_free(rob);
 
+    //Vector callback
+    rob = p64_reorder_alloc_vec(8, 2, false, vec_callback, NULL);
+    EXPECT(rob != NULL);
+    next_elem = 100;
+    EXPECT(p64_reorder_acquire(rob, 5, &sn) == 5);
+    EXPECT(sn == 0);
+    p64_reorder_release(rob, 3, (void *[]){(void *)103, (void *)104}, 2);
+    p64_reorder_release(rob, 2, &(void *){P64_REORDER_DUMMY}, 1);
+    p64_reorder_release(rob, 1, &(void *){(void *)101}, 1);
+    EXPECT(ncalls == 0);
+    p64_reorder_release(rob, 0, &(void *){(void *)100}, 1);
+    EXPECT(ncalls == 2);
+    EXPECT(next_elem == 105);
+    EXPECT(p64_reorder_acquire(rob, 3, &sn) == 3);
+    EXPECT(sn == 5);
+    p64_reorder_release(rob, 5,
+			(void *[]){(void *)105, (void *)106, (void *)107}, 3);
+    EXPECT(ncalls == 4);
+    EXPECT(next_elem == 108);
+    p64_reorder_free(rob);
+
     printf("reorder tests complete\n");
     return 0;
 }
@@ -2,8 +2,12 @@
 //
 //SPDX-License-Identifier:        BSD-3-Clause
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "p64_ringbuf_template.h"
 //Instantiate the ring buffer template using uint32_t as the ring element
@@ -50,16 +54,314 @@ test_rb(uint32_t flags)
     p64_ringbuf_ui32_free(rb);
 }
 
+static void
+test_span(uint32_t flags)
+{
+    uint32_t index;
+    uint32_t vec[4];
+    p64_ringbuf_ui32_span_t sp;
+
+    p64_ringbuf_ui32_t *rb = p64_ringbuf_ui32_alloc(4, flags);
+    EXPECT(rb != NULL);
+
+    EXPECT(p64_ringbuf_ui32_dequeue_reserve(rb, 1, &sp) == 0);
+    EXPECT(p64_ringbuf_ui32_dequeue_commit(rb, &sp));
+    EXPECT(p64_ringbuf_ui32_enqueue(rb, (uint32_t[]){ 1, 2, 3 }, 3) == 3);
+    EXPECT(p64_ringbuf_ui32_dequeue(rb, vec, 2, &index) == 2);
+    //Reservation wraps around end of ring
+    EXPECT(p64_ringbuf_ui32_enqueue_reserve(rb, 4, &sp) == 3);
+    EXPECT(sp.num[0] == 1 && sp.num[1] == 2);
+    EXPECT(sp.ev[1] == &rb->ring[0]);
+    sp.ev[0][0] = 4;
+    sp.ev[1][0] = 5;
+    sp.ev[1][1] = 6;
+    p64_ringbuf_ui32_enqueue_commit(rb, &sp);
+    EXPECT(p64_ringbuf_ui32_enqueue_reserve(rb, 1, &sp) == 0);
+    p64_ringbuf_ui32_enqueue_commit(rb, &sp);
+
+    EXPECT(p64_ringbuf_ui32_dequeue_reserve(rb, 4, &sp) == 4);
+    EXPECT(sp.num[0] == 2 && sp.num[1] == 2);
+    EXPECT(sp.ev[0][0] == 3 && sp.ev[0][1] == 4);
+    EXPECT(sp.ev[1][0] == 5 && sp.ev[1][1] == 6);
+    EXPECT(p64_ringbuf_ui32_dequeue_commit(rb, &sp));
+    EXPECT(p64_ringbuf_ui32_dequeue(rb, vec, 1, &index) == 0);
+
+    p64_ringbuf_ui32_free(rb);
+}
+
+static void
+test_span_ptr(uint32_t flags)
+{
+    static char objs[3];
+    p64_ringbuf_span_t sp;
+
+    p64_ringbuf_t *rb = p64_ringbuf_alloc(2, flags, sizeof(void *));
+    EXPECT(rb != NULL);
+    EXPECT(p64_ringbuf_enqueue_reserve(rb, 3, &sp) == 2);
+    EXPECT(sp.num[0] == 2 && sp.num[1] == 0);
+    sp.ev[0][0] = &objs[0];
+    sp.ev[0][1] = &objs[1];
+    p64_ringbuf_enqueue_commit(rb, &sp);
+    EXPECT(p64_ringbuf_dequeue_reserve(rb, 1, &sp) == 1);
+    EXPECT(sp.ev[0][0] == &objs[0]);
+    EXPECT(p64_ringbuf_dequeue_commit(rb, &sp));
+    EXPECT(p64_ringbuf_enqueue(rb, (void *[]){ &objs[2] }, 1) == 1);
+    EXPECT(p64_ringbuf_dequeue_reserve(rb, 2, &sp) == 2);
+    EXPECT(sp.num[0] == 1 && sp.num[1] == 1);
+    EXPECT(sp.ev[0][0] == &objs[1] && sp.ev[1][0] == &objs[2]);
+    EXPECT(p64_ringbuf_dequeue_commit(rb, &sp));
+    p64_ringbuf_free(rb);
+}
+
+static void *
+producer(void *arg)
+{
+    p64_ringbuf_t *rb = arg;
+    //Give consumer time to go to sleep
+    nanosleep(&(struct timespec){ .tv_sec = 0, .tv_nsec = 10000000 }, NULL);
+    EXPECT(p64_ringbuf_enqueue(rb, (void *[]){ (void*)1 }, 1) == 1);
+    return NULL;
+}
+
+static void
+test_bulk(uint32_t flags)
+{
+    static char objs[4];
+    void *vec[4];
+    uint32_t index;
+
+    p64_ringbuf_t *rb = p64_ringbuf_alloc(4, flags, sizeof(void *));
+    EXPECT(rb != NULL);
+    EXPECT(p64_ringbuf_enqueue_bulk(rb, (void *[]){ &objs[0], &objs[1], &objs[2] }, 3, 3) == 3);
+    //Only one free slot
+    EXPECT(p64_ringbuf_enqueue_bulk(rb, (void *[]){ &objs[3], &objs[3] }, 2, 2) == 0);
+    EXPECT(p64_ringbuf_dequeue_bulk(rb, vec, 4, 4, &index) == 0);
+    EXPECT(p64_ringbuf_dequeue_bulk(rb, vec, 2, 4, &index) == 3);
+    EXPECT(index == 0);
+    EXPECT(vec[0] == &objs[0] && vec[2] == &objs[2]);
+    EXPECT(p64_ringbuf_enqueue_bulk(rb, (void *[]){ &objs[3] }, 1, 1) == 1);
+    EXPECT(p64_ringbuf_dequeue_bulk(rb, vec, 2, 2, &index) == 0);
+    EXPECT(p64_ringbuf_dequeue_bulk(rb, vec, 1, 1, &index) == 1);
+    EXPECT(index == 3);
+    EXPECT(vec[0] == &objs[3]);
+    p64_ringbuf_free(rb);
+}
+
+static void
+test_shared(uint32_t flags)
+{
+    void *vec[4];
+    uint32_t index;
+    size_t sz = p64_ringbuf_size(4, sizeof(void *));
+    int fd = memfd_create("ringbuf", 0);
+    EXPECT(fd >= 0);
+    EXPECT(ftruncate(fd, sz) == 0);
+    //Map same memory twice at different addresses
+    void *m0 = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    void *m1 = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    EXPECT(m0 != MAP_FAILED && m1 != MAP_FAILED && m0 != m1);
+    p64_ringbuf_t *rb0 = p64_ringbuf_init(m0, sz, 4, flags, sizeof(void *));
+    p64_ringbuf_t *rb1 = p64_ringbuf_attach(m1);
+    EXPECT(p64_ringbuf_enqueue(rb0, (void *[]){ (void*)1, (void*)2 }, 2) == 2);
+    EXPECT(p64_ringbuf_dequeue(rb1, vec, 4, &index) == 2);
+    EXPECT(vec[0] == (void*)1 && vec[1] == (void*)2);
+    EXPECT(p64_ringbuf_enqueue(rb1, (void *[]){ (void*)3 }, 1) == 1);
+    EXPECT(p64_ringbuf_dequeue(rb0, vec, 4, &index) == 1);
+    EXPECT(vec[0] == (void*)3 && index == 2);
+    EXPECT(munmap(m0, sz) == 0);
+    EXPECT(munmap(m1, sz) == 0);
+    close(fd);
+}
+
+static void
+test_wait(uint32_t flags)
+{
+    void *vec[4];
+    uint32_t index;
+
+    p64_ringbuf_t *rb = p64_ringbuf_alloc(4, flags | P64_RINGBUF_F_WAITDEQ,
+					  sizeof(void *));
+    EXPECT(rb != NULL);
+    EXPECT(p64_ringbuf_dequeue_wait(rb, vec, 4, &index, 0) == 0);
+    EXPECT(p64_ringbuf_dequeue_wait(rb, vec, 4, &index, 1000000) == 0);
+    EXPECT(p64_ringbuf_enqueue(rb, (void *[]){ (void*)2 }, 1) == 1);
+    EXPECT(p64_ringbuf_dequeue_wait(rb, vec, 4, &index, ~(uint64_t)0) == 1);
+    EXPECT(vec[0] == (void*)2);
+    //Sleeping consumer is woken by producer
+    pthread_t tid;
+    EXPECT(pthread_create(&tid, NULL, producer, rb) == 0);
+    EXPECT(p64_ringbuf_dequeue_wait(rb, vec, 4, &index, ~(uint64_t)0) == 1);
+    EXPECT(vec[0] == (void*)1);
+    EXPECT(index == 1);
+    EXPECT(pthread_join(tid, NULL) == 0);
+    p64_ringbuf_free(rb);
+}
+
+static void
+test_stage(uint32_t single)
+{
+    static char objs[6];
+    p64_ringbuf_span_t sp;
+
+    p64_stagering_t *sr = p64_stagering_alloc(4, 3, single);
+    EXPECT(sr != NULL);
+    //Nothing for later stages yet
+    EXPECT(p64_stagering_acquire(sr, 1, 4, &sp) == 0);
+    EXPECT(p64_stagering_acquire(sr, 2, 4, &sp) == 0);
+    EXPECT(p64_stagering_acquire(sr, 0, 3, &sp) == 3);
+    EXPECT(sp.num[0] == 3 && sp.num[1] == 0);
+    for (uint32_t i = 0; i < 3; i++)
+    {
+	sp.ev[0][i] = &objs[i];
+    }
+    p64_stagering_release(sr, 0, &sp);
+    EXPECT(p64_stagering_acquire(sr, 2, 4, &sp) == 0);
+    EXPECT(p64_stagering_acquire(sr, 1, 2, &sp) == 2);
+    EXPECT(sp.ev[0][0] == &objs[0] && sp.ev[0][1] == &objs[1]);
+    //Update elements in place
+    sp.ev[0][1] = &objs[4];
+    p64_stagering_release(sr, 1, &sp);
+    EXPECT(p64_stagering_acquire(sr, 2, 4, &sp) == 2);
+    EXPECT(sp.ev[0][0] == &objs[0] && sp.ev[0][1] == &objs[4]);
+    p64_stagering_release(sr, 2, &sp);
+    //Only one slot free, two returned slots wrap around
+    EXPECT(p64_stagering_acquire(sr, 0, 4, &sp) == 3);
+    EXPECT(sp.num[0] == 1 && sp.num[1] == 2);
+    sp.ev[0][0] = &objs[3];
+    sp.ev[1][0] = &objs[4];
+    sp.ev[1][1] = &objs[5];
+    p64_stagering_release(sr, 0, &sp);
+    EXPECT(p64_stagering_acquire(sr, 0, 4, &sp) == 0);
+    EXPECT(p64_stagering_acquire(sr, 1, 8, &sp) == 4);
+    EXPECT(sp.num[0] == 2 && sp.num[1] == 2);
+    EXPECT(sp.ev[0][0] == &objs[2] && sp.ev[1][1] == &objs[5]);
+    p64_stagering_release(sr, 1, &sp);
+    EXPECT(p64_stagering_acquire(sr, 2, 8, &sp) == 4);
+    p64_stagering_release(sr, 2, &sp);
+    p64_stagering_free(sr);
+}
+
+#define NSTAGEELEMS 4000
+#define NWORKERS 2
+
+static p64_stagering_t *stage_sr;
+static uint32_t stage_done;
+
+static void *
+stage_worker(void *arg)
+{
+    (void)arg;
+    p64_ringbuf_span_t sp;
+    while (!__atomic_load_n(&stage_done, __ATOMIC_ACQUIRE))
+    {
+	uint32_t n = p64_stagering_acquire(stage_sr, 1, 8, &sp);
+	for (uint32_t s = 0; s < 2; s++)
+	{
+	    for (uint32_t i = 0; i < sp.num[s]; i++)
+	    {
+		sp.ev[s][i] = (void *)((uintptr_t)sp.ev[s][i] + 1);
+	    }
+	}
+	if (n != 0)
+	{
+	    p64_stagering_release(stage_sr, 1, &sp);
+	}
+    }
+    return NULL;
+}
+
+static void *
+stage_producer(void *arg)
+{
+    (void)arg;
+    p64_ringbuf_span_t sp;
+    uintptr_t next = 0;
+    while (next < NSTAGEELEMS)
+    {
+	(void)p64_stagering_acquire(stage_sr, 0, 8, &sp);
+	for (uint32_t s = 0; s < 2; s++)
+	{
+	    for (uint32_t i = 0; i < sp.num[s]; i++)
+	    {
+		sp.ev[s][i] = (void *)(next++ * 2);
+	    }
+	}
+	p64_stagering_release(stage_sr, 0, &sp);
+    }
+    return NULL;
+}
+
+//Single producer stage, MT-safe middle stage and single consumer stage
+static void
+test_stage_mt(void)
+{
+    p64_ringbuf_span_t sp;
+    pthread_t tid[NWORKERS + 1];
+
+    stage_sr = p64_stagering_alloc(64, 3, 1U << 0 | 1U << 2);
+    EXPECT(stage_sr != NULL);
+    stage_done = false;
+    EXPECT(pthread_create(&tid[0], NULL, stage_producer, NULL) == 0);
+    for (uint32_t i = 1; i <= NWORKERS; i++)
+    {
+	EXPECT(pthread_create(&tid[i], NULL, stage_worker, NULL) == 0);
+    }
+    uintptr_t next = 0;
+    while (next < NSTAGEELEMS)
+    {
+	(void)p64_stagering_acquire(stage_sr, 2, 8, &sp);
+	for (uint32_t s = 0; s < 2; s++)
+	{
+	    for (uint32_t i = 0; i < sp.num[s]; i++)
+	    {
+		//Elements arrive in order and processed by the middle stage
+		EXPECT(sp.ev[s][i] == (void *)(next++ * 2 + 1));
+	    }
+	}
+	p64_stagering_release(stage_sr, 2, &sp);
+    }
+    __atomic_store_n(&stage_done, true, __ATOMIC_RELEASE);
+    for (uint32_t i = 0; i <= NWORKERS; i++)
+    {
+	EXPECT(pthread_join(tid[i], NULL) == 0);
+    }
+    p64_stagering_free(stage_sr);
+}
+
 int main(void)
 {
     printf("testing MPMC ring buffer\n");
     test_rb(P64_RINGBUF_F_MPENQ | P64_RINGBUF_F_MCDEQ);
+    test_span(P64_RINGBUF_F_MPENQ | P64_RINGBUF_F_MCDEQ);
+    test_span_ptr(P64_RINGBUF_F_MPENQ | P64_RINGBUF_F_MCDEQ);
+    test_bulk(P64_RINGBUF_F_MPENQ | P64_RINGBUF_F_MCDEQ);
+    test_wait(P64_RINGBUF_F_MPENQ | P64_RINGBUF_F_MCDEQ);
+    test_shared(P64_RINGBUF_F_MPENQ | P64_RINGBUF_F_MCDEQ);
     printf("testing SPSC ring buffer\n");
     test_rb(P64_RINGBUF_F_SPENQ | P64_RINGBUF_F_SCDEQ);
+    test_span(P64_RINGBUF_F_SPENQ | P64_RINGBUF_F_SCDEQ);
+    test_span_ptr(P64_RINGBUF_F_SPENQ | P64_RINGBUF_F_SCDEQ);
+    test_bulk(P64_RINGBUF_F_SPENQ | P64_RINGBUF_F_SCDEQ);
+    test_wait(P64_RINGBUF_F_SPENQ | P64_RINGBUF_F_SCDEQ);
+    test_shared(P64_RINGBUF_F_SPENQ | P64_RINGBUF_F_SCDEQ);
     printf("testing MPLFC ring buffer\n");
     test_rb(P64_RINGBUF_F_MPENQ | P64_RINGBUF_F_LFDEQ);
+    test_span(P64_RINGBUF_F_MPENQ | P64_RINGBUF_F_LFDEQ);
+    test_span_ptr(P64_RINGBUF_F_MPENQ | P64_RINGBUF_F_LFDEQ);
+    test_bulk(P64_RINGBUF_F_MPENQ | P64_RINGBUF_F_LFDEQ);
+    test_wait(P64_RINGBUF_F_MPENQ | P64_RINGBUF_F_LFDEQ);
+    test_shared(P64_RINGBUF_F_MPENQ | P64_RINGBUF_F_LFDEQ);
     printf("testing SPLFC ring buffer\n");
     test_rb(P64_RINGBUF_F_SPENQ | P64_RINGBUF_F_LFDEQ);
+    test_span(P64_RINGBUF_F_SPENQ | P64_RINGBUF_F_LFDEQ);
+    test_span_ptr(P64_RINGBUF_F_SPENQ | P64_RINGBUF_F_LFDEQ);
+    test_bulk(P64_RINGBUF_F_SPENQ | P64_RINGBUF_F_LFDEQ);
+    test_wait(P64_RINGBUF_F_SPENQ | P64_RINGBUF_F_LFDEQ);
+    test_shared(P64_RINGBUF_F_SPENQ | P64_RINGBUF_F_LFDEQ);
+    printf("testing staged ring\n");
+    test_stage(0);
+    test_stage(1U << 0 | 1U << 1 | 1U << 2);
+    test_stage_mt();
     printf("ringbuf test complete\n");
     return 0;
 }
@@ -2,13 +2,84 @@
 //
 //SPDX-License-Identifier:        BSD-3-Clause
 
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include "p64_rwlock.h"
 #include "expect.h"
 
+#define NTHREADS 3
+#define NITER 2000
+
+static p64_rwlock_t lock;
+
+static void *
+writer(void *arg)
+{
+    (void)arg;
+    p64_rwlock_acquire_wr(&lock);
+    p64_rwlock_release_wr(&lock);
+    return NULL;
+}
+
+//Data protected by the lock, the two fields are always equal when the lock
+//is not held for writing
+static uint32_t data[2];
+
+static void
+update_data(void)
+{
+    data[0]++;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    data[1]++;
+}
+
+static void *
+thread_func(void *arg)
+{
+    uint32_t rnd = (uintptr_t)arg * 2654435761U + 1;
+    for (uint32_t i = 0; i < NITER; i++)
+    {
+	rnd ^= rnd << 13;
+	rnd ^= rnd >> 17;
+	rnd ^= rnd << 5;
+	switch (rnd % 4)
+	{
+	    case 0 :
+		p64_rwlock_acquire_wr(&lock);
+		update_data();
+		p64_rwlock_release_wr(&lock);
+		break;
+	    case 1 :
+		p64_rwlock_acquire_rd(&lock);
+		EXPECT(data[0] == data[1]);
+		if (p64_rwlock_upgrade(&lock))
+		{
+		    update_data();
+		    p64_rwlock_release_wr(&lock);
+		}
+		else
+		{
+		    //Let the pending writer proceed
+		    p64_rwlock_release_rd(&lock);
+		}
+		break;
+	    default :
+		p64_rwlock_acquire_rd(&lock);
+		EXPECT(data[0] == data[1]);
+		p64_rwlock_release_rd(&lock);
+		break;
+	}
+	if (i % 16 == 0)
+	{
+	    sched_yield();
+	}
+    }
+    return NULL;
+}
+
 int main(void)
 {
-    p64_rwlock_t lock;
     p64_rwlock_init(&lock);
     p64_rwlock_acquire_rd(&lock);
     EXPECT(lock == 1);
@@ -23,6 +94,53 @@ int main(void)
     p64_rwlock_release_wr(&lock);
     EXPECT(lock == 0);
 
+    //Try-acquire
+    EXPECT(p64_rwlock_try_acquire_rd(&lock));
+    EXPECT(lock == 1);
+    EXPECT(!p64_rwlock_try_acquire_wr(&lock));
+    EXPECT(p64_rwlock_try_acquire_rd(&lock));
+    EXPECT(lock == 2);
+    p64_rwlock_release_rd(&lock);
+    p64_rwlock_release_rd(&lock);
+    EXPECT(p64_rwlock_try_acquire_wr(&lock));
+    EXPECT(lock == 0x80000000);
+    EXPECT(!p64_rwlock_try_acquire_rd(&lock));
+    EXPECT(!p64_rwlock_try_acquire_wr(&lock));
+    p64_rwlock_release_wr(&lock);
+    EXPECT(lock == 0);
+
+    //Upgrade
+    p64_rwlock_acquire_rd(&lock);
+    EXPECT(p64_rwlock_upgrade(&lock));
+    EXPECT(lock == 0x80000000);
+    p64_rwlock_release_wr(&lock);
+    EXPECT(lock == 0);
+    //Upgrade fails when another writer is pending
+    p64_rwlock_acquire_rd(&lock);
+    pthread_t tid[NTHREADS];
+    EXPECT(pthread_create(&tid[0], NULL, writer, NULL) == 0);
+    while ((__atomic_load_n(&lock, __ATOMIC_RELAXED) & 0x80000000) == 0)
+    {
+	sched_yield();
+    }
+    EXPECT(!p64_rwlock_upgrade(&lock));
+    //Read release with writer pending
+    p64_rwlock_release_rd(&lock);
+    pthread_join(tid[0], NULL);
+    EXPECT(lock == 0);
+
+    //Concurrent readers, writers and upgraders
+    for (uintptr_t i = 0; i < NTHREADS; i++)
+    {
+	EXPECT(pthread_create(&tid[i], NULL, thread_func, (void *)i) == 0);
+    }
+    for (uint32_t i = 0; i < NTHREADS; i++)
+    {
+	pthread_join(tid[i], NULL);
+    }
+    EXPECT(lock == 0);
+    EXPECT(data[0] == data[1]);
+
     printf("rwlock tests complete\n");
     return 0;
 }
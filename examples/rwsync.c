@@ -2,10 +2,22 @@
 //
 //SPDX-License-Identifier:        BSD-3-Clause
 
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include "p64_rwsync.h"
+#include "p64_rwsync_template.h"
 #include "expect.h"
 
+struct route
+{
+    uint32_t addr;
+    uint16_t port;
+    uint8_t flags;
+};
+
+P64_RWSYNC(routesync, struct route)
+
 int main(void)
 {
     p64_rwsync_t sync;
@@ -17,6 +29,59 @@ int main(void)
     s = p64_rwsync_acquire_rd(&sync);
     p64_rwsync_write(&sync, "Mary had a little lamb", data, 23);
     EXPECT(p64_rwsync_release_rd(&sync, s) == false);
+    char copy[23];
+    p64_rwsync_read(&sync, copy, data, 23);
+    EXPECT(strcmp(copy, "Mary had a little lamb") == 0);
+
+    //Word aligned copy of multiple cache lines
+    uint64_t big[67], bigcopy[67];
+    for (uint32_t i = 0; i < 67; i++)
+    {
+	bigcopy[i] = i * 0x0101010101010101ULL;
+    }
+    p64_rwsync_write(&sync, bigcopy, big, sizeof big);
+    memset(bigcopy, 0, sizeof bigcopy);
+    p64_rwsync_read(&sync, bigcopy, big, sizeof big);
+    for (uint32_t i = 0; i < 67; i++)
+    {
+	EXPECT(bigcopy[i] == i * 0x0101010101010101ULL);
+    }
+
+    //Double buffered data
+    uint64_t dbuf[2][4] = { { 1, 2, 3, 4 }, { 0 } };
+    uint64_t val[4];
+    p64_rwsync_init(&sync);
+    p64_rwsync_read_dbuf(&sync, val, dbuf, sizeof dbuf[0]);
+    EXPECT(val[0] == 1 && val[3] == 4);
+    uint64_t upd[4] = { 5, 6, 7, 8 };
+    p64_rwsync_write_dbuf(&sync, upd, dbuf, sizeof dbuf[0]);
+    EXPECT(sync == 2);
+    EXPECT(dbuf[0][0] == 1 && dbuf[1][0] == 5);
+    p64_rwsync_read_dbuf(&sync, val, dbuf, sizeof dbuf[0]);
+    EXPECT(val[0] == 5 && val[3] == 8);
+    //Reads of the stable buffer succeed while a write is in progress
+    p64_rwsync_acquire_wr(&sync);
+    p64_rwsync_read_dbuf(&sync, val, dbuf, sizeof dbuf[0]);
+    EXPECT(val[0] == 5 && val[3] == 8);
+    p64_rwsync_release_wr(&sync);
+    EXPECT(sync == 4);
+    p64_rwsync_write_dbuf(&sync, dbuf[0], dbuf, sizeof dbuf[0]);
+    EXPECT(sync == 6);
+    EXPECT(dbuf[1][0] == 1);
+
+    //Typed container
+    routesync_t rt;
+    struct route r = { 1, 2, 3 };
+    routesync_init(&rt, &r);
+    r = (struct route) { 0, 0, 0 };
+    routesync_read(&rt, &r);
+    EXPECT(r.addr == 1 && r.port == 2 && r.flags == 3);
+    r = (struct route) { 4, 5, 6 };
+    routesync_write(&rt, &r);
+    EXPECT(rt.sync == 2);
+    r = (struct route) { 0, 0, 0 };
+    routesync_read(&rt, &r);
+    EXPECT(r.addr == 4 && r.port == 5 && r.flags == 6);
 
     printf("rwsync tests complete\n");
     return 0;
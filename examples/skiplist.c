@@ -0,0 +1,213 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p64_skiplist.h"
+#include "p64_hazardptr.h"
+#include "expect.h"
+
+#define NTHREADS 4
+#define NKEYS 256
+#define NITER 4000
+
+struct my_elem
+{
+    p64_skipelem_t elem;
+    uint32_t key;
+};
+
+static uint32_t nfreed = 0;
+
+static struct my_elem *
+elem_alloc(uint32_t k)
+{
+    struct my_elem *me = malloc(sizeof(struct my_elem));
+    if (me == NULL)
+	perror("malloc"), exit(-1);
+    me->key = k;
+    return me;
+}
+
+static void
+elem_free(void *ptr)
+{
+    __atomic_fetch_add(&nfreed, 1, __ATOMIC_RELAXED);
+    free(ptr);
+}
+
+static int
+compf(const p64_skipelem_t *se, const void *key)
+{
+    uint32_t k = *(const uint32_t *)key;
+    const struct my_elem *me = (const struct my_elem *)se;
+    return me->key < k ? -1 : me->key > k ? 1 : 0;
+}
+
+static p64_skiplist_t *sl;
+
+//Count elements with keys in [lo, hi), verify they are in order
+static uint32_t
+count_range(uint32_t lo, uint32_t hi)
+{
+    p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+    uint32_t n = 0;
+    uint32_t prev = 0;
+    struct my_elem *me = (struct my_elem *)p64_skiplist_lower_bound(sl, &lo,
+								      &hp);
+    while (me != NULL && me->key < hi)
+    {
+	EXPECT(n == 0 || me->key > prev);
+	prev = me->key;
+	n++;
+	me = (struct my_elem *)p64_skiplist_next(sl, &me->elem, &prev, &hp);
+    }
+    p64_hazptr_release_ro(&hp);
+    return n;
+}
+
+static void *
+thread_func(void *arg)
+{
+    uint32_t tidx = (uintptr_t)arg;
+    uint32_t rnd = tidx * 2654435761U + 1;
+    p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+    for (uint32_t i = 0; i < NITER; i++)
+    {
+	rnd ^= rnd << 13;
+	rnd ^= rnd >> 17;
+	rnd ^= rnd << 5;
+	//Each thread owns the keys k where k % NTHREADS == tidx
+	uint32_t k = (rnd % (NKEYS / NTHREADS)) * NTHREADS + tidx;
+	switch (rnd / 7 % 4)
+	{
+	    case 0 :
+	    case 1 :
+	    {
+		struct my_elem *me = elem_alloc(k);
+		bool present = p64_skiplist_lookup(sl, &k, &hp) != NULL;
+		p64_hazptr_release_ro(&hp);
+		if (p64_skiplist_insert(sl, &me->elem, &me->key))
+		{
+		    EXPECT(!present);
+		}
+		else
+		{
+		    EXPECT(present);
+		    free(me);
+		}
+		break;
+	    }
+	    case 2 :
+	    {
+		bool present = p64_skiplist_lookup(sl, &k, &hp) != NULL;
+		p64_hazptr_release_ro(&hp);
+		struct my_elem *me = (struct my_elem *)
+		    p64_skiplist_remove(sl, &k, elem_free, &hp);
+		EXPECT((me != NULL) == present);
+		EXPECT(me == NULL || me->key == k);
+		p64_hazptr_release_ro(&hp);
+		break;
+	    }
+	    case 3 :
+		EXPECT(count_range(k, k + NKEYS / 4) <= NKEYS / 4);
+		break;
+	}
+    }
+    p64_hazptr_unregister();
+    return NULL;
+}
+
+int main(void)
+{
+    p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+    uint32_t k;
+    sl = p64_skiplist_alloc(compf);
+    EXPECT(sl != NULL);
+
+    //Insert keys 0, 10, 20.. 990 in pseudo-random order
+    for (uint32_t i = 0; i < 100; i++)
+    {
+	struct my_elem *me = elem_alloc((i * 37 % 100) * 10);
+	EXPECT(p64_skiplist_insert(sl, &me->elem, &me->key));
+    }
+    struct my_elem *dup = elem_alloc(500);
+    EXPECT(!p64_skiplist_insert(sl, &dup->elem, &dup->key));
+    free(dup);
+    k = 500;
+    struct my_elem *me = (struct my_elem *)p64_skiplist_lookup(sl, &k, &hp);
+    EXPECT(me != NULL && me->key == 500);
+    p64_hazptr_release_ro(&hp);
+    k = 505;
+    EXPECT(p64_skiplist_lookup(sl, &k, &hp) == NULL);
+    EXPECT(hp == P64_HAZARDPTR_NULL);
+    me = (struct my_elem *)p64_skiplist_lower_bound(sl, &k, &hp);
+    EXPECT(me != NULL && me->key == 510);
+    p64_hazptr_release_ro(&hp);
+    k = 991;
+    EXPECT(p64_skiplist_lower_bound(sl, &k, &hp) == NULL);
+    EXPECT(count_range(0, 1000) == 100);
+    EXPECT(count_range(100, 200) == 10);
+
+    //Iterate past a removed element
+    k = 300;
+    me = (struct my_elem *)p64_skiplist_lookup(sl, &k, &hp);
+    EXPECT(me != NULL);
+    p64_hazardptr_t hpr = P64_HAZARDPTR_NULL;
+    EXPECT(p64_skiplist_remove(sl, &k, elem_free, &hpr) == &me->elem);
+    p64_hazptr_release_ro(&hpr);
+    EXPECT(p64_skiplist_remove(sl, &k, elem_free, &hpr) == NULL);
+    //'me' still protected by 'hp'
+    p64_hazptr_reclaim();
+    EXPECT(nfreed == 0);
+    me = (struct my_elem *)p64_skiplist_next(sl, &me->elem, &k, &hp);
+    EXPECT(me != NULL && me->key == 310);
+    p64_hazptr_release_ro(&hp);
+    p64_hazptr_reclaim();
+    EXPECT(nfreed == 1);
+    EXPECT(count_range(0, 1000) == 99);
+
+    //Remove all elements
+    for (uint32_t i = 0; i < 100; i++)
+    {
+	k = i * 10;
+	me = (struct my_elem *)p64_skiplist_remove(sl, &k, elem_free, &hp);
+	EXPECT((me != NULL) == (k != 300));
+	p64_hazptr_release_ro(&hp);
+    }
+    EXPECT(count_range(0, 1000) == 0);
+    p64_hazptr_reclaim();
+    EXPECT(nfreed == 100);
+
+    //Concurrent inserts, removals and range scans
+    pthread_t tid[NTHREADS];
+    for (uintptr_t i = 0; i < NTHREADS; i++)
+    {
+	EXPECT(pthread_create(&tid[i], NULL, thread_func, (void *)i) == 0);
+    }
+    for (uint32_t i = 0; i < NTHREADS; i++)
+    {
+	pthread_join(tid[i], NULL);
+    }
+    uint32_t n = count_range(0, NKEYS);
+    for (k = 0; k < NKEYS; k++)
+    {
+	if (p64_skiplist_remove(sl, &k, elem_free, &hp) != NULL)
+	{
+	    n--;
+	}
+	p64_hazptr_release_ro(&hp);
+    }
+    EXPECT(n == 0);
+    EXPECT(count_range(0, NKEYS) == 0);
+    p64_skiplist_free(sl);
+    p64_hazptr_reclaim();
+    EXPECT(p64_hazptr_dump(stdout) == p64_hazptr_maxrefs());
+    p64_hazptr_unregister();
+
+    printf("skiplist tests complete\n");
+    return 0;
+}
@@ -0,0 +1,100 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <pthread.h>
+#include <stdio.h>
+#include "p64_backoff.h"
+#include "p64_barrier.h"
+#include "p64_spinlock.h"
+#include "expect.h"
+
+#define NTHREADS 4
+#define NITER 10000
+
+static p64_spinlock_t spin;
+static p64_tktlock_t tkt;
+static p64_barrier_t barrier;
+static uint32_t counter[2];
+
+static void *
+thread_func(void *arg)
+{
+    (void)arg;
+    p64_barrier_wait(&barrier);
+    for (uint32_t i = 0; i < NITER; i++)
+    {
+	p64_spinlock_acquire(&spin);
+	counter[0]++;
+	p64_spinlock_release(&spin);
+	p64_tktlock_acquire(&tkt);
+	counter[1]++;
+	p64_tktlock_release(&tkt);
+    }
+    p64_barrier_wait(&barrier);
+    return NULL;
+}
+
+static void
+run_threads(void)
+{
+    pthread_t tid[NTHREADS];
+    counter[0] = counter[1] = 0;
+    p64_barrier_init(&barrier, NTHREADS);
+    for (uintptr_t i = 0; i < NTHREADS; i++)
+    {
+	EXPECT(pthread_create(&tid[i], NULL, thread_func, (void *)i) == 0);
+    }
+    for (uint32_t i = 0; i < NTHREADS; i++)
+    {
+	pthread_join(tid[i], NULL);
+    }
+    EXPECT(counter[0] == NTHREADS * NITER);
+    EXPECT(counter[1] == NTHREADS * NITER);
+}
+
+int main(void)
+{
+    p64_spinlock_init(&spin);
+    EXPECT(p64_spinlock_try_acquire(&spin));
+    EXPECT(!p64_spinlock_try_acquire(&spin));
+    p64_spinlock_release(&spin);
+
+    p64_tktlock_init(&tkt);
+    EXPECT(p64_tktlock_try_acquire(&tkt));
+    EXPECT(tkt.enter == 1 && tkt.leave == 0);
+    EXPECT(!p64_tktlock_try_acquire(&tkt));
+    p64_tktlock_release(&tkt);
+    EXPECT(tkt.enter == 1 && tkt.leave == 1);
+    p64_tktlock_acquire(&tkt);
+    EXPECT(tkt.enter == 2 && tkt.leave == 1);
+    p64_tktlock_release(&tkt);
+    //Ticket wrap-around
+    tkt.enter = tkt.leave = 0xffff;
+    p64_tktlock_acquire(&tkt);
+    EXPECT(tkt.enter == 0 && tkt.leave == 0xffff);
+    p64_tktlock_release(&tkt);
+    EXPECT(p64_tktlock_try_acquire(&tkt));
+    p64_tktlock_release(&tkt);
+
+    //Default policy, spin without backoff
+    p64_backoff_t bo;
+    p64_backoff_get(&bo);
+    EXPECT(bo.min == 0 && bo.max == 0 && bo.yield == 0);
+    run_threads();
+
+    //Exponential backoff, then yield (for oversubscribed cores)
+    bo = (p64_backoff_t) { .min = 4, .max = 256, .yield = 16 };
+    p64_backoff_set(&bo);
+    p64_backoff_get(&bo);
+    EXPECT(bo.min == 4 && bo.max == 256 && bo.yield == 16);
+    run_threads();
+
+    //Yield immediately
+    bo = (p64_backoff_t) { .min = 0, .max = 0, .yield = 1 };
+    p64_backoff_set(&bo);
+    run_threads();
+
+    printf("spinlock tests complete\n");
+    return 0;
+}
@@ -0,0 +1,64 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "p64_hazardptr.h"
+#include "p64_spinlock.h"
+#include "p64_stats.h"
+#include "expect.h"
+
+static char *
+dump(void)
+{
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *fp = open_memstream(&buf, &len);
+    EXPECT(fp != NULL);
+    p64_stats_dump(fp);
+    fclose(fp);
+    printf("%s", buf);
+    return buf;
+}
+
+//Return value of named counter in dump, zero if not present
+static unsigned long
+value(const char *buf, const char *name)
+{
+    const char *p = strstr(buf, name);
+    return p != NULL ? strtoul(p + strlen(name), NULL, 10) : 0;
+}
+
+int main(void)
+{
+    char *buf;
+    p64_spinlock_t lock;
+    p64_spinlock_init(&lock);
+    p64_spinlock_acquire(&lock);
+    p64_spinlock_release(&lock);
+    //Uncontended operations should not count any spins
+    (void)p64_hazptr_reclaim();
+    buf = dump();
+    EXPECT(value(buf, "spinlock spins") == 0);
+    if (p64_stats_enabled())
+    {
+	EXPECT(value(buf, "p64_stats:") >= 1);
+	EXPECT(value(buf, "hazptr reclaim runs") == 1);
+	p64_stats_reset();
+	free(buf);
+	buf = dump();
+	EXPECT(value(buf, "hazptr reclaim runs") == 0);
+    }
+    else
+    {
+	EXPECT(strstr(buf, "not enabled") != NULL);
+    }
+    free(buf);
+    p64_hazptr_unregister();
+
+    printf("stats tests complete\n");
+    return 0;
+}
@@ -5,6 +5,7 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "p64_timer.h"
 #include "expect.h"
@@ -19,6 +20,187 @@ callback(p64_timer_t tim,
     *(p64_tick_t *)arg = tck;
 }
 
+#define NTIMERS 64
+
+struct my_timer
+{
+    p64_timer_t tim;
+    p64_tick_t tmo;//Expected expiration tick
+    uint32_t nexp;//Number of expirations
+};
+
+static void
+callback_multi(p64_timer_t tim,
+	       p64_tick_t tmo,
+	       void *arg)
+{
+    struct my_timer *mt = arg;
+    EXPECT(mt->tim == tim);
+    EXPECT(mt->tmo == tmo);
+    EXPECT(tmo <= p64_timer_tick_get());
+    mt->nexp++;
+}
+
+//Timers with widely different expiration ticks, advance time in steps
+static void
+test_multi(void)
+{
+    static struct my_timer mts[NTIMERS];
+    p64_tick_t now = p64_timer_tick_get();
+    p64_tick_t last = now;
+    for (uint32_t i = 0; i < NTIMERS; i++)
+    {
+	mts[i].tim = p64_timer_alloc(callback_multi, &mts[i]);
+	EXPECT(mts[i].tim != P64_TIMER_NULL);
+	mts[i].tmo = now + 1 + (i * 0x9E3779B97F4A7C15ULL) % (2ULL << (i % 40));
+	mts[i].nexp = 0;
+	EXPECT(p64_timer_set(mts[i].tim, mts[i].tmo));
+	last = mts[i].tmo > last ? mts[i].tmo : last;
+    }
+    //Move some timers to earlier and later expiration ticks, cancel some
+    for (uint32_t i = 0; i < NTIMERS; i += 8)
+    {
+	mts[i].tmo = now + 1 + (mts[i].tmo - now) / 2;
+	EXPECT(p64_timer_reset(mts[i].tim, mts[i].tmo));
+	mts[i + 1].tmo += 1000;
+	EXPECT(p64_timer_reset(mts[i + 1].tim, mts[i + 1].tmo));
+	mts[i + 2].tmo = P64_TIMER_TICK_INVALID;
+	EXPECT(p64_timer_cancel(mts[i + 2].tim));
+	last = mts[i + 1].tmo > last ? mts[i + 1].tmo : last;
+    }
+    while (now < last)
+    {
+	now += 1 + now / 3;
+	p64_timer_tick_set(now);
+	p64_timer_expire();
+	for (uint32_t i = 0; i < NTIMERS; i++)
+	{
+	    EXPECT(mts[i].nexp == (mts[i].tmo <= now));
+	}
+    }
+    for (uint32_t i = 0; i < NTIMERS; i++)
+    {
+	p64_timer_free(mts[i].tim);
+    }
+}
+
+static void
+callback_group(p64_timer_t tim,
+	       p64_tick_t tmo,
+	       void *arg)
+{
+    (void)tim;
+    *(p64_tick_t *)arg = tmo;
+}
+
+//Timers in a separate group with its own current tick
+static void
+test_group(void)
+{
+    p64_tick_t exp[3] = { -1, -1, -1 };
+    p64_timer_t tims[3];
+    p64_timer_group_t *tg = p64_timer_group_alloc(3);
+    EXPECT(tg != NULL);
+    for (uint32_t i = 0; i < 3; i++)
+    {
+	tims[i] = p64_timer_group_timer_alloc(tg, callback_group, &exp[i]);
+	EXPECT(tims[i] != P64_TIMER_NULL);
+    }
+    EXPECT(p64_timer_group_timer_alloc(tg, callback_group, NULL) ==
+	   P64_TIMER_NULL);
+    EXPECT(p64_timer_group_tick_get(tg) == 0);
+    EXPECT(p64_timer_group_set(tg, tims[0], 10));
+    EXPECT(p64_timer_group_set(tg, tims[1], 20));
+    EXPECT(p64_timer_group_set(tg, tims[2], 30));
+    EXPECT(p64_timer_group_cancel(tg, tims[2]));
+    //Default group is not affected
+    p64_tick_t now = p64_timer_tick_get();
+    p64_timer_group_tick_set(tg, 15);
+    EXPECT(p64_timer_tick_get() == now);
+    p64_timer_group_expire(tg);
+    EXPECT(exp[0] == 10 && exp[1] == (p64_tick_t)-1);
+    EXPECT(!p64_timer_group_reset(tg, tims[0], 40));
+    p64_timer_group_tick_set(tg, 40);
+    p64_timer_group_expire(tg);
+    EXPECT(exp[1] == 20 && exp[2] == (p64_tick_t)-1);
+    for (uint32_t i = 0; i < 3; i++)
+    {
+	p64_timer_group_timer_free(tg, tims[i]);
+    }
+    p64_timer_group_free(tg);
+}
+
+static uint64_t
+time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//Timers in a group using the built-in clock
+static void
+test_clock(void)
+{
+    p64_tick_t exp = -1;
+    p64_timer_group_t *tg = p64_timer_group_alloc(1);
+    EXPECT(tg != NULL);
+    //1us ticks
+    p64_timer_group_clock_enable(tg, 1000);
+    p64_tick_t start = p64_timer_group_tick_get(tg);
+    uint64_t t0 = time_ns();
+    p64_timer_t tim = p64_timer_group_timer_alloc(tg, callback_group, &exp);
+    EXPECT(tim != P64_TIMER_NULL);
+    EXPECT(p64_timer_group_set(tg, tim, start + 2000));
+    while (exp == (p64_tick_t)-1)
+    {
+	p64_timer_group_expire(tg);
+    }
+    uint64_t elapsed = time_ns() - t0;
+    EXPECT(exp == start + 2000);
+    EXPECT(p64_timer_group_tick_get(tg) >= start + 2000);
+    //Allow for inaccuracy of the measured counter frequency
+    EXPECT(elapsed >= 1800000);
+    printf("Built-in clock timer expired after %"PRIu64"ns\n", elapsed);
+    p64_timer_group_timer_free(tg, tim);
+    p64_timer_group_free(tg);
+}
+
+//Set and cancel multiple timers using one call
+static void
+test_vec(void)
+{
+    static struct my_timer mts[4];
+    p64_timer_t tims[4];
+    p64_tick_t tmos[4];
+    p64_tick_t now = p64_timer_tick_get();
+    for (uint32_t i = 0; i < 4; i++)
+    {
+	tims[i] = p64_timer_alloc(callback_multi, &mts[i]);
+	EXPECT(tims[i] != P64_TIMER_NULL);
+	mts[i].tim = tims[i];
+	mts[i].tmo = tmos[i] = now + 10 - i;
+	mts[i].nexp = 0;
+    }
+    //Timer 1 already active and not updated
+    EXPECT(p64_timer_set(tims[1], now + 20));
+    mts[1].tmo = now + 20;
+    EXPECT(p64_timer_set_vec(tims, tmos, 4) == 3);
+    //Timer 3 expires first
+    p64_timer_tick_set(now + 7);
+    p64_timer_expire();
+    EXPECT(mts[3].nexp == 1 && mts[2].nexp == 0);
+    EXPECT(p64_timer_cancel_vec(tims, 4) == 3);
+    EXPECT(p64_timer_cancel_vec(tims, 4) == 0);
+    p64_timer_tick_set(now + 20);
+    p64_timer_expire();
+    for (uint32_t i = 0; i < 4; i++)
+    {
+	EXPECT(mts[i].nexp == (i == 3));
+	p64_timer_free(tims[i]);
+    }
+}
+
 int main(void)
 {
     p64_tick_t exp_a = -1;
@@ -41,6 +223,18 @@ int main(void)
     p64_timer_tick_set(3);
     p64_timer_expire();
     EXPECT(exp_a == 1);
+    for (uint32_t k = 0; k < 8; k++)
+    {
+	const char *name = p64_timer_scan_kernel(k);
+	if (name != NULL)
+	{
+	    printf("Scan kernel %s\n", name);
+	    test_multi();
+	}
+    }
+    test_group();
+    test_vec();
+    test_clock();
     EXPECT(!p64_timer_reset(tim_a, 0xFFFFFFFFFFFFFFFEULL));
     EXPECT(p64_timer_set(tim_a, 0xFFFFFFFFFFFFFFFEULL));
     EXPECT(p64_timer_reset(tim_a, 0xFFFFFFFFFFFFFFFEULL));
@@ -0,0 +1,99 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "p64_timer.h"
+#include "expect.h"
+
+//Total number of timers scanned for each kernel and timer group size
+#define NSCANNED (16 * 1024 * 1024)
+
+static void
+callback(p64_timer_t tim,
+	 p64_tick_t tmo,
+	 void *arg)
+{
+    (void)tim;
+    (void)tmo;
+    (*(uint32_t *)arg)++;
+}
+
+static uint64_t
+time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//Each expiration scans all timers, one timer expires
+static double
+bench(uint32_t ntimers)
+{
+    uint32_t nexp = 0;
+    p64_timer_group_t *tg = p64_timer_group_alloc(ntimers);
+    EXPECT(tg != NULL);
+    p64_timer_t *tims = malloc(ntimers * sizeof(p64_timer_t));
+    EXPECT(tims != NULL);
+    for (uint32_t i = 0; i < ntimers; i++)
+    {
+	tims[i] = p64_timer_group_timer_alloc(tg, callback, &nexp);
+	EXPECT(tims[i] != P64_TIMER_NULL);
+	//Most timers expire far into the future
+	EXPECT(p64_timer_group_set(tg, tims[i], 1000000000 + i));
+    }
+    EXPECT(p64_timer_group_cancel(tg, tims[ntimers / 2]));
+    uint32_t niter = NSCANNED / ntimers;
+    uint64_t start = time_ns();
+    for (uint32_t i = 1; i <= niter; i++)
+    {
+	EXPECT(p64_timer_group_set(tg, tims[ntimers / 2], i));
+	p64_timer_group_tick_set(tg, i);
+	p64_timer_group_expire(tg);
+    }
+    uint64_t elapsed = time_ns() - start;
+    EXPECT(nexp == niter);
+    for (uint32_t i = 0; i < ntimers; i++)
+    {
+	if (i != ntimers / 2)
+	{
+	    EXPECT(p64_timer_group_cancel(tg, tims[i]));
+	}
+	p64_timer_group_timer_free(tg, tims[i]);
+    }
+    free(tims);
+    p64_timer_group_free(tg);
+    return (double)elapsed / niter;
+}
+
+int main(void)
+{
+    printf("%-8s", "timers");
+    for (uint32_t k = 0; k < 8; k++)
+    {
+	const char *name = p64_timer_scan_kernel(k);
+	if (name != NULL)
+	{
+	    printf(" %14s", name);
+	}
+    }
+    printf("  (nanoseconds per expiration scan)\n");
+    for (uint32_t ntimers = 1024; ntimers <= 64 * 1024; ntimers *= 2)
+    {
+	printf("%-8u", ntimers);
+	for (uint32_t k = 0; k < 8; k++)
+	{
+	    if (p64_timer_scan_kernel(k) != NULL)
+	    {
+		printf(" %14.1f", bench(ntimers));
+	    }
+	}
+	printf("\n");
+    }
+    return 0;
+}
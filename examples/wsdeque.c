@@ -0,0 +1,175 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p64_wsdeque.h"
+#include "p64_reorder.h"
+#include "expect.h"
+
+#define NWORKERS 4
+#define NTASKS 20000
+#define DEQUESZ 256
+#define ROBSZ 1024
+
+//Task scheduling with a reorder buffer fed through work-stealing deques
+//Only worker 0 acquires sequence numbers and creates tasks (a skewed
+//workload), idle workers steal tasks instead of contending on a shared queue
+//Completed tasks are released into the reorder buffer which retires them in
+//sequence number order
+
+struct task
+{
+    uint32_t sn;
+    uint32_t cost;
+};
+
+static p64_reorder_t *rob;
+static p64_wsdeque_t *deques[NWORKERS];
+static uint32_t nretired = 0;
+static uint32_t ncompleted = 0;
+static uint32_t nprocessed[NWORKERS];
+static uint32_t nproduced = 0;//Only accessed by worker 0
+
+static void
+retire_cb(void *arg, void *elem, uint32_t sn)
+{
+    (void)arg;
+    if (elem != NULL)
+    {
+	struct task *tsk = elem;
+	//Retire callbacks are serialised by the reorder buffer
+	EXPECT(tsk->sn == sn);
+	EXPECT(sn == nretired);
+	nretired++;
+	free(tsk);
+    }
+}
+
+static void
+process(struct task *tsk)
+{
+    //Simulate work of varying cost
+    volatile uint32_t x = 0;
+    for (uint32_t i = 0; i < tsk->cost; i++)
+    {
+	x += i;
+    }
+}
+
+static void
+produce(p64_wsdeque_t *wsd)
+{
+    //Only create tasks which fit in our deque
+    while (nproduced < NTASKS && p64_wsdeque_size(wsd) < DEQUESZ)
+    {
+	uint32_t sn;
+	if (p64_reorder_acquire(rob, 1, &sn) == 0)
+	{
+	    //Reorder buffer full
+	    return;
+	}
+	struct task *tsk = malloc(sizeof(struct task));
+	if (tsk == NULL)
+	    perror("malloc"), exit(-1);
+	tsk->sn = sn;
+	tsk->cost = (sn * 2654435761U) % 1000;
+	EXPECT(p64_wsdeque_push(wsd, tsk));
+	nproduced++;
+    }
+}
+
+static void *
+worker(void *arg)
+{
+    uint32_t tidx = (uintptr_t)arg;
+    uint32_t victim = tidx;
+    while (__atomic_load_n(&ncompleted, __ATOMIC_RELAXED) < NTASKS)
+    {
+	if (tidx == 0)
+	{
+	    produce(deques[tidx]);
+	}
+	struct task *tsk = p64_wsdeque_pop(deques[tidx]);
+	if (tsk == NULL)
+	{
+	    //Own deque empty, steal from another worker
+	    victim = (victim + 1) % NWORKERS;
+	    if (victim == tidx)
+	    {
+		continue;
+	    }
+	    tsk = p64_wsdeque_steal(deques[victim]);
+	    if (tsk == NULL)
+	    {
+		continue;
+	    }
+	}
+	process(tsk);
+	nprocessed[tidx]++;
+	__atomic_fetch_add(&ncompleted, 1, __ATOMIC_RELAXED);
+	p64_reorder_release(rob, tsk->sn, (void **)&tsk, 1);
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    p64_wsdeque_t *wsd = p64_wsdeque_alloc(3);
+    EXPECT(wsd != NULL);
+    EXPECT(p64_wsdeque_pop(wsd) == NULL);
+    EXPECT(p64_wsdeque_steal(wsd) == NULL);
+    EXPECT(p64_wsdeque_push(wsd, (void *)1));
+    EXPECT(p64_wsdeque_push(wsd, (void *)2));
+    EXPECT(p64_wsdeque_push(wsd, (void *)3));
+    EXPECT(p64_wsdeque_push(wsd, (void *)4));
+    EXPECT(!p64_wsdeque_push(wsd, (void *)5));
+    EXPECT(p64_wsdeque_size(wsd) == 4);
+    //Owner pops LIFO, thieves steal FIFO
+    EXPECT(p64_wsdeque_pop(wsd) == (void *)4);
+    EXPECT(p64_wsdeque_steal(wsd) == (void *)1);
+    EXPECT(p64_wsdeque_push(wsd, (void *)5));
+    EXPECT(p64_wsdeque_push(wsd, (void *)6));
+    EXPECT(!p64_wsdeque_push(wsd, (void *)7));
+    EXPECT(p64_wsdeque_steal(wsd) == (void *)2);
+    EXPECT(p64_wsdeque_pop(wsd) == (void *)6);
+    EXPECT(p64_wsdeque_pop(wsd) == (void *)5);
+    EXPECT(p64_wsdeque_pop(wsd) == (void *)3);
+    EXPECT(p64_wsdeque_pop(wsd) == NULL);
+    EXPECT(p64_wsdeque_steal(wsd) == NULL);
+    EXPECT(p64_wsdeque_size(wsd) == 0);
+    p64_wsdeque_free(wsd);
+
+    rob = p64_reorder_alloc(ROBSZ, false, retire_cb, NULL);
+    EXPECT(rob != NULL);
+    for (uint32_t i = 0; i < NWORKERS; i++)
+    {
+	deques[i] = p64_wsdeque_alloc(DEQUESZ);
+	EXPECT(deques[i] != NULL);
+    }
+    pthread_t tid[NWORKERS];
+    for (uintptr_t i = 0; i < NWORKERS; i++)
+    {
+	EXPECT(pthread_create(&tid[i], NULL, worker, (void *)i) == 0);
+    }
+    for (uint32_t i = 0; i < NWORKERS; i++)
+    {
+	pthread_join(tid[i], NULL);
+    }
+    EXPECT(nretired == NTASKS);
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < NWORKERS; i++)
+    {
+	printf("Worker %u processed %u tasks\n", i, nprocessed[i]);
+	sum += nprocessed[i];
+	p64_wsdeque_free(deques[i]);
+    }
+    EXPECT(sum == NTASKS);
+    p64_reorder_free(rob);
+
+    printf("wsdeque tests complete\n");
+    return 0;
+}
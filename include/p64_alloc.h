@@ -0,0 +1,54 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Memory allocation for all data structures allocated by the library
+//The default allocator uses aligned_alloc() and free(), large allocations
+//can be placed on a specific NUMA node and backed by (transparent) huge pages
+//A user defined allocator can be installed e.g. to allocate from hugetlbfs
+//(1GB pages) or a memory pool set up by some other framework
+
+#ifndef _P64_ALLOC_H
+#define _P64_ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//Allocate memory on any NUMA node (no specific placement)
+#define P64_ALLOC_ANYNODE (-1)
+
+#define P64_ALLOC_F_HUGEPAGE 0x0001 //Back memory by huge pages if possible
+
+//Allocate 'size' bytes aligned to 'align' (a power of two)
+//'node' is a NUMA node or P64_ALLOC_ANYNODE, 'flags' are P64_ALLOC_F_*
+//Return NULL if memory cannot be allocated
+typedef void *(*p64_alloc_cb)(void *arg,
+			      size_t size,
+			      size_t align,
+			      int32_t node,
+			      uint32_t flags);
+
+//Free memory allocated by the corresponding allocation function
+typedef void (*p64_free_cb)(void *arg, void *ptr);
+
+//Set the process-wide allocator, NULL restores the default allocator
+//Call before any data structures are allocated, memory must be freed by the
+//allocator which allocated it
+void p64_set_allocator(p64_alloc_cb alloc_cb, p64_free_cb free_cb, void *arg);
+
+//Allocate memory using the current allocator
+void *p64_malloc(size_t size, size_t align, int32_t node, uint32_t flags);
+
+//Free memory allocated by p64_malloc(), 'ptr' may be NULL
+void p64_mfree(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,6 +7,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include "p64_alloc.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -26,6 +27,25 @@ p64_antireplay_t *
 p64_antireplay_alloc(uint32_t winsize,
 		     bool swizzle);
 
+//As p64_antireplay_alloc()
+//Memory is allocated on NUMA node 'numanode' (or P64_ALLOC_ANYNODE) using
+//P64_ALLOC_F_* 'allocflags', see p64_alloc.h
+p64_antireplay_t *
+p64_antireplay_alloc_ex(uint32_t winsize,
+			bool swizzle,
+			int32_t numanode,
+			uint32_t allocflags);
+
+//Allocate a compact anti-replay window which uses one bit per sequence
+//number, in the style of RFC 6479
+//The window rotates in blocks of 32 sequence numbers, a sequence number is
+//accepted if it is newer than the highest seen minus between 'winsize' - 31
+//and 'winsize'
+//Sequence numbers must not advance by 2^36 or more at a time
+//'winsize' must be a power of two and at least 64
+p64_antireplay_t *
+p64_antireplay_alloc_bitmap(uint32_t winsize);
+
 void
 p64_antireplay_free(p64_antireplay_t *arwin);
 
@@ -37,6 +57,16 @@ p64_antireplay_result_t
 p64_antireplay_test_and_set(p64_antireplay_t *arwin,
 			    p64_antireplay_sn_t sn);
 
+//Test and set a burst of sequence numbers
+//results[i] is the same as if p64_antireplay_test_and_set() had been called
+//for each sequence number in array order
+//Return number of sequence numbers which passed
+uint32_t
+p64_antireplay_test_and_set_vec(p64_antireplay_t *arwin,
+				const p64_antireplay_sn_t sns[],
+				uint32_t num,
+				p64_antireplay_result_t results[]);
+
 #ifdef __cplusplus
 }
 #endif
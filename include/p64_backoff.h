@@ -0,0 +1,38 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Backoff policy for threads waiting in spin locks, ticket locks and barriers
+//The default policy spins without backoff which is best for dedicated cores
+//With oversubscribed cores (e.g. CPU quotas), exponential backoff and
+//yielding the CPU avoid stalls when a lock holder has been preempted
+
+#ifndef _P64_BACKOFF_H
+#define _P64_BACKOFF_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct p64_backoff
+{
+    uint32_t min;//Initial backoff (pause iterations), 0 disables backoff
+    uint32_t max;//Maximum backoff (pause iterations), backoff doubles until max
+    uint32_t yield;//Yield the CPU after this many waits, 0 never yields
+} p64_backoff_t;
+
+//Set the process-wide backoff policy
+//Threads already waiting continue to use the earlier policy
+void p64_backoff_set(const p64_backoff_t *bo);
+
+//Get the process-wide backoff policy
+void p64_backoff_get(p64_backoff_t *bo);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
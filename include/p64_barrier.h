@@ -23,8 +23,31 @@ void p64_barrier_init(p64_barrier_t *br, uint32_t numthreads);
 
 //Enter the barrier and wait until all threads have entered the barrier
 //p64_barrier_wait() has release and acquire ordering
+//Waiting threads use the backoff policy set by p64_backoff_set()
 void p64_barrier_wait(p64_barrier_t *br);
 
+//Combining tree barrier for high thread counts
+//Threads arrive at leaf nodes shared by 'fanout' threads, the last thread to
+//arrive at a node continues to the parent node, the last thread to arrive at
+//the root releases the nodes it won which releases the other threads
+//top-down, each thread spins on the node where it was not the last to arrive
+//Threads spinning on the same flag are limited to 'fanout' and barrier
+//latency grows with the depth of the tree, O(log(numthreads))
+typedef struct p64_barrier_tree p64_barrier_tree_t;
+
+//Allocate a tree barrier for 'numthreads' threads and max 'fanout' child
+//threads/nodes per node
+p64_barrier_tree_t *p64_barrier_tree_alloc(uint32_t numthreads,
+					   uint32_t fanout);
+
+//Free a tree barrier
+void p64_barrier_tree_free(p64_barrier_tree_t *br);
+
+//Enter the tree barrier and wait until all threads have entered the barrier
+//Each thread must use a unique thread index 'tidx' (0..numthreads-1)
+//p64_barrier_tree_wait() has release and acquire ordering
+void p64_barrier_tree_wait(p64_barrier_tree_t *br, uint32_t tidx);
+
 #ifdef __cplusplus
 }
 #endif
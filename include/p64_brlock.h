@@ -0,0 +1,48 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Big reader lock
+//Readers update a per-thread reader indicator (slot) in a separate cache
+//line, writers set a writer flag and wait for all reader slots to drain
+//Read-mostly use cases scale with the number of reader threads
+
+#ifndef _P64_BRLOCK_H
+#define _P64_BRLOCK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct p64_brlock p64_brlock_t;
+
+//Allocate a big reader lock with 'nslots' reader slots
+//Threads are assigned to slots round-robin, use at least as many slots as
+//there are reader threads for best scalability
+p64_brlock_t *p64_brlock_alloc(uint32_t nslots);
+
+//Free a big reader lock
+void p64_brlock_free(p64_brlock_t *lock);
+
+//Acquire a read lock
+//Block until no write is in progress
+void p64_brlock_acquire_rd(p64_brlock_t *lock);
+
+//Release a read lock
+void p64_brlock_release_rd(p64_brlock_t *lock);
+
+//Acquire a write lock
+//Block until earlier reads & writes have completed
+void p64_brlock_acquire_wr(p64_brlock_t *lock);
+
+//Release a write lock
+void p64_brlock_release_wr(p64_brlock_t *lock);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
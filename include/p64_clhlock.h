@@ -33,6 +33,35 @@ void p64_clhlock_acquire(p64_clhlock_t *lock, p64_clhnode_t **nodep);
 //Release a CLH lock
 void p64_clhlock_release(p64_clhnode_t **nodep);
 
+//Acquire a CLH lock using a node from a per-thread pool
+//*nodep will be written with a pointer to the node which must be passed to
+//p64_clhlock_release_pooled()
+//Nodes are recycled automatically and freed when the thread exits
+void p64_clhlock_acquire_pooled(p64_clhlock_t *lock, p64_clhnode_t **nodep);
+
+//Release a CLH lock acquired using p64_clhlock_acquire_pooled()
+//The node is returned to the pool and *nodep is reset
+void p64_clhlock_release_pooled(p64_clhnode_t **nodep);
+
+//NUMA-aware (hierarchical) cohort lock built from CLH locks
+//Threads first acquire the CLH lock of their NUMA node and then the global
+//CLH lock, the global lock is passed directly to a waiting thread on the
+//same node at most 'maxhandoff' times before it is released to other nodes
+//Uses pooled nodes
+typedef struct p64_clhcohort p64_clhcohort_t;
+
+//Allocate a cohort lock for 'nnodes' NUMA nodes
+p64_clhcohort_t *p64_clhcohort_alloc(uint32_t nnodes, uint32_t maxhandoff);
+
+//Free a cohort lock
+void p64_clhcohort_free(p64_clhcohort_t *lock);
+
+//Acquire a cohort lock, 'node' (0..nnodes-1) is the NUMA node of the thread
+void p64_clhcohort_acquire(p64_clhcohort_t *lock, uint32_t node);
+
+//Release a cohort lock, 'node' must be the same as when acquired
+void p64_clhcohort_release(p64_clhcohort_t *lock, uint32_t node);
+
 #ifdef __cplusplus
 }
 #endif
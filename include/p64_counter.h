@@ -0,0 +1,73 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Statistics counters with per-thread slots
+//Each thread updates counters in its own cache line(s) using relaxed loads
+//and stores, no atomic read-modify-write operations are used and writers do
+//not share cache lines, reading a counter sums the slots of all threads
+//A thread is assigned a slot index when it registers (or on its first
+//update), the index is recycled when the thread unregisters and the values
+//in the slot are kept, at most MAXTHREADS (128) registered threads at a time
+
+#ifndef _P64_COUNTER_H
+#define _P64_COUNTER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct p64_counter p64_counter_t;
+
+//Register the calling thread, assigning it a slot index
+//p64_counter_add() and p64_counter_add_vec() will register the calling
+//thread if necessary
+void
+p64_counter_register(void);
+
+//Unregister the calling thread, its slot index may be reused by another
+//thread which continues to add to the same slots
+//Must be called before a thread which has updated counters exits for its
+//slot index to be reused
+void
+p64_counter_unregister(void);
+
+//Allocate a set of 'ncounters' counters, all counters are zero
+//Return NULL if memory allocation fails
+p64_counter_t *
+p64_counter_alloc(uint32_t ncounters);
+
+//Free a set of counters
+void
+p64_counter_free(p64_counter_t *cnt);
+
+//Add 'val' to counter 'idx'
+void
+p64_counter_add(p64_counter_t *cnt, uint32_t idx, uint64_t val);
+
+//Add vals[i] to counter 'first' + i for all i < 'num'
+//Writer-side batching, e.g. packet and byte counters updated by one call
+void
+p64_counter_add_vec(p64_counter_t *cnt,
+		    uint32_t first,
+		    const uint64_t vals[],
+		    uint32_t num);
+
+//Return value of counter 'idx', the sum over all threads
+//Concurrent updates may or may not be included
+uint64_t
+p64_counter_read(p64_counter_t *cnt, uint32_t idx);
+
+//Reset counter 'idx' to zero
+//Concurrent updates may or may not be included in the value being reset
+void
+p64_counter_reset(p64_counter_t *cnt, uint32_t idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,79 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Bucketized cuckoo hash table
+//Each element can be stored in one of two buckets, each bucket fits in one
+//cache line and stores the element pointers together with their hash values
+//so a lookup reads at most two cache lines before comparing keys
+//Lookups, insertions into a non-full bucket and removals are lock-free,
+//displacing elements to make room for an insertion is serialised by a lock
+//The table is not resized, insertion fails when no room can be made
+
+#ifndef _P64_CUCKOOHT_H
+#define _P64_CUCKOOHT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "p64_hashtable.h"
+#include "p64_hazardptr.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct p64_cuckooht p64_cuckooht_t;
+
+//Elements are opaque to the cuckoo hash table and need no embedded field
+//but must be at least 4-byte aligned (the two least significant bits of
+//element pointers are used as marks)
+typedef int (*p64_cuckooht_compare)(const void *elem, const void *key);
+
+//Allocate a cuckoo hash table with space for at least 'nelems' elements
+p64_cuckooht_t *p64_cuckooht_alloc(uint32_t nelems);
+
+//Free a cuckoo hash table
+//The hash table must be empty
+void p64_cuckooht_free(p64_cuckooht_t *ht);
+
+//Look up the element matching 'key'
+//Return NULL if element not found
+void *p64_cuckooht_lookup(p64_cuckooht_t *ht,
+			  p64_cuckooht_compare cf,
+			  const void *key,
+			  p64_hashvalue_t hash,
+			  p64_hazardptr_t *hp);
+
+#ifndef NDEBUG
+#define p64_cuckooht_lookup(_a, _b, _c, _d, _e) \
+({ \
+     p64_hazardptr_t *_f = (_e); \
+     void *_g = p64_cuckooht_lookup((_a), (_b), (_c), (_d), _f); \
+     if (*(_f) != P64_HAZARDPTR_NULL) \
+	 p64_hazptr_annotate(*(_f), __FILE__, __LINE__); \
+     _g; \
+})
+#endif
+
+//Insert an element into the hash table
+//Return false if the element could not be inserted, the table is too full
+bool p64_cuckooht_insert(p64_cuckooht_t *ht,
+			 void *elem,
+			 p64_hashvalue_t hash);
+
+//Remove specified element
+//Return false if removal fails, element not found
+//The caller must retire the element, e.g. using p64_hazptr_retire()
+bool p64_cuckooht_remove(p64_cuckooht_t *ht,
+			 void *elem,
+			 p64_hashvalue_t hash);
+
+//Number of element slots in each cuckoo bucket
+#define P64_CUCKOOHT_BKTSIZE 3
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
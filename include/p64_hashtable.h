@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "p64_alloc.h"
 #include "p64_hazardptr.h"
 
 #ifdef __cplusplus
@@ -29,12 +30,26 @@ typedef struct p64_hashelem
 
 typedef struct p64_hashtable p64_hashtable_t;
 
+//Safe memory reclamation uses hazard pointers by default
+//If built with USE_HASHTABLE_QSBR, QSBR (p64_qsbr.h) is used instead, returned
+//hazard pointers are always P64_HAZARDPTR_NULL, threads must periodically call
+//p64_qsbr_quiescent() when not referencing any elements and removed elements
+//must be retired using p64_qsbr_retire()
+
 typedef int (*p64_hashtable_compare)(const p64_hashelem_t *,
 				     const void *key);
 
 //Allocate a hash table with space for at least 'nelems' elements
 p64_hashtable_t *p64_hashtable_alloc(uint32_t nelems);
 
+//As p64_hashtable_alloc()
+//Memory is allocated on NUMA node 'numanode' (or P64_ALLOC_ANYNODE) using
+//P64_ALLOC_F_* 'allocflags', see p64_alloc.h
+//Tables allocated when the hash table is resized use the same placement
+p64_hashtable_t *p64_hashtable_alloc_ex(uint32_t nelems,
+					int32_t numanode,
+					uint32_t allocflags);
+
 //Free a hash table
 //The hash table must be empty
 void p64_hashtable_free(p64_hashtable_t *);
@@ -56,6 +71,25 @@ p64_hashelem_t *p64_hashtable_lookup(p64_hashtable_t *ht,
 })
 #endif
 
+//Look up multiple keys in the hash table
+//Buckets and elements are prefetched for all keys before they are searched
+//results[i] is set to the element matching keys[i] or NULL if not found
+//If 'hps' is not NULL, hps[i] holds the reference to results[i], release
+//each with p64_hazptr_release_ro()
+//With 'hps', 'num' plus two (used during the lookup) must not exceed the
+//number of free hazard pointers, i.e. at most p64_hazptr_maxrefs() - 2 keys
+//when the thread holds no other references
+//If 'hps' is NULL, no references are kept and the caller must ensure that
+//found elements are not reclaimed concurrently
+//Return number of elements found
+uint32_t p64_hashtable_lookup_vec(p64_hashtable_t *ht,
+				  p64_hashtable_compare cf,
+				  const void *keys[],
+				  const p64_hashvalue_t hashes[],
+				  uint32_t num,
+				  p64_hashelem_t *results[],
+				  p64_hazardptr_t hps[]);
+
 //Insert an element into the hash table
 void p64_hashtable_insert(p64_hashtable_t *ht,
 			  p64_hashelem_t *he,
@@ -86,11 +120,100 @@ p64_hashelem_t *p64_hashtable_remove_by_key(p64_hashtable_t *ht,
 })
 #endif
 
+//Resize the hash table to have space for at least 'nelems' elements
+//Elements are migrated incrementally to the new table, other threads which
+//access the hash table will help with the migration
+//Lookups and insertions are not blocked, removal of an element may have
+//to wait for the element's bucket to be migrated
+//Return false if allocation fails or a resize is already in progress
+bool p64_hashtable_resize(p64_hashtable_t *ht, uint32_t nelems);
+
+//Callback invoked for each element by the traversal functions
+//Return true to remove the element from the hash table
+typedef bool (*p64_hashtable_trav_cb)(void *arg,
+				      p64_hashelem_t *he,
+				      p64_hashvalue_t hash);
+
+//Traverse the hash table, invoking the callback for every element
+//Elements are protected by hazard pointers while the callback is invoked,
+//the callback may access the element but must not keep any reference to it
+//Elements for which the callback returns true are removed in place and then
+//retired using 'reclaim' (p64_hazptr_retire() or p64_qsbr_retire()), if
+//'reclaim' is NULL the caller must reclaim removed elements itself
+//Concurrent insertions, removals and resizing may cause elements to be
+//missed or passed to the callback more than once
+//Return number of callback invocations
+uint32_t p64_hashtable_traverse(p64_hashtable_t *ht,
+				p64_hashtable_trav_cb cb,
+				void *arg,
+				void (*reclaim)(void *));
+
+//Traverse buckets [first, last) of the current table
+//Use p64_hashtable_nbuckets() to partition the table so that multiple threads
+//can traverse it in parallel, 'last' is limited to the number of buckets
+uint32_t p64_hashtable_traverse_range(p64_hashtable_t *ht,
+				      uint32_t first,
+				      uint32_t last,
+				      p64_hashtable_trav_cb cb,
+				      void *arg,
+				      void (*reclaim)(void *));
+
+//Resumable traversal, traverse the next 'nbkts' buckets from '*cursor' and
+//update '*cursor', initialize '*cursor' to 0 to start from the beginning
+//Return false and reset '*cursor' when the end of the table has been reached
+bool p64_hashtable_traverse_next(p64_hashtable_t *ht,
+				 uint32_t *cursor,
+				 uint32_t nbkts,
+				 p64_hashtable_trav_cb cb,
+				 void *arg,
+				 void (*reclaim)(void *));
+
+//Return number of buckets in the current table
+uint32_t p64_hashtable_nbuckets(p64_hashtable_t *ht);
+
+//Number of element slots in each hash bucket
+#define P64_HASHTABLE_BKTSIZE 4
+
+typedef struct p64_hashtable_stats
+{
+    uint64_t nelems;//Number of elements in hash table
+    uint64_t ncasfail;//Number of failed CAS operations (contention)
+    uint32_t nresizes;//Number of resizes
+    uint32_t nbkts;//Number of buckets in current table
+    uint32_t maxchain;//Longest list of elements in current table
+    //fill[i] is number of buckets with 'i' used slots
+    uint32_t fill[P64_HASHTABLE_BKTSIZE + 1];
+} p64_hashtable_stats_t;
+
+//Return statistics for the hash table
+//Element and CAS failure counters are kept per thread group and are summed
+//when read, the current table is traversed to find the longest list and the
+//bucket fill histogram
+//Concurrent updates may make the statistics inaccurate
+void p64_hashtable_stats(p64_hashtable_t *ht,
+			 p64_hashtable_stats_t *st);
+
 //Traverse hash table, printing information and invoking callback function
 uint32_t
 p64_hashtable_check(p64_hashtable_t *ht,
 		    uint64_t (*f)(p64_hashelem_t *));
 
+//Special functions used by templates
+//Return the list heads of the bucket for 'hash' in the current table, the
+//table is protected by '*hptbl', the resize count is returned in '*nresizes'
+//Return NULL if a resize is in progress
+p64_hashelem_t *
+p64_hashtable_bucket_(p64_hashtable_t *ht,
+		      p64_hashvalue_t hash,
+		      p64_hazardptr_t *hptbl,
+		      uint32_t *nresizes);
+
+//Return true if no resize has started since p64_hashtable_bucket_()
+//returned 'nresizes', a failed search of the bucket is then conclusive
+bool
+p64_hashtable_unchanged_(p64_hashtable_t *ht,
+			 uint32_t nresizes);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,175 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#ifndef _P64_HASHTABLE_TEMPLATE_H
+#define _P64_HASHTABLE_TEMPLATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "p64_hashtable.h"
+
+#ifndef P64_CONCAT
+#define P64_CONCAT(x, y) x ## y
+#endif
+
+#ifdef __clang__
+#define P64_HASHTABLE_UNROLL_ __attribute__((opencl_unroll_hint(4)))
+#elif defined __GNUC__
+#define P64_HASHTABLE_UNROLL_ __attribute__((optimize("unroll-loops")))
+#else
+#define P64_HASHTABLE_UNROLL_
+#endif
+
+//USE_HASHTABLE_QSBR must be defined the same way as when building the library
+#ifdef USE_HASHTABLE_QSBR
+#define P64_HASHTABLE_ACQUIRE_(pptr, hpp) \
+({ \
+     *(hpp) = P64_HAZARDPTR_NULL; \
+     __atomic_load_n((pptr), __ATOMIC_ACQUIRE); \
+})
+#define P64_HASHTABLE_RELEASE_(hpp) (void)(hpp)
+#else
+#define P64_HASHTABLE_ACQUIRE_(pptr, hpp) \
+    p64_hazptr_acquire((void **)(pptr), (hpp))
+#define P64_HASHTABLE_RELEASE_(hpp) p64_hazptr_release_ro((hpp))
+#endif
+
+//Element pointers may carry REMOVE (1) and FROZEN (2) marks
+#define P64_HASHTABLE_MARKS_ ((uintptr_t)3)
+
+//Generate hash table functions for keys of type '_keytype'
+//'_hashfn' has the signature p64_hashvalue_t (*)(const _keytype *key)
+//'_eqfn' has the signature bool (*)(const p64_hashelem_t *he, const _keytype *key)
+//Both should be static inline functions, they are then inlined into the
+//generated functions so that e.g. fixed size keys can be compared using a
+//few (SIMD) instructions instead of calling a compare function
+//Lookups search the bucket slots and the element list inline, only while
+//the table is being resized are p64_hashtable_lookup() and the compare
+//function called
+//Removal by key looks up the element inline and then removes that element
+#define P64_HASHTABLE(_name, _keytype, _hashfn, _eqfn) \
+static inline p64_hashvalue_t \
+P64_CONCAT(_name,_hash)(const _keytype *key) \
+{ \
+    return _hashfn(key); \
+} \
+\
+static int \
+P64_CONCAT(_name,_compare_)(const p64_hashelem_t *he, const void *key) \
+{ \
+    return _eqfn(he, (const _keytype *)key) ? 0 : 1; \
+} \
+\
+P64_HASHTABLE_UNROLL_ \
+static inline p64_hashelem_t * \
+P64_CONCAT(_name,_bucket_lookup_)(p64_hashelem_t *bkt, const _keytype *key, p64_hashvalue_t hash, p64_hazardptr_t *hp) \
+{ \
+    for (uint32_t i = 0; i < P64_HASHTABLE_BKTSIZE; i++) \
+    { \
+	if (__atomic_load_n(&bkt[i].hash, __ATOMIC_RELAXED) == hash) \
+	{ \
+	    p64_hashelem_t *he = (p64_hashelem_t *)P64_HASHTABLE_ACQUIRE_(&bkt[i].next, hp); \
+	    /* Head element pointers may be frozen by migration */ \
+	    he = (p64_hashelem_t *)((uintptr_t)he & ~P64_HASHTABLE_MARKS_); \
+	    if (he != NULL && _eqfn(he, key)) \
+	    { \
+		return he; \
+	    } \
+	} \
+    } \
+    return NULL; \
+} \
+\
+static inline p64_hashelem_t * \
+P64_CONCAT(_name,_list_lookup_)(p64_hashelem_t *org, const _keytype *key, p64_hazardptr_t *hp) \
+{ \
+    p64_hazardptr_t hpprnt = P64_HAZARDPTR_NULL; \
+    p64_hashelem_t *prnt = org; \
+    for (;;) \
+    { \
+	p64_hashelem_t *cur = (p64_hashelem_t *)P64_HASHTABLE_ACQUIRE_(&prnt->next, hp); \
+	if ((uintptr_t)cur & 1) \
+	{ \
+	    /* Parent marked for removal, restart from beginning */ \
+	    prnt = org; \
+	    continue; \
+	} \
+	cur = (p64_hashelem_t *)((uintptr_t)cur & ~P64_HASHTABLE_MARKS_); \
+	if (cur == NULL || _eqfn(cur, key)) \
+	{ \
+	    P64_HASHTABLE_RELEASE_(&hpprnt); \
+	    return cur; \
+	} \
+	prnt = cur; \
+	p64_hazardptr_t tmp = hpprnt; \
+	hpprnt = *hp; \
+	*hp = tmp; \
+    } \
+} \
+\
+static inline p64_hashelem_t * \
+P64_CONCAT(_name,_lookup_)(p64_hashtable_t *ht, const _keytype *key, p64_hashvalue_t hash, p64_hazardptr_t *hp) \
+{ \
+    p64_hazardptr_t hptbl = P64_HAZARDPTR_NULL; \
+    uint32_t nresizes; \
+    p64_hashelem_t *bkt = p64_hashtable_bucket_(ht, hash, &hptbl, &nresizes); \
+    *hp = P64_HAZARDPTR_NULL; \
+    if (bkt != NULL) \
+    { \
+	p64_hashelem_t *he = P64_CONCAT(_name,_bucket_lookup_)(bkt, key, hash, hp); \
+	if (he == NULL) \
+	{ \
+	    he = P64_CONCAT(_name,_list_lookup_)(&bkt[hash % P64_HASHTABLE_BKTSIZE], key, hp); \
+	} \
+	if (he != NULL || p64_hashtable_unchanged_(ht, nresizes)) \
+	{ \
+	    if (he == NULL) \
+	    { \
+		P64_HASHTABLE_RELEASE_(hp); \
+	    } \
+	    P64_HASHTABLE_RELEASE_(&hptbl); \
+	    return he; \
+	} \
+	P64_HASHTABLE_RELEASE_(hp); \
+	P64_HASHTABLE_RELEASE_(&hptbl); \
+    } \
+    /* Resize in progress, search all tables */ \
+    return p64_hashtable_lookup(ht, P64_CONCAT(_name,_compare_), key, hash, hp); \
+} \
+\
+static inline p64_hashelem_t * \
+P64_CONCAT(_name,_lookup)(p64_hashtable_t *ht, const _keytype *key, p64_hazardptr_t *hp) \
+{ \
+    return P64_CONCAT(_name,_lookup_)(ht, key, _hashfn(key), hp); \
+} \
+\
+static inline void \
+P64_CONCAT(_name,_insert)(p64_hashtable_t *ht, p64_hashelem_t *he, const _keytype *key) \
+{ \
+    p64_hashtable_insert(ht, he, _hashfn(key)); \
+} \
+\
+static inline bool \
+P64_CONCAT(_name,_remove)(p64_hashtable_t *ht, p64_hashelem_t *he, const _keytype *key) \
+{ \
+    return p64_hashtable_remove(ht, he, _hashfn(key)); \
+} \
+\
+static inline p64_hashelem_t * \
+P64_CONCAT(_name,_remove_by_key)(p64_hashtable_t *ht, const _keytype *key, p64_hazardptr_t *hp) \
+{ \
+    p64_hashvalue_t hash = _hashfn(key); \
+    for (;;) \
+    { \
+	p64_hashelem_t *he = P64_CONCAT(_name,_lookup_)(ht, key, hash, hp); \
+	if (he == NULL || p64_hashtable_remove(ht, he, hash)) \
+	{ \
+	    return he; \
+	} \
+	/* Element removed by other thread, look for any other match */ \
+	P64_HASHTABLE_RELEASE_(hp); \
+    } \
+}
+
+#endif
@@ -7,6 +7,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #ifdef __cplusplus
@@ -17,6 +18,17 @@ extern "C"
 typedef void **p64_hazardptr_t;
 #define P64_HAZARDPTR_NULL NULL
 
+//Register the calling thread
+//Hazard areas are allocated at run-time or recycled from unregistered threads
+//p64_hazptr_acquire() and p64_hazptr_retire() will register the calling thread
+//if necessary
+void p64_hazptr_register(void);
+
+//Unregister the calling thread
+//All hazard pointers must have been released
+//Objects which are still referenced are handed over to the remaining threads
+void p64_hazptr_unregister(void);
+
 //Return maximum number of references per thread
 uint32_t p64_hazptr_maxrefs(void);
 
@@ -25,6 +37,8 @@ uint32_t p64_hazptr_maxrefs(void);
 //Re-use the specified hazard pointer (if *hp != P64_HAZARDPTR_NULL)
 //Write any allocated hazard pointer to *hp
 //Note that a hazard pointer may have been allocated even if NULL is returned
+//The two least significant bits of '*pptr' may be used as marks, the object
+//pointed to is protected regardless of any marks
 //p64_hazptr_acquire() has acquire memory ordering
 void *p64_hazptr_acquire(void **pptr, p64_hazardptr_t *hp);
 #ifndef NDEBUG
@@ -58,6 +72,11 @@ void p64_hazptr_release_ro(p64_hazardptr_t *hp);
 //Call 'callback' when object is no longer referenced and can be destroyed
 void p64_hazptr_retire(void *ptr, void (*callback)(void *ptr));
 
+//Retire multiple removed objects which use the same call-back
+void p64_hazptr_retire_vec(void *ptrs[],
+			   uint32_t num,
+			   void (*callback)(void *ptr));
+
 //Force garbage reclamation
 bool p64_hazptr_reclaim(void);
 
@@ -9,7 +9,9 @@
 //Lax means 'inexact' behaviour, i.e. retiring holes (empty ROB slots) is
 //supported and any stragglers will be retired out-of-order
 
+#include <stddef.h>
 #include <stdint.h>
+#include "p64_alloc.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -36,6 +38,40 @@ p64_laxrob_t *p64_laxrob_alloc(uint32_t nslots,
 			       p64_laxrob_cb cb,
 			       void *arg);
 
+//As p64_laxrob_alloc()
+//Memory is allocated on NUMA node 'numanode' (or P64_ALLOC_ANYNODE) using
+//P64_ALLOC_F_* 'allocflags', see p64_alloc.h
+p64_laxrob_t *p64_laxrob_alloc_ex(uint32_t nslots,
+				  uint32_t vecsz,
+				  p64_laxrob_cb cb,
+				  void *arg,
+				  int32_t numanode,
+				  uint32_t allocflags);
+
+//Allocate a reorder buffer with time-based retirement
+//The time (tick) of the ROB is advanced by p64_laxrob_tick(), elements are
+//stamped with the current tick when inserted
+//Elements which have been held for 'maxhold' ticks are retired together
+//with any preceding holes, this bounds latency also under low load
+p64_laxrob_t *p64_laxrob_alloc_timeout(uint32_t nslots,
+				       uint32_t vecsz,
+				       uint32_t maxhold,
+				       p64_laxrob_cb cb,
+				       void *arg);
+
+//Allocate a reorder buffer for user defined elements
+//'next_off' is the offset of the next pointer (a pointer to the same type of
+//element) and 'sn_off' is the offset of the 32-bit sequence number, e.g.
+//offsetof(struct mydesc, next) and offsetof(struct mydesc, sn)
+//Elements are cast to and from p64_laxrob_elem_t when passed to insert and
+//by the callback, other fields of p64_laxrob_elem_t are not accessed
+p64_laxrob_t *p64_laxrob_alloc_layout(uint32_t nslots,
+				      uint32_t vecsz,
+				      size_t next_off,
+				      size_t sn_off,
+				      p64_laxrob_cb cb,
+				      void *arg);
+
 //Free a reorder buffer
 //The reorder buffer must be empty
 void p64_laxrob_free(p64_laxrob_t *rb);
@@ -49,6 +85,14 @@ void p64_laxrob_insert(p64_laxrob_t *rb,
 void p64_laxrob_flush(p64_laxrob_t *rb,
 		      uint32_t nslots);
 
+//Advance the time of a reorder buffer with time-based retirement to 'now'
+//Retire elements held for at least 'maxhold' ticks together with all
+//preceding slots (holes and younger elements)
+//'now' may be e.g. p64_timer time or a caller maintained tick
+//Time comparison performed using "serial number arithmetic"
+void p64_laxrob_tick(p64_laxrob_t *rb,
+		     uint32_t now);
+
 #ifdef __cplusplus
 }
 #endif
@@ -8,12 +8,16 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include "p64_alloc.h"
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+#define P64_LFRING_F_WAITDEQ    0x0001 //Consumers may block waiting
+#define P64_LFRING_F_STRICTFIFO 0x0002 //Preserve FIFO order
+
 typedef struct p64_lfring p64_lfring_t;
 
 //Allocate a ring buffer with space for at least 'nelems' elements
@@ -21,11 +25,41 @@ typedef struct p64_lfring p64_lfring_t;
 p64_lfring_t *
 p64_lfring_alloc(uint32_t nelems);
 
+//As p64_lfring_alloc() with P64_LFRING_F_* 'flags'
+//With P64_LFRING_F_STRICTFIFO, ring slots carry sequence numbers and
+//elements are dequeued in the order they were enqueued, a thread which is
+//preempted after claiming slots will delay dequeue of later elements
+//Memory is allocated on NUMA node 'numanode' (or P64_ALLOC_ANYNODE) using
+//P64_ALLOC_F_* 'allocflags', see p64_alloc.h
+p64_lfring_t *
+p64_lfring_alloc_ex(uint32_t nelems,
+		    uint32_t flags,
+		    int32_t numanode,
+		    uint32_t allocflags);
+
 //Free a ring buffer
 //The ring buffer must be empty
 void
 p64_lfring_free(p64_lfring_t *lfr);
 
+//Return size of memory needed for a ring buffer with 'nelems' elements
+size_t
+p64_lfring_size(uint32_t nelems, uint32_t flags);
+
+//Construct a ring buffer in caller-supplied memory, e.g. shared memory
+//'mem' must be cache line aligned and 'size' >= p64_lfring_size()
+//The ring buffer is position independent and can be used by multiple
+//processes which map the memory at different addresses, the elements
+//themselves must be meaningful to all processes
+//The ring buffer must not be freed using p64_lfring_free()
+p64_lfring_t *
+p64_lfring_init(void *mem, size_t size, uint32_t nelems, uint32_t flags);
+
+//Attach to a ring buffer constructed by p64_lfring_init(), e.g. in another
+//process
+p64_lfring_t *
+p64_lfring_attach(void *mem);
+
 //Enqueue elements on a ring buffer
 //The number of actually enqueued elements is returned
 uint32_t
@@ -40,6 +74,47 @@ p64_lfring_dequeue(p64_lfring_t *lfr,
 		   void *elems[],
 		   uint32_t nelems);
 
+//Dequeue elements from a ring buffer, wait if ring buffer is empty
+//Consumers spin adaptively and then sleep, producers wake sleeping consumers
+//Wait at most 'timeout' nanoseconds, ~0 waits forever
+//The ring buffer must have been allocated with P64_LFRING_F_WAITDEQ
+//The number of actually dequeued elements is returned
+uint32_t
+p64_lfring_dequeue_wait(p64_lfring_t *lfr,
+			void *elems[],
+			uint32_t nelems,
+			uint64_t timeout);
+
+//Unbounded lock-free queue built from linked fixed-size ring segments
+//Segments are allocated when the queue grows and retired using hazard
+//pointers when drained, memory use follows the number of queued elements
+//Elements must not be NULL
+typedef struct p64_lfring_seg p64_lfring_seg_t;
+
+//Allocate an unbounded ring with 'segsize' elements per segment
+//'segsize' != 0
+p64_lfring_seg_t *
+p64_lfring_seg_alloc(uint32_t segsize);
+
+//Free an unbounded ring
+//The ring must be empty
+void
+p64_lfring_seg_free(p64_lfring_seg_t *lfs);
+
+//Enqueue elements on an unbounded ring
+//All elements are enqueued
+void
+p64_lfring_seg_enqueue(p64_lfring_seg_t *lfs,
+		       void *const elems[],
+		       uint32_t nelems);
+
+//Dequeue elements from an unbounded ring
+//The number of actually dequeued elements is returned
+uint32_t
+p64_lfring_seg_dequeue(p64_lfring_seg_t *lfs,
+		       void *elems[],
+		       uint32_t nelems);
+
 #ifdef __cplusplus
 }
 #endif
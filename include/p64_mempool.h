@@ -0,0 +1,53 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Pool of fixed size objects
+//Each thread caches two magazines of free objects per pool, full magazines
+//are exchanged with a lock-free global depot so most allocations and frees
+//do not touch shared cache lines
+
+#ifndef _P64_MEMPOOL_H
+#define _P64_MEMPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "p64_alloc.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct p64_mempool p64_mempool_t;
+
+//Allocate a pool of 'nobjs' objects of 'objsize' bytes each
+//Objects are aligned to 'align' (a power of two)
+//Memory is allocated on NUMA node 'numanode' (or P64_ALLOC_ANYNODE) using
+//p64_malloc(), see p64_alloc.h
+p64_mempool_t *p64_mempool_alloc(uint32_t nobjs,
+				 size_t objsize,
+				 size_t align,
+				 int32_t numanode);
+
+//Free a pool
+//Objects cached by other threads are discarded
+void p64_mempool_free(p64_mempool_t *mp);
+
+//Get an object from the pool
+//Return NULL if the pool is empty
+//Objects cached by other threads are not available
+void *p64_mempool_get(p64_mempool_t *mp);
+
+//Return an object to the pool
+void p64_mempool_put(p64_mempool_t *mp, void *obj);
+
+//Return objects cached by the calling thread to the pool
+//Call before the thread exits or when it stops using the pool
+void p64_mempool_flush(p64_mempool_t *mp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
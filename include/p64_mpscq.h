@@ -0,0 +1,58 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Intrusive unbounded multi-producer single-consumer queue (Vyukov)
+//Producers enqueue using one atomic exchange and one store and are wait-free,
+//there is no capacity to size ahead of time
+//The consumer dequeues one element or the whole queue as a batch, it may
+//have to wait for a producer which is in the middle of linking its element
+
+#ifndef _P64_MPSCQ_H
+#define _P64_MPSCQ_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//Each element in the queue must include a p64_mpscq_elem field
+typedef struct p64_mpscq_elem
+{
+    struct p64_mpscq_elem *next;//Linked list next pointer
+} p64_mpscq_elem_t;
+
+typedef struct p64_mpscq p64_mpscq_t;
+
+//Allocate an empty queue
+//Return NULL if memory allocation fails
+p64_mpscq_t *
+p64_mpscq_alloc(void);
+
+//Free a queue
+//The queue must be empty
+void
+p64_mpscq_free(p64_mpscq_t *q);
+
+//Enqueue an element (any thread)
+void
+p64_mpscq_enqueue(p64_mpscq_t *q, p64_mpscq_elem_t *elem);
+
+//Dequeue the least recently enqueued element (consumer only)
+//Return NULL if the queue is empty
+p64_mpscq_elem_t *
+p64_mpscq_dequeue(p64_mpscq_t *q);
+
+//Dequeue all elements (consumer only)
+//Return a NULL-terminated list (linked by 'next') in FIFO order, or NULL if
+//the queue is empty
+p64_mpscq_elem_t *
+p64_mpscq_dequeue_all(p64_mpscq_t *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,91 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Message ring buffer for variable size messages
+//Messages are stored contiguously in the ring with a length prefix and
+//can be written and read in place
+
+#ifndef _P64_MSGRING_H
+#define _P64_MSGRING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define P64_MSGRING_F_MPENQ 0x0000 //Multi producer
+#define P64_MSGRING_F_SPENQ 0x0001 //Single producer
+
+typedef struct p64_msgring p64_msgring_t;
+
+typedef struct p64_msgring_result
+{
+    uint32_t actual;//Number of messages
+    uint32_t index;//Start of reserved space
+    uint32_t size;//Size of reserved space
+} p64_msgring_result_t;
+
+//Allocate a message ring with space for at least 'nbytes' bytes
+//Each message uses 8 bytes of overhead and is padded to a multiple of 8 bytes
+//The maximum message length is half the ring size minus 8 bytes, messages
+//are never split so larger messages might not fit even in an empty ring
+//'nbytes' != 0 and 'nbytes' <= 0x80000000
+p64_msgring_t *
+p64_msgring_alloc(uint32_t nbytes, uint32_t flags);
+
+//Free a message ring
+//The message ring must be empty
+void
+p64_msgring_free(p64_msgring_t *mr);
+
+//Reserve contiguous space for 'num' messages of lengths 'lens[]'
+//Either all messages or no messages are reserved
+//Messages longer than the maximum message length are never reserved
+//Pointers to the message payloads are returned in 'msgs[]'
+//Write the messages and then publish them to the consumer using
+//p64_msgring_enqueue_commit()
+//The number of reserved messages is returned
+uint32_t
+p64_msgring_enqueue_reserve(p64_msgring_t *mr,
+			    const uint32_t lens[],
+			    uint32_t num,
+			    void *msgs[],
+			    p64_msgring_result_t *res);
+
+//Publish all messages reserved by p64_msgring_enqueue_reserve()
+void
+p64_msgring_enqueue_commit(p64_msgring_t *mr,
+			   const p64_msgring_result_t *res);
+
+//Copy a message of length 'len' into the ring
+//Return false if there is no space for the message
+bool
+p64_msgring_enqueue(p64_msgring_t *mr, const void *msg, uint32_t len);
+
+//Reserve up to 'num' messages for in-place dequeue
+//Pointers to the messages and their lengths are returned in 'msgs[]' and
+//'lens[]'
+//Read the messages and then release the space using
+//p64_msgring_dequeue_commit()
+//The number of reserved messages is returned
+uint32_t
+p64_msgring_dequeue_reserve(p64_msgring_t *mr,
+			    void *msgs[],
+			    uint32_t lens[],
+			    uint32_t num,
+			    p64_msgring_result_t *res);
+
+//Release the space of all messages reserved by p64_msgring_dequeue_reserve()
+void
+p64_msgring_dequeue_commit(p64_msgring_t *mr,
+			   const p64_msgring_result_t *res);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,62 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Ordered scheduler with per-flow ordering
+//Flows are hashed onto a number of independent reorder buffers, order is
+//maintained only for flows which map to the same reorder buffer so
+//contention is spread and a slow element for one flow does not block
+//flows mapped to other reorder buffers
+
+#ifndef _P64_ORDSCHED_H
+#define _P64_ORDSCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "p64_reorder.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct p64_ordsched p64_ordsched_t;
+
+//Allocate an ordered scheduler with 'nqueues' reorder buffers, each with
+//space for at least 'nelems' elements
+//In-order elements from all queues are passed to the (reorder) callback
+//which must be MT-safe as different queues may retire elements concurrently
+p64_ordsched_t *p64_ordsched_alloc(uint32_t nqueues,
+				   uint32_t nelems,
+				   p64_reorder_cb cb,
+				   void *arg);
+
+//Free an ordered scheduler
+//All reorder buffers must be empty
+void p64_ordsched_free(p64_ordsched_t *os);
+
+//Return the queue (0..nqueues-1) which a flow maps to
+uint32_t p64_ordsched_queue(const p64_ordsched_t *os, uint64_t flow);
+
+//Acquire (consecutive) space in the reorder buffer of flow 'flow'
+//Return amount of space actually acquired
+//Write the first acquired slot number to '*sn'
+uint32_t p64_ordsched_acquire(p64_ordsched_t *os,
+			      uint64_t flow,
+			      uint32_t nelems,
+			      uint32_t *sn);
+
+//Insert elements into the reorder buffer of flow 'flow' from the indicated
+//position, 'flow' and 'sn' must match a previous acquire
+//If possible release in-order elements and invoke the callback
+void p64_ordsched_release(p64_ordsched_t *os,
+			  uint64_t flow,
+			  uint32_t sn,
+			  void *elems[],
+			  uint32_t nelems);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
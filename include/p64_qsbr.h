@@ -0,0 +1,51 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Quiescent State Based Reclamation (QSBR)
+//Threads periodically announce quiescent states where they do not hold any
+//references to shared objects. A retired object can be reclaimed when all
+//registered threads have passed through a quiescent state after the object
+//was retired. Readers do not need any fences or atomic read-modify-write
+//operations.
+
+#ifndef _P64_QSBR_H
+#define _P64_QSBR_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//Register the calling thread
+//A thread must be registered before it accesses any shared objects
+//p64_qsbr_quiescent() and p64_qsbr_retire() will register the calling thread
+//if necessary
+void p64_qsbr_register(void);
+
+//Unregister the calling thread
+//The thread must not hold any references to shared objects
+//Wait for all objects retired by the thread to be reclaimed
+void p64_qsbr_unregister(void);
+
+//Announce a quiescent state
+//The calling thread does not hold any references to shared objects
+//p64_qsbr_quiescent() has release memory ordering
+void p64_qsbr_quiescent(void);
+
+//Retire a removed object
+//Call 'callback' when all registered threads have passed through a quiescent
+//state and the object can be destroyed
+void p64_qsbr_retire(void *ptr, void (*callback)(void *ptr));
+
+//Force garbage reclamation
+//Return true if any objects were reclaimed
+bool p64_qsbr_reclaim(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//RCU-style publication of read-mostly objects (e.g. configuration)
+//Writers publish a new version of an object by swapping the pointer, the
+//old version is retired and reclaimed when no longer referenced
+//With the default QSBR backend (p64_qsbr.h), readers dereference the
+//published pointer using a single load and no stores, they must be registered
+//with QSBR and periodically call p64_qsbr_quiescent() when not referencing
+//any object
+//With the hazard pointer backend (P64_RCU_F_HAZPTR), readers need not
+//announce quiescent states but acquire and release a hazard pointer
+
+#ifndef _P64_RCUPTR_H
+#define _P64_RCUPTR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "p64_hazardptr.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//Use hazard pointers instead of QSBR for safe memory reclamation
+#define P64_RCU_F_HAZPTR 0x0001
+
+typedef struct p64_rcu_ptr
+{
+    void *ptr;//Published object
+    uint32_t flags;
+} p64_rcu_ptr_t;
+
+//Initialise an RCU pointer to 'ptr' (may be NULL) using P64_RCU_F_* 'flags'
+void
+p64_rcu_init(p64_rcu_ptr_t *rp, void *ptr, uint32_t flags);
+
+//Return the published object (QSBR backend only)
+//The object may be accessed until the next quiescent state of the thread
+//Dependent loads are ordered after the load of the pointer
+static inline void *
+p64_rcu_deref(const p64_rcu_ptr_t *rp)
+{
+    return __atomic_load_n(&rp->ptr, __ATOMIC_ACQUIRE);
+}
+
+//Acquire a reference to the published object (hazard pointer backend only)
+//Return the object or NULL, release the reference using
+//p64_hazptr_release_ro()
+void *
+p64_rcu_acquire(p64_rcu_ptr_t *rp, p64_hazardptr_t *hp);
+
+#ifndef NDEBUG
+#define p64_rcu_acquire(_a, _b) \
+({ \
+     p64_hazardptr_t *_c = (_b); \
+     void *_d = p64_rcu_acquire((_a), _c); \
+     if (*(_c) != P64_HAZARDPTR_NULL) \
+	 p64_hazptr_annotate(*(_c), __FILE__, __LINE__); \
+     _d; \
+})
+#endif
+
+//Publish a new object, the object must be fully initialised
+//The previous object (if not NULL) is retired using 'reclaim' which is
+//called when the object is no longer referenced by any reader
+//If 'reclaim' is NULL, the caller must ensure that the previous object is
+//reclaimed safely
+void
+p64_rcu_assign(p64_rcu_ptr_t *rp, void *ptr, void (*reclaim)(void *));
+
+//Publish a new object if the published object is still 'old'
+//For concurrent writers which copy and update the published object
+//The previous object is retired as for p64_rcu_assign()
+//Return false if the published object has been replaced by another writer,
+//'ptr' is then not published
+bool
+p64_rcu_replace(p64_rcu_ptr_t *rp,
+		void *old,
+		void *ptr,
+		void (*reclaim)(void *));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
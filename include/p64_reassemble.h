@@ -5,13 +5,18 @@
 #ifndef _P64_REASSEMBLE_H
 #define _P64_REASSEMBLE_H
 
+#include <stdbool.h>
 #include <stdint.h>
+#include "p64_alloc.h"
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+//IPv6 fragments are supported by converting the fragment header to IPv4
+//format using p64_reassemble_fraginfo_ipv6(), the hash should then be
+//computed over <IPv6 src, IPv6 dst, 32-bit identification>
 typedef struct p64_fragment
 {
     struct p64_fragment *nextfrag;
@@ -21,10 +26,39 @@ typedef struct p64_fragment
     uint16_t len;//Length in bytes of IPv4 payload (host endian)
 } p64_fragment_t;
 
+//Convert the 'Fragment Offset' and 'M' flag fields of an IPv6 fragment header
+//(host endian) to IPv4 fragment info
+static inline uint16_t
+p64_reassemble_fraginfo_ipv6(uint16_t offlg)
+{
+    return (offlg >> 3) | ((offlg & 1) ? 0x2000 : 0);
+}
+
 typedef struct p64_reassemble p64_reassemble_t;
 
 typedef void (*p64_reassemble_cb)(void *arg, p64_fragment_t *frag);
 
+//Segment of a reassembled datagram
+//Use 'len' bytes of the fragment payload starting 'skip' bytes into it
+typedef struct p64_reassemble_seg
+{
+    p64_fragment_t *frag;
+    uint32_t offset;//Offset of segment in reassembled datagram
+    uint16_t skip;//Bytes to skip at beginning of fragment payload
+    uint16_t len;//Length of segment
+} p64_reassemble_seg_t;
+
+//Callback for complete datagrams in scatter-gather format
+//'frag' is the list of all fragments (sorted on offset), 'segs' is a list
+//of contiguous, non-overlapping segments in offset order, segments only
+//refer to fragments which contribute data (duplicates are excluded)
+//'segs' is only valid during the callback, the fragments are owned by the
+//user (e.g. free them by traversing 'frag')
+typedef void (*p64_reassemble_sg_cb)(void *arg,
+				     p64_fragment_t *frag,
+				     const p64_reassemble_seg_t segs[],
+				     uint32_t nsegs);
+
 //Allocate a fragment table of size 'nentries'
 //Specify callbacks for complete datagrams and stale fragment lists
 p64_reassemble_t *p64_reassemble_alloc(uint32_t nentries,
@@ -32,6 +66,60 @@ p64_reassemble_t *p64_reassemble_alloc(uint32_t nentries,
 				       p64_reassemble_cb stale_cb,
 				       void *arg);
 
+//Allocate a sharded fragment table with 'nshards' shards of 'nentries'
+//each, every shard is located in separate cache lines
+//Use p64_reassemble_shard() to find the shard a fragment maps to and steer
+//fragments to the thread (CPU) which owns that shard
+p64_reassemble_t *p64_reassemble_alloc_sharded(uint32_t nentries,
+					       uint32_t nshards,
+					       p64_reassemble_cb complete_cb,
+					       p64_reassemble_cb stale_cb,
+					       void *arg);
+
+//As p64_reassemble_alloc_sharded()
+//Memory is allocated on NUMA node 'numanode' (or P64_ALLOC_ANYNODE) using
+//P64_ALLOC_F_* 'allocflags', see p64_alloc.h
+p64_reassemble_t *p64_reassemble_alloc_ex(uint32_t nentries,
+					  uint32_t nshards,
+					  p64_reassemble_cb complete_cb,
+					  p64_reassemble_cb stale_cb,
+					  void *arg,
+					  int32_t numanode,
+					  uint32_t allocflags);
+
+//Return the shard (0..nshards-1) which a fragment hash maps to
+uint32_t p64_reassemble_shard(const p64_reassemble_t *re, uint64_t hash);
+
+//Limits on fragments buffered in a fragment table, 0 means no limit
+//Fragments of different datagrams may map to the same table entry (hash
+//bucket) in which case they share the per-entry limits
+typedef struct p64_reassemble_limits
+{
+    uint32_t maxfrags;//Max number of fragments per entry (datagram)
+    uint32_t maxbytes_bucket;//Max number of bytes buffered per entry
+    uint64_t maxbytes;//Max number of bytes buffered in the whole table
+} p64_reassemble_limits_t;
+
+//Set limits for a fragment table, call before any fragments are inserted
+//When a per-entry limit is exceeded, the datagrams in that entry with the
+//earliest arrival time are passed to the stale callback until the entry is
+//within limits
+//When the table limit is exceeded, the oldest fragment lists from a sample
+//of table entries are passed to the stale callback until the table is
+//within limits
+void p64_reassemble_set_limits(p64_reassemble_t *re,
+			       const p64_reassemble_limits_t *lim);
+
+//Max number of segments of a datagram passed to the scatter-gather callback
+#define P64_REASSEMBLE_SG_MAXSEGS 256
+
+//Pass complete datagrams as scatter-gather lists to 'complete_sg_cb' instead
+//of to the completion callback, call before any fragments are inserted
+//Datagrams with more than P64_REASSEMBLE_SG_MAXSEGS segments are passed to
+//the stale callback
+void p64_reassemble_set_complete_sg(p64_reassemble_t *re,
+				    p64_reassemble_sg_cb complete_sg_cb);
+
 //Free a fragment table
 //Pass any remaining fragments to the stale callback
 void p64_reassemble_free(p64_reassemble_t *re);
@@ -49,6 +137,20 @@ void p64_reassemble_insert(p64_reassemble_t *re,
 void p64_reassemble_expire(p64_reassemble_t *re,
 			   uint32_t time);
 
+//Expire all fragments in one shard that arrived earlier than 'time'
+void p64_reassemble_expire_shard(p64_reassemble_t *re,
+				 uint32_t shard,
+				 uint32_t time);
+
+//Incrementally expire fragments that arrived earlier than 'time'
+//Scan the next 'budget' table entries, continuing where the previous call
+//(by any thread) stopped and wrapping around at the end of the table
+//Return true if the scan reached the end of the table (completed a pass)
+//The cost per call is bounded by 'budget' regardless of table size
+bool p64_reassemble_expire_incr(p64_reassemble_t *re,
+				uint32_t time,
+				uint32_t budget);
+
 #ifdef __cplusplus
 }
 #endif
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "p64_alloc.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -21,12 +22,36 @@ typedef struct p64_reorder p64_reorder_t;
 //Called with NULL elem to conclude a sequence of calls with non-NULL elem
 typedef void (*p64_reorder_cb)(void *arg, void *elem, uint32_t sn);
 
+//Callback for in-order elements, 'vec' is an array (size 'n') of elements
+//Called once per consecutive sequence of retired elements (or per full
+//output vector), dummy elements are excluded
+typedef void (*p64_reorder_vec_cb)(void *arg, void *vec[], uint32_t n);
+
 //Allocate a reorder buffer with space for at least 'nelems' elements
 p64_reorder_t *p64_reorder_alloc(uint32_t nelems,
 				 bool user_acquire,
 				 p64_reorder_cb cb,
 				 void *arg);
 
+//As p64_reorder_alloc()
+//Memory is allocated on NUMA node 'numanode' (or P64_ALLOC_ANYNODE) using
+//P64_ALLOC_F_* 'allocflags', see p64_alloc.h
+p64_reorder_t *p64_reorder_alloc_ex(uint32_t nelems,
+				    bool user_acquire,
+				    p64_reorder_cb cb,
+				    void *arg,
+				    int32_t numanode,
+				    uint32_t allocflags);
+
+//Allocate a reorder buffer with space for at least 'nelems' elements
+//In-order elements are passed to the callback in vectors of up to 'vecsz'
+//elements
+p64_reorder_t *p64_reorder_alloc_vec(uint32_t nelems,
+				     uint32_t vecsz,
+				     bool user_acquire,
+				     p64_reorder_vec_cb cb,
+				     void *arg);
+
 //Free a reorder buffer
 //The reorder buffer must be empty
 void p64_reorder_free(p64_reorder_t *rob);
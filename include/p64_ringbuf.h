@@ -8,6 +8,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include "p64_alloc.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -19,6 +20,7 @@ extern "C"
 #define P64_RINGBUF_F_MCDEQ      0x0000 //Multi consumer
 #define P64_RINGBUF_F_SCDEQ      0x0002 //Single consumer
 #define P64_RINGBUF_F_LFDEQ      0x0004 //Lock-free multi consumer
+#define P64_RINGBUF_F_WAITDEQ    0x0008 //Consumers may block waiting
 
 typedef struct p64_ringbuf p64_ringbuf_t;
 
@@ -29,17 +31,57 @@ typedef struct p64_ringbuf_result
     uint32_t mask;
 } p64_ringbuf_result_t;
 
+//Reserved ring buffer slots for in-place enqueue or dequeue
+//Slots may wrap around the end of the ring and are then described by two
+//spans, the second span is empty (num[1] == 0) if there is no wrap-around
+typedef struct p64_ringbuf_span
+{
+    void **ev[2];//First slot of each span
+    uint32_t num[2];//Number of slots in each span
+    p64_ringbuf_result_t r;//Private
+} p64_ringbuf_span_t;
+
 //Allocate a ring buffer with space for at least 'nelems' elements
 //of size 'esize' each
 //'nelems' != 0 and 'nelems' <= 0x80000000
 p64_ringbuf_t *
 p64_ringbuf_alloc(uint32_t nelems, uint32_t flags, size_t esize);
 
+//As p64_ringbuf_alloc()
+//Memory is allocated on NUMA node 'numanode' (or P64_ALLOC_ANYNODE) using
+//P64_ALLOC_F_* 'allocflags', see p64_alloc.h
+p64_ringbuf_t *
+p64_ringbuf_alloc_ex(uint32_t nelems,
+		     uint32_t flags,
+		     size_t esize,
+		     int32_t numanode,
+		     uint32_t allocflags);
+
 //Free a ring buffer
 //The ring buffer must be empty
 void
 p64_ringbuf_free(p64_ringbuf_t *rb);
 
+//Return size of memory needed for a ring buffer with 'nelems' elements
+//of size 'esize' each
+size_t
+p64_ringbuf_size(uint32_t nelems, size_t esize);
+
+//Construct a ring buffer in caller-supplied memory, e.g. shared memory
+//'mem' must be cache line aligned and 'size' >= p64_ringbuf_size()
+//The ring buffer is position independent and can be used by multiple
+//processes which map the memory at different addresses, the elements
+//themselves must be meaningful to all processes
+//The ring buffer must not be freed using p64_ringbuf_free()
+p64_ringbuf_t *
+p64_ringbuf_init(void *mem, size_t size, uint32_t nelems, uint32_t flags,
+		 size_t esize);
+
+//Attach to a ring buffer constructed by p64_ringbuf_init(), e.g. in another
+//process
+p64_ringbuf_t *
+p64_ringbuf_attach(void *mem);
+
 //Enqueue elements on a ring buffer
 //The number of actually enqueued elements is returned
 uint32_t
@@ -51,6 +93,88 @@ uint32_t
 p64_ringbuf_dequeue(p64_ringbuf_t *rb, void *ev[], uint32_t num,
 		    uint32_t *index);
 
+//Enqueue at least 'min' and at most 'num' elements on a ring buffer
+//Either all of 'min' elements are enqueued or no elements are enqueued,
+//use 'min' == 'num' for all-or-nothing (bulk) semantics
+//The number of actually enqueued elements is returned
+uint32_t
+p64_ringbuf_enqueue_bulk(p64_ringbuf_t *rb, void *const ev[], uint32_t min,
+			 uint32_t num);
+
+//Dequeue at least 'min' and at most 'num' elements from a ring buffer
+//Either all of 'min' elements are dequeued or no elements are dequeued,
+//use 'min' == 'num' for all-or-nothing (bulk) semantics
+//The number of actually dequeued elements is returned
+uint32_t
+p64_ringbuf_dequeue_bulk(p64_ringbuf_t *rb, void *ev[], uint32_t min,
+			 uint32_t num, uint32_t *index);
+
+//Dequeue elements from a ring buffer, wait if ring buffer is empty
+//Consumers spin adaptively and then sleep, producers wake sleeping consumers
+//Wait at most 'timeout' nanoseconds, ~0 waits forever
+//The ring buffer must have been allocated with P64_RINGBUF_F_WAITDEQ
+//The number of actually dequeued elements is returned
+uint32_t
+p64_ringbuf_dequeue_wait(p64_ringbuf_t *rb, void *ev[], uint32_t num,
+			 uint32_t *index, uint64_t timeout);
+
+//Reserve up to 'num' empty slots for in-place enqueue
+//The number of actually reserved slots is returned
+//Write elements directly to the reserved slots and then publish them to
+//consumers using p64_ringbuf_enqueue_commit()
+uint32_t
+p64_ringbuf_enqueue_reserve(p64_ringbuf_t *rb, uint32_t num,
+			    p64_ringbuf_span_t *sp);
+
+//Publish all slots reserved by p64_ringbuf_enqueue_reserve()
+void
+p64_ringbuf_enqueue_commit(p64_ringbuf_t *rb, const p64_ringbuf_span_t *sp);
+
+//Reserve up to 'num' full slots for in-place dequeue
+//The number of actually reserved slots is returned
+//Read elements directly from the reserved slots and then return the slots to
+//producers using p64_ringbuf_dequeue_commit()
+uint32_t
+p64_ringbuf_dequeue_reserve(p64_ringbuf_t *rb, uint32_t num,
+			    p64_ringbuf_span_t *sp);
+
+//Return all slots reserved by p64_ringbuf_dequeue_reserve() to producers
+//With P64_RINGBUF_F_LFDEQ, the reservation is speculative and commit fails
+//(returns false) if the slots have been dequeued by another consumer, any
+//elements read must then be discarded and the dequeue restarted
+bool
+p64_ringbuf_dequeue_commit(p64_ringbuf_t *rb, const p64_ringbuf_span_t *sp);
+
+//Staged ring: a pipeline of 'nstages' stages sharing one ring buffer
+//Elements stay in their slots while passing through the stages in order,
+//stage 0 acquires empty slots and writes elements to them, stage k > 0
+//acquires slots released by stage k-1, slots released by the last stage
+//become empty slots for stage 0
+//Slots are released to the next stage in the order they were acquired
+typedef struct p64_stagering p64_stagering_t;
+
+//Allocate a staged ring with space for at least 'nelems' elements
+//'nelems' != 0 and 'nelems' <= 0x80000000, 2 <= 'nstages' <= 32
+//Bit k in 'single' set => stage k is used by a single thread (MT-unsafe)
+p64_stagering_t *
+p64_stagering_alloc(uint32_t nelems, uint32_t nstages, uint32_t single);
+
+//Free a staged ring
+//All stages must have released all slots
+void
+p64_stagering_free(p64_stagering_t *sr);
+
+//Reserve up to 'num' slots for in-place processing by stage 'stage'
+//The number of actually reserved slots is returned
+uint32_t
+p64_stagering_acquire(p64_stagering_t *sr, uint32_t stage, uint32_t num,
+		      p64_ringbuf_span_t *sp);
+
+//Release all slots reserved by p64_stagering_acquire() to the next stage
+void
+p64_stagering_release(p64_stagering_t *sr, uint32_t stage,
+		      const p64_ringbuf_span_t *sp);
+
 //Special functions used by templates
 void *
 p64_ringbuf_alloc_(uint32_t nelems, uint32_t flags, size_t esize);
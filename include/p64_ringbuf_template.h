@@ -26,6 +26,13 @@ typedef struct _name \
     _type ring[1]; /* Can't use flexible array member */ \
 } P64_CONCAT(_name,_t); \
 \
+typedef struct P64_CONCAT(_name,_span) \
+{ \
+    _type *ev[2]; \
+    uint32_t num[2]; \
+    p64_ringbuf_result_t r; \
+} P64_CONCAT(_name,_span_t); \
+\
 static inline P64_CONCAT(_name,_t) * \
 P64_CONCAT(_name,_alloc)(uint32_t nelems, uint32_t flags) \
 { \
@@ -74,6 +81,50 @@ P64_CONCAT(_name,_dequeue)(P64_CONCAT(_name,_t) *rb, _type ev[], uint32_t num, u
     } \
     while (!p64_ringbuf_release_(rb, r, false)); \
     return r.actual; \
+} \
+\
+static inline uint32_t \
+P64_CONCAT(_name,_make_spans)(P64_CONCAT(_name,_t) *rb, p64_ringbuf_result_t r, P64_CONCAT(_name,_span_t) *sp) \
+{ \
+    uint32_t idx = r.index & r.mask; \
+    uint32_t num0 = r.mask + 1 - idx < r.actual ? r.mask + 1 - idx : r.actual; \
+    sp->ev[0] = &rb->ring[idx]; \
+    sp->num[0] = num0; \
+    sp->ev[1] = &rb->ring[0]; \
+    sp->num[1] = r.actual - num0; \
+    sp->r = r; \
+    return r.actual; \
+} \
+\
+static inline uint32_t \
+P64_CONCAT(_name,_enqueue_reserve)(P64_CONCAT(_name,_t) *rb, uint32_t num, P64_CONCAT(_name,_span_t) *sp) \
+{ \
+    return P64_CONCAT(_name,_make_spans)(rb, p64_ringbuf_acquire_(rb, num, true), sp); \
+} \
+\
+static inline void \
+P64_CONCAT(_name,_enqueue_commit)(P64_CONCAT(_name,_t) *rb, const P64_CONCAT(_name,_span_t) *sp) \
+{ \
+    if (sp->r.actual != 0) \
+    { \
+	(void)p64_ringbuf_release_(rb, sp->r, true); \
+    } \
+} \
+\
+static inline uint32_t \
+P64_CONCAT(_name,_dequeue_reserve)(P64_CONCAT(_name,_t) *rb, uint32_t num, P64_CONCAT(_name,_span_t) *sp) \
+{ \
+    return P64_CONCAT(_name,_make_spans)(rb, p64_ringbuf_acquire_(rb, num, false), sp); \
+} \
+\
+static inline bool \
+P64_CONCAT(_name,_dequeue_commit)(P64_CONCAT(_name,_t) *rb, const P64_CONCAT(_name,_span_t) *sp) \
+{ \
+    if (sp->r.actual != 0) \
+    { \
+	return p64_ringbuf_release_(rb, sp->r, false); \
+    } \
+    return true; \
 }
 
 #endif
@@ -5,6 +5,7 @@
 #ifndef _P64_RWLOCK_H
 #define _P64_RWLOCK_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -12,6 +13,8 @@ extern "C"
 {
 #endif
 
+//Writer-preferring reader/writer lock
+//A writer excludes new readers as soon as it has set the writer flag
 typedef uint32_t p64_rwlock_t;
 
 //Initialise a read/write lock
@@ -21,6 +24,10 @@ void p64_rwlock_init(p64_rwlock_t *lock);
 //Block until no write is in progress
 void p64_rwlock_acquire_rd(p64_rwlock_t *lock);
 
+//Try to acquire a read lock
+//Return false if a write is in progress or pending
+bool p64_rwlock_try_acquire_rd(p64_rwlock_t *lock);
+
 //Release a read lock
 void p64_rwlock_release_rd(p64_rwlock_t *lock);
 
@@ -28,6 +35,17 @@ void p64_rwlock_release_rd(p64_rwlock_t *lock);
 //Block until earlier reads & writes have completed
 void p64_rwlock_acquire_wr(p64_rwlock_t *lock);
 
+//Try to acquire a write lock
+//Return false if any readers or writer are present
+bool p64_rwlock_try_acquire_wr(p64_rwlock_t *lock);
+
+//Upgrade a read lock to a write lock
+//Block until other reads have completed
+//Return false if another writer is pending, the caller still holds the read
+//lock and must release it (to let the other writer proceed) before
+//acquiring the write lock
+bool p64_rwlock_upgrade(p64_rwlock_t *lock);
+
 //Release a write lock
 void p64_rwlock_release_wr(p64_rwlock_t *lock);
 
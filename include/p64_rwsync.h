@@ -50,6 +50,28 @@ void p64_rwsync_write(p64_rwsync_t *sync,
 		      void *data,
 		      size_t len);
 
+//Double buffered variants, 'data' points to two buffers of 'len' bytes each
+//Readers read the stable buffer while a write updates the other buffer
+//so readers do not wait for a write in progress and only retry if a
+//further write starts before the read has completed
+//The first buffer must be initialised before any read, alternatively
+//perform an initial write (which updates the second buffer)
+//Do not mix with p64_rwsync_read/write() on the same synchroniser
+
+//Perform an atomic read of the associated double buffered data
+//Does not block for concurrent writes
+void p64_rwsync_read_dbuf(const p64_rwsync_t *sync,
+			  void *dst,
+			  const void *data,
+			  size_t len);
+
+//Perform an atomic write of the associated double buffered data
+//Will block for concurrent writes
+void p64_rwsync_write_dbuf(p64_rwsync_t *sync,
+			   const void *src,
+			   void *data,
+			   size_t len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,52 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#ifndef _P64_RWSYNC_TEMPLATE_H
+#define _P64_RWSYNC_TEMPLATE_H
+
+#include "p64_rwsync.h"
+
+#ifndef P64_CONCAT
+#define P64_CONCAT(x, y) x ## y
+#endif
+
+//Generate a read/write synchronised container for data of type '_type'
+//The data is copied using plain structure assignment between the seqlock
+//fences, the size is known at compile time so the compiler can inline and
+//vectorize the copy
+#define P64_RWSYNC(_name, _type) \
+typedef struct _name \
+{ \
+    p64_rwsync_t sync; \
+    _type data; \
+} P64_CONCAT(_name,_t); \
+\
+static inline void \
+P64_CONCAT(_name,_init)(P64_CONCAT(_name,_t) *rs, const _type *data) \
+{ \
+    p64_rwsync_init(&rs->sync); \
+    rs->data = *data; \
+} \
+\
+static inline void \
+P64_CONCAT(_name,_read)(P64_CONCAT(_name,_t) *rs, _type *data) \
+{ \
+    p64_rwsync_t prv; \
+    do \
+    { \
+	prv = p64_rwsync_acquire_rd(&rs->sync); \
+	*data = rs->data; \
+    } \
+    while (!p64_rwsync_release_rd(&rs->sync, prv)); \
+} \
+\
+static inline void \
+P64_CONCAT(_name,_write)(P64_CONCAT(_name,_t) *rs, const _type *data) \
+{ \
+    p64_rwsync_acquire_wr(&rs->sync); \
+    rs->data = *data; \
+    p64_rwsync_release_wr(&rs->sync); \
+}
+
+#endif
@@ -0,0 +1,121 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Lock-free skip list (ordered map)
+//Elements are kept in key order, the bottom level list defines membership,
+//higher levels are shortcuts which are linked after and unlinked before the
+//bottom level
+//Safe memory reclamation uses hazard pointers, each operation uses at most
+//three hazard pointers (including any returned hazard pointer)
+
+#ifndef _P64_SKIPLIST_H
+#define _P64_SKIPLIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "p64_hazardptr.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//Max number of levels, with 1/4 of the elements on each level promoted to
+//the next level, good performance for up to 4^12 (16M) elements
+#define P64_SKIPLIST_MAXLEVELS 12
+
+//Each element in the skip list must include a p64_skipelem field
+typedef struct p64_skipelem
+{
+    struct p64_skipelem *next[P64_SKIPLIST_MAXLEVELS];
+    void (*callback)(void *);//Retire call-back
+    uint32_t height;//Number of levels
+    uint32_t refs;
+} p64_skipelem_t;
+
+typedef struct p64_skiplist p64_skiplist_t;
+
+//Compare element and key, return <0, 0 or >0 if the element is less than,
+//equal to or greater than the key
+typedef int (*p64_skiplist_compare)(const p64_skipelem_t *,
+				    const void *key);
+
+//Allocate a skip list
+p64_skiplist_t *p64_skiplist_alloc(p64_skiplist_compare cf);
+
+//Free a skip list
+//The skip list must be empty
+void p64_skiplist_free(p64_skiplist_t *sl);
+
+//Look up element with key equal to 'key'
+//Return NULL if element not found
+//The returned element is protected by the hazard pointer *hp which must be
+//released using p64_hazptr_release_ro()
+p64_skipelem_t *p64_skiplist_lookup(p64_skiplist_t *sl,
+				    const void *key,
+				    p64_hazardptr_t *hp);
+
+//Look up first element with key greater than or equal to 'key'
+//Return NULL if there is no such element
+//The returned element is protected by the hazard pointer *hp
+p64_skipelem_t *p64_skiplist_lower_bound(p64_skiplist_t *sl,
+					 const void *key,
+					 p64_hazardptr_t *hp);
+
+//Return the element following 'elem' (with key 'key') or NULL if 'elem' is
+//the last element
+//'elem' must be protected by the hazard pointer *hp, on return the returned
+//element (if any) is protected by *hp instead
+//If 'elem' has been removed, return the first element with key greater than
+//'key'
+p64_skipelem_t *p64_skiplist_next(p64_skiplist_t *sl,
+				  p64_skipelem_t *elem,
+				  const void *key,
+				  p64_hazardptr_t *hp);
+
+#ifndef NDEBUG
+#define P64_SKIPLIST_ANNOTATE(_call, _hp) \
+({ \
+     p64_hazardptr_t *_f = (_hp); \
+     p64_skipelem_t *_g = (_call); \
+     if (*(_f) != P64_HAZARDPTR_NULL) \
+	 p64_hazptr_annotate(*(_f), __FILE__, __LINE__); \
+     _g; \
+})
+#define p64_skiplist_lookup(_a, _b, _c) \
+    P64_SKIPLIST_ANNOTATE(p64_skiplist_lookup((_a), (_b), (_c)), (_c))
+#define p64_skiplist_lower_bound(_a, _b, _c) \
+    P64_SKIPLIST_ANNOTATE(p64_skiplist_lower_bound((_a), (_b), (_c)), (_c))
+#define p64_skiplist_next(_a, _b, _c, _d) \
+    P64_SKIPLIST_ANNOTATE(p64_skiplist_next((_a), (_b), (_c), (_d)), (_d))
+#endif
+
+//Insert element with key 'key' into the skip list
+//Return false if an element with an equal key already exists
+//The element may be removed and retired by another thread as soon as it has
+//been inserted
+bool p64_skiplist_insert(p64_skiplist_t *sl,
+			 p64_skipelem_t *elem,
+			 const void *key);
+
+//Remove and return element with key equal to 'key'
+//Return NULL if element not found
+//'callback' is called (see p64_hazptr_retire()) when the element has been
+//unlinked from all levels and is no longer referenced
+//The returned element is protected by the hazard pointer *hp
+p64_skipelem_t *p64_skiplist_remove(p64_skiplist_t *sl,
+				    const void *key,
+				    void (*callback)(void *),
+				    p64_hazardptr_t *hp);
+
+#ifndef NDEBUG
+#define p64_skiplist_remove(_a, _b, _c, _d) \
+    P64_SKIPLIST_ANNOTATE(p64_skiplist_remove((_a), (_b), (_c), (_d)), (_d))
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -5,6 +5,7 @@
 #ifndef _P64_SPINLOCK_H
 #define _P64_SPINLOCK_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -18,6 +19,7 @@ typedef uint8_t p64_spinlock_t;
 void p64_spinlock_init(p64_spinlock_t *lock);
 
 //Acquire a spin lock
+//Waiting threads use the backoff policy set by p64_backoff_set()
 void p64_spinlock_acquire(p64_spinlock_t *lock);
 
 //Try to acquire a spin lock
@@ -29,6 +31,27 @@ void p64_spinlock_release(p64_spinlock_t *lock);
 //Release a spin lock when no writes to shared data have been made
 void p64_spinlock_release_ro(p64_spinlock_t *lock);
 
+//Ticket lock, waiting threads acquire the lock in FIFO order
+//Supports up to 65535 waiting threads
+typedef struct p64_tktlock
+{
+    uint16_t enter;//Next ticket to hand out
+    uint16_t leave;//Ticket currently served
+} p64_tktlock_t;
+
+//Initialise a ticket lock
+void p64_tktlock_init(p64_tktlock_t *lock);
+
+//Acquire a ticket lock
+void p64_tktlock_acquire(p64_tktlock_t *lock);
+
+//Try to acquire a ticket lock
+//Fail if the lock is held or there are waiting threads
+bool p64_tktlock_try_acquire(p64_tktlock_t *lock);
+
+//Release a ticket lock
+void p64_tktlock_release(p64_tktlock_t *lock);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,35 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Contention statistics
+//Counters are only maintained when the library is built with P64_STATS
+//defined (e.g. 'make STATS=1'), otherwise no overhead is incurred
+
+#ifndef _P64_STATS_H
+#define _P64_STATS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//Return true if the library was built with statistics support
+bool p64_stats_enabled(void);
+
+//Print the sum of each counter over all threads (also exited threads)
+//Counters which are zero are not printed
+void p64_stats_dump(FILE *fp);
+
+//Reset all counters of all threads
+//Concurrent updates may be lost
+void p64_stats_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
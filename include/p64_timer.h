@@ -40,6 +40,18 @@ bool p64_timer_reset(p64_timer_t tim, p64_tick_t tmo);
 //Return false if timer inactive (already expired or cancelled)
 bool p64_timer_cancel(p64_timer_t tim);
 
+//Set (activate) multiple inactive timers
+//Active timers are not updated
+//The earliest expiration tick is published once for all timers
+//Return number of timers set
+uint32_t p64_timer_set_vec(const p64_timer_t tims[],
+			   const p64_tick_t tmos[],
+			   uint32_t num);
+
+//Cancel multiple active timers
+//Return number of timers cancelled
+uint32_t p64_timer_cancel_vec(const p64_timer_t tims[], uint32_t num);
+
 //Return current timer tick
 p64_tick_t p64_timer_tick_get(void);
 
@@ -49,6 +61,89 @@ void p64_timer_tick_set(p64_tick_t now);
 //Expire timers <= current tick and invoke call-backs
 void p64_timer_expire(void);
 
+//Use the built-in clock for the default group
+//See p64_timer_group_clock_enable()
+void p64_timer_clock_enable(uint64_t tick_ns);
+
+//Timer groups are independent sets of timers with their own current tick
+//Timer handles are only valid in the group from which they were allocated
+//The functions above operate on a default group with MAXTIMERS timers
+typedef struct p64_timer_group p64_timer_group_t;
+
+//Allocate a timer group with space for 'ntimers' timers
+//The memory is initialised by the calling thread so will normally be local to
+//the NUMA node of that thread
+//Return NULL if memory allocation fails
+p64_timer_group_t *p64_timer_group_alloc(uint32_t ntimers);
+
+//Free a timer group
+//The timer group must not have any active timers
+void p64_timer_group_free(p64_timer_group_t *tg);
+
+//Allocate a timer in the group
+//Return P64_TIMER_NULL if no timer available
+p64_timer_t p64_timer_group_timer_alloc(p64_timer_group_t *tg,
+					p64_timer_cb cb,
+					void *arg);
+
+//Free a timer in the group
+void p64_timer_group_timer_free(p64_timer_group_t *tg, p64_timer_t tim);
+
+//Set (activate) an inactive (expired or cancelled) timer in the group
+//Return false if timer already active
+bool p64_timer_group_set(p64_timer_group_t *tg,
+			 p64_timer_t tim,
+			 p64_tick_t tmo);
+
+//Reset an active (not yet expired) timer in the group
+//Return false if timer inactive (already expired or cancelled)
+bool p64_timer_group_reset(p64_timer_group_t *tg,
+			   p64_timer_t tim,
+			   p64_tick_t tmo);
+
+//Cancel (deactivate) an active (not yet expired) timer in the group
+//Return false if timer inactive (already expired or cancelled)
+bool p64_timer_group_cancel(p64_timer_group_t *tg, p64_timer_t tim);
+
+//Set (activate) multiple inactive timers in the group
+//Return number of timers set
+uint32_t p64_timer_group_set_vec(p64_timer_group_t *tg,
+				 const p64_timer_t tims[],
+				 const p64_tick_t tmos[],
+				 uint32_t num);
+
+//Cancel multiple active timers in the group
+//Return number of timers cancelled
+uint32_t p64_timer_group_cancel_vec(p64_timer_group_t *tg,
+				    const p64_timer_t tims[],
+				    uint32_t num);
+
+//Return current timer tick of the group
+p64_tick_t p64_timer_group_tick_get(p64_timer_group_t *tg);
+
+//Set current timer tick of the group
+void p64_timer_group_tick_set(p64_timer_group_t *tg, p64_tick_t now);
+
+//Expire timers in the group <= current tick and invoke call-backs
+void p64_timer_group_expire(p64_timer_group_t *tg);
+
+//Derive the current tick of the group from the CPU counter (TSC on x86-64,
+//CNTVCT_EL0 on aarch64) instead of p64_timer_group_tick_set()
+//Each tick is 'tick_ns' nanoseconds, ticks are counted from the call
+//Threads read the counter themselves so no thread needs to publish the tick
+//and timeouts can have nanosecond resolution
+//Must be called before any timers are set and before the group is used by
+//other threads, p64_timer_group_tick_set() must not be called afterwards
+//On x86-64 the counter frequency is measured which takes 10ms
+void p64_timer_group_clock_enable(p64_timer_group_t *tg, uint64_t tick_ns);
+
+//Select the kernel used for scanning timers on expiration
+//Kernel 0 is the scalar version, other kernels use SIMD instructions
+//The best kernel supported by the CPU is selected by default
+//With the timer wheel (USE_TIMER_WHEEL), there is only kernel 0 "wheel"
+//Return name of kernel or NULL if kernel 'idx' is not available
+const char *p64_timer_scan_kernel(uint32_t idx);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,58 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Chase-Lev work-stealing deque
+//The owner thread pushes and pops elements at the bottom (LIFO), any other
+//thread may steal elements from the top (FIFO)
+//Owner push and pop use no atomic read-modify-write operations except when
+//popping the last element, thieves use CAS
+
+#ifndef _P64_WSDEQUE_H
+#define _P64_WSDEQUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct p64_wsdeque p64_wsdeque_t;
+
+//Allocate a work-stealing deque with space for at least 'nelems' elements
+//'nelems' != 0 and 'nelems' <= 0x40000000
+p64_wsdeque_t *
+p64_wsdeque_alloc(uint32_t nelems);
+
+//Free a work-stealing deque
+//The deque must be empty
+void
+p64_wsdeque_free(p64_wsdeque_t *wsd);
+
+//Push an element at the bottom of the deque (owner only)
+//'elem' must not be NULL
+//Return false if the deque is full
+bool
+p64_wsdeque_push(p64_wsdeque_t *wsd, void *elem);
+
+//Pop the most recently pushed element (owner only)
+//Return NULL if the deque is empty
+void *
+p64_wsdeque_pop(p64_wsdeque_t *wsd);
+
+//Steal the least recently pushed element (any thread)
+//Return NULL if the deque is empty
+void *
+p64_wsdeque_steal(p64_wsdeque_t *wsd);
+
+//Return number of elements in the deque, may be stale when returned
+uint32_t
+p64_wsdeque_size(p64_wsdeque_t *wsd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
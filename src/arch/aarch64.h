@@ -5,9 +5,16 @@
 #ifndef _AARCH64_H
 #define _AARCH64_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "build_config.h"
+
+#ifdef USE_LSE_DISPATCH
+#include <sys/auxv.h>
+#endif
+
 static inline void sevl(void)
 {
     __asm__ volatile("sevl" : : : );
@@ -24,6 +31,46 @@ static inline void doze(void)
     __asm__ volatile("isb" : : : );//isb better than nop
 }
 
+//Read the virtual counter
+static inline uint64_t
+counter_read(void)
+{
+    uint64_t cnt;
+    __asm__ volatile("isb; mrs %0, cntvct_el0" : "=r" (cnt) : : "memory");
+    return cnt;
+}
+
+//Return frequency of the virtual counter
+static inline uint64_t
+counter_freq(void)
+{
+    uint64_t frq;
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r" (frq));
+    return frq;
+}
+
+#ifdef USE_LSE_DISPATCH
+#ifndef HWCAP_ATOMICS
+#define HWCAP_ATOMICS (1 << 8)
+#endif
+
+//Return true if the CPU implements the ARMv8.1 LSE atomic instructions
+//The hardware capabilities are read once per translation unit, concurrent
+//first calls may read them more than once but always get the same result
+static inline bool
+has_lse(void)
+{
+    static int lse = -1;
+    int val = __atomic_load_n(&lse, __ATOMIC_RELAXED);
+    if (val < 0)
+    {
+	val = (getauxval(AT_HWCAP) & HWCAP_ATOMICS) != 0;
+	__atomic_store_n(&lse, val, __ATOMIC_RELAXED);
+    }
+    return val != 0;
+}
+#endif
+
 static inline void
 smp_fence(unsigned int mask)
 {
@@ -7,12 +7,39 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <time.h>
 
 static inline void doze(void)
 {
     __asm__ volatile("rep; nop" : : : );
 }
 
+//Read the time stamp counter
+static inline uint64_t
+counter_read(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a" (lo), "=d" (hi) : : "memory");
+    return (uint64_t)hi << 32 | lo;
+}
+
+//Return frequency of the time stamp counter
+//The frequency is not architecturally visible so is measured against
+//CLOCK_MONOTONIC for 10ms, assumes an invariant TSC
+static inline uint64_t
+counter_freq(void)
+{
+    struct timespec ts0, ts1, req = { 0, 10000000 };
+    clock_gettime(CLOCK_MONOTONIC, &ts0);
+    uint64_t cnt0 = counter_read();
+    nanosleep(&req, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    uint64_t cnt1 = counter_read();
+    uint64_t ns = (ts1.tv_sec - ts0.tv_sec) * 1000000000ULL +
+		  ts1.tv_nsec - ts0.tv_nsec;
+    return (cnt1 - cnt0) * 1000000000ULL / ns;
+}
+
 static inline void
 smp_fence(unsigned int mask)
 {
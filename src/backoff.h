@@ -0,0 +1,63 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#ifndef _BACKOFF_H
+#define _BACKOFF_H
+
+#include <sched.h>
+#include <stdint.h>
+
+#include "p64_backoff.h"
+
+#include "arch.h"
+#include "common.h"
+#include "stats.h"
+
+extern p64_backoff_t p64_backoff_policy;
+
+//Per-wait backoff state
+struct backoff
+{
+    p64_backoff_t cfg;
+    uint32_t delay;
+    uint32_t nwaits;
+};
+
+static inline void
+backoff_init(struct backoff *bo)
+{
+    p64_backoff_get(&bo->cfg);
+    bo->delay = bo->cfg.min;
+    bo->nwaits = 0;
+}
+
+//Called in each iteration of a wait loop in place of DOZE()
+static inline void
+backoff_wait(struct backoff *bo)
+{
+    if (LIKELY(bo->cfg.min == 0 && bo->cfg.yield == 0))
+    {
+	//Default policy, no backoff
+	DOZE();
+	return;
+    }
+    if (bo->cfg.yield != 0 && bo->nwaits >= bo->cfg.yield)
+    {
+	//Waited long enough, the thread we wait for may have been preempted
+	STAT_INC(STAT_BACKOFF_YIELD);
+	sched_yield();
+	//Don't block in the next WFE
+	SEVL();
+	return;
+    }
+    bo->nwaits++;
+    for (uint32_t i = 0; i < bo->delay; i++)
+    {
+	doze();
+    }
+    bo->delay = bo->delay * 2 <= bo->cfg.max ? bo->delay * 2 : bo->cfg.max;
+    DOZE();
+}
+
+#endif
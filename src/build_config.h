@@ -8,8 +8,18 @@
 #define USE_SPLIT_PRODCONS
 //#define USE_SPLIT_HEADTAIL
 
-//Use load/store exclusive directly
+//Select ARMv8.1 LSE atomics or load/store exclusive at run-time so that one
+//binary runs well on both v8.0 and v8.1+ CPU's, has no effect if the target
+//architecture mandates LSE (e.g. -march=armv8.1-a)
+//The compiler's outline atomics (-moutline-atomics) perform the same
+//selection for __atomic builtins
 #ifdef __aarch64__
+#define USE_LSE_DISPATCH
+#endif
+
+//Use load/store exclusive directly
+//Not with USE_LSE_DISPATCH, __atomic builtins will then use LSE if available
+#if defined __aarch64__ && !defined USE_LSE_DISPATCH
 #define USE_LDXSTX
 #endif
 
@@ -23,9 +33,23 @@
 #define USE_DMB
 #endif
 
+//Use hierarchical timer wheel instead of scanning all timers on expiration
+//Better for large number of timers, operations are serialised by a lock
+//#define USE_TIMER_WHEEL
+
+//Use QSBR instead of hazard pointers for safe memory reclamation in hash table
+//Readers do not need any fences, threads must announce quiescent states
+//#define USE_HASHTABLE_QSBR
+
 #define CACHE_LINE 64
 #define MAXTHREADS 128
-#define MAXHPREFS 3
+//Hazard pointers per thread, at most 32 (size of free mask)
+//Covers p64_hashtable_lookup_vec() bursts of up to 30 keys
+#define MAXHPREFS 32
 #define MAXTIMERS 8192
+//Minimum number of objects retired between hazard pointer garbage collections
+#define HP_RETIRE_THRESHOLD 1024
+//Initial size of per-thread QSBR list of retired objects
+#define QSBR_RETIRE_THRESHOLD 1024
 
 #endif
@@ -0,0 +1,142 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#ifndef _FUTEX_H
+#define _FUTEX_H
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arch.h"
+#include "common.h"
+#include "stats.h"
+
+//Spin limits for adaptive spinning before going to sleep
+#define SPIN_MIN 64
+#define SPIN_MAX 16384
+
+//Deadline which never expires
+#define DEADLINE_NEVER (~(uint64_t)0)
+
+static inline uint64_t
+monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t
+deadline_ns(uint64_t timeout)
+{
+    uint64_t now = monotonic_ns();
+    return timeout < DEADLINE_NEVER - now ? now + timeout : DEADLINE_NEVER;
+}
+
+//Sleep while *loc == val, at most until deadline
+//'shared' futexes may be used by multiple processes
+static inline void
+futex_wait(uint32_t *loc, uint32_t val, uint64_t deadline, bool shared)
+{
+    struct timespec ts, *tsp = NULL;
+    if (deadline != DEADLINE_NEVER)
+    {
+	uint64_t now = monotonic_ns();
+	uint64_t rel = deadline > now ? deadline - now : 0;
+	ts.tv_sec = rel / 1000000000;
+	ts.tv_nsec = rel % 1000000000;
+	tsp = &ts;
+    }
+    (void)syscall(SYS_futex, loc, shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE,
+		  val, tsp, NULL, 0);
+}
+
+//Wake all threads sleeping on loc
+static inline void
+futex_wake(uint32_t *loc, bool shared)
+{
+    (void)syscall(SYS_futex, loc, shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE,
+		  INT_MAX, NULL, NULL, 0);
+}
+
+//Spin while *loc == val, at most '*budget' iterations
+//Return true if *loc changed
+//The spin budget grows when spinning succeeds and shrinks when it fails
+static inline bool
+spin_while_equal(uint32_t *loc, uint32_t val, uint32_t *budget)
+{
+    uint32_t nspins = *budget;
+    SEVL();
+    while (WFE() && LDXR32(loc, __ATOMIC_ACQUIRE) == val)
+    {
+	if (nspins-- == 0)
+	{
+	    *budget = *budget / 2 >= SPIN_MIN ? *budget / 2 : SPIN_MIN;
+	    return false;
+	}
+	DOZE();
+    }
+    *budget = *budget * 2 <= SPIN_MAX ? *budget * 2 : SPIN_MAX;
+    return true;
+}
+
+//Wait until *tailp != *headp (i.e. a ring is not empty) or deadline expires
+//'waiters' is incremented while sleeping, producers must wake sleepers on
+//'tailp' after updating it if 'waiters' is non-zero
+//Return false if deadline has expired
+static inline bool
+wait_nonempty(uint32_t *tailp,
+	      const uint32_t *headp,
+	      uint32_t *waiters,
+	      uint32_t *budget,
+	      uint64_t deadline,
+	      bool shared)
+{
+    uint32_t tail = __atomic_load_n(tailp, __ATOMIC_ACQUIRE);
+    if (tail != __atomic_load_n(headp, __ATOMIC_ACQUIRE))
+    {
+	return true;
+    }
+    //Busy case, spin
+    if (spin_while_equal(tailp, tail, budget))
+    {
+	return true;
+    }
+    if (deadline != DEADLINE_NEVER && monotonic_ns() >= deadline)
+    {
+	return false;
+    }
+    //Idle case, sleep
+    __atomic_fetch_add(waiters, 1, __ATOMIC_RELAXED);
+    //Order increment of waiters before re-reading tail, matches producer's
+    //StoreLoad fence between updating tail and reading waiters
+    smp_fence(StoreLoad);
+    tail = __atomic_load_n(tailp, __ATOMIC_ACQUIRE);
+    if (tail == __atomic_load_n(headp, __ATOMIC_ACQUIRE))
+    {
+	STAT_INC(STAT_FUTEX_SLEEP);
+	futex_wait(tailp, tail, deadline, shared);
+    }
+    __atomic_fetch_sub(waiters, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+//Wake any consumers sleeping in wait_nonempty()
+static inline void
+wake_waiters(uint32_t *tailp, uint32_t *waiters, bool shared)
+{
+    //Order update of tail before reading waiters
+    smp_fence(StoreLoad);
+    if (UNLIKELY(__atomic_load_n(waiters, __ATOMIC_RELAXED) != 0))
+    {
+	futex_wake(tailp, shared);
+    }
+}
+
+#endif
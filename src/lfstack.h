@@ -0,0 +1,99 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Lock-free stack (freelist) of elements linked through a pointer field
+//The head pointer is paired with a counter which is updated by every
+//operation for ABA protection, both are updated using a 128-bit CAS
+//Elements must remain accessible (not be returned to the OS) as long as the
+//stack is used since a popping thread may read the link of a just popped
+//element
+
+#ifndef _LFSTACK_H
+#define _LFSTACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arch.h"
+#include "common.h"
+#include "lockfree.h"
+#include "stats.h"
+
+struct lfstack
+{
+    void *head;
+    uintptr_t count;//For ABA protection
+} ALIGNED(16);
+
+union lfstack_u
+{
+    struct lfstack st;
+    __int128 ui;
+};
+
+//Pointer to link field of element
+#define LFS_LINK(elem, off) ((void **)((char *)(elem) + (off)))
+
+static inline void
+lfstack_init(struct lfstack *st, void *head)
+{
+    st->head = head;
+    st->count = 0;
+}
+
+//Pop an element, return NULL if stack is empty
+//'off' is the offset of the link field in the element
+static inline void *
+lfstack_pop(struct lfstack *st, size_t off, enum stat id)
+{
+    union lfstack_u old, neu;
+    do
+    {
+	old.st.count = __atomic_load_n(&st->count, __ATOMIC_ACQUIRE);
+	//count will be read before head, torn read will be detected by CAS
+	old.st.head = __atomic_load_n(&st->head, __ATOMIC_ACQUIRE);
+	if (UNLIKELY(old.st.head == NULL))
+	{
+	    return NULL;
+	}
+	//Dereferencing old.head => need acquire
+	neu.st.head = __atomic_load_n(LFS_LINK(old.st.head, off),
+				      __ATOMIC_RELAXED);
+	neu.st.count = old.st.count + 1;
+    }
+    while (UNLIKELY(!lockfree_compare_exchange_16((__int128 *)st,
+						  &old.ui,
+						  neu.ui,
+						  /*weak=*/true,
+						  __ATOMIC_RELAXED,
+						  __ATOMIC_RELAXED)) &&
+	   STAT_RETRY(id));
+    (void)id;
+    return old.st.head;
+}
+
+//Push an element
+//'off' is the offset of the link field in the element
+static inline void
+lfstack_push(struct lfstack *st, void *elem, size_t off, enum stat id)
+{
+    union lfstack_u old, neu;
+    do
+    {
+	old.st = *st;
+	__atomic_store_n(LFS_LINK(elem, off), old.st.head, __ATOMIC_RELAXED);
+	neu.st.head = elem;
+	neu.st.count = old.st.count + 1;
+    }
+    while (UNLIKELY(!lockfree_compare_exchange_16((__int128 *)st,
+						  &old.ui,
+						  neu.ui,
+						  /*weak=*/true,
+						  __ATOMIC_RELEASE,
+						  __ATOMIC_RELAXED)) &&
+	   STAT_RETRY(id));
+    (void)id;
+}
+
+#endif
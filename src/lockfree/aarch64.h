@@ -6,6 +6,8 @@
 #define _LOCKFREE_AARCH64_H
 
 #include <stdbool.h>
+#include "build_config.h"
+#include "arch.h"
 #include "common.h"
 
 #include "ldxstx.h"
@@ -14,7 +16,19 @@
 #define __ARM_FEATURE_ATOMICS
 #endif
 
-#ifdef __ARM_FEATURE_ATOMICS
+//HAS_LSE() selects between LSE atomics (CASP, LDUMAX) and load/store
+//exclusive loops, it is constant true when the target architecture mandates
+//LSE and a run-time check with USE_LSE_DISPATCH
+#if defined __ARM_FEATURE_ATOMICS
+#define HAS_LSE() true
+#define LSE_ARCH ""
+#elif defined USE_LSE_DISPATCH
+#define HAS_LSE() has_lse()
+//Let the assembler accept LSE instructions even if the compiler targets v8.0
+#define LSE_ARCH ".arch_extension lse\n\t"
+#endif
+
+#ifdef HAS_LSE
 ALWAYS_INLINE
 static inline __int128 casp(__int128 *var, __int128 old, __int128 neu, int mo)
 {
@@ -24,7 +38,7 @@ static inline __int128 casp(__int128 *var, __int128 old, __int128 neu, int mo)
     register uint64_t x3 __asm ("x3") = (uint64_t)(neu >> 64);
     if (mo == __ATOMIC_RELAXED)
     {
-	__asm __volatile("casp %[old1], %[old2], %[neu1], %[neu2], [%[v]]"
+	__asm __volatile(LSE_ARCH "casp %[old1], %[old2], %[neu1], %[neu2], [%[v]]"
 
 			: [old1] "+r" (x0), [old2] "+r" (x1)
 			: [neu1] "r" (x2), [neu2] "r" (x3), [v] "r" (var)
@@ -32,21 +46,21 @@ static inline __int128 casp(__int128 *var, __int128 old, __int128 neu, int mo)
     }
     else if (mo == __ATOMIC_ACQUIRE)
     {
-	__asm __volatile("caspa %[old1], %[old2], %[neu1], %[neu2], [%[v]]"
+	__asm __volatile(LSE_ARCH "caspa %[old1], %[old2], %[neu1], %[neu2], [%[v]]"
 			: [old1] "+r" (x0), [old2] "+r" (x1)
 			: [neu1] "r" (x2), [neu2] "r" (x3), [v] "r" (var)
 			: "memory");
     }
     else if (mo == __ATOMIC_ACQ_REL)
     {
-	__asm __volatile("caspal x0, %[old2], %[neu1], %[neu2], [%[v]]"
+	__asm __volatile(LSE_ARCH "caspal x0, %[old2], %[neu1], %[neu2], [%[v]]"
 			: [old1] "+r" (x0), [old2] "+r" (x1)
 			: [neu1] "r" (x2), [neu2] "r" (x3), [v] "r" (var)
 			: "memory");
     }
     else if (mo == __ATOMIC_RELEASE)
     {
-	__asm __volatile("caspl %[old1], %[old2], %[neu1], %[neu2], [%[v]]"
+	__asm __volatile(LSE_ARCH "caspl %[old1], %[old2], %[neu1], %[neu2], [%[v]]"
 			: [old1] "+r" (x0), [old2] "+r" (x1)
 			: [neu1] "r" (x2), [neu2] "r" (x3), [v] "r" (var)
 			: "memory");
@@ -62,13 +76,16 @@ static inline __int128 casp(__int128 *var, __int128 old, __int128 neu, int mo)
 ALWAYS_INLINE
 static inline bool lockfree_compare_exchange_16(register __int128 *var, __int128 *exp, register __int128 neu, bool weak, int mo_success, int mo_failure)
 {
-#ifdef __ARM_FEATURE_ATOMICS
-    (void)weak; (void)mo_failure;
-    __int128 old, expected = *exp;
-    old = casp(var, expected, neu, mo_success);
-    *exp = old;//Always update, atomically read value
-    return old == expected;
-#else
+#ifdef HAS_LSE
+    if (HAS_LSE())
+    {
+	(void)weak; (void)mo_failure;
+	__int128 old, expected = *exp;
+	old = casp(var, expected, neu, mo_success);
+	*exp = old;//Always update, atomically read value
+	return old == expected;
+    }
+#endif
     (void)weak;//Always do strong CAS or we can't perform atomic read
     (void)mo_failure;//Ignore memory ordering for failure, memory order for
     //success must be stronger or equal
@@ -85,19 +102,21 @@ static inline bool lockfree_compare_exchange_16(register __int128 *var, __int128
     while (UNLIKELY(stx128(var, old == expected ? neu : old, stx_mo)));
     *exp = old;//Always update, atomically read value
     return old == expected;
-#endif
 }
 
 ALWAYS_INLINE
 static inline bool lockfree_compare_exchange_16_frail(register __int128 *var, __int128 *exp, register __int128 neu, bool weak, int mo_success, int mo_failure)
 {
-#ifdef __ARM_FEATURE_ATOMICS
-    (void)weak; (void)mo_failure;
-    __int128 old, expected = *exp;
-    old = casp(var, expected, neu, mo_success);
-    *exp = old;//Always update, atomically read value
-    return old == expected;
-#else
+#ifdef HAS_LSE
+    if (HAS_LSE())
+    {
+	(void)weak; (void)mo_failure;
+	__int128 old, expected = *exp;
+	old = casp(var, expected, neu, mo_success);
+	*exp = old;//Always update, atomically read value
+	return old == expected;
+    }
+#endif
     (void)weak;//Weak CAS and non-atomic load on failure
     (void)mo_failure;//Ignore memory ordering for failure, memory order for
     //success must be stronger or equal
@@ -117,7 +136,6 @@ static inline bool lockfree_compare_exchange_16_frail(register __int128 *var, __
     //Wrong value or STX failed
     *exp = old;//Old possibly torn value (OK for 'frail' flavour)
     return 0;//Failure, *exp updated
-#endif
 }
 
 ALWAYS_INLINE
@@ -134,15 +152,19 @@ static inline __int128 lockfree_load_16(__int128 *var, int mo)
 ALWAYS_INLINE
 static inline void lockfree_store_16(__int128 *var, __int128 neu, int mo)
 {
-#ifdef __ARM_FEATURE_ATOMICS
-    __int128 old, expected;
-    do
+#ifdef HAS_LSE
+    if (HAS_LSE())
     {
-	expected = *var;
-	old = casp(var, expected, neu, mo);
+	__int128 old, expected;
+	do
+	{
+	    expected = *var;
+	    old = casp(var, expected, neu, mo);
+	}
+	while (old != expected);
+	return;
     }
-    while (old != expected);
-#else
+#endif
     int ldx_mo = __ATOMIC_ACQUIRE;
     int stx_mo = MO_STORE(mo);
     do
@@ -150,22 +172,24 @@ static inline void lockfree_store_16(__int128 *var, __int128 neu, int mo)
 	(void)ldx128(var, ldx_mo);
     }
     while (UNLIKELY(stx128(var, neu, stx_mo)));
-#endif
 }
 
 ALWAYS_INLINE
 static inline __int128 lockfree_exchange_16(__int128 *var, __int128 neu, int mo)
 {
-#ifdef __ARM_FEATURE_ATOMICS
-    __int128 old, expected;
-    do
+#ifdef HAS_LSE
+    if (HAS_LSE())
     {
-	expected = *var;
-	old = casp(var, expected, neu, mo);
+	__int128 old, expected;
+	do
+	{
+	    expected = *var;
+	    old = casp(var, expected, neu, mo);
+	}
+	while (old != expected);
+	return old;
     }
-    while (old != expected);
-    return old;
-#else
+#endif
     int ldx_mo = MO_LOAD(mo);
     int stx_mo = MO_STORE(mo);
     register __int128 old;
@@ -175,22 +199,24 @@ static inline __int128 lockfree_exchange_16(__int128 *var, __int128 neu, int mo)
     }
     while (UNLIKELY(stx128(var, neu, stx_mo)));
     return old;
-#endif
 }
 
 ALWAYS_INLINE
 static inline __int128 lockfree_fetch_and_16(__int128 *var, __int128 mask, int mo)
 {
-#ifdef __ARM_FEATURE_ATOMICS
-    __int128 old, expected;
-    do
+#ifdef HAS_LSE
+    if (HAS_LSE())
     {
-	expected = *var;
-	old = casp(var, expected, expected & mask, mo);
+	__int128 old, expected;
+	do
+	{
+	    expected = *var;
+	    old = casp(var, expected, expected & mask, mo);
+	}
+	while (old != expected);
+	return old;
     }
-    while (old != expected);
-    return old;
-#else
+#endif
     int ldx_mo = MO_LOAD(mo);
     int stx_mo = MO_STORE(mo);
     register __int128 old;
@@ -200,22 +226,24 @@ static inline __int128 lockfree_fetch_and_16(__int128 *var, __int128 mask, int m
     }
     while (UNLIKELY(stx128(var, old & mask, stx_mo)));
     return old;
-#endif
 }
 
 ALWAYS_INLINE
 static inline __int128 lockfree_fetch_or_16(__int128 *var, __int128 mask, int mo)
 {
-#ifdef __ARM_FEATURE_ATOMICS
-    __int128 old, expected;
-    do
+#ifdef HAS_LSE
+    if (HAS_LSE())
     {
-	expected = *var;
-	old = casp(var, expected, expected | mask, mo);
+	__int128 old, expected;
+	do
+	{
+	    expected = *var;
+	    old = casp(var, expected, expected | mask, mo);
+	}
+	while (old != expected);
+	return old;
     }
-    while (old != expected);
-    return old;
-#else
+#endif
     int ldx_mo = MO_LOAD(mo);
     int stx_mo = MO_STORE(mo);
     register __int128 old;
@@ -225,7 +253,6 @@ static inline __int128 lockfree_fetch_or_16(__int128 *var, __int128 mask, int mo
     }
     while (UNLIKELY(stx128(var, old | mask, stx_mo)));
     return old;
-#endif
 }
 
 #define _ATOMIC_UMAX_4_DEFINED
@@ -234,40 +261,44 @@ static inline uint32_t
 lockfree_fetch_umax_4(uint32_t *var, uint32_t val, int mo)
 {
     uint32_t old;
-#ifdef __ARM_FEATURE_ATOMICS
-    if (mo == __ATOMIC_RELAXED)
+#ifdef HAS_LSE
+    if (HAS_LSE())
     {
-	__asm __volatile("ldumax %w1, %w0, [%x2]"
-			:"=&r"(old)
-			:"r"(val), "r"(var)
-			:"memory");
-    }
-    else if (mo == __ATOMIC_ACQUIRE)
-    {
-	__asm __volatile("ldumaxa %w1, %w0, [%x2]"
-			:"=&r"(old)
-			:"r"(val), "r"(var)
-			:"memory");
-    }
-    else if (mo == __ATOMIC_RELEASE)
-    {
-	__asm __volatile("ldumaxl %w1, %w0, [%x2]"
-			:"=&r"(old)
-			:"r"(val), "r"(var)
-			:"memory");
-    }
-    else if (mo == __ATOMIC_ACQ_REL)
-    {
-	__asm __volatile("ldumaxl %w1, %w0, [%x2]"
-			:"=&r"(old)
-			:"r"(val), "r"(var)
-			:"memory");
-    }
-    else
-    {
-	abort();
+	if (mo == __ATOMIC_RELAXED)
+	{
+	    __asm __volatile(LSE_ARCH "ldumax %w1, %w0, [%x2]"
+			    :"=&r"(old)
+			    :"r"(val), "r"(var)
+			    :"memory");
+	}
+	else if (mo == __ATOMIC_ACQUIRE)
+	{
+	    __asm __volatile(LSE_ARCH "ldumaxa %w1, %w0, [%x2]"
+			    :"=&r"(old)
+			    :"r"(val), "r"(var)
+			    :"memory");
+	}
+	else if (mo == __ATOMIC_RELEASE)
+	{
+	    __asm __volatile(LSE_ARCH "ldumaxl %w1, %w0, [%x2]"
+			    :"=&r"(old)
+			    :"r"(val), "r"(var)
+			    :"memory");
+	}
+	else if (mo == __ATOMIC_ACQ_REL)
+	{
+	    __asm __volatile(LSE_ARCH "ldumaxal %w1, %w0, [%x2]"
+			    :"=&r"(old)
+			    :"r"(val), "r"(var)
+			    :"memory");
+	}
+	else
+	{
+	    abort();
+	}
+	return old;
     }
-#else
+#endif
     do
     {
 	old = ldx32(var, MO_LOAD(mo));
@@ -278,7 +309,6 @@ lockfree_fetch_umax_4(uint32_t *var, uint32_t val, int mo)
 	//Else val > old, update
     }
     while (UNLIKELY(stx32(var, val, MO_STORE(mo))));
-#endif
     return old;
 }
 
@@ -288,40 +318,44 @@ static inline uint64_t
 lockfree_fetch_umax_8(uint64_t *var, uint64_t val, int mo)
 {
     uint64_t old;
-#ifdef __ARM_FEATURE_ATOMICS
-    if (mo == __ATOMIC_RELAXED)
-    {
-	__asm __volatile("ldumax %x1, %x0, [%x2]"
-			:"=&r"(old)
-			:"r"(val), "r"(var)
-			:"memory");
-    }
-    else if (mo == __ATOMIC_ACQUIRE)
+#ifdef HAS_LSE
+    if (HAS_LSE())
     {
-	__asm __volatile("ldumaxa %x1, %x0, [%x2]"
-			:"=&r"(old)
-			:"r"(val), "r"(var)
-			:"memory");
-    }
-    else if (mo == __ATOMIC_RELEASE)
-    {
-	__asm __volatile("ldumaxl %x1, %x0, [%x2]"
-			:"=&r"(old)
-			:"r"(val), "r"(var)
-			:"memory");
-    }
-    else if (mo == __ATOMIC_ACQ_REL)
-    {
-	__asm __volatile("ldumaxal %x1, %x0, [%x2]"
-			:"=&r"(old)
-			:"r"(val), "r"(var)
-			:"memory");
-    }
-    else
-    {
-	abort();
+	if (mo == __ATOMIC_RELAXED)
+	{
+	    __asm __volatile(LSE_ARCH "ldumax %x1, %x0, [%x2]"
+			    :"=&r"(old)
+			    :"r"(val), "r"(var)
+			    :"memory");
+	}
+	else if (mo == __ATOMIC_ACQUIRE)
+	{
+	    __asm __volatile(LSE_ARCH "ldumaxa %x1, %x0, [%x2]"
+			    :"=&r"(old)
+			    :"r"(val), "r"(var)
+			    :"memory");
+	}
+	else if (mo == __ATOMIC_RELEASE)
+	{
+	    __asm __volatile(LSE_ARCH "ldumaxl %x1, %x0, [%x2]"
+			    :"=&r"(old)
+			    :"r"(val), "r"(var)
+			    :"memory");
+	}
+	else if (mo == __ATOMIC_ACQ_REL)
+	{
+	    __asm __volatile(LSE_ARCH "ldumaxal %x1, %x0, [%x2]"
+			    :"=&r"(old)
+			    :"r"(val), "r"(var)
+			    :"memory");
+	}
+	else
+	{
+	    abort();
+	}
+	return old;
     }
-#else
+#endif
     do
     {
 	old = ldx64(var, MO_LOAD(mo));
@@ -332,7 +366,6 @@ lockfree_fetch_umax_8(uint64_t *var, uint64_t val, int mo)
 	//Else val > old, update
     }
     while (UNLIKELY(stx64(var, val, MO_STORE(mo))));
-#endif
     return old;
 }
 
@@ -0,0 +1,128 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <linux/mempolicy.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "p64_alloc.h"
+#include "build_config.h"
+
+#include "common.h"
+
+#define HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+//Max NUMA node number
+#define MAXNODES 1024
+
+//Prefer 'node' for the pages in the range, only affects pages which have not
+//yet been touched, large allocations are normally mapped on demand
+static void
+bind_node(void *addr, size_t len, int32_t node)
+{
+    uintptr_t pgsz = sysconf(_SC_PAGESIZE);
+    uintptr_t beg = ROUNDUP((uintptr_t)addr, pgsz);
+    uintptr_t end = ((uintptr_t)addr + len) & ~(pgsz - 1);
+    if (beg < end)
+    {
+	unsigned long mask[MAXNODES / (8 * sizeof(unsigned long))] = { 0 };
+	mask[node / (8 * sizeof(unsigned long))] =
+	    1UL << (node % (8 * sizeof(unsigned long)));
+	//Best effort, ignore failures (e.g. no NUMA support)
+	(void)syscall(SYS_mbind, beg, end - beg, MPOL_PREFERRED, mask,
+		      (unsigned long)MAXNODES + 1, 0);
+    }
+}
+
+static void *
+default_alloc(void *arg,
+	      size_t size,
+	      size_t align,
+	      int32_t node,
+	      uint32_t flags)
+{
+    (void)arg;
+    bool huge = (flags & P64_ALLOC_F_HUGEPAGE) && size >= HUGE_PAGE_SIZE;
+    if (huge && align < HUGE_PAGE_SIZE)
+    {
+	align = HUGE_PAGE_SIZE;
+    }
+    //aligned_alloc() requires size to be a multiple of the alignment
+    size = ROUNDUP(size, align);
+    void *ptr = aligned_alloc(align, size);
+    if (ptr == NULL)
+    {
+	return NULL;
+    }
+    if (huge)
+    {
+	//Use transparent huge pages, ignore failures
+	(void)madvise(ptr, size, MADV_HUGEPAGE);
+    }
+    if (node != P64_ALLOC_ANYNODE)
+    {
+	bind_node(ptr, size, node);
+    }
+    return ptr;
+}
+
+static void
+default_free(void *arg, void *ptr)
+{
+    (void)arg;
+    free(ptr);
+}
+
+static struct
+{
+    p64_alloc_cb alloc;
+    p64_free_cb free;
+    void *arg;
+} allocator = { default_alloc, default_free, NULL };
+
+void
+p64_set_allocator(p64_alloc_cb alloc_cb, p64_free_cb free_cb, void *arg)
+{
+    if (UNLIKELY((alloc_cb == NULL) != (free_cb == NULL)))
+    {
+	fprintf(stderr, "Allocation and free functions must both be set\n"),
+	abort();
+    }
+    if (alloc_cb == NULL)
+    {
+	alloc_cb = default_alloc;
+	free_cb = default_free;
+	arg = NULL;
+    }
+    allocator.alloc = alloc_cb;
+    allocator.free = free_cb;
+    allocator.arg = arg;
+}
+
+void *
+p64_malloc(size_t size, size_t align, int32_t node, uint32_t flags)
+{
+    if (UNLIKELY(!IS_POWER_OF_TWO(align)))
+    {
+	fprintf(stderr, "Invalid alignment %zu\n", align), abort();
+    }
+    if (UNLIKELY(node < P64_ALLOC_ANYNODE || node >= MAXNODES))
+    {
+	fprintf(stderr, "Invalid NUMA node %d\n", node), abort();
+    }
+    return allocator.alloc(allocator.arg, size, align, node, flags);
+}
+
+void
+p64_mfree(void *ptr)
+{
+    if (ptr != NULL)
+    {
+	allocator.free(allocator.arg, ptr);
+    }
+}
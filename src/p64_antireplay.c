@@ -7,44 +7,103 @@
 #include <string.h>
 
 #include "p64_antireplay.h"
+#include "p64_alloc.h"
 #include "build_config.h"
 
 #include "lockfree.h"
 #include "common.h"
 
+//Max number of sequence numbers processed together by
+//p64_antireplay_test_and_set_vec()
+#define VEC_BATCH 32
+
+//Bitmap mode: each 64-bit word holds a block of consecutive sequence numbers,
+//the least significant bits of the block number are used as a tag
+#define BLK_SHIFT 5
+#define BLK_SIZE (1U << BLK_SHIFT)
+#define TAG(w) ((uint32_t)((w) >> 32))
+#define BITS(w) ((uint32_t)(w))
+#define WORD(tag, bits) ((uint64_t)(tag) << 32 | (bits))
+
 struct p64_antireplay
 {
     uint32_t winmask;
     bool swizzle;
+    bool bitmap;
+    //Bitmap mode: highest block number seen
+    uint64_t top;
+    //Highest sequence number seen per entry or bitmap words
     p64_antireplay_sn_t snv[] ALIGNED(CACHE_LINE);
 };
 
-p64_antireplay_t *
-p64_antireplay_alloc(uint32_t winsize, bool swizzle)
+union snpair
+{
+    __int128 ui;
+    p64_antireplay_sn_t sn[2];
+};
+
+static p64_antireplay_t *
+antireplay_alloc(uint32_t nentries,
+		 bool swizzle,
+		 bool bitmap,
+		 int32_t numanode,
+		 uint32_t allocflags)
 {
-    if (winsize == 0 || !IS_POWER_OF_TWO(winsize))
-    {
-	fprintf(stderr, "Invalid window size %u\n", winsize), abort();
-    }
     size_t nbytes = ROUNDUP(sizeof(p64_antireplay_t) +
-			    winsize * sizeof(p64_antireplay_sn_t),
+			    nentries * sizeof(p64_antireplay_sn_t),
 			    CACHE_LINE);
-    p64_antireplay_t *ar = aligned_alloc(CACHE_LINE, nbytes);
+    p64_antireplay_t *ar = p64_malloc(nbytes, CACHE_LINE, numanode,
+					 allocflags);
     if (ar != NULL)
     {
 	//Clear all sequence numbers
 	memset(ar, 0, nbytes);
-	ar->winmask = winsize - 1;
+	ar->winmask = nentries - 1;
 	ar->swizzle = swizzle;
+	ar->bitmap = bitmap;
 	return ar;
     }
     return NULL;
 }
 
+p64_antireplay_t *
+p64_antireplay_alloc(uint32_t winsize, bool swizzle)
+{
+    if (winsize == 0 || !IS_POWER_OF_TWO(winsize))
+    {
+	fprintf(stderr, "Invalid window size %u\n", winsize), abort();
+    }
+    return antireplay_alloc(winsize, swizzle, false, P64_ALLOC_ANYNODE, 0);
+}
+
+p64_antireplay_t *
+p64_antireplay_alloc_ex(uint32_t winsize,
+			bool swizzle,
+			int32_t numanode,
+			uint32_t allocflags)
+{
+    if (winsize == 0 || !IS_POWER_OF_TWO(winsize))
+    {
+	fprintf(stderr, "Invalid window size %u\n", winsize), abort();
+    }
+    return antireplay_alloc(winsize, swizzle, false, numanode, allocflags);
+}
+
+p64_antireplay_t *
+p64_antireplay_alloc_bitmap(uint32_t winsize)
+{
+    if (winsize < 2 * BLK_SIZE || !IS_POWER_OF_TWO(winsize))
+    {
+	fprintf(stderr, "Invalid window size %u\n", winsize), abort();
+    }
+    return antireplay_alloc(winsize / BLK_SIZE, false, true,
+			    P64_ALLOC_ANYNODE, 0);
+}
+
 void
 p64_antireplay_free(p64_antireplay_t *ar)
 {
-    free(ar);
+    p64_mfree(ar);
 }
 
 static inline uint32_t
@@ -72,13 +131,9 @@ sn_to_index(p64_antireplay_t *ar, p64_antireplay_sn_t sn)
     }
 }
 
-p64_antireplay_result_t
-p64_antireplay_test(p64_antireplay_t *ar,
-		    p64_antireplay_sn_t sn)
+static inline p64_antireplay_result_t
+compare(p64_antireplay_sn_t sn, p64_antireplay_sn_t old)
 {
-    uint32_t index = sn_to_index(ar, sn);
-    p64_antireplay_sn_t old = __atomic_load_n(&ar->snv[index],
-					      __ATOMIC_RELAXED);
     if (sn > old)
     {
 	return p64_ar_pass;
@@ -93,23 +148,251 @@ p64_antireplay_test(p64_antireplay_t *ar,
     }
 }
 
+//Bitmap mode, check sequence number against window top and block word
+static inline p64_antireplay_result_t
+compare_bitmap(p64_antireplay_t *ar, p64_antireplay_sn_t sn, uint64_t word)
+{
+    uint64_t blk = sn >> BLK_SHIFT;
+    if (blk + ar->winmask < __atomic_load_n(&ar->top, __ATOMIC_RELAXED))
+    {
+	//Block is outside of window
+	return p64_ar_stale;
+    }
+    int32_t diff = (int32_t)((uint32_t)blk - TAG(word));
+    if (diff > 0)
+    {
+	//Newer block, not yet seen
+	return p64_ar_pass;
+    }
+    else if (diff == 0)
+    {
+	uint32_t bit = 1U << (sn % BLK_SIZE);
+	return (BITS(word) & bit) == 0 ? p64_ar_pass : p64_ar_replay;
+    }
+    else
+    {
+	//Word reused by newer block
+	return p64_ar_stale;
+    }
+}
+
+static inline uint64_t *
+sn_to_word(p64_antireplay_t *ar, p64_antireplay_sn_t sn)
+{
+    return &ar->snv[(sn >> BLK_SHIFT) & ar->winmask];
+}
+
+static p64_antireplay_result_t
+test_and_set_bitmap(p64_antireplay_t *ar,
+		    p64_antireplay_sn_t sn)
+{
+    uint64_t *loc = sn_to_word(ar, sn);
+    uint32_t tag = (uint32_t)(sn >> BLK_SHIFT);
+    uint32_t bit = 1U << (sn % BLK_SIZE);
+    uint64_t old = __atomic_load_n(loc, __ATOMIC_RELAXED);
+    uint64_t neu;
+    do
+    {
+	p64_antireplay_result_t res = compare_bitmap(ar, sn, old);
+	if (res != p64_ar_pass)
+	{
+	    return res;
+	}
+	if (TAG(old) == tag)
+	{
+	    //Set our bit in current block
+	    neu = old | bit;
+	}
+	else
+	{
+	    //Rotate in new block, clearing bits of the old block
+	    neu = WORD(tag, bit);
+	}
+    }
+    while (!__atomic_compare_exchange_n(loc,
+					&old,//Updated on failure
+					neu,
+					/*weak=*/true,
+					__ATOMIC_RELAXED,
+					__ATOMIC_RELAXED));
+    if (TAG(old) != tag)
+    {
+	//New block rotated in, advance window
+	(void)lockfree_fetch_umax_8(&ar->top, sn >> BLK_SHIFT,
+				    __ATOMIC_RELAXED);
+    }
+    return p64_ar_pass;
+}
+
+p64_antireplay_result_t
+p64_antireplay_test(p64_antireplay_t *ar,
+		    p64_antireplay_sn_t sn)
+{
+    if (ar->bitmap)
+    {
+	return compare_bitmap(ar, sn, __atomic_load_n(sn_to_word(ar, sn),
+						      __ATOMIC_RELAXED));
+    }
+    uint32_t index = sn_to_index(ar, sn);
+    p64_antireplay_sn_t old = __atomic_load_n(&ar->snv[index],
+					      __ATOMIC_RELAXED);
+    return compare(sn, old);
+}
+
 p64_antireplay_result_t
 p64_antireplay_test_and_set(p64_antireplay_t *ar,
 			    p64_antireplay_sn_t sn)
 {
+    if (ar->bitmap)
+    {
+	return test_and_set_bitmap(ar, sn);
+    }
     uint32_t index = sn_to_index(ar, sn);
     p64_antireplay_sn_t old = lockfree_fetch_umax_8(&ar->snv[index],
 						    sn, __ATOMIC_RELAXED);
-    if (sn > old)
+    return compare(sn, old);
+}
+
+//Update two adjacent entries snv[index] and snv[index + 1] using one
+//128-bit CAS, return the old values
+static inline union snpair
+fetch_umax_pair(p64_antireplay_t *ar,
+		uint32_t index,
+		p64_antireplay_sn_t max0,
+		p64_antireplay_sn_t max1)
+{
+    __int128 *loc = (__int128 *)&ar->snv[index];
+    union snpair old, neu;
+    old.sn[0] = __atomic_load_n(&ar->snv[index], __ATOMIC_RELAXED);
+    old.sn[1] = __atomic_load_n(&ar->snv[index + 1], __ATOMIC_RELAXED);
+    do
     {
-	return p64_ar_pass;
+	neu.sn[0] = max0 > old.sn[0] ? max0 : old.sn[0];
+	neu.sn[1] = max1 > old.sn[1] ? max1 : old.sn[1];
+	if (neu.sn[0] == old.sn[0] && neu.sn[1] == old.sn[1])
+	{
+	    //No update needed
+	    break;
+	}
     }
-    else if (sn == old)
+    while (!lockfree_compare_exchange_16(loc,
+					 &old.ui,//Updated on failure
+					 neu.ui,
+					 /*weak=*/true,
+					 __ATOMIC_RELAXED,
+					 __ATOMIC_RELAXED));
+    return old;
+}
+
+//Compute results for a group of sequence numbers which map to the same
+//entry, in original order as if each was tested and set separately
+static inline uint32_t
+resolve(const p64_antireplay_sn_t sns[],
+	const uint8_t order[],
+	uint32_t first,
+	uint32_t last,
+	p64_antireplay_sn_t old,
+	p64_antireplay_result_t results[])
+{
+    uint32_t npass = 0;
+    for (uint32_t i = first; i < last; i++)
     {
-	return p64_ar_replay;
+	p64_antireplay_sn_t sn = sns[order[i]];
+	results[order[i]] = compare(sn, old);
+	if (sn > old)
+	{
+	    old = sn;
+	    npass++;
+	}
     }
-    else
+    return npass;
+}
+
+static uint32_t
+test_and_set_batch(p64_antireplay_t *ar,
+		   const p64_antireplay_sn_t sns[],
+		   uint32_t num,
+		   p64_antireplay_result_t results[])
+{
+    uint32_t index[VEC_BATCH];
+    uint8_t order[VEC_BATCH];
+    for (uint32_t i = 0; i < num; i++)
     {
-	return p64_ar_stale;
+	index[i] = sn_to_index(ar, sns[i]);
+	PREFETCH_FOR_WRITE(&ar->snv[index[i]]);
+	//Insertion sort on index, stable so that sequence numbers which map
+	//to the same entry remain in original order
+	uint32_t j = i;
+	while (j > 0 && index[order[j - 1]] > index[i])
+	{
+	    order[j] = order[j - 1];
+	    j--;
+	}
+	order[j] = i;
+    }
+    uint32_t npass = 0;
+    uint32_t i = 0;
+    while (i < num)
+    {
+	//Find group of sequence numbers which map to the same entry
+	uint32_t idx = index[order[i]];
+	p64_antireplay_sn_t max = 0;
+	uint32_t j = i;
+	while (j < num && index[order[j]] == idx)
+	{
+	    max = sns[order[j]] > max ? sns[order[j]] : max;
+	    j++;
+	}
+	//Check for group which maps to the adjacent entry
+	if ((idx & 1) == 0 && j < num && index[order[j]] == idx + 1)
+	{
+	    p64_antireplay_sn_t max1 = 0;
+	    uint32_t k = j;
+	    while (k < num && index[order[k]] == idx + 1)
+	    {
+		max1 = sns[order[k]] > max1 ? sns[order[k]] : max1;
+		k++;
+	    }
+	    union snpair old = fetch_umax_pair(ar, idx, max, max1);
+	    npass += resolve(sns, order, i, j, old.sn[0], results);
+	    npass += resolve(sns, order, j, k, old.sn[1], results);
+	    i = k;
+	}
+	else
+	{
+	    p64_antireplay_sn_t old = lockfree_fetch_umax_8(&ar->snv[idx],
+							    max,
+							    __ATOMIC_RELAXED);
+	    npass += resolve(sns, order, i, j, old, results);
+	    i = j;
+	}
+    }
+    return npass;
+}
+
+uint32_t
+p64_antireplay_test_and_set_vec(p64_antireplay_t *ar,
+				const p64_antireplay_sn_t sns[],
+				uint32_t num,
+				p64_antireplay_result_t results[])
+{
+    uint32_t npass = 0;
+    if (ar->bitmap)
+    {
+	for (uint32_t i = 0; i < num; i++)
+	{
+	    results[i] = test_and_set_bitmap(ar, sns[i]);
+	    npass += results[i] == p64_ar_pass;
+	}
+	return npass;
+    }
+    while (num != 0)
+    {
+	uint32_t n = MIN(num, (uint32_t)VEC_BATCH);
+	npass += test_and_set_batch(ar, sns, n, results);
+	sns += n;
+	results += n;
+	num -= n;
     }
+    return npass;
 }
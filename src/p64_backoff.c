@@ -0,0 +1,34 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p64_backoff.h"
+#include "build_config.h"
+
+#include "backoff.h"
+
+p64_backoff_t p64_backoff_policy = { 0, 0, 0 };
+
+void
+p64_backoff_set(const p64_backoff_t *bo)
+{
+    if (UNLIKELY(bo->min > bo->max))
+    {
+	fprintf(stderr, "Invalid backoff min %u > max %u\n", bo->min, bo->max),
+	abort();
+    }
+    __atomic_store_n(&p64_backoff_policy.min, bo->min, __ATOMIC_RELAXED);
+    __atomic_store_n(&p64_backoff_policy.max, bo->max, __ATOMIC_RELAXED);
+    __atomic_store_n(&p64_backoff_policy.yield, bo->yield, __ATOMIC_RELAXED);
+}
+
+void
+p64_backoff_get(p64_backoff_t *bo)
+{
+    bo->min = __atomic_load_n(&p64_backoff_policy.min, __ATOMIC_RELAXED);
+    bo->max = __atomic_load_n(&p64_backoff_policy.max, __ATOMIC_RELAXED);
+    bo->yield = __atomic_load_n(&p64_backoff_policy.yield, __ATOMIC_RELAXED);
+}
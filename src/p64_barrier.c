@@ -3,11 +3,17 @@
 //SPDX-License-Identifier:        BSD-3-Clause
 
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 #include "p64_barrier.h"
+#include "p64_alloc.h"
 #include "build_config.h"
 
 #include "arch.h"
+#include "backoff.h"
+#include "common.h"
+#include "stats.h"
 
 void
 p64_barrier_init(p64_barrier_t *br, uint32_t numthreads)
@@ -37,11 +43,161 @@ p64_barrier_wait(p64_barrier_t *br)
     {
 	register uint32_t numthr = br->numthr;
 	uint32_t cur_lap = LAP(before, numthr);
+	uint64_t start = STAT_TIMESTAMP();
+	struct backoff bo;
+	backoff_init(&bo);
 	SEVL();
 	while (WFE() &&
 	       LAP(LDXR32(&br->waiting, __ATOMIC_ACQUIRE), numthr) == cur_lap)
 	{
-	    DOZE();
+	    backoff_wait(&bo);
 	}
+	STAT_ADD(STAT_BARRIER_WAIT, STAT_TIMESTAMP() - start);
+    }
+}
+
+#define NO_PARENT (~(uint32_t)0)
+//Max depth of tree, reached with fanout 2 and 2^32 threads
+#define MAXDEPTH 32
+
+struct node
+{
+    uint32_t count;//Number of arrivals in current episode
+    uint32_t sense;//Toggled when an episode completes
+    uint32_t expected;//Number of arrivals which completes an episode
+    uint32_t parent;//Index of parent node
+} ALIGNED(CACHE_LINE);
+
+struct p64_barrier_tree
+{
+    uint32_t numthr;
+    uint32_t fanout;
+    struct node nodes[] ALIGNED(CACHE_LINE);
+};
+
+static uint32_t
+num_nodes(uint32_t numthreads, uint32_t fanout)
+{
+    uint32_t nnodes = 0;
+    uint32_t nlevel = numthreads;
+    do
+    {
+	nlevel = (nlevel + fanout - 1) / fanout;
+	nnodes += nlevel;
+    }
+    while (nlevel > 1);
+    return nnodes;
+}
+
+p64_barrier_tree_t *
+p64_barrier_tree_alloc(uint32_t numthreads, uint32_t fanout)
+{
+    if (numthreads < 1)
+    {
+	fprintf(stderr, "Invalid number of threads %u\n", numthreads), abort();
+    }
+    if (fanout < 2)
+    {
+	fprintf(stderr, "Invalid fanout %u\n", fanout), abort();
+    }
+    uint32_t nnodes = num_nodes(numthreads, fanout);
+    size_t nbytes = ROUNDUP(sizeof(p64_barrier_tree_t) +
+			    nnodes * sizeof(struct node),
+			    CACHE_LINE);
+    p64_barrier_tree_t *br = p64_malloc(nbytes, CACHE_LINE,
+					P64_ALLOC_ANYNODE, 0);
+    if (br != NULL)
+    {
+	br->numthr = numthreads;
+	br->fanout = fanout;
+	//Nodes are stored level by level, leaves first
+	uint32_t first = 0;//Index of first node on current level
+	uint32_t nchild = numthreads;//Number of children of current level
+	do
+	{
+	    uint32_t nlevel = (nchild + fanout - 1) / fanout;
+	    for (uint32_t i = 0; i < nlevel; i++)
+	    {
+		struct node *n = &br->nodes[first + i];
+		n->count = 0;
+		n->sense = 0;
+		n->expected = MIN(fanout, nchild - i * fanout);
+		n->parent = nlevel > 1 ? first + nlevel + i / fanout : NO_PARENT;
+	    }
+	    first += nlevel;
+	    nchild = nlevel;
+	}
+	while (nchild > 1);
+	return br;
+    }
+    return NULL;
+}
+
+void
+p64_barrier_tree_free(p64_barrier_tree_t *br)
+{
+    p64_mfree(br);
+}
+
+void
+p64_barrier_tree_wait(p64_barrier_tree_t *br, uint32_t tidx)
+{
+    if (UNLIKELY(tidx >= br->numthr))
+    {
+	fprintf(stderr, "Invalid thread index %u\n", tidx), abort();
+    }
+    //Nodes where we were the last thread to arrive, these we must release
+    struct node *won[MAXDEPTH];
+    uint32_t sense[MAXDEPTH];
+    uint32_t depth = 0;
+    uint32_t idx = tidx / br->fanout;
+    for (;;)
+    {
+	struct node *n = &br->nodes[idx];
+	//Read sense before arriving, the node cannot be released before we
+	//have arrived
+	uint32_t s = __atomic_load_n(&n->sense, __ATOMIC_ACQUIRE);
+	uint32_t before = __atomic_fetch_add(&n->count, 1, __ATOMIC_ACQ_REL);
+	if (before + 1 == n->expected)
+	{
+	    //Last to arrive, reset node for next episode and continue up
+	    //No other thread will arrive before the node has been released
+	    __atomic_store_n(&n->count, 0, __ATOMIC_RELAXED);
+	    won[depth] = n;
+	    sense[depth] = s;
+	    depth++;
+	    if (n->parent == NO_PARENT)
+	    {
+		//Last thread to arrive at root
+		break;
+	    }
+	    idx = n->parent;
+	}
+	else
+	{
+	    //Wait for the last thread to arrive to release the node
+	    //Only threads arriving at the same node spin on the same flag
+	    uint64_t start = STAT_TIMESTAMP();
+	    struct backoff bo;
+	    backoff_init(&bo);
+	    SEVL();
+	    while (WFE() && LDXR32(&n->sense, __ATOMIC_ACQUIRE) == s)
+	    {
+		backoff_wait(&bo);
+	    }
+	    STAT_ADD(STAT_BARRIER_WAIT, STAT_TIMESTAMP() - start);
+	    break;
+	}
+    }
+    //Release nodes we won, top-down
+    while (depth-- != 0)
+    {
+	//Release also orders the reset of the node count
+#ifdef USE_DMB
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&won[depth]->sense, sense[depth] ^ 1, __ATOMIC_RELAXED);
+#else
+	__atomic_store_n(&won[depth]->sense, sense[depth] ^ 1, __ATOMIC_RELEASE);
+#endif
     }
 }
@@ -0,0 +1,185 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p64_brlock.h"
+#include "p64_alloc.h"
+#include "build_config.h"
+
+#include "arch.h"
+#include "common.h"
+#include "stats.h"
+
+struct slot
+{
+    uint32_t nreaders;
+} ALIGNED(CACHE_LINE);
+
+struct p64_brlock
+{
+    uint32_t writer ALIGNED(CACHE_LINE);
+    uint32_t nslots;
+    struct slot slots[] ALIGNED(CACHE_LINE);
+};
+
+p64_brlock_t *
+p64_brlock_alloc(uint32_t nslots)
+{
+    if (nslots < 1)
+    {
+	fprintf(stderr, "Invalid number of reader slots %u\n", nslots), abort();
+    }
+    size_t nbytes = ROUNDUP(sizeof(p64_brlock_t) + nslots * sizeof(struct slot),
+			    CACHE_LINE);
+    p64_brlock_t *lock = p64_malloc(nbytes, CACHE_LINE, P64_ALLOC_ANYNODE, 0);
+    if (lock != NULL)
+    {
+	lock->writer = 0;
+	lock->nslots = nslots;
+	for (uint32_t i = 0; i < nslots; i++)
+	{
+	    lock->slots[i].nreaders = 0;
+	}
+	return lock;
+    }
+    return NULL;
+}
+
+void
+p64_brlock_free(p64_brlock_t *lock)
+{
+    if (lock != NULL)
+    {
+	if (lock->writer != 0)
+	{
+	    fprintf(stderr, "Big reader lock %p is locked\n", lock), abort();
+	}
+	for (uint32_t i = 0; i < lock->nslots; i++)
+	{
+	    if (lock->slots[i].nreaders != 0)
+	    {
+		fprintf(stderr, "Big reader lock %p has readers\n", lock);
+		abort();
+	    }
+	}
+	p64_mfree(lock);
+    }
+}
+
+//Thread index, used to select reader slot
+static __thread uint32_t thread_idx = ~0U;
+
+static inline struct slot *
+my_slot(p64_brlock_t *lock)
+{
+    if (UNLIKELY(thread_idx == ~0U))
+    {
+	static uint32_t next_idx = 0;
+	thread_idx = __atomic_fetch_add(&next_idx, 1, __ATOMIC_RELAXED);
+    }
+    return &lock->slots[thread_idx % lock->nslots];
+}
+
+static inline void
+wait_for_no_writer(p64_brlock_t *lock)
+{
+    if (__atomic_load_n(&lock->writer, __ATOMIC_RELAXED) != 0)
+    {
+	uint64_t start = STAT_TIMESTAMP();
+	SEVL();
+	while (WFE() && LDXR32(&lock->writer, __ATOMIC_RELAXED) != 0)
+	{
+	    DOZE();
+	}
+	STAT_ADD(STAT_BRLOCK_WAIT, STAT_TIMESTAMP() - start);
+    }
+}
+
+void
+p64_brlock_acquire_rd(p64_brlock_t *lock)
+{
+    struct slot *slot = my_slot(lock);
+    for (;;)
+    {
+	//Announce our presence in our own slot
+	__atomic_fetch_add(&slot->nreaders, 1, __ATOMIC_RELAXED);
+	//Order slot update before check of writer flag
+	smp_fence(StoreLoad);
+	if (LIKELY(__atomic_load_n(&lock->writer, __ATOMIC_ACQUIRE) == 0))
+	{
+	    //No writer present, read lock acquired
+	    return;
+	}
+	//Writer present, back off and wait for writer to go away
+	__atomic_fetch_sub(&slot->nreaders, 1, __ATOMIC_RELAXED);
+	STAT_INC(STAT_BRLOCK_RETRY);
+	wait_for_no_writer(lock);
+    }
+}
+
+void
+p64_brlock_release_rd(p64_brlock_t *lock)
+{
+    struct slot *slot = my_slot(lock);
+    //Decrement number of readers, release our (read) accesses
+    uint32_t prev = __atomic_fetch_sub(&slot->nreaders, 1, __ATOMIC_RELEASE);
+    if (UNLIKELY(prev == 0))
+    {
+	fprintf(stderr, "Invalid read release of BR lock %p\n", lock), abort();
+    }
+}
+
+void
+p64_brlock_acquire_wr(p64_brlock_t *lock)
+{
+    //Acquire writer flag, excluding other writers and new readers
+    uint32_t old;
+    do
+    {
+	wait_for_no_writer(lock);
+	old = 0;
+    }
+    while (!__atomic_compare_exchange_n(&lock->writer, &old, 1,
+					/*weak=*/true,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED) &&
+	   STAT_RETRY(STAT_BRLOCK_RETRY));
+    //Order writer flag update before check of reader slots
+    smp_fence(StoreLoad);
+    //Wait for present readers to drain from all slots
+    for (uint32_t i = 0; i < lock->nslots; i++)
+    {
+	uint32_t *nreaders = &lock->slots[i].nreaders;
+	if (__atomic_load_n(nreaders, __ATOMIC_ACQUIRE) != 0)
+	{
+	    uint64_t start = STAT_TIMESTAMP();
+	    SEVL();
+	    while (WFE() && LDXR32(nreaders, __ATOMIC_ACQUIRE) != 0)
+	    {
+		DOZE();
+	    }
+	    STAT_ADD(STAT_BRLOCK_WAIT, STAT_TIMESTAMP() - start);
+	}
+    }
+}
+
+void
+p64_brlock_release_wr(p64_brlock_t *lock)
+{
+    if (UNLIKELY(lock->writer == 0))
+    {
+	fprintf(stderr, "Invalid write release of BR lock %p\n", lock), abort();
+    }
+    //Clear writer flag
+#ifdef USE_DMB
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&lock->writer, 0, __ATOMIC_RELAXED);
+#else
+    __atomic_store_n(&lock->writer, 0, __ATOMIC_RELEASE);
+#endif
+}
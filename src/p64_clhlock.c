@@ -4,15 +4,23 @@
 // Original implementation by Brian Brooks @ ARM
 
 #include <assert.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "p64_clhlock.h"
+#include "p64_alloc.h"
 #include "build_config.h"
 
 #include "common.h"
 #include "arch.h"
+#include "stats.h"
+
+//Values of the wait field
+#define CLH_FREE 0 //Lock released
+#define CLH_WAIT 1 //Lock held or waiting for lock
+#define CLH_PASS 2 //Lock released, global (cohort) lock passed to successor
 
 struct p64_clhnode
 {
@@ -23,24 +31,80 @@ struct p64_clhnode
 static p64_clhnode_t *
 alloc_clhnode(void)
 {
-    p64_clhnode_t *node = aligned_alloc(CACHE_LINE, sizeof(p64_clhnode_t));
+    //Each node in its own cache line
+    p64_clhnode_t *node = aligned_alloc(CACHE_LINE,
+					ROUNDUP(sizeof(p64_clhnode_t),
+						CACHE_LINE));
     if (node == NULL)
     {
 	perror("aligned_alloc");
 	exit(EXIT_FAILURE);
     }
     node->prev = NULL;
-    __atomic_store_n(&node->wait, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&node->wait, CLH_WAIT, __ATOMIC_RELAXED);
     __atomic_thread_fence(__ATOMIC_RELEASE);
     return node;
 }
 
+//Per-thread pool of free nodes linked using the prev field
+//Nodes in the pool are owned by the thread and freed when the thread exits
+static __thread p64_clhnode_t *node_pool = NULL;
+static pthread_key_t pool_key;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+static void
+pool_destructor(void *ptr)
+{
+    p64_clhnode_t **pool = ptr;
+    while (*pool != NULL)
+    {
+	p64_clhnode_t *node = *pool;
+	*pool = node->prev;
+	free(node);
+    }
+}
+
+static void
+pool_init(void)
+{
+    if (pthread_key_create(&pool_key, pool_destructor) != 0)
+    {
+	perror("pthread_key_create"), abort();
+    }
+}
+
+static p64_clhnode_t *
+pool_get(void)
+{
+    p64_clhnode_t *node = node_pool;
+    if (LIKELY(node != NULL))
+    {
+	node_pool = node->prev;
+	node->prev = NULL;
+	return node;
+    }
+    //Pool empty, register destructor for this thread's pool
+    pthread_once(&pool_once, pool_init);
+    if (pthread_setspecific(pool_key, &node_pool) != 0)
+    {
+	perror("pthread_setspecific"), abort();
+    }
+    return alloc_clhnode();
+}
+
+static inline void
+pool_put(p64_clhnode_t *node)
+{
+    node->prev = node_pool;
+    node_pool = node;
+}
+
 void
 p64_clhlock_init(p64_clhlock_t *lock)
 {
     lock->tail = alloc_clhnode();
     lock->tail->prev = NULL;
-    __atomic_store_n(&lock->tail->wait, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&lock->tail->wait, CLH_FREE, __ATOMIC_RELAXED);
 }
 
 void
@@ -49,57 +113,195 @@ p64_clhlock_fini(p64_clhlock_t *lock)
     free(lock->tail);
 }
 
-void
-p64_clhlock_acquire(p64_clhlock_t *lock, p64_clhnode_t **nodep)
+//Return the wait value written by the previous lock owner
+static inline uint32_t
+clh_acquire(p64_clhlock_t *lock, p64_clhnode_t *node)
 {
     PREFETCH_FOR_WRITE(&lock->tail);
 
-    //When called first time, we will not have a node yet so allocate one
-    if (*nodep == NULL)
-    {
-	*nodep = alloc_clhnode();
-    }
-    assert((*nodep)->wait == 1);
+    assert(node->wait == CLH_WAIT);
 
     //Insert our node last in queue, get back previous last (tail) node
     p64_clhnode_t *prev = __atomic_exchange_n(&lock->tail,
-					      *nodep,
+					      node,
 					      __ATOMIC_ACQUIRE);
 
     //Save previous node in (what is still) "our" node for later use
-    (*nodep)->prev = prev;
+    node->prev = prev;
 
     //Wait for previous thread to signal us (using their node)
-    if (__atomic_load_n(&prev->wait, __ATOMIC_ACQUIRE))
+    uint32_t wait;
+    if ((wait = __atomic_load_n(&prev->wait, __ATOMIC_ACQUIRE)) == CLH_WAIT)
     {
+	uint64_t start = STAT_TIMESTAMP();
 	SEVL();
-	while (WFE() && LDXR32(&prev->wait, __ATOMIC_ACQUIRE))
+	while (WFE() &&
+	       (wait = LDXR32(&prev->wait, __ATOMIC_ACQUIRE)) == CLH_WAIT)
 	{
 	    DOZE();
 	}
+	STAT_ADD(STAT_CLHLOCK_WAIT, STAT_TIMESTAMP() - start);
     }
     //Now we own the previous node
 
     //Ensure the next thread will wait for us
-    __atomic_store_n(&prev->wait, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&prev->wait, CLH_WAIT, __ATOMIC_RELAXED);
+    return wait;
 }
 
-void
-p64_clhlock_release(p64_clhnode_t **nodep)
+//Return the previous node which is now owned by the caller
+static inline p64_clhnode_t *
+clh_release(p64_clhnode_t *node, uint32_t wait)
 {
     //Read previous node, it will become our new node
-    p64_clhnode_t *prev = (*nodep)->prev;
+    p64_clhnode_t *prev = node->prev;
 
     //Signal any (current or future) thread that waits for us using "our"
     //old node
 #ifdef USE_DMB
     __atomic_thread_fence(__ATOMIC_RELEASE);
-    __atomic_store_n(&(*nodep)->wait, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&node->wait, wait, __ATOMIC_RELAXED);
 #else
-    __atomic_store_n(&(*nodep)->wait, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&node->wait, wait, __ATOMIC_RELEASE);
 #endif
     //Now when we have signaled the next thread, it will own "our" old node
+    return prev;
+}
+
+void
+p64_clhlock_acquire(p64_clhlock_t *lock, p64_clhnode_t **nodep)
+{
+    //When called first time, we will not have a node yet so allocate one
+    if (*nodep == NULL)
+    {
+	*nodep = alloc_clhnode();
+    }
+    (void)clh_acquire(lock, *nodep);
+}
 
+void
+p64_clhlock_release(p64_clhnode_t **nodep)
+{
     //Save our new node for later use
-    *nodep = prev;
+    *nodep = clh_release(*nodep, CLH_FREE);
+}
+
+void
+p64_clhlock_acquire_pooled(p64_clhlock_t *lock, p64_clhnode_t **nodep)
+{
+    *nodep = pool_get();
+    (void)clh_acquire(lock, *nodep);
+}
+
+void
+p64_clhlock_release_pooled(p64_clhnode_t **nodep)
+{
+    pool_put(clh_release(*nodep, CLH_FREE));
+    *nodep = NULL;
+}
+
+struct cohort
+{
+    p64_clhlock_t local;//Lock for threads on this NUMA node
+    p64_clhnode_t *lnode;//Local lock node of current owner
+    p64_clhnode_t *gnode;//Node used by the cohort for the global lock
+    uint32_t handoffs;//Number of consecutive local handoffs
+} ALIGNED(CACHE_LINE);
+
+struct p64_clhcohort
+{
+    p64_clhlock_t global;
+    uint32_t ncohorts;
+    uint32_t maxhandoff;
+    struct cohort cohorts[] ALIGNED(CACHE_LINE);
+};
+
+p64_clhcohort_t *
+p64_clhcohort_alloc(uint32_t nnodes, uint32_t maxhandoff)
+{
+    if (nnodes < 1)
+    {
+	fprintf(stderr, "Invalid number of NUMA nodes %u\n", nnodes), abort();
+    }
+    size_t nbytes = ROUNDUP(sizeof(p64_clhcohort_t) +
+			    nnodes * sizeof(struct cohort), CACHE_LINE);
+    p64_clhcohort_t *lock = p64_malloc(nbytes, CACHE_LINE,
+				       P64_ALLOC_ANYNODE, 0);
+    if (lock != NULL)
+    {
+	p64_clhlock_init(&lock->global);
+	lock->ncohorts = nnodes;
+	lock->maxhandoff = maxhandoff;
+	for (uint32_t i = 0; i < nnodes; i++)
+	{
+	    p64_clhlock_init(&lock->cohorts[i].local);
+	    lock->cohorts[i].lnode = NULL;
+	    lock->cohorts[i].gnode = NULL;
+	    lock->cohorts[i].handoffs = 0;
+	}
+	return lock;
+    }
+    return NULL;
+}
+
+void
+p64_clhcohort_free(p64_clhcohort_t *lock)
+{
+    if (lock != NULL)
+    {
+	for (uint32_t i = 0; i < lock->ncohorts; i++)
+	{
+	    p64_clhlock_fini(&lock->cohorts[i].local);
+	    free(lock->cohorts[i].gnode);
+	}
+	p64_clhlock_fini(&lock->global);
+	p64_mfree(lock);
+    }
+}
+
+static inline struct cohort *
+get_cohort(p64_clhcohort_t *lock, uint32_t node)
+{
+    if (UNLIKELY(node >= lock->ncohorts))
+    {
+	fprintf(stderr, "Invalid NUMA node %u\n", node), abort();
+    }
+    return &lock->cohorts[node];
+}
+
+void
+p64_clhcohort_acquire(p64_clhcohort_t *lock, uint32_t node)
+{
+    struct cohort *co = get_cohort(lock, node);
+    p64_clhnode_t *lnode = pool_get();
+    if (clh_acquire(&co->local, lnode) != CLH_PASS)
+    {
+	//Global lock not passed from previous owner in cohort, acquire it
+	p64_clhlock_acquire(&lock->global, &co->gnode);
+    }
+    co->lnode = lnode;
+}
+
+void
+p64_clhcohort_release(p64_clhcohort_t *lock, uint32_t node)
+{
+    struct cohort *co = get_cohort(lock, node);
+    p64_clhnode_t *lnode = co->lnode;
+    co->lnode = NULL;
+    uint32_t wait;
+    if (__atomic_load_n(&co->local.tail, __ATOMIC_RELAXED) != lnode &&
+	co->handoffs < lock->maxhandoff)
+    {
+	//Local thread waiting, pass global lock to it
+	co->handoffs++;
+	wait = CLH_PASS;
+    }
+    else
+    {
+	//No local waiters or too many local handoffs, release global lock
+	co->handoffs = 0;
+	p64_clhlock_release(&co->gnode);
+	wait = CLH_FREE;
+    }
+    pool_put(clh_release(lnode, wait));
 }
@@ -0,0 +1,193 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "p64_counter.h"
+#include "p64_alloc.h"
+#include "build_config.h"
+
+#include "common.h"
+
+struct p64_counter
+{
+    uint32_t ncounters;
+    uint32_t stride;//Counters per thread slot, a multiple of a cache line
+    uint64_t *base;//Counter values at last reset
+    uint64_t slots[] ALIGNED(CACHE_LINE);//MAXTHREADS * stride counters
+};
+
+//Number of thread indexes ever assigned, readers sum slots below this
+static uint32_t tidx_counter = 0;
+
+//Which thread indexes are owned by a registered thread?
+static uint32_t slot_inuse[MAXTHREADS];
+
+//Index of this thread's slot, assigned on registration
+static __thread uint32_t TIDX = MAXTHREADS;
+
+void
+p64_counter_register(void)
+{
+    if (TIDX != MAXTHREADS)
+    {
+	//Already registered
+	return;
+    }
+    //Recycle the first free index, the slots of an unregistered thread keep
+    //their values so counter sums are unaffected by reuse
+    for (uint32_t tidx = 0; tidx < MAXTHREADS; tidx++)
+    {
+	//Acquire order to see the final updates of the previous owner
+	if (__atomic_load_n(&slot_inuse[tidx], __ATOMIC_RELAXED) == 0 &&
+	    __atomic_exchange_n(&slot_inuse[tidx], 1, __ATOMIC_ACQUIRE) == 0)
+	{
+	    uint32_t old = __atomic_load_n(&tidx_counter, __ATOMIC_RELAXED);
+	    while (old <= tidx &&
+		   !__atomic_compare_exchange_n(&tidx_counter,
+						&old,//Updated on failure
+						tidx + 1,
+						/*weak=*/true,
+						__ATOMIC_RELAXED,
+						__ATOMIC_RELAXED))
+	    {
+		//Extend the range of slots summed by readers
+	    }
+	    TIDX = tidx;
+	    return;
+	}
+    }
+    fprintf(stderr, "Too many threads using counters\n"), abort();
+}
+
+void
+p64_counter_unregister(void)
+{
+    if (TIDX == MAXTHREADS)
+    {
+	return;
+    }
+    //Release order so that our updates are seen by the next owner
+    __atomic_store_n(&slot_inuse[TIDX], 0, __ATOMIC_RELEASE);
+    TIDX = MAXTHREADS;
+}
+
+static inline uint32_t
+thread_index(void)
+{
+    if (UNLIKELY(TIDX == MAXTHREADS))
+    {
+	p64_counter_register();
+    }
+    return TIDX;
+}
+
+p64_counter_t *
+p64_counter_alloc(uint32_t ncounters)
+{
+    if (ncounters == 0)
+    {
+	fprintf(stderr, "Invalid number of counters %u\n", ncounters), abort();
+    }
+    uint32_t stride = ROUNDUP(ncounters, CACHE_LINE / sizeof(uint64_t));
+    size_t sz_slots = (size_t)MAXTHREADS * stride * sizeof(uint64_t);
+    size_t sz_base = ROUNDUP(ncounters * sizeof(uint64_t), CACHE_LINE);
+    size_t sz = sizeof(p64_counter_t) + sz_slots + sz_base;
+    p64_counter_t *cnt = p64_malloc(sz, CACHE_LINE, P64_ALLOC_ANYNODE, 0);
+    if (cnt != NULL)
+    {
+	memset(cnt, 0, sz);
+	cnt->ncounters = ncounters;
+	cnt->stride = stride;
+	cnt->base = (uint64_t *)((char *)cnt->slots + sz_slots);
+    }
+    return cnt;
+}
+
+void
+p64_counter_free(p64_counter_t *cnt)
+{
+    p64_mfree(cnt);
+}
+
+static inline void
+check_index(p64_counter_t *cnt, uint32_t idx, uint32_t num)
+{
+    if (UNLIKELY(idx >= cnt->ncounters || num > cnt->ncounters - idx))
+    {
+	fprintf(stderr, "Invalid counter index %u\n", idx), abort();
+    }
+}
+
+static inline void
+add_local(uint64_t *slot, uint64_t val)
+{
+    //Only this thread writes to its slot, readers may load concurrently
+    __atomic_store_n(slot,
+		     __atomic_load_n(slot, __ATOMIC_RELAXED) + val,
+		     __ATOMIC_RELAXED);
+}
+
+void
+p64_counter_add(p64_counter_t *cnt,
+		uint32_t idx,
+		uint64_t val)
+{
+    check_index(cnt, idx, 1);
+    uint64_t *slot = &cnt->slots[thread_index() * cnt->stride];
+    add_local(&slot[idx], val);
+}
+
+void
+p64_counter_add_vec(p64_counter_t *cnt,
+		    uint32_t first,
+		    const uint64_t vals[],
+		    uint32_t num)
+{
+    check_index(cnt, first, num);
+    uint64_t *slot = &cnt->slots[thread_index() * cnt->stride + first];
+    for (uint32_t i = 0; i < num; i++)
+    {
+	add_local(&slot[i], vals[i]);
+    }
+}
+
+static uint64_t
+sum_slots(p64_counter_t *cnt, uint32_t idx)
+{
+    uint32_t nthreads = __atomic_load_n(&tidx_counter, __ATOMIC_RELAXED);
+    nthreads = MIN(nthreads, MAXTHREADS);
+    uint64_t sum = 0;
+    for (uint32_t t = 0; t < nthreads; t++)
+    {
+	sum += __atomic_load_n(&cnt->slots[t * cnt->stride + idx],
+			       __ATOMIC_RELAXED);
+    }
+    return sum;
+}
+
+uint64_t
+p64_counter_read(p64_counter_t *cnt,
+		 uint32_t idx)
+{
+    check_index(cnt, idx, 1);
+    //Load base before summing, acquire order synchronizes with the reset
+    //so that the slots loaded below are at least as large as those summed
+    //into the base, the difference then cannot wrap
+    uint64_t base = __atomic_load_n(&cnt->base[idx], __ATOMIC_ACQUIRE);
+    return sum_slots(cnt, idx) - base;
+}
+
+void
+p64_counter_reset(p64_counter_t *cnt,
+		  uint32_t idx)
+{
+    check_index(cnt, idx, 1);
+    //Slots are only written by their threads, remember the current sum
+    //Release order for the loads of the slots, see p64_counter_read()
+    __atomic_store_n(&cnt->base[idx], sum_slots(cnt, idx), __ATOMIC_RELEASE);
+}
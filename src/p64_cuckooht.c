@@ -0,0 +1,489 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Bucketized cuckoo hash table
+//
+//An element with hash value H can be stored in bucket B0 (low bits of H) or
+//B1 (high bits of H). Each cell holds the element pointer and the hash value
+//so keys are only compared when the stored hash matches.
+//
+//When both buckets of a new element are full, a breadth-first search finds a
+//path of elements which can be displaced to their alternate buckets. The path
+//is executed from its free end so that each displaced element is copied to
+//its destination cell before it is cleared from its source cell. A displaced
+//element is therefore always present somewhere, but a lookup which searches
+//the destination before the copy and the source after the clear would still
+//miss it. Every bucket has a change counter which is incremented between the
+//copy and the clear; lookups read both counters before and after searching
+//and retry if any counter changed.
+//
+//The source cell is marked before it is copied so that a concurrent removal
+//cannot remove the source while the copy is made (and leave the copy behind).
+//Removals wait for any displacement of their element to complete.
+//Displacements are serialised by a lock, all other operations are lock-free.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "p64_cuckooht.h"
+#include "p64_alloc.h"
+#undef p64_cuckooht_lookup
+#include "p64_hazardptr.h"
+#include "p64_spinlock.h"
+#include "build_config.h"
+
+#include "arch.h"
+#include "backoff.h"
+#include "common.h"
+#include "lockfree.h"
+#include "stats.h"
+
+#define MARK_MOVE 1UL
+#define HAS_MARK(ptr) (((uintptr_t)(ptr) & MARK_MOVE) != 0)
+#define SET_MARK(ptr) (void *)((uintptr_t)(ptr) |  MARK_MOVE)
+#define REM_MARK(ptr) (void *)((uintptr_t)(ptr) & ~MARK_MOVE)
+
+//CACHE_LINE == 64, __SIZEOF_POINTER__ == 8 => BKT_SIZE == 3
+#define BKT_SIZE ((CACHE_LINE - 2 * __SIZEOF_POINTER__) / (2 * __SIZEOF_POINTER__))
+
+#if BKT_SIZE != P64_CUCKOOHT_BKTSIZE
+#error Unsupported bucket size
+#endif
+
+#if __SIZEOF_POINTER__ == 8
+typedef __int128 uintptr_pair_t;
+#define lockfree_compare_exchange_pair lockfree_compare_exchange_16
+#define lockfree_store_pair lockfree_store_16
+#endif
+
+struct cell
+{
+    p64_hashvalue_t hash;
+    void *elem;
+};
+
+union cellui
+{
+    struct cell c;
+    uintptr_pair_t ui;
+};
+
+struct bucket
+{
+    uint32_t chgcnt;//Incremented when an element is moved out of the bucket
+    uint32_t pad[(2 * __SIZEOF_POINTER__ - sizeof(uint32_t)) / sizeof(uint32_t)];
+    struct cell cells[BKT_SIZE];
+} ALIGNED(CACHE_LINE);
+
+struct p64_cuckooht
+{
+    uint32_t mask;//Number of buckets - 1
+    p64_spinlock_t lock;//Serialises displacements
+    struct bucket buckets[] ALIGNED(CACHE_LINE);
+};
+
+p64_cuckooht_t *
+p64_cuckooht_alloc(uint32_t nelems)
+{
+    //Leave some slack so that 'nelems' elements can be inserted without
+    //exceeding ~90% occupancy
+    size_t nbkts = (nelems + nelems / 8 + BKT_SIZE - 1) / BKT_SIZE;
+    nbkts = nbkts < 2 ? 2 : ROUNDUP_POW2(nbkts);
+    size_t sz = sizeof(p64_cuckooht_t) + nbkts * sizeof(struct bucket);
+    p64_cuckooht_t *ht = p64_malloc(ROUNDUP(sz, CACHE_LINE), CACHE_LINE,
+				    P64_ALLOC_ANYNODE, 0);
+    if (ht != NULL)
+    {
+	memset(ht, 0, sz);
+	ht->mask = nbkts - 1;
+	p64_spinlock_init(&ht->lock);
+	//All cells already cleared
+    }
+    return ht;
+}
+
+void
+p64_cuckooht_free(p64_cuckooht_t *ht)
+{
+    if (ht != NULL)
+    {
+#ifndef NDEBUG
+	for (uint32_t i = 0; i <= ht->mask; i++)
+	{
+	    for (uint32_t j = 0; j < BKT_SIZE; j++)
+	    {
+		if (ht->buckets[i].cells[j].elem != NULL)
+		{
+		    fprintf(stderr, "Cuckoo hash table %p is not empty\n", ht),
+		    abort();
+		}
+	    }
+	}
+#endif
+	p64_mfree(ht);
+    }
+}
+
+static inline uint32_t
+bucket_index0(p64_cuckooht_t *ht, p64_hashvalue_t hash)
+{
+    return hash & ht->mask;
+}
+
+static inline uint32_t
+bucket_index1(p64_cuckooht_t *ht, p64_hashvalue_t hash)
+{
+    uint32_t bix0 = hash & ht->mask;
+    uint32_t bix1 = (hash >> 32) & ht->mask;
+    //The two buckets must differ
+    return bix1 != bix0 ? bix1 : bix0 ^ 1;
+}
+
+static inline void *
+bucket_lookup(struct bucket *bkt,
+	      p64_cuckooht_compare cf,
+	      const void *key,
+	      p64_hashvalue_t hash,
+	      p64_hazardptr_t *hazpp)
+{
+    for (uint32_t i = 0; i < BKT_SIZE; i++)
+    {
+	if (__atomic_load_n(&bkt->cells[i].hash, __ATOMIC_RELAXED) == hash)
+	{
+	    //Cell may have changed since hash value was read, compare key of
+	    //whatever element we got a reference to
+	    void *elem = REM_MARK(p64_hazptr_acquire(&bkt->cells[i].elem,
+						     hazpp));
+	    if (elem != NULL && cf(elem, key) == 0)
+	    {
+		return elem;
+	    }
+	}
+    }
+    return NULL;
+}
+
+void *
+p64_cuckooht_lookup(p64_cuckooht_t *ht,
+		    p64_cuckooht_compare cf,
+		    const void *key,
+		    p64_hashvalue_t hash,
+		    p64_hazardptr_t *hazpp)
+{
+    struct bucket *bkt0 = &ht->buckets[bucket_index0(ht, hash)];
+    struct bucket *bkt1 = &ht->buckets[bucket_index1(ht, hash)];
+    PREFETCH_FOR_READ(bkt0);
+    PREFETCH_FOR_READ(bkt1);
+    do
+    {
+	//Acquire MO: if we see a change, we also see the copied element
+	uint32_t chg0 = __atomic_load_n(&bkt0->chgcnt, __ATOMIC_ACQUIRE);
+	uint32_t chg1 = __atomic_load_n(&bkt1->chgcnt, __ATOMIC_ACQUIRE);
+	void *elem = bucket_lookup(bkt0, cf, key, hash, hazpp);
+	if (elem == NULL)
+	{
+	    elem = bucket_lookup(bkt1, cf, key, hash, hazpp);
+	}
+	if (elem != NULL)
+	{
+	    return elem;
+	}
+	//Cells must be read before change counters are re-read
+	smp_fence(LoadLoad);
+	if (__atomic_load_n(&bkt0->chgcnt, __ATOMIC_RELAXED) == chg0 &&
+	    __atomic_load_n(&bkt1->chgcnt, __ATOMIC_RELAXED) == chg1)
+	{
+	    //No element moved out of our buckets during the search
+	    return NULL;
+	}
+	//Element might have been moved from the bucket searched last to the
+	//bucket searched first
+    }
+    while (STAT_RETRY(STAT_CUCKOOHT_RETRY));
+    return NULL;
+}
+
+static inline bool
+bucket_insert(struct bucket *bkt,
+	      void *elem,
+	      p64_hashvalue_t hash)
+{
+    for (uint32_t i = 0; i < BKT_SIZE; i++)
+    {
+	if (__atomic_load_n(&bkt->cells[i].elem, __ATOMIC_RELAXED) == NULL)
+	{
+	    union cellui old = { .c.hash = 0, .c.elem = NULL };
+	    union cellui neu = { .c.hash = hash, .c.elem = elem };
+	    //Release MO: make element contents visible
+	    if (lockfree_compare_exchange_pair((uintptr_pair_t *)&bkt->cells[i],
+					       &old.ui,
+					       neu.ui,
+					       /*weak=*/false,
+					       __ATOMIC_RELEASE,
+					       __ATOMIC_RELAXED))
+	    {
+		return true;
+	    }
+	}
+    }
+    return false;
+}
+
+//Move element in src cell to (empty) dst cell
+//Return false if either cell changed
+static bool
+move_cell(p64_cuckooht_t *ht,
+	  uint32_t srcbix,
+	  uint32_t srcidx,
+	  uint32_t dstbix,
+	  uint32_t dstidx)
+{
+    struct bucket *src = &ht->buckets[srcbix];
+    struct cell *srccell = &src->cells[srcidx];
+    struct cell *dstcell = &ht->buckets[dstbix].cells[dstidx];
+    union cellui old;
+    old.c.elem = __atomic_load_n(&srccell->elem, __ATOMIC_RELAXED);
+    old.c.hash = __atomic_load_n(&srccell->hash, __ATOMIC_RELAXED);
+    if (old.c.elem == NULL)
+    {
+	//Element removed, source cell is already free
+	return true;
+    }
+    if (HAS_MARK(old.c.elem) ||
+	(bucket_index0(ht, old.c.hash) != dstbix &&
+	 bucket_index1(ht, old.c.hash) != dstbix))
+    {
+	//Cell changed since path was computed
+	return false;
+    }
+    //Mark source cell so that the element cannot be removed while it is
+    //being moved
+    //Acquire MO: synchronize with the insertion of the element
+    union cellui mrk = { .c.hash = old.c.hash, .c.elem = SET_MARK(old.c.elem) };
+    if (!lockfree_compare_exchange_pair((uintptr_pair_t *)srccell,
+					&old.ui,
+					mrk.ui,
+					/*weak=*/false,
+					__ATOMIC_ACQUIRE,
+					__ATOMIC_RELAXED))
+    {
+	return false;
+    }
+    //Release MO: make element contents visible to readers of dst cell
+    union cellui emp = { .c.hash = 0, .c.elem = NULL };
+    if (!lockfree_compare_exchange_pair((uintptr_pair_t *)dstcell,
+					&emp.ui,
+					old.ui,
+					/*weak=*/false,
+					__ATOMIC_RELEASE,
+					__ATOMIC_RELAXED))
+    {
+	//Destination cell taken by insertion, restore source cell
+	//Only we can update a marked cell
+	lockfree_store_pair((uintptr_pair_t *)srccell, old.ui, __ATOMIC_RELAXED);
+	return false;
+    }
+    //Release MO: copy must be visible before the change
+    __atomic_fetch_add(&src->chgcnt, 1, __ATOMIC_RELEASE);
+    //Release MO: change must be visible before the source cell is cleared
+    emp.c.hash = 0;
+    emp.c.elem = NULL;
+    lockfree_store_pair((uintptr_pair_t *)srccell, emp.ui, __ATOMIC_RELEASE);
+    return true;
+}
+
+//Maximum number of buckets visited when searching for a cuckoo path
+#define MAXNODES 256
+
+struct node
+{
+    uint32_t bix;//Bucket index
+    int32_t prnt;//Index of parent node, -1 for root nodes
+    uint32_t pidx;//Cell in parent bucket whose element moves to this bucket
+};
+
+static bool
+on_path(const struct node *nodes, int32_t n, uint32_t bix)
+{
+    for (; n >= 0; n = nodes[n].prnt)
+    {
+	if (nodes[n].bix == bix)
+	{
+	    return true;
+	}
+    }
+    return false;
+}
+
+//Try to free a cell in one of the buckets by displacing elements
+//Return false if no cuckoo path was found
+static bool
+make_room(p64_cuckooht_t *ht, uint32_t bix0, uint32_t bix1)
+{
+    struct node nodes[MAXNODES];
+    nodes[0] = (struct node){ .bix = bix0, .prnt = -1, .pidx = 0 };
+    nodes[1] = (struct node){ .bix = bix1, .prnt = -1, .pidx = 0 };
+    int32_t head = 0, tail = 2;
+    while (head < tail)
+    {
+	struct bucket *bkt = &ht->buckets[nodes[head].bix];
+	for (uint32_t i = 0; i < BKT_SIZE; i++)
+	{
+	    p64_hashvalue_t hash = __atomic_load_n(&bkt->cells[i].hash,
+						   __ATOMIC_RELAXED);
+	    if (__atomic_load_n(&bkt->cells[i].elem, __ATOMIC_RELAXED) == NULL)
+	    {
+		if (nodes[head].prnt < 0)
+		{
+		    //Element removed, cell available for insertion
+		    return true;
+		}
+		//Cell will be found free when checked from the parent bucket
+		continue;
+	    }
+	    uint32_t alt = bucket_index0(ht, hash);
+	    if (alt == nodes[head].bix)
+	    {
+		alt = bucket_index1(ht, hash);
+	    }
+	    if (on_path(nodes, head, alt))
+	    {
+		continue;
+	    }
+	    struct bucket *dst = &ht->buckets[alt];
+	    for (uint32_t j = 0; j < BKT_SIZE; j++)
+	    {
+		if (__atomic_load_n(&dst->cells[j].elem,
+				    __ATOMIC_RELAXED) == NULL)
+		{
+		    //Found free cell, execute path backwards
+		    uint32_t dstbix = alt, dstidx = j;
+		    uint32_t srcidx = i;
+		    int32_t n = head;
+		    for (;;)
+		    {
+			if (!move_cell(ht, nodes[n].bix, srcidx, dstbix, dstidx))
+			{
+			    //Concurrent update, caller will retry
+			    return true;
+			}
+			STAT_INC(STAT_CUCKOOHT_MOVE);
+			if (nodes[n].prnt < 0)
+			{
+			    return true;
+			}
+			dstbix = nodes[n].bix;
+			dstidx = srcidx;
+			srcidx = nodes[n].pidx;
+			n = nodes[n].prnt;
+		    }
+		}
+	    }
+	    if (tail < MAXNODES)
+	    {
+		nodes[tail++] = (struct node){ .bix = alt, .prnt = head, .pidx = i };
+	    }
+	}
+	head++;
+    }
+    return false;
+}
+
+bool
+p64_cuckooht_insert(p64_cuckooht_t *ht,
+		    void *elem,
+		    p64_hashvalue_t hash)
+{
+    assert(!HAS_MARK(elem));
+    uint32_t bix0 = bucket_index0(ht, hash);
+    uint32_t bix1 = bucket_index1(ht, hash);
+    for (;;)
+    {
+	if (bucket_insert(&ht->buckets[bix0], elem, hash) ||
+	    bucket_insert(&ht->buckets[bix1], elem, hash))
+	{
+	    return true;
+	}
+	//Both buckets full, displace elements to make room
+	p64_spinlock_acquire(&ht->lock);
+	bool found = make_room(ht, bix0, bix1);
+	p64_spinlock_release(&ht->lock);
+	if (!found)
+	{
+	    return false;
+	}
+    }
+}
+
+static inline bool
+bucket_remove(struct bucket *bkt,
+	      void *elem,
+	      p64_hashvalue_t hash,
+	      bool *moving)
+{
+    for (uint32_t i = 0; i < BKT_SIZE; i++)
+    {
+	void *ptr = __atomic_load_n(&bkt->cells[i].elem, __ATOMIC_RELAXED);
+	if (REM_MARK(ptr) == elem)
+	{
+	    if (HAS_MARK(ptr))
+	    {
+		//Element is being moved, wait for it to complete
+		*moving = true;
+		continue;
+	    }
+	    union cellui old = { .c.hash = hash, .c.elem = elem };
+	    union cellui emp = { .c.hash = 0, .c.elem = NULL };
+	    if (lockfree_compare_exchange_pair((uintptr_pair_t *)&bkt->cells[i],
+					       &old.ui,
+					       emp.ui,
+					       /*weak=*/false,
+					       __ATOMIC_RELAXED,
+					       __ATOMIC_RELAXED))
+	    {
+		return true;
+	    }
+	    //Cell changed (element marked for move), try again
+	    *moving = true;
+	}
+    }
+    return false;
+}
+
+bool
+p64_cuckooht_remove(p64_cuckooht_t *ht,
+		    void *elem,
+		    p64_hashvalue_t hash)
+{
+    struct bucket *bkt0 = &ht->buckets[bucket_index0(ht, hash)];
+    struct bucket *bkt1 = &ht->buckets[bucket_index1(ht, hash)];
+    struct backoff bo;
+    backoff_init(&bo);
+    for (;;)
+    {
+	bool moving = false;
+	//Same protocol as lookup, don't miss an element moved between buckets
+	uint32_t chg0 = __atomic_load_n(&bkt0->chgcnt, __ATOMIC_ACQUIRE);
+	uint32_t chg1 = __atomic_load_n(&bkt1->chgcnt, __ATOMIC_ACQUIRE);
+	if (bucket_remove(bkt0, elem, hash, &moving) ||
+	    bucket_remove(bkt1, elem, hash, &moving))
+	{
+	    return true;
+	}
+	smp_fence(LoadLoad);
+	if (!moving &&
+	    __atomic_load_n(&bkt0->chgcnt, __ATOMIC_RELAXED) == chg0 &&
+	    __atomic_load_n(&bkt1->chgcnt, __ATOMIC_RELAXED) == chg1)
+	{
+	    return false;
+	}
+	STAT_INC(STAT_CUCKOOHT_RETRY);
+	if (moving)
+	{
+	    backoff_wait(&bo);
+	}
+    }
+}
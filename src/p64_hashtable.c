@@ -12,20 +12,51 @@
 #include "p64_hashtable.h"
 #undef p64_hashtable_lookup
 #undef p64_hashtable_remove_by_key
+#include "p64_alloc.h"
 #include "p64_hazardptr.h"
 #include "build_config.h"
 
+#include "arch.h"
 #include "common.h"
 #include "lockfree.h"
+#include "stats.h"
+
+#ifdef USE_HASHTABLE_QSBR
+#include "p64_qsbr.h"
+//Memory is reclaimed using QSBR, hazard pointers are not used but always
+//returned as P64_HAZARDPTR_NULL
+#undef p64_hazptr_acquire
+#define p64_hazptr_acquire(pptr, hpp) \
+({ \
+     *(hpp) = P64_HAZARDPTR_NULL; \
+     __atomic_load_n((pptr), __ATOMIC_ACQUIRE); \
+})
+#define p64_hazptr_release(hpp) (void)(hpp)
+#define p64_hazptr_release_ro(hpp) (void)(hpp)
+#define p64_hazptr_retire(ptr, cb) p64_qsbr_retire((ptr), (cb))
+#endif
+
+#if defined __aarch64__ && defined __ARM_NEON
+#include <arm_neon.h>
+#elif defined __x86_64__
+#include <immintrin.h>
+#endif
 
 #define MARK_REMOVE 1UL
+#define MARK_FROZEN 2UL
+#define MARK_MASK (MARK_REMOVE | MARK_FROZEN)
 #define HAS_MARK(ptr) (((uintptr_t)(ptr) & MARK_REMOVE) != 0)
 #define SET_MARK(ptr) (void *)((uintptr_t)(ptr) |  MARK_REMOVE)
-#define REM_MARK(ptr) (void *)((uintptr_t)(ptr) & ~MARK_REMOVE)
+#define IS_FROZEN(ptr) (((uintptr_t)(ptr) & MARK_FROZEN) != 0)
+#define REM_MARK(ptr) (void *)((uintptr_t)(ptr) & ~MARK_MASK)
 
 //CACHE_LINE == 64, __SIZEOF_POINTER__ == 8 => BKT_SIZE == 4
 #define BKT_SIZE (CACHE_LINE / (2 * __SIZEOF_POINTER__))
 
+#if BKT_SIZE != P64_HASHTABLE_BKTSIZE
+#error Unsupported bucket size
+#endif
+
 struct hash_bucket
 {
     p64_hashelem_t elems[BKT_SIZE];
@@ -42,11 +73,105 @@ union heui
     uintptr_pair_t ui;
 };
 
-struct p64_hashtable
+//Migration state of buckets in a table which is being resized
+#define BKT_INIT 0//Not yet migrated
+#define BKT_BUSY 1//Migration in progress
+#define BKT_DONE 2//All elements migrated
+
+struct hash_table
 {
     uint32_t nbkts;
-    uint32_t nused;//elements
-    struct hash_bucket buckets[];
+    uint32_t migidx;//Next bucket to migrate
+    uint32_t nmigrated;//Number of migrated buckets
+    uint32_t ninserters;//Number of threads inserting into this table
+    struct hash_table *next;//Destination table when resizing
+    uint8_t *state;//Migration state per bucket
+    struct hash_bucket buckets[] ALIGNED(CACHE_LINE);
+};
+
+//Number of element counter shards, threads are spread over the shards
+#define NSHARDS 32
+
+//Counters updated by a subset of threads, summed when read
+struct counter_shard
+{
+    int64_t nelems;//Inserted minus removed elements
+    uint64_t ncasfail;//Failed CAS operations
+} ALIGNED(CACHE_LINE);
+
+struct p64_hashtable
+{
+    struct hash_table *cur;//Current table
+    struct hash_table *old;//Table being migrated from or NULL
+    uint32_t nresizes;//Incremented when a resize starts
+    uint32_t resizing;//Resize in progress
+    int32_t numanode;//Placement of tables
+    uint32_t allocflags;
+    struct counter_shard shards[NSHARDS];
+};
+
+//Shard used by this thread, assigned on first update
+static __thread uint32_t shard_idx = NSHARDS;
+//Failed CAS operations by this thread not yet added to a shard
+//Counts belong to the hash table of the current call and are added to its
+//shard by update_counters() before the call returns
+static __thread uint32_t pending_casfail = 0;
+//Next shard to assign
+static uint32_t shard_next = 0;
+
+//Begin a call which may update the hash table
+static inline void
+begin_update(void)
+{
+    //Counts from a call on another hash table must not be charged to us
+    assert(pending_casfail == 0);
+    pending_casfail = 0;
+}
+
+static inline void
+update_counters(p64_hashtable_t *ht, int32_t removed)
+{
+    if (removed != 0 || pending_casfail != 0)
+    {
+	if (UNLIKELY(shard_idx == NSHARDS))
+	{
+	    shard_idx = __atomic_fetch_add(&shard_next, 1, __ATOMIC_RELAXED) %
+			NSHARDS;
+	}
+	struct counter_shard *sh = &ht->shards[shard_idx];
+	if (removed != 0)
+	{
+	    __atomic_fetch_sub(&sh->nelems, removed, __ATOMIC_RELAXED);
+	}
+	if (pending_casfail != 0)
+	{
+	    __atomic_fetch_add(&sh->ncasfail, pending_casfail,
+			       __ATOMIC_RELAXED);
+	    STAT_ADD(STAT_HASHTABLE_RETRY, pending_casfail);
+	    pending_casfail = 0;
+	}
+    }
+}
+
+static uint64_t
+count_elems(p64_hashtable_t *ht)
+{
+    int64_t nelems = 0;
+    for (uint32_t i = 0; i < NSHARDS; i++)
+    {
+	nelems += __atomic_load_n(&ht->shards[i].nelems, __ATOMIC_RELAXED);
+    }
+    //Concurrent updates may make the sum temporarily negative
+    return nelems > 0 ? nelems : 0;
+}
+
+//Status of an operation performed on a single table
+enum op_status
+{
+    op_notfound,//Element not found
+    op_success,//Operation completed
+    op_frozen,//List frozen by migration, retry operation
+    op_search//Element marked but no longer linked from parent, search again
 };
 
 static uint32_t
@@ -78,60 +203,156 @@ bucket_check(uint32_t bix,
     return num;
 }
 
+static uint32_t
+table_check(struct hash_table *tbl,
+	    uint64_t (*f)(p64_hashelem_t *))
+{
+    uint32_t num = 0;
+    for (uint32_t i = 0; i < tbl->nbkts; i++)
+    {
+	num += bucket_check(i, &tbl->buckets[i], f);
+    }
+    return num;
+}
+
 uint32_t
 p64_hashtable_check(p64_hashtable_t *ht,
 		    uint64_t (*f)(p64_hashelem_t *))
 {
     uint32_t num = 0;
-    for (uint32_t i = 0; i < ht->nbkts; i++)
+    if (ht->old != NULL)
     {
-	num += bucket_check(i, &ht->buckets[i], f);
+	printf("Migrating table (%u buckets)\n", ht->old->nbkts);
+	num += table_check(ht->old, f);
     }
-    printf("Found %u elements (%u)\n", num, ht->nused);
+    num += table_check(ht->cur, f);
+    printf("Found %u elements (%lu)\n", num, count_elems(ht));
     return num;
 }
 
-p64_hashtable_t *
-p64_hashtable_alloc(uint32_t nelems)
+static struct hash_table *
+table_alloc(uint32_t nelems, int32_t numanode, uint32_t allocflags)
 {
     size_t nbkts = (nelems + BKT_SIZE - 1) / BKT_SIZE;
-    size_t sz = sizeof(p64_hashtable_t) +
-		sizeof(struct hash_bucket) * nbkts;
+    if (nbkts == 0)
+    {
+	nbkts = 1;
+    }
+    size_t sz = sizeof(struct hash_table) +
+		sizeof(struct hash_bucket) * nbkts +
+		sizeof(uint8_t) * nbkts;
     sz = ROUNDUP(sz, CACHE_LINE);
-    p64_hashtable_t *ht = aligned_alloc(CACHE_LINE, sz);
+    struct hash_table *tbl = p64_malloc(sz, CACHE_LINE, numanode, allocflags);
+    if (tbl != NULL)
+    {
+	memset(tbl, 0, sz);
+	tbl->nbkts = nbkts;
+	tbl->migidx = 0;
+	tbl->nmigrated = 0;
+	tbl->ninserters = 0;
+	tbl->next = NULL;
+	tbl->state = (uint8_t *)&tbl->buckets[nbkts];
+	//All buckets already cleared (NULL pointers)
+	//All bucket states already cleared (BKT_INIT)
+    }
+    return tbl;
+}
+
+p64_hashtable_t *
+p64_hashtable_alloc_ex(uint32_t nelems, int32_t numanode, uint32_t allocflags)
+{
+    size_t sz = ROUNDUP(sizeof(p64_hashtable_t), CACHE_LINE);
+    p64_hashtable_t *ht = p64_malloc(sz, CACHE_LINE, numanode, 0);
     if (ht != NULL)
     {
 	memset(ht, 0, sz);
-	ht->nbkts = nbkts;
-	ht->nused = 0;
-	//All buckets already cleared (NULL pointers)
+	ht->cur = table_alloc(nelems, numanode, allocflags);
+	if (ht->cur == NULL)
+	{
+	    p64_mfree(ht);
+	    return NULL;
+	}
+	ht->old = NULL;
+	ht->nresizes = 0;
+	ht->resizing = 0;
+	ht->numanode = numanode;
+	ht->allocflags = allocflags;
+	//All counter shards already cleared
     }
     return ht;
 }
 
+p64_hashtable_t *
+p64_hashtable_alloc(uint32_t nelems)
+{
+    return p64_hashtable_alloc_ex(nelems, P64_ALLOC_ANYNODE, 0);
+}
+
 void
 p64_hashtable_free(p64_hashtable_t *ht)
 {
     if (ht != NULL)
     {
 #ifndef NDEBUG
-	if (ht->nused != 0)
+	if (count_elems(ht) != 0)
 	{
 	    fprintf(stderr, "Hash table %p is not empty\n", ht), abort();
 	}
 #endif
-	free(ht);
+	p64_mfree(ht->old);
+	p64_mfree(ht->cur);
+	p64_mfree(ht);
     }
 }
 
+static inline uint32_t
+bucket_index(struct hash_table *tbl, p64_hashvalue_t hash)
+{
+    return (hash / BKT_SIZE) % tbl->nbkts;
+}
+
+//Return bit mask of bucket slots with matching hash value
+//Hash values and next pointers are interleaved in the bucket, compare all
+//hash values using SIMD instructions and ignore the next pointer lanes
 UNROLL_LOOPS ALWAYS_INLINE
-static inline p64_hashelem_t *
-bucket_lookup(struct hash_bucket *bkt,
-	      p64_hashtable_compare cf,
-	      const void *key,
-	      p64_hashvalue_t hash,
-	      p64_hazardptr_t *hazpp)
+static inline uint32_t
+bucket_match(const struct hash_bucket *bkt, p64_hashvalue_t hash)
 {
+#if BKT_SIZE == 4 && defined __aarch64__ && defined __ARM_NEON
+    static const uint32_t bits[4] = { 1, 2, 4, 8 };
+    //De-interleave hash values and next pointers
+    uint64x2x2_t e01 = vld2q_u64((const uint64_t *)&bkt->elems[0]);
+    uint64x2x2_t e23 = vld2q_u64((const uint64_t *)&bkt->elems[2]);
+    uint64x2_t h = vdupq_n_u64(hash);
+    //Narrow 64-bit lane masks to 32-bit lanes, one per slot
+    uint32x4_t m = vcombine_u32(vmovn_u64(vceqq_u64(e01.val[0], h)),
+				vmovn_u64(vceqq_u64(e23.val[0], h)));
+    return vaddvq_u32(vandq_u32(m, vld1q_u32(bits)));
+#elif BKT_SIZE == 4 && defined __AVX2__
+    const __m256i *v = (const __m256i *)bkt->elems;
+    __m256i h = _mm256_set1_epi64x(hash);
+    //Hash values are in lanes 0 and 2, next pointers in lanes 1 and 3
+    uint32_t m01 = _mm256_movemask_pd(_mm256_castsi256_pd(
+				_mm256_cmpeq_epi64(_mm256_load_si256(&v[0]), h)));
+    uint32_t m23 = _mm256_movemask_pd(_mm256_castsi256_pd(
+				_mm256_cmpeq_epi64(_mm256_load_si256(&v[1]), h)));
+    return (m01 & 1) | ((m01 >> 1) & 2) | ((m23 & 1) << 2) | ((m23 << 1) & 8);
+#elif BKT_SIZE == 4 && defined __SSE2__
+    const __m128i *v = (const __m128i *)bkt->elems;
+    __m128i h = _mm_set1_epi64x(hash);
+    //Gather hash values of slot pairs
+    __m128i h01 = _mm_unpacklo_epi64(_mm_load_si128(&v[0]),
+				     _mm_load_si128(&v[1]));
+    __m128i h23 = _mm_unpacklo_epi64(_mm_load_si128(&v[2]),
+				     _mm_load_si128(&v[3]));
+    //SSE2 lacks 64-bit compare, combine the two 32-bit halves
+    __m128i c01 = _mm_cmpeq_epi32(h01, h);
+    __m128i c23 = _mm_cmpeq_epi32(h23, h);
+    c01 = _mm_and_si128(c01, _mm_shuffle_epi32(c01, _MM_SHUFFLE(2, 3, 0, 1)));
+    c23 = _mm_and_si128(c23, _mm_shuffle_epi32(c23, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (uint32_t)_mm_movemask_pd(_mm_castsi128_pd(c01)) |
+	   (uint32_t)_mm_movemask_pd(_mm_castsi128_pd(c23)) << 2;
+#else
     uint32_t mask = 0;
     //We want this loop unrolled
     for (uint32_t i = 0; i < BKT_SIZE; i++)
@@ -141,13 +362,28 @@ bucket_lookup(struct hash_bucket *bkt,
 	    mask |= 1U << i;
 	}
     }
+    return mask;
+#endif
+}
+
+UNROLL_LOOPS ALWAYS_INLINE
+static inline p64_hashelem_t *
+bucket_lookup(struct hash_bucket *bkt,
+	      p64_hashtable_compare cf,
+	      const void *key,
+	      p64_hashvalue_t hash,
+	      p64_hazardptr_t *hazpp)
+{
+    uint32_t mask = bucket_match(bkt, hash);
     while (mask != 0)
     {
 	uint32_t i = __builtin_ctz(mask);
 	p64_hashelem_t *prnt = &bkt->elems[i];
 	p64_hashelem_t *he = p64_hazptr_acquire((void**)&prnt->next, hazpp);
 	//The head element pointers cannot be marked for REMOVAL
-	assert(REM_MARK(he) == he);
+	assert(!HAS_MARK(he));
+	//But they may be frozen by migration
+	he = REM_MARK(he);
 	if (he != NULL)
 	{
 	    if (cf(he, key) == 0)
@@ -168,9 +404,18 @@ list_lookup(p64_hashelem_t *prnt,
 	    p64_hazardptr_t *hazpp)
 {
     p64_hazardptr_t hpprnt = P64_HAZARDPTR_NULL;
+    p64_hashelem_t *const org = prnt;
     for (;;)
     {
 	p64_hashelem_t *this = p64_hazptr_acquire((void**)&prnt->next, hazpp);
+	if (UNLIKELY(HAS_MARK(this)))
+	{
+	    //Parent marked for removal, 'this' may also have been removed
+	    //and cannot be safely dereferenced
+	    //Restart from beginning
+	    prnt = org;
+	    continue;
+	}
 	this = REM_MARK(this);
 	if (this == NULL)
 	{
@@ -189,17 +434,15 @@ list_lookup(p64_hashelem_t *prnt,
     }
 }
 
-p64_hashelem_t *
-p64_hashtable_lookup(p64_hashtable_t *ht,
-		     p64_hashtable_compare cf,
-		     const void *key,
-		     p64_hashvalue_t hash,
-		     p64_hazardptr_t *hazpp)
+static p64_hashelem_t *
+table_lookup(struct hash_table *tbl,
+	     p64_hashtable_compare cf,
+	     const void *key,
+	     p64_hashvalue_t hash,
+	     p64_hazardptr_t *hazpp)
 {
-    uint32_t bix = (hash / BKT_SIZE) % ht->nbkts;
-    struct hash_bucket *bkt = &ht->buckets[bix];
+    struct hash_bucket *bkt = &tbl->buckets[bucket_index(tbl, hash)];
     p64_hashelem_t *he;
-    *hazpp = P64_HAZARDPTR_NULL;
     he = bucket_lookup(bkt, cf, key, hash, hazpp);
     if (he != NULL)
     {
@@ -214,9 +457,232 @@ p64_hashtable_lookup(p64_hashtable_t *ht,
     return NULL;
 }
 
-//Remove node, return true if element removed by us or some other thread
-//Returns fails if element cannot be removed due to parent marked for removal
+//Migration of elements from the old table to the new table:
+//1. Freeze all lists in the bucket by setting the FROZEN mark on every next
+//   pointer, other threads cannot update frozen next pointers
+//2. Move elements one by one, always the last element in a list first
+//   a) Insert the element (still frozen) into the new table
+//   b) Unlink the element from its (frozen) list in the old table
+//   c) Unfreeze the element, other threads may now update it
+//   Elements marked for removal are unlinked but not inserted into new table
+//Elements are thus always present in the old and/or new table and a lookup
+//which searches the old table before the new table will find the element
+//Migration does not start until all insertions into the old table have
+//completed, new elements are always inserted into the new table
+
+//Verify that no resize started or completed after tables were read
+static inline bool
+tables_unchanged(p64_hashtable_t *ht,
+		 uint32_t nresizes,
+		 struct hash_table *old,
+		 struct hash_table *cur)
+{
+    //Order the loads below after the search of the tables
+    smp_fence(LoadLoad);
+    return __atomic_load_n(&ht->nresizes, __ATOMIC_RELAXED) == nresizes &&
+	   __atomic_load_n(&ht->old, __ATOMIC_RELAXED) == old &&
+	   __atomic_load_n(&ht->cur, __ATOMIC_RELAXED) == cur;
+}
+
+p64_hashelem_t *
+p64_hashtable_lookup(p64_hashtable_t *ht,
+		     p64_hashtable_compare cf,
+		     const void *key,
+		     p64_hashvalue_t hash,
+		     p64_hazardptr_t *hazpp)
+{
+    p64_hazardptr_t hptbl = P64_HAZARDPTR_NULL;
+    p64_hashelem_t *he;
+    *hazpp = P64_HAZARDPTR_NULL;
+    for (;;)
+    {
+	uint32_t nresizes = __atomic_load_n(&ht->nresizes, __ATOMIC_ACQUIRE);
+	//Search any table being migrated before current table
+	struct hash_table *old = p64_hazptr_acquire((void **)&ht->old, &hptbl);
+	if (UNLIKELY(old != NULL))
+	{
+	    he = table_lookup(old, cf, key, hash, hazpp);
+	    if (he != NULL)
+	    {
+		break;
+	    }
+	}
+	struct hash_table *cur = p64_hazptr_acquire((void **)&ht->cur, &hptbl);
+	he = table_lookup(cur, cf, key, hash, hazpp);
+	if (he != NULL)
+	{
+	    break;
+	}
+	//Element not found, verify that tables didn't change during search
+	if (LIKELY(tables_unchanged(ht, nresizes, old, cur)))
+	{
+	    break;
+	}
+	//Elements may have been migrated to a new table, search again
+    }
+    p64_hazptr_release_ro(&hptbl);
+    return he;
+}
+
+p64_hashelem_t *
+p64_hashtable_bucket_(p64_hashtable_t *ht,
+		      p64_hashvalue_t hash,
+		      p64_hazardptr_t *hptbl,
+		      uint32_t *nresizes)
+{
+    *nresizes = __atomic_load_n(&ht->nresizes, __ATOMIC_ACQUIRE);
+    if (UNLIKELY(__atomic_load_n(&ht->old, __ATOMIC_ACQUIRE) != NULL))
+    {
+	//Elements may still be in the table being migrated
+	return NULL;
+    }
+    struct hash_table *tbl = p64_hazptr_acquire((void **)&ht->cur, hptbl);
+    return tbl->buckets[bucket_index(tbl, hash)].elems;
+}
+
+bool
+p64_hashtable_unchanged_(p64_hashtable_t *ht,
+			 uint32_t nresizes)
+{
+    //A resize which completed before nresizes was read is harmless, one that
+    //started later increments nresizes
+    smp_fence(LoadLoad);
+    return __atomic_load_n(&ht->nresizes, __ATOMIC_RELAXED) == nresizes;
+}
+
+UNROLL_LOOPS ALWAYS_INLINE
+static inline void
+bucket_prefetch(struct hash_bucket *bkt,
+		p64_hashvalue_t hash)
+{
+    uint32_t mask = bucket_match(bkt, hash);
+    while (mask != 0)
+    {
+	uint32_t i = __builtin_ctz(mask);
+	//Prefetch candidate element, harmless even if element is freed
+	PREFETCH_FOR_READ(REM_MARK(bkt->elems[i].next));
+	mask &= ~(1U << i);
+    }
+}
+
+//Return reference to caller or release it
+static inline void
+keep_ref(p64_hazardptr_t hps[],
+	 uint32_t i,
+	 p64_hazardptr_t *hp)
+{
+    if (hps != NULL)
+    {
+	hps[i] = *hp;
+    }
+    else
+    {
+	p64_hazptr_release_ro(hp);
+    }
+}
+
+uint32_t
+p64_hashtable_lookup_vec(p64_hashtable_t *ht,
+			 p64_hashtable_compare cf,
+			 const void *keys[],
+			 const p64_hashvalue_t hashes[],
+			 uint32_t num,
+			 p64_hashelem_t *results[],
+			 p64_hazardptr_t hps[])
+{
+    uint32_t nfound = 0;
+    if (UNLIKELY(__atomic_load_n(&ht->old, __ATOMIC_ACQUIRE) != NULL))
+    {
+	//Resize in progress, search old and new tables for each key
+	for (uint32_t i = 0; i < num; i++)
+	{
+	    p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+	    results[i] = p64_hashtable_lookup(ht, cf, keys[i], hashes[i], &hp);
+	    nfound += results[i] != NULL;
+	    keep_ref(hps, i, &hp);
+	}
+	return nfound;
+    }
+    p64_hazardptr_t hptbl = P64_HAZARDPTR_NULL;
+    uint32_t nresizes = __atomic_load_n(&ht->nresizes, __ATOMIC_ACQUIRE);
+    struct hash_table *cur = p64_hazptr_acquire((void **)&ht->cur, &hptbl);
+    //Stage 1: Prefetch all buckets
+    for (uint32_t i = 0; i < num; i++)
+    {
+	PREFETCH_FOR_READ(&cur->buckets[bucket_index(cur, hashes[i])]);
+    }
+    //Stage 2: Prefetch candidate elements from buckets
+    for (uint32_t i = 0; i < num; i++)
+    {
+	bucket_prefetch(&cur->buckets[bucket_index(cur, hashes[i])], hashes[i]);
+    }
+    //Stage 3: Compare keys and search lists
+    bool missed = false;
+    for (uint32_t i = 0; i < num; i++)
+    {
+	p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+	results[i] = table_lookup(cur, cf, keys[i], hashes[i], &hp);
+	nfound += results[i] != NULL;
+	missed |= results[i] == NULL;
+	keep_ref(hps, i, &hp);
+    }
+    if (UNLIKELY(missed) && !tables_unchanged(ht, nresizes, NULL, cur))
+    {
+	p64_hazptr_release_ro(&hptbl);
+	//Elements may have been migrated to a new table, search again
+	for (uint32_t i = 0; i < num; i++)
+	{
+	    if (results[i] == NULL)
+	    {
+		p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+		results[i] = p64_hashtable_lookup(ht, cf, keys[i], hashes[i],
+						  &hp);
+		nfound += results[i] != NULL;
+		keep_ref(hps, i, &hp);
+	    }
+	}
+	return nfound;
+    }
+    p64_hazptr_release_ro(&hptbl);
+    return nfound;
+}
+
+//Set the REMOVE mark on an element
+//Fails (returns false) if element is frozen but not marked
 static inline bool
+mark_node(p64_hashelem_t *this)
+{
+    uintptr_t old = __atomic_load_n((uintptr_t *)&this->next, __ATOMIC_RELAXED);
+    for (;;)
+    {
+	if (HAS_MARK(old))
+	{
+	    //Already marked for removal (by us or some other thread)
+	    return true;
+	}
+	if (IS_FROZEN(old))
+	{
+	    //Element frozen before it could be marked for removal
+	    return false;
+	}
+	if (__atomic_compare_exchange_n((uintptr_t *)&this->next,
+					&old,//Updated on failure
+					old | MARK_REMOVE,
+					/*weak=*/true,
+					__ATOMIC_RELAXED,
+					__ATOMIC_RELAXED))
+	{
+	    return true;
+	}
+	pending_casfail++;
+    }
+}
+
+//Remove node, return op_success if element removed by us or migration
+//Returns op_notfound if element cannot be removed due to parent marked for
+//removal, op_frozen if element frozen before it was marked for removal and
+//op_search if element marked but parent doesn't point to it anymore
+static inline enum op_status
 remove_node(p64_hashelem_t *prnt,
 	    p64_hashelem_t *this,
 	    p64_hashvalue_t hash,
@@ -224,7 +690,10 @@ remove_node(p64_hashelem_t *prnt,
 {
     assert(this == REM_MARK(this));
     //Set our REMOVE mark (it may already be set)
-    __atomic_fetch_or((uintptr_t *)&this->next, MARK_REMOVE, __ATOMIC_RELAXED);
+    if (!mark_node(this))
+    {
+	return op_frozen;
+    }
     //Now nobody may update our next pointer
     //And other threads may help to remove us
     //Swing our parent's next pointer
@@ -241,16 +710,30 @@ remove_node(p64_hashelem_t *prnt,
 				       __ATOMIC_RELAXED))
     {
 	(*removed)++;
-	return true;
+	return op_success;
+    }
+    pending_casfail++;
+    if (REM_MARK(old.he.next) != this)
+    {
+	//prnt->next doesn't point to 'this', 'this' already removed or
+	//migrated to a new table before it was marked
+	return op_search;
     }
-    else if (REM_MARK(old.he.next) != this)
+    else if (IS_FROZEN(old.he.next))
     {
-	//prnt->next doesn't point to 'this', 'this' already removed
-	return true;
+	//Parent frozen, 'this' will be unlinked (and not migrated) by migration
+	//Wait for this to happen before 'this' can be retired
+	SEVL();
+	while (WFE() &&
+	       REM_MARK(LDXR64((uint64_t *)&prnt->next, __ATOMIC_ACQUIRE)) == this)
+	{
+	    DOZE();
+	}
+	return op_success;
     }
     //Else prnt->next does point to 'this' but parent marked for removal
     assert(old.he.next == SET_MARK(this));
-    return false;
+    return op_notfound;
 }
 
 static inline p64_hashelem_t *
@@ -259,7 +742,7 @@ insert_node(p64_hashelem_t *prnt,
 	    p64_hashvalue_t hash)
 {
     assert(he->hash == 0);
-    assert(he->next == NULL);
+    assert(REM_MARK(he->next) == NULL);
     union heui old = {.he.next = NULL, .he.hash = 0 };
     union heui neu = {.he.next = he, .he.hash = hash };
     if (lockfree_compare_exchange_pair((uintptr_pair_t *)prnt,
@@ -273,6 +756,7 @@ insert_node(p64_hashelem_t *prnt,
 	return NULL;
     }
     //CAS failed, unexpected value returned
+    pending_casfail++;
     return old.he.next;
 }
 
@@ -304,7 +788,7 @@ bucket_insert(struct hash_bucket *bkt,
     return false;
 }
 
-static void
+static enum op_status
 list_insert(p64_hashelem_t *prnt,
 	    p64_hashelem_t *he,
 	    p64_hashvalue_t hash,
@@ -316,6 +800,14 @@ list_insert(p64_hashelem_t *prnt,
     for (;;)
     {
 	p64_hashelem_t *this = p64_hazptr_acquire((void**)&prnt->next, &hpthis);
+	if (UNLIKELY(HAS_MARK(this)))
+	{
+	    //Parent marked for removal, 'this' may also have been removed
+	    //and cannot be safely dereferenced
+	    //Restart from beginning
+	    prnt = org;
+	    continue;
+	}
 	this = REM_MARK(this);
 	if (this == NULL)
 	{
@@ -326,9 +818,16 @@ list_insert(p64_hashelem_t *prnt,
 		//CAS succeeded, our element added to end of list
 		p64_hazptr_release(&hpprnt);
 		p64_hazptr_release_ro(&hpthis);
-		return;//Element inserted
+		return op_success;//Element inserted
 	    }
 	    //Else CAS failed, next pointer unexpectedly changed
+	    if (IS_FROZEN(old))
+	    {
+		//List frozen by migration
+		p64_hazptr_release_ro(&hpprnt);
+		p64_hazptr_release_ro(&hpthis);
+		return op_frozen;
+	    }
 	    if (HAS_MARK(old))
 	    {
 		//Parent marked for removal and must be removed before we
@@ -349,12 +848,20 @@ list_insert(p64_hashelem_t *prnt,
 	    //Found other element ('this' != 'he') marked for removal
 	    //Let's give a helping hand
 	    //FIXME prnt->hash not read atomically with prnt->next, problem?
-	    if (remove_node(prnt, this, prnt->hash, removed))
+	    enum op_status st = remove_node(prnt, this, prnt->hash, removed);
+	    if (st == op_success || st == op_search)
 	    {
 		//'this' node removed, '*prnt' points to 'next'
 		//Continue from current position
 		continue;
 	    }
+	    else if (st != op_notfound)
+	    {
+		//List frozen by migration
+		p64_hazptr_release_ro(&hpprnt);
+		p64_hazptr_release_ro(&hpthis);
+		return op_frozen;
+	    }
 	    //Else parent node is also marked for removal
 	    //Parent must be removed before we remove 'this'
 	    //Restart from beginning
@@ -367,108 +874,341 @@ list_insert(p64_hashelem_t *prnt,
     }
 }
 
-void
-p64_hashtable_insert(p64_hashtable_t *ht,
-		     p64_hashelem_t *he,
-		     p64_hashvalue_t hash)
+static enum op_status
+table_insert(struct hash_table *tbl,
+	     p64_hashelem_t *he,
+	     p64_hashvalue_t hash,
+	     int32_t *removed)
 {
-    int32_t removed = -1;//Assume one node inserted
-    uint32_t bix = (hash / BKT_SIZE) % ht->nbkts;
-    struct hash_bucket *bkt = &ht->buckets[bix];
-    he->hash = 0;
-    he->next = NULL;
-    bool success = bucket_insert(bkt, he, hash);
-    if (!success)
-    {
-	p64_hashelem_t *prnt = &bkt->elems[hash % BKT_SIZE];
-	list_insert(prnt, he, hash, &removed);
-    }
-#ifndef NDEBUG
-    if (removed != 0)
+    struct hash_bucket *bkt = &tbl->buckets[bucket_index(tbl, hash)];
+    if (bucket_insert(bkt, he, hash))
     {
-	__atomic_fetch_sub(&ht->nused, removed, __ATOMIC_RELAXED);
+	return op_success;
     }
-#endif
+    p64_hashelem_t *prnt = &bkt->elems[hash % BKT_SIZE];
+    return list_insert(prnt, he, hash, removed);
 }
 
-UNROLL_LOOPS ALWAYS_INLINE
-static inline bool
-bucket_remove(struct hash_bucket *bkt,
-	      p64_hashelem_t *he,
-	      p64_hashvalue_t hash,
-	      int32_t *removed)
+//Wait for frozen list to be unfrozen or migrated
+static void
+wait_migrated(struct hash_table *tbl,
+	      p64_hashvalue_t hash)
 {
-    uint32_t mask = 0;
-    //We want this loop unrolled
-    for (uint32_t i = 0; i < BKT_SIZE; i++)
+    //Synchronize with the freezing of the list
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&tbl->next, __ATOMIC_RELAXED) == NULL)
     {
-	if (bkt->elems[i].next == he)
-	{
-	    mask |= 1U << i;
-	}
+	//Element being migrated into this table is temporarily frozen
+	DOZE();
+	return;
     }
-    if (mask != 0)
+    //Bucket is being migrated from this table
+    uint8_t *state = &tbl->state[bucket_index(tbl, hash)];
+    if (__atomic_load_n(state, __ATOMIC_ACQUIRE) != BKT_DONE)
     {
-	uint32_t i = __builtin_ctz(mask);
-	p64_hashelem_t *prnt = &bkt->elems[i];
-	//No need to p64_hazptr_acquire(), we already have a reference
-	//Cannot fail due to parent marked for removal
-	(void)remove_node(prnt, he, hash, removed);
-	return true;
+	SEVL();
+	while (WFE() && LDXR8(state, __ATOMIC_ACQUIRE) != BKT_DONE)
+	{
+	    DOZE();
+	}
     }
-    return false;
 }
 
-static bool
-list_remove(p64_hashelem_t *prnt,
-	    p64_hashelem_t *he,
-	    p64_hashvalue_t hash,
-	    int32_t *removed)
+//Freeze list so that it cannot be updated by other threads
+static void
+freeze_list(p64_hashelem_t *prnt)
 {
-    p64_hazardptr_t hpprnt = P64_HAZARDPTR_NULL;
-    p64_hazardptr_t hpthis = P64_HAZARDPTR_NULL;
-    p64_hazardptr_t hpnext = P64_HAZARDPTR_NULL;
-    p64_hashelem_t *const org = prnt;
     for (;;)
     {
-	p64_hashelem_t *this = p64_hazptr_acquire((void**)&prnt->next, &hpthis);
-	this = REM_MARK(this);
+	//Release order to synchronize with wait_migrated()
+	uintptr_t old = __atomic_fetch_or((uintptr_t *)&prnt->next,
+					  MARK_FROZEN,
+					  __ATOMIC_RELEASE);
+	p64_hashelem_t *this = REM_MARK(old);
+	if (this == NULL)
+	{
+	    return;
+	}
+	//'this' cannot be unlinked (and retired) anymore
+	prnt = this;
+    }
+}
+
+static void
+migrate_bucket(p64_hashtable_t *ht,
+	       struct hash_table *tbl,
+	       uint32_t bix)
+{
+    struct hash_bucket *bkt = &tbl->buckets[bix];
+    struct hash_table *dst = tbl->next;
+    int32_t removed = 0;
+    for (uint32_t i = 0; i < BKT_SIZE; i++)
+    {
+	freeze_list(&bkt->elems[i]);
+    }
+    //All lists in bucket are now frozen and only updated by us
+    for (uint32_t i = 0; i < BKT_SIZE; i++)
+    {
+	for (;;)
+	{
+	    //Find last element in list
+	    p64_hashelem_t *prnt = &bkt->elems[i];
+	    p64_hashelem_t *this = REM_MARK(prnt->next);
+	    if (this == NULL)
+	    {
+		//List is empty
+		break;
+	    }
+	    p64_hashelem_t *next;
+	    while ((next = REM_MARK(this->next)) != NULL)
+	    {
+		prnt = this;
+		this = next;
+	    }
+	    p64_hashvalue_t hash = prnt->hash;
+	    //Marks cannot change when element is frozen
+	    bool migrate = !HAS_MARK(this->next);
+	    if (migrate)
+	    {
+		//Insert element into new table, element remains frozen
+		assert(this->hash == 0);
+		while (table_insert(dst, this, hash, &removed) != op_success)
+		{
+		    //Other element being migrated is temporarily frozen
+		    DOZE();
+		}
+	    }
+	    else
+	    {
+		//Element marked for removal, don't migrate it
+		removed++;
+	    }
+	    //Unlink element from old list, keep any REMOVE mark of parent
+	    uintptr_t mark = (uintptr_t)prnt->next & MARK_REMOVE;
+	    __atomic_store_n(&prnt->hash, 0, __ATOMIC_RELAXED);
+	    __atomic_store_n(&prnt->next,
+			     (p64_hashelem_t *)(mark | MARK_FROZEN),
+			     __ATOMIC_RELEASE);
+	    if (migrate)
+	    {
+		//Unfreeze element in new table
+		__atomic_store_n(&this->next, NULL, __ATOMIC_RELEASE);
+	    }
+	}
+    }
+    update_counters(ht, removed);
+    __atomic_store_n(&tbl->state[bix], BKT_DONE, __ATOMIC_RELEASE);
+    if (__atomic_add_fetch(&tbl->nmigrated, 1, __ATOMIC_ACQ_REL) == tbl->nbkts)
+    {
+	//All buckets migrated, resize complete
+	__atomic_store_n(&ht->old, NULL, __ATOMIC_RELEASE);
+	__atomic_store_n(&ht->resizing, 0, __ATOMIC_RELEASE);
+	//Old table may still be referenced by concurrent lookups
+	p64_hazptr_retire(tbl, p64_mfree);
+    }
+}
+
+//Migrate one bucket from the table being resized (if any)
+static void
+help_migrate(p64_hashtable_t *ht)
+{
+    p64_hazardptr_t hptbl = P64_HAZARDPTR_NULL;
+    struct hash_table *tbl = p64_hazptr_acquire((void **)&ht->old, &hptbl);
+    //Migration must not start until all insertions into the old table have
+    //completed, no new insertions into old table when it is not current
+    if (tbl != NULL &&
+	__atomic_load_n(&ht->cur, __ATOMIC_SEQ_CST) != tbl &&
+	__atomic_load_n(&tbl->ninserters, __ATOMIC_SEQ_CST) == 0)
+    {
+	while (__atomic_load_n(&tbl->migidx, __ATOMIC_RELAXED) < tbl->nbkts)
+	{
+	    uint32_t bix = __atomic_fetch_add(&tbl->migidx, 1, __ATOMIC_RELAXED);
+	    uint8_t init = BKT_INIT;
+	    if (bix < tbl->nbkts &&
+		__atomic_compare_exchange_n(&tbl->state[bix],
+					    &init,
+					    BKT_BUSY,
+					    /*weak=*/false,
+					    __ATOMIC_ACQUIRE,
+					    __ATOMIC_RELAXED))
+	    {
+		migrate_bucket(ht, tbl, bix);
+		break;
+	    }
+	}
+    }
+    p64_hazptr_release(&hptbl);
+}
+
+bool
+p64_hashtable_resize(p64_hashtable_t *ht,
+		     uint32_t nelems)
+{
+    uint32_t idle = 0;
+    begin_update();
+    if (!__atomic_compare_exchange_n(&ht->resizing,
+				     &idle,
+				     1,
+				     /*weak=*/false,
+				     __ATOMIC_ACQUIRE,
+				     __ATOMIC_RELAXED))
+    {
+	//Resize already in progress
+	return false;
+    }
+    struct hash_table *neu = table_alloc(nelems, ht->numanode, ht->allocflags);
+    if (neu == NULL)
+    {
+	__atomic_store_n(&ht->resizing, 0, __ATOMIC_RELEASE);
+	return false;
+    }
+    //Current table can only be changed by us
+    struct hash_table *old = ht->cur;
+    old->next = neu;
+    //Lookups which fail will now be retried
+    __atomic_store_n(&ht->nresizes, ht->nresizes + 1, __ATOMIC_RELAXED);
+    //Make old table available for migration
+    __atomic_store_n(&ht->old, old, __ATOMIC_RELEASE);
+    //New elements will be inserted into the new table
+    //Sequential consistency to order against check of old->ninserters
+    __atomic_store_n(&ht->cur, neu, __ATOMIC_SEQ_CST);
+    //Migrate buckets (with help from other threads)
+    while (__atomic_load_n(&ht->old, __ATOMIC_ACQUIRE) == old)
+    {
+	help_migrate(ht);
+    }
+    update_counters(ht, 0);
+    return true;
+}
+
+void
+p64_hashtable_insert(p64_hashtable_t *ht,
+		     p64_hashelem_t *he,
+		     p64_hashvalue_t hash)
+{
+    int32_t removed = -1;//Assume one node inserted
+    p64_hazardptr_t hptbl = P64_HAZARDPTR_NULL;
+    begin_update();
+    if (UNLIKELY(__atomic_load_n(&ht->old, __ATOMIC_RELAXED) != NULL))
+    {
+	help_migrate(ht);
+    }
+    he->hash = 0;
+    he->next = NULL;
+    for (;;)
+    {
+	//Always insert into current table
+	struct hash_table *tbl = p64_hazptr_acquire((void **)&ht->cur, &hptbl);
+	//Announce our insertion so that migration of the table is delayed
+	__atomic_fetch_add(&tbl->ninserters, 1, __ATOMIC_SEQ_CST);
+	if (UNLIKELY(__atomic_load_n(&ht->cur, __ATOMIC_SEQ_CST) != tbl))
+	{
+	    //Table resized, retry with new current table
+	    __atomic_fetch_sub(&tbl->ninserters, 1, __ATOMIC_RELAXED);
+	    continue;
+	}
+	enum op_status st = table_insert(tbl, he, hash, &removed);
+	__atomic_fetch_sub(&tbl->ninserters, 1, __ATOMIC_RELEASE);
+	if (LIKELY(st == op_success))
+	{
+	    break;
+	}
+	//Inserted element temporarily frozen by migration, retry
+	DOZE();
+    }
+    p64_hazptr_release(&hptbl);
+    update_counters(ht, removed);
+}
+
+UNROLL_LOOPS ALWAYS_INLINE
+static inline enum op_status
+bucket_remove(struct hash_bucket *bkt,
+	      p64_hashelem_t *he,
+	      p64_hashvalue_t hash,
+	      int32_t *removed)
+{
+    uint32_t mask = 0;
+    //We want this loop unrolled
+    for (uint32_t i = 0; i < BKT_SIZE; i++)
+    {
+	if (REM_MARK(bkt->elems[i].next) == he)
+	{
+	    mask |= 1U << i;
+	}
+    }
+    if (mask != 0)
+    {
+	uint32_t i = __builtin_ctz(mask);
+	p64_hashelem_t *prnt = &bkt->elems[i];
+	//No need to p64_hazptr_acquire(), we already have a reference
+	//Cannot fail due to parent marked for removal
+	enum op_status st = remove_node(prnt, he, hash, removed);
+	assert(st != op_notfound);
+	return st;
+    }
+    return op_notfound;
+}
+
+static enum op_status
+list_remove(p64_hashelem_t *prnt,
+	    p64_hashelem_t *he,
+	    p64_hashvalue_t hash,
+	    int32_t *removed)
+{
+    p64_hazardptr_t hpprnt = P64_HAZARDPTR_NULL;
+    p64_hazardptr_t hpthis = P64_HAZARDPTR_NULL;
+    p64_hazardptr_t hpnext = P64_HAZARDPTR_NULL;
+    p64_hashelem_t *const org = prnt;
+    enum op_status st;
+    for (;;)
+    {
+	p64_hashelem_t *this = p64_hazptr_acquire((void**)&prnt->next, &hpthis);
+	if (UNLIKELY(HAS_MARK(this)))
+	{
+	    //Parent marked for removal, 'this' may also have been removed
+	    //and cannot be safely dereferenced
+	    //Restart from beginning
+	    prnt = org;
+	    continue;
+	}
+	this = REM_MARK(this);
 	if (UNLIKELY(this == NULL))
 	{
 	    //End of list
-	    p64_hazptr_release(&hpprnt);
-	    p64_hazptr_release(&hpthis);
-	    p64_hazptr_release(&hpnext);
-	    return false;//Element not found
+	    st = op_notfound;//Element not found
+	    break;
 	}
 	else if (this == he)
 	{
 	    //Found our element, now remove it
-	    if (remove_node(prnt, this, hash, removed))
+	    st = remove_node(prnt, this, hash, removed);
+	    if (st == op_notfound)
 	    {
-		//Success, 'this' node is removed
-		p64_hazptr_release(&hpprnt);
-		p64_hazptr_release(&hpthis);
-		p64_hazptr_release(&hpnext);
-		return true;
+		//Parent node is also marked for removal
+		//Parent must be removed before we remove 'this'
+		//'this' is marked so search for it again
+		st = op_search;
 	    }
-	    //Else parent node is also marked for removal
-	    //Parent must be removed before we remove 'this'
-	    //Restart from beginning
-	    prnt = org;
-	    continue;
+	    break;
 	}
 	else if (UNLIKELY(HAS_MARK(this->next)))
 	{
 	    //Found other element ('this' != 'he') marked for removal
 	    //Let's give a helping hand
 	    //FIXME prnt->hash not read atomically with prnt->next, problem?
-	    if (remove_node(prnt, this, prnt->hash, removed))
+	    st = remove_node(prnt, this, prnt->hash, removed);
+	    if (st == op_success || st == op_search)
 	    {
 		//'this' node removed, '*prnt' points to 'next'
 		//Continue from current position
 		continue;
 	    }
+	    else if (st != op_notfound)
+	    {
+		//List frozen by migration
+		st = op_frozen;
+		break;
+	    }
 	    //Else parent node is also marked for removal
 	    //Parent must be removed before we remove 'this'
 	    //Restart from beginning
@@ -479,6 +1219,82 @@ list_remove(p64_hashelem_t *prnt,
 	prnt = this;
 	SWAP(hpprnt, hpthis);
     }
+    p64_hazptr_release(&hpprnt);
+    p64_hazptr_release(&hpthis);
+    p64_hazptr_release(&hpnext);
+    return st;
+}
+
+static enum op_status
+table_remove(struct hash_table *tbl,
+	     p64_hashelem_t *he,
+	     p64_hashvalue_t hash,
+	     int32_t *removed)
+{
+    struct hash_bucket *bkt = &tbl->buckets[bucket_index(tbl, hash)];
+    enum op_status st = bucket_remove(bkt, he, hash, removed);
+    if (st == op_notfound)
+    {
+	p64_hashelem_t *prnt = &bkt->elems[hash % BKT_SIZE];
+	st = list_remove(prnt, he, hash, removed);
+    }
+    return st;
+}
+
+//Remove specified element from any table
+//'marked' indicates element already marked for removal by us
+static bool
+remove_elem(p64_hashtable_t *ht,
+	    p64_hashelem_t *he,
+	    p64_hashvalue_t hash,
+	    int32_t *removed,
+	    bool marked)
+{
+    p64_hazardptr_t hptbl = P64_HAZARDPTR_NULL;
+    enum op_status st;
+    for (;;)
+    {
+	uint32_t nresizes = __atomic_load_n(&ht->nresizes, __ATOMIC_ACQUIRE);
+	//Search any table being migrated before current table
+	struct hash_table *old = p64_hazptr_acquire((void **)&ht->old, &hptbl);
+	struct hash_table *tbl = old;
+	st = op_notfound;
+	if (UNLIKELY(old != NULL))
+	{
+	    st = table_remove(old, he, hash, removed);
+	}
+	struct hash_table *cur = NULL;
+	if (st == op_notfound)
+	{
+	    tbl = cur = p64_hazptr_acquire((void **)&ht->cur, &hptbl);
+	    st = table_remove(cur, he, hash, removed);
+	}
+	if (LIKELY(st == op_success))
+	{
+	    break;
+	}
+	else if (st == op_notfound)
+	{
+	    //Element not found, verify that tables didn't change during search
+	    if (tables_unchanged(ht, nresizes, old, cur))
+	    {
+		break;
+	    }
+	    continue;
+	}
+	else if (st == op_search)
+	{
+	    //Element marked, search for it until it has been unlinked
+	    marked = true;
+	    continue;
+	}
+	//Else list frozen by migration
+	//Retry when element has been migrated
+	wait_migrated(tbl, hash);
+    }
+    p64_hazptr_release_ro(&hptbl);
+    //A marked element which cannot be found has been removed
+    return st == op_success || marked;
 }
 
 bool
@@ -487,20 +1303,13 @@ p64_hashtable_remove(p64_hashtable_t *ht,
 		     p64_hashvalue_t hash)
 {
     int32_t removed = 0;
-    uint32_t bix = (hash / BKT_SIZE) % ht->nbkts;
-    struct hash_bucket *bkt = &ht->buckets[bix];
-    bool success = bucket_remove(bkt, he, hash, &removed);
-    if (!success)
+    begin_update();
+    if (UNLIKELY(__atomic_load_n(&ht->old, __ATOMIC_RELAXED) != NULL))
     {
-	p64_hashelem_t *prnt = &bkt->elems[hash % BKT_SIZE];
-	success = list_remove(prnt, he, hash, &removed);
+	help_migrate(ht);
     }
-#ifndef NDEBUG
-    if (removed != 0)
-    {
-	__atomic_fetch_sub(&ht->nused, removed, __ATOMIC_RELAXED);
-    }
-#endif
+    bool success = remove_elem(ht, he, hash, &removed, false);
+    update_counters(ht, removed);
     return success;
 }
 
@@ -511,36 +1320,33 @@ bucket_remove_by_key(struct hash_bucket *bkt,
 		     const void *key,
 		     p64_hashvalue_t hash,
 		     p64_hazardptr_t *hazpp,
-		     int32_t *removed)
+		     int32_t *removed,
+		     enum op_status *st)
 {
-    uint32_t mask = 0;
-    //We want this loop unrolled
-    for (uint32_t i = 0; i < BKT_SIZE; i++)
-    {
-	if (bkt->elems[i].hash == hash)
-	{
-	    mask |= 1U << i;
-	}
-    }
+    uint32_t mask = bucket_match(bkt, hash);
     while (mask != 0)
     {
 	uint32_t i = __builtin_ctz(mask);
 	p64_hashelem_t *prnt = &bkt->elems[i];
 	p64_hashelem_t *he = p64_hazptr_acquire((void**)&prnt->next, hazpp);
 	//The head element pointers cannot be marked for REMOVAL
-	assert(REM_MARK(he) == he);
+	assert(!HAS_MARK(he));
+	//But they may be frozen by migration
+	he = REM_MARK(he);
 	if (he != NULL)
 	{
 	    if (cf(he, key) == 0)
 	    {
 		//Found our element
 		//Cannot fail due to parent marked for removal
-		(void)remove_node(prnt, he, hash, removed);
+		*st = remove_node(prnt, he, hash, removed);
+		assert(*st != op_notfound);
 		return he;
 	    }
 	}
 	mask &= ~(1U << i);
     }
+    *st = op_notfound;
     return NULL;
 }
 
@@ -550,7 +1356,8 @@ list_remove_by_key(p64_hashelem_t *prnt,
 		   const void *key,
 		   p64_hashvalue_t hash,
 		   p64_hazardptr_t *hazpp,
-		   int32_t *removed)
+		   int32_t *removed,
+		   enum op_status *st)
 {
     p64_hazardptr_t hpprnt = P64_HAZARDPTR_NULL;
     p64_hazardptr_t hpthis = P64_HAZARDPTR_NULL;
@@ -559,6 +1366,14 @@ list_remove_by_key(p64_hashelem_t *prnt,
     for (;;)
     {
 	p64_hashelem_t *this = p64_hazptr_acquire((void**)&prnt->next, &hpthis);
+	if (UNLIKELY(HAS_MARK(this)))
+	{
+	    //Parent marked for removal, 'this' may also have been removed
+	    //and cannot be safely dereferenced
+	    //Restart from beginning
+	    prnt = org;
+	    continue;
+	}
 	this = REM_MARK(this);
 	if (UNLIKELY(this == NULL))
 	{
@@ -566,36 +1381,46 @@ list_remove_by_key(p64_hashelem_t *prnt,
 	    p64_hazptr_release(&hpprnt);
 	    p64_hazptr_release(&hpthis);
 	    p64_hazptr_release(&hpnext);
+	    *st = op_notfound;
 	    return NULL;//Element not found
 	}
 	else if (cf(this, key) == 0)
 	{
 	    //Found our element, now remove it
-	    if (remove_node(prnt, this, hash, removed))
+	    *st = remove_node(prnt, this, hash, removed);
+	    if (*st == op_notfound)
 	    {
-		//Success, 'this' node is removed
-		p64_hazptr_release(&hpprnt);
-		p64_hazptr_release(&hpnext);
-		*hazpp = hpthis;
-		return this;
+		//Parent node is also marked for removal
+		//Parent must be removed before we remove 'this'
+		//'this' is marked so search for it again
+		*st = op_search;
 	    }
-	    //Else parent node is also marked for removal
-	    //Parent must be removed before we remove 'this'
-	    //Restart from beginning
-	    prnt = org;
-	    continue;
+	    p64_hazptr_release(&hpprnt);
+	    p64_hazptr_release(&hpnext);
+	    *hazpp = hpthis;
+	    return this;
 	}
 	else if (UNLIKELY(HAS_MARK(this->next)))
 	{
 	    //Found other element ('this' != 'he') marked for removal
 	    //Let's give a helping hand
 	    //FIXME prnt->hash not read atomically with prnt->next, problem?
-	    if (remove_node(prnt, this, prnt->hash, removed))
+	    enum op_status hst = remove_node(prnt, this, prnt->hash, removed);
+	    if (hst == op_success || hst == op_search)
 	    {
 		//'this' node removed, '*prnt' points to 'next'
 		//Continue from current position
 		continue;
 	    }
+	    else if (hst != op_notfound)
+	    {
+		//List frozen by migration
+		p64_hazptr_release(&hpprnt);
+		p64_hazptr_release(&hpthis);
+		p64_hazptr_release(&hpnext);
+		*st = op_frozen;
+		return NULL;
+	    }
 	    //Else parent node is also marked for removal
 	    //Parent must be removed before we remove 'this'
 	    //Restart from beginning
@@ -608,6 +1433,27 @@ list_remove_by_key(p64_hashelem_t *prnt,
     }
 }
 
+static p64_hashelem_t *
+table_remove_by_key(struct hash_table *tbl,
+		    p64_hashtable_compare cf,
+		    const void *key,
+		    p64_hashvalue_t hash,
+		    p64_hazardptr_t *hazpp,
+		    int32_t *removed,
+		    enum op_status *st)
+{
+    struct hash_bucket *bkt = &tbl->buckets[bucket_index(tbl, hash)];
+    p64_hashelem_t *he = bucket_remove_by_key(bkt, cf, key, hash,
+					      hazpp, removed, st);
+    if (he == NULL)
+    {
+	p64_hazptr_release_ro(hazpp);
+	p64_hashelem_t *prnt = &bkt->elems[hash % BKT_SIZE];
+	he = list_remove_by_key(prnt, cf, key, hash, hazpp, removed, st);
+    }
+    return he;
+}
+
 p64_hashelem_t *
 p64_hashtable_remove_by_key(p64_hashtable_t *ht,
 			    p64_hashtable_compare cf,
@@ -616,20 +1462,336 @@ p64_hashtable_remove_by_key(p64_hashtable_t *ht,
 			    p64_hazardptr_t *hazpp)
 {
     int32_t removed = 0;
-    uint32_t bix = (hash / BKT_SIZE) % ht->nbkts;
-    struct hash_bucket *bkt = &ht->buckets[bix];
-    p64_hashelem_t *he = bucket_remove_by_key(bkt, cf, key, hash,
-					      hazpp, &removed);
-    if (he == NULL)
+    p64_hazardptr_t hptbl = P64_HAZARDPTR_NULL;
+    p64_hashelem_t *he = NULL;
+    enum op_status st;
+    begin_update();
+    if (UNLIKELY(__atomic_load_n(&ht->old, __ATOMIC_RELAXED) != NULL))
     {
-	p64_hashelem_t *prnt = &bkt->elems[hash % BKT_SIZE];
-	he = list_remove_by_key(prnt, cf, key, hash, hazpp, &removed);
+	help_migrate(ht);
     }
-#ifndef NDEBUG
-    if (removed != 0)
+    for (;;)
     {
-	__atomic_fetch_sub(&ht->nused, removed, __ATOMIC_RELAXED);
+	uint32_t nresizes = __atomic_load_n(&ht->nresizes, __ATOMIC_ACQUIRE);
+	//Search any table being migrated before current table
+	struct hash_table *old = p64_hazptr_acquire((void **)&ht->old, &hptbl);
+	struct hash_table *tbl = old;
+	st = op_notfound;
+	if (UNLIKELY(old != NULL))
+	{
+	    he = table_remove_by_key(old, cf, key, hash, hazpp, &removed, &st);
+	}
+	struct hash_table *cur = NULL;
+	if (st == op_notfound)
+	{
+	    tbl = cur = p64_hazptr_acquire((void **)&ht->cur, &hptbl);
+	    he = table_remove_by_key(cur, cf, key, hash, hazpp, &removed, &st);
+	}
+	if (LIKELY(st == op_success))
+	{
+	    break;
+	}
+	else if (st == op_notfound)
+	{
+	    //Element not found, verify that tables didn't change during search
+	    if (tables_unchanged(ht, nresizes, old, cur))
+	    {
+		break;
+	    }
+	    continue;
+	}
+	else if (st == op_search)
+	{
+	    //Element marked, search for it until it has been unlinked
+	    //Table no longer needed, *hazpp still references element
+	    p64_hazptr_release_ro(&hptbl);
+	    (void)remove_elem(ht, he, hash, &removed, true);
+	    break;
+	}
+	//Else list frozen by migration
+	//Retry when element has been migrated
+	wait_migrated(tbl, hash);
+	p64_hazptr_release_ro(hazpp);
     }
-#endif
+    p64_hazptr_release_ro(&hptbl);
+    update_counters(ht, removed);
     return he;
 }
+
+//Invoke callback for each element in list, remove elements for which the
+//callback returns true
+//Restart from beginning if list is concurrently updated, elements already
+//passed to the callback may then be visited again
+static uint32_t
+list_traverse(p64_hashtable_t *ht,
+	      p64_hashelem_t *head,
+	      p64_hashtable_trav_cb cb,
+	      void *arg,
+	      void (*reclaim)(void *),
+	      int32_t *removed)
+{
+    p64_hazardptr_t hpprnt = P64_HAZARDPTR_NULL;
+    p64_hazardptr_t hpthis = P64_HAZARDPTR_NULL;
+    p64_hashelem_t *prnt = head;
+    uint32_t num = 0;
+    for (;;)
+    {
+	p64_hashelem_t *this = p64_hazptr_acquire((void**)&prnt->next, &hpthis);
+	if (UNLIKELY(HAS_MARK(this)))
+	{
+	    //Parent marked for removal, 'this' may also have been removed
+	    //and cannot be safely dereferenced
+	    //Restart from beginning
+	    prnt = head;
+	    continue;
+	}
+	this = REM_MARK(this);
+	if (this == NULL)
+	{
+	    break;
+	}
+	//Read hash value and verify that it still belongs to 'this'
+	p64_hashvalue_t hash = __atomic_load_n(&prnt->hash, __ATOMIC_RELAXED);
+	smp_fence(LoadLoad);
+	if (UNLIKELY(REM_MARK(__atomic_load_n(&prnt->next, __ATOMIC_RELAXED)) !=
+		     this))
+	{
+	    //Parent updated, read again
+	    continue;
+	}
+	if (UNLIKELY(HAS_MARK(this->next)))
+	{
+	    //'this' marked for removal by other thread
+	    //Let's give a helping hand
+	    enum op_status st = remove_node(prnt, this, hash, removed);
+	    if (st == op_success || st == op_search)
+	    {
+		//'this' node removed, '*prnt' points to 'next'
+		//Continue from current position
+		continue;
+	    }
+	    //Else parent node is also marked for removal
+	    //Parent must be removed before we remove 'this'
+	    //Restart from beginning
+	    prnt = head;
+	    continue;
+	}
+	num++;
+	if (!cb(arg, this, hash))
+	{
+	    //Continue traversal
+	    prnt = this;
+	    SWAP(hpprnt, hpthis);
+	    continue;
+	}
+	//Callback requested removal of 'this'
+	enum op_status st = remove_node(prnt, this, hash, removed);
+	if (UNLIKELY(st == op_notfound || st == op_frozen))
+	{
+	    //Parent marked for removal or list frozen by migration
+	    //Search for 'this' in the hash table until it has been removed
+	    //Parent not needed anymore, release it to make room for the
+	    //hazard pointers used by the search
+	    p64_hazptr_release_ro(&hpprnt);
+	    bool success = remove_elem(ht, this, hash, removed,
+				       st == op_notfound);
+	    prnt = head;
+	    if (!success)
+	    {
+		//'this' removed by other thread
+		continue;
+	    }
+	}
+	//'this' has been unlinked, '*prnt' points to 'next'
+	if (reclaim != NULL)
+	{
+	    p64_hazptr_retire(this, reclaim);
+	}
+    }
+    p64_hazptr_release_ro(&hpprnt);
+    p64_hazptr_release_ro(&hpthis);
+    return num;
+}
+
+static uint32_t
+table_traverse(p64_hashtable_t *ht,
+	       struct hash_table *tbl,
+	       uint32_t first,
+	       uint32_t last,
+	       p64_hashtable_trav_cb cb,
+	       void *arg,
+	       void (*reclaim)(void *),
+	       int32_t *removed)
+{
+    uint32_t num = 0;
+    for (uint32_t bix = first; bix < last; bix++)
+    {
+	struct hash_bucket *bkt = &tbl->buckets[bix];
+	if (bix + 1 < last)
+	{
+	    PREFETCH_FOR_READ(&tbl->buckets[bix + 1]);
+	}
+	for (uint32_t i = 0; i < BKT_SIZE; i++)
+	{
+	    //Avoid acquiring hazard pointers for empty slots
+	    if (REM_MARK(__atomic_load_n(&bkt->elems[i].next,
+					 __ATOMIC_RELAXED)) != NULL)
+	    {
+		num += list_traverse(ht, &bkt->elems[i], cb, arg, reclaim,
+				     removed);
+	    }
+	}
+    }
+    return num;
+}
+
+uint32_t
+p64_hashtable_traverse_range(p64_hashtable_t *ht,
+			     uint32_t first,
+			     uint32_t last,
+			     p64_hashtable_trav_cb cb,
+			     void *arg,
+			     void (*reclaim)(void *))
+{
+    p64_hazardptr_t hptbl = P64_HAZARDPTR_NULL;
+    int32_t removed = 0;
+    uint32_t num = 0;
+    begin_update();
+    if (UNLIKELY(__atomic_load_n(&ht->old, __ATOMIC_RELAXED) != NULL))
+    {
+	help_migrate(ht);
+    }
+    struct hash_table *cur = p64_hazptr_acquire((void **)&ht->cur, &hptbl);
+    uint32_t nbkts = cur->nbkts;
+    //Traverse the corresponding part of any table being migrated before
+    //current table, elements are migrated from the old table to the new
+    struct hash_table *old = p64_hazptr_acquire((void **)&ht->old, &hptbl);
+    if (UNLIKELY(old != NULL) && old != cur)
+    {
+	uint32_t ofirst = (uint64_t)MIN(first, nbkts) * old->nbkts / nbkts;
+	uint32_t olast = (uint64_t)MIN(last, nbkts) * old->nbkts / nbkts;
+	num += table_traverse(ht, old, ofirst, olast, cb, arg, reclaim,
+			      &removed);
+    }
+    cur = p64_hazptr_acquire((void **)&ht->cur, &hptbl);
+    num += table_traverse(ht, cur, first, MIN(last, cur->nbkts), cb, arg,
+			  reclaim, &removed);
+    p64_hazptr_release_ro(&hptbl);
+    update_counters(ht, removed);
+    return num;
+}
+
+uint32_t
+p64_hashtable_traverse(p64_hashtable_t *ht,
+		       p64_hashtable_trav_cb cb,
+		       void *arg,
+		       void (*reclaim)(void *))
+{
+    return p64_hashtable_traverse_range(ht, 0, UINT32_MAX, cb, arg, reclaim);
+}
+
+bool
+p64_hashtable_traverse_next(p64_hashtable_t *ht,
+			    uint32_t *cursor,
+			    uint32_t nbkts,
+			    p64_hashtable_trav_cb cb,
+			    void *arg,
+			    void (*reclaim)(void *))
+{
+    uint32_t first = *cursor;
+    uint32_t last = nbkts < UINT32_MAX - first ? first + nbkts : UINT32_MAX;
+    (void)p64_hashtable_traverse_range(ht, first, last, cb, arg, reclaim);
+    if (last >= p64_hashtable_nbuckets(ht))
+    {
+	//End of table reached
+	*cursor = 0;
+	return false;
+    }
+    *cursor = last;
+    return true;
+}
+
+uint32_t
+p64_hashtable_nbuckets(p64_hashtable_t *ht)
+{
+    p64_hazardptr_t hptbl = P64_HAZARDPTR_NULL;
+    struct hash_table *tbl = p64_hazptr_acquire((void **)&ht->cur, &hptbl);
+    uint32_t nbkts = tbl->nbkts;
+    p64_hazptr_release_ro(&hptbl);
+    return nbkts;
+}
+
+//Return number of elements in list, restart if list is concurrently updated
+static uint32_t
+list_length(p64_hashelem_t *head)
+{
+    p64_hazardptr_t hpprnt = P64_HAZARDPTR_NULL;
+    p64_hazardptr_t hpthis = P64_HAZARDPTR_NULL;
+    p64_hashelem_t *prnt = head;
+    uint32_t len = 0;
+    for (;;)
+    {
+	p64_hashelem_t *this = p64_hazptr_acquire((void**)&prnt->next, &hpthis);
+	if (UNLIKELY(HAS_MARK(this)))
+	{
+	    //Parent marked for removal, 'this' may also have been removed
+	    //and cannot be safely dereferenced
+	    //Restart from beginning
+	    prnt = head;
+	    len = 0;
+	    continue;
+	}
+	this = REM_MARK(this);
+	if (this == NULL)
+	{
+	    break;
+	}
+	len++;
+	prnt = this;
+	SWAP(hpprnt, hpthis);
+    }
+    p64_hazptr_release_ro(&hpprnt);
+    p64_hazptr_release_ro(&hpthis);
+    return len;
+}
+
+void
+p64_hashtable_stats(p64_hashtable_t *ht,
+		    p64_hashtable_stats_t *st)
+{
+    p64_hazardptr_t hptbl = P64_HAZARDPTR_NULL;
+    st->nelems = count_elems(ht);
+    st->ncasfail = 0;
+    for (uint32_t i = 0; i < NSHARDS; i++)
+    {
+	st->ncasfail += __atomic_load_n(&ht->shards[i].ncasfail,
+					__ATOMIC_RELAXED);
+    }
+    st->nresizes = __atomic_load_n(&ht->nresizes, __ATOMIC_RELAXED);
+    st->maxchain = 0;
+    for (uint32_t i = 0; i <= BKT_SIZE; i++)
+    {
+	st->fill[i] = 0;
+    }
+    struct hash_table *tbl = p64_hazptr_acquire((void **)&ht->cur, &hptbl);
+    st->nbkts = tbl->nbkts;
+    for (uint32_t bix = 0; bix < tbl->nbkts; bix++)
+    {
+	struct hash_bucket *bkt = &tbl->buckets[bix];
+	uint32_t nfill = 0;
+	for (uint32_t i = 0; i < BKT_SIZE; i++)
+	{
+	    uint32_t len = list_length(&bkt->elems[i]);
+	    if (len != 0)
+	    {
+		nfill++;
+	    }
+	    if (len > st->maxchain)
+	    {
+		st->maxchain = len;
+	    }
+	}
+	st->fill[nfill]++;
+    }
+    p64_hazptr_release_ro(&hptbl);
+}
@@ -16,75 +16,156 @@
 
 #include "arch.h"
 #include "common.h"
-
-#define MAXREFS (MAXTHREADS * MAXHPREFS + 1)//One extra element!
+#include "stats.h"
 
 #define IS_NULL_PTR(ptr) ((uintptr_t)(ptr) < CACHE_LINE)
+//Low order bits of a pointer may be used as marks by the caller
+#define REM_MARKS(ptr) (void *)((uintptr_t)(ptr) & ~(uintptr_t)3)
+
+#define ALL_FREE (~0U >> (32 - MAXHPREFS))
 
 typedef void *userptr_t;
 
 struct hazard_area
 {
-    uint32_t free;//Which refs are free?
     userptr_t refs[MAXHPREFS];
+    uint32_t free;//Which refs are free? Written only by owner
+    uint32_t inuse;//Owned by a registered thread?
+    struct hazard_area *next;
 } ALIGNED(CACHE_LINE);
 
-static struct hazard_area hazard_areas[MAXTHREADS];
+//List of all hazard areas ever allocated, areas are recycled but never freed
+static struct hazard_area *hazard_areas = NULL;
+
+struct object
+{
+    userptr_t ptr;
+    void (*cb)(userptr_t);
+};
+
+//Retired objects left behind by unregistered threads
+struct orphans
+{
+    struct orphans *next;
+    uint32_t nitems;
+    struct object objs[];
+};
+
+static struct orphans *orphans = NULL;
 
 struct thread_state
 {
-    uint16_t tidx;//Thread index
+    struct hazard_area *ha;
     struct
     {
 	uint32_t nitems;
-	struct
-	{
-	    userptr_t ptr;
-	    void (*cb)(userptr_t);
-	} objs [MAXTHREADS * MAXHPREFS];
+	uint32_t maxitems;
+	struct object *objs;
     } rlist;//Removed but not yet recycled objects
+    uint32_t maxrefs;
+    uint32_t maxrefset;
+    userptr_t *refs;
+    userptr_t *refset;
     struct
     {
 	const char *file;
 	uintptr_t line;//Unsigned the size of a pointer
     } hp_fileline[MAXHPREFS];
-} ALIGNED(CACHE_LINE);
+};
 
-static uint32_t tidx_counter = 0;
-static uint32_t numthreads = 0;
-static struct thread_state thread_state[MAXTHREADS];
+static __thread struct thread_state thread_state;
 static __thread struct thread_state *TS;
 
+static void *
+xrealloc(void *ptr, size_t size)
+{
+    ptr = realloc(ptr, size);
+    if (ptr == NULL)
+    {
+	perror("realloc"), abort();
+    }
+    return ptr;
+}
+
+//Ensure there is room for at least 'size' retired objects
 static void
-p64_hazardptr_init(void)
+rlist_reserve(struct thread_state *ts,
+	      uint32_t size)
 {
-    uint32_t tidx = __atomic_fetch_add(&tidx_counter, 1, __ATOMIC_RELAXED);
-    if (tidx >= MAXTHREADS)
+    if (size > ts->rlist.maxitems)
     {
-	fprintf(stderr, "Too many threads using hazard pointers\n"), abort();
+	ts->rlist.objs = xrealloc(ts->rlist.objs, size * sizeof(struct object));
+	ts->rlist.maxitems = size;
     }
-    struct thread_state *ts = &thread_state[tidx];
-    TS = ts;
-    ts->tidx = tidx;
+}
+
+static struct hazard_area *
+hazard_area_alloc(void)
+{
+    struct hazard_area *ha;
+    //Try to recycle a hazard area released by an unregistered thread
+    for (ha = __atomic_load_n(&hazard_areas, __ATOMIC_ACQUIRE);
+	 ha != NULL;
+	 ha = ha->next)
+    {
+	if (__atomic_load_n(&ha->inuse, __ATOMIC_RELAXED) == 0 &&
+	    __atomic_exchange_n(&ha->inuse, 1, __ATOMIC_ACQUIRE) == 0)
+	{
+	    assert(ha->free == ALL_FREE);
+	    return ha;
+	}
+    }
+    //Allocate and initialise a new hazard area
+    //First touch by the owning thread makes memory local to its NUMA node
+    ha = aligned_alloc(CACHE_LINE, sizeof(struct hazard_area));
+    if (ha == NULL)
+    {
+	perror("aligned_alloc"), abort();
+    }
+    for (uint32_t i = 0; i < MAXHPREFS; i++)
+    {
+	ha->refs[i] = NULL;
+    }
+    ha->free = ALL_FREE;
+    ha->inuse = 1;
+    //Insert first in list, release our hazard area
+    ha->next = __atomic_load_n(&hazard_areas, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&hazard_areas,
+					&ha->next,
+					ha,
+					/*weak=*/true,
+					__ATOMIC_RELEASE,
+					__ATOMIC_RELAXED))
+    {
+	//Failed, ha->next updated, try again
+    }
+    return ha;
+}
+
+void
+p64_hazptr_register(void)
+{
+    if (TS != NULL)
+    {
+	//Already registered
+	return;
+    }
+    struct thread_state *ts = &thread_state;
+    ts->ha = hazard_area_alloc();
     ts->rlist.nitems = 0;
-    hazard_areas[tidx].free = (1U << MAXHPREFS) - 1U;
+    ts->rlist.maxitems = 0;
+    ts->rlist.objs = NULL;
+    rlist_reserve(ts, HP_RETIRE_THRESHOLD);
+    ts->maxrefs = 0;
+    ts->maxrefset = 0;
+    ts->refs = NULL;
+    ts->refset = NULL;
     for (uint32_t i = 0; i < MAXHPREFS; i++)
     {
-	hazard_areas[tidx].refs[i] = NULL;
 	ts->hp_fileline[i].file = NULL;
 	ts->hp_fileline[i].line = 0;
     }
-    //Increment 'numthreads' in-order since the store will release our
-    //and any preceding hazard_areas and their hazard pointers
-    if (__atomic_load_n(&numthreads, __ATOMIC_RELAXED) != tidx)
-    {
-	SEVL();
-	while (WFE() && LDXR32(&numthreads, __ATOMIC_RELAXED) != tidx)
-	{
-	    DOZE();
-	}
-    }
-    __atomic_store_n(&numthreads, tidx + 1, __ATOMIC_RELEASE);
+    TS = ts;
 }
 
 uint32_t
@@ -100,13 +181,14 @@ p64_hazptr_alloc(void)
 {
     if (UNLIKELY(TS == NULL))
     {
-	p64_hazardptr_init();
+	p64_hazptr_register();
     }
-    struct hazard_area *ha = &hazard_areas[TS->tidx];
+    struct hazard_area *ha = TS->ha;
     if (ha->free != 0)
     {
 	uint32_t idx = __builtin_ctz(ha->free);
-	ha->free &= ~(1U << idx);
+	//Ordered before the reference is written to the hazard pointer
+	__atomic_store_n(&ha->free, ha->free & ~(1U << idx), __ATOMIC_RELAXED);
 	assert(IS_NULL_PTR(ha->refs[idx]));
 	//printf("p64_hazptr_alloc(%u)\n", idx);
 	return &ha->refs[idx];
@@ -119,7 +201,7 @@ p64_hazptr_alloc(void)
 static inline void
 p64_hazptr_free(p64_hazardptr_t hp)
 {
-    struct hazard_area *ha = &hazard_areas[TS->tidx];
+    struct hazard_area *ha = TS->ha;
     uint32_t idx = hp - ha->refs;
     if (UNLIKELY(idx >= MAXHPREFS))
     {
@@ -130,7 +212,7 @@ p64_hazptr_free(p64_hazardptr_t hp)
     {
 	fprintf(stderr, "Hazard pointer %p already free\n", hp), abort();
     }
-    ha->free |= 1U << idx;
+    __atomic_store_n(&ha->free, ha->free | (1U << idx), __ATOMIC_RELAXED);
     TS->hp_fileline[idx].file = NULL;
     TS->hp_fileline[idx].line = 0;
     //printf("p64_hazptr_free(%u)\n", idx);
@@ -143,7 +225,7 @@ p64_hazptr_annotate(p64_hazardptr_t hp,
 {
     if (hp != P64_HAZARDPTR_NULL)
     {
-	struct hazard_area *ha = &hazard_areas[TS->tidx];
+	struct hazard_area *ha = TS->ha;
 	uint32_t idx = hp - ha->refs;
 	if (idx < MAXHPREFS)
 	{
@@ -158,9 +240,9 @@ p64_hazptr_dump(FILE *fp)
 {
     if (UNLIKELY(TS == NULL))
     {
-	p64_hazardptr_init();
+	p64_hazptr_register();
     }
-    struct hazard_area *ha = &hazard_areas[TS->tidx];
+    struct hazard_area *ha = TS->ha;
     for (uint32_t i = 0; i < MAXHPREFS; i++)
     {
 	if ((ha->free & (1U << i)) == 0)
@@ -221,7 +303,8 @@ p64_hazptr_acquire(void **pptr,
 	    }
 	}
 	//Step 2b: Initialise hazard pointer with reference
-	__atomic_store_n(*hp, ptr, __ATOMIC_SEQ_CST);
+	//Any mark bits in the pointer are removed from the reference
+	__atomic_store_n(*hp, REM_MARKS(ptr), __ATOMIC_SEQ_CST);
 
 	//Sequential consistency will separate the store and the load
 
@@ -265,86 +348,139 @@ p64_hazptr_release_ro(p64_hazardptr_t *hp)
     }
 }
 
-//Qsort call-back: compare two pointers
-static int
-compare_ptr(const void *ppa,
-	    const void *ppb)
+static inline uint32_t
+refset_hash(userptr_t ptr,
+	    uint32_t bits)
 {
-    const void *pa = *(const void * const *)ppa;
-    const void *pb = *(const void * const *)ppb;
-    //Can't use pointer subtraction because difference might not fit into an int
-    return pa < pb ? -1 : pa > pb ? 1 : 0;
+    return ((uintptr_t)ptr * 0x9E3779B97F4A7C15ULL) >> (64 - bits);
 }
 
-//Collect active references from all threads
+//Collect active references from all threads into a hash set
+//Open addressing with linear probing, load factor <= 0.5
+//Return log2 of hash set size or 0 if there are no active references
 static uint32_t
-collect_refs(userptr_t refs[MAXREFS])
+collect_refs(struct thread_state *ts)
 {
     uint32_t nrefs = 0;
-    for (uint32_t t = 0; t < numthreads; t++)
+    //Hazard areas of threads which register after this load cannot hold
+    //references to objects which have already been removed
+    for (struct hazard_area *ha = __atomic_load_n(&hazard_areas,
+						  __ATOMIC_ACQUIRE);
+	 ha != NULL;
+	 ha = ha->next)
     {
-	for (uint32_t i = 0; i < MAXHPREFS; i++)
+	//Only scan allocated hazard pointers, this skips areas of threads
+	//which have unregistered or which hold no hazard pointers
+	//A hazard pointer allocated after this load will be written after
+	//our removal has become visible and thus cannot reference it
+	uint32_t free = __atomic_load_n(&ha->free, __ATOMIC_ACQUIRE);
+	uint32_t used = ~free & ALL_FREE;
+	while (used != 0)
 	{
-	    userptr_t ptr = __atomic_load_n(&hazard_areas[t].refs[i],
-					    __ATOMIC_RELAXED);
+	    uint32_t i = __builtin_ctz(used);
+	    used &= used - 1;
+	    userptr_t ptr = __atomic_load_n(&ha->refs[i], __ATOMIC_RELAXED);
 	    if (!IS_NULL_PTR(ptr))
 	    {
-		refs[nrefs++] = ptr;
+		if (UNLIKELY(nrefs == ts->maxrefs))
+		{
+		    ts->maxrefs = ts->maxrefs != 0 ? 2 * ts->maxrefs :
+						     MAXHPREFS;
+		    ts->refs = xrealloc(ts->refs,
+					ts->maxrefs * sizeof(userptr_t));
+		}
+		ts->refs[nrefs++] = ptr;
 	    }
 	}
     }
-    if (nrefs >= 2)
+    if (nrefs == 0)
+    {
+	return 0;
+    }
+    uint32_t bits = 1;
+    while ((1U << bits) < 2 * nrefs)
+    {
+	bits++;
+    }
+    if ((1U << bits) > ts->maxrefset)
     {
-	qsort(refs, nrefs, sizeof refs[0], compare_ptr);
+	ts->maxrefset = 1U << bits;
+	ts->refset = xrealloc(ts->refset, ts->maxrefset * sizeof(userptr_t));
     }
-    return nrefs;
+    userptr_t *refset = ts->refset;
+    uint32_t mask = (1U << bits) - 1;
+    memset(refset, 0, sizeof(userptr_t) << bits);
+    for (uint32_t i = 0; i < nrefs; i++)
+    {
+	uint32_t h = refset_hash(ts->refs[i], bits);
+	while (refset[h] != NULL && refset[h] != ts->refs[i])
+	{
+	    h = (h + 1) & mask;
+	}
+	refset[h] = ts->refs[i];
+    }
+    return bits;
 }
 
-//Check if a specific reference exists in the array
-static bool
-find_ptr(userptr_t refs[],
-	 int nrefs,
+//Check if a specific reference exists in the hash set
+static inline bool
+find_ptr(userptr_t refset[],
+	 uint32_t bits,
 	 userptr_t ptr)
 {
-    if (nrefs > 0)
+    if (bits != 0)
     {
-	int half = nrefs / 2;
-	if (ptr < refs[half])
-	{
-	    return find_ptr(refs, half - 1, ptr);
-	}
-	else if (ptr > refs[half])
+	uint32_t mask = (1U << bits) - 1;
+	uint32_t h = refset_hash(ptr, bits);
+	while (refset[h] != NULL)
 	{
-	    return find_ptr(refs + half + 1, nrefs - half - 1, ptr);
-	}
-	else//ptr == refs[half]
-	{
-	    return true;
+	    if (refset[h] == ptr)
+	    {
+		return true;
+	    }
+	    h = (h + 1) & mask;
 	}
     }
     return false;
 }
 
-//Traverse all retired objects and reclaim those that have no references
-static int
-garbage_collect(void)
+//Move objects retired by unregistered threads to our list of retired objects
+static void
+adopt_orphans(struct thread_state *ts)
 {
-    if (UNLIKELY(TS == NULL))
+    if (__atomic_load_n(&orphans, __ATOMIC_RELAXED) == NULL)
     {
-	p64_hazardptr_init();
+	return;
     }
-    struct thread_state *ts = TS;
+    struct orphans *ol = __atomic_exchange_n(&orphans, NULL, __ATOMIC_ACQUIRE);
+    while (ol != NULL)
+    {
+	struct orphans *next = ol->next;
+	rlist_reserve(ts, ts->rlist.nitems + ol->nitems);
+	memcpy(&ts->rlist.objs[ts->rlist.nitems],
+	       ol->objs,
+	       ol->nitems * sizeof(struct object));
+	ts->rlist.nitems += ol->nitems;
+	free(ol);
+	ol = next;
+    }
+}
+
+//Traverse all retired objects and reclaim those that have no references
+static int
+garbage_collect(struct thread_state *ts)
+{
+    adopt_orphans(ts);
     uint32_t nreclaimed = 0;
-    userptr_t refs[MAXREFS];
-    //Get sorted list of active references
-    uint32_t nrefs = collect_refs(refs);
+    //Get set of active references
+    uint32_t bits = collect_refs(ts);
     //Traverse list of retired objects
     uint32_t n = 0;
     for (uint32_t i = 0; i != ts->rlist.nitems; i++)
     {
 	userptr_t ptr         = ts->rlist.objs[i].ptr;
 	void (*cb)(userptr_t) = ts->rlist.objs[i].cb;
-	if (find_ptr(refs, nrefs, ptr))
+	if (find_ptr(ts->refset, bits, ptr))
 	{
 	    //Retired object still referenced, keep it in rlist
 	    ts->rlist.objs[n  ].ptr = ptr;
@@ -359,6 +495,11 @@ garbage_collect(void)
     }
     //Some objects may remain in the list of retired objects
     ts->rlist.nitems = n;
+    STAT_INC(STAT_HAZPTR_GC);
+    STAT_ADD(STAT_HAZPTR_FREED, nreclaimed);
+    //At least HP_RETIRE_THRESHOLD objects can be retired before the next
+    //garbage collection
+    rlist_reserve(ts, n + HP_RETIRE_THRESHOLD);
     return nreclaimed;
 }
 
@@ -368,26 +509,91 @@ void
 p64_hazptr_retire(void *ptr,
 		  void (*cb)(void *ptr))
 {
+    p64_hazptr_retire_vec(&ptr, 1, cb);
+}
+
+void
+p64_hazptr_retire_vec(void *ptrs[],
+		      uint32_t num,
+		      void (*cb)(void *ptr))
+{
+    if (UNLIKELY(TS == NULL))
+    {
+	p64_hazptr_register();
+    }
     struct thread_state *ts = TS;
-    //There is always space for one extra retired object
-    ts->rlist.objs[ts->rlist.nitems  ].ptr = ptr;
-    ts->rlist.objs[ts->rlist.nitems++].cb  = cb;
-    if (ts->rlist.nitems == MAXREFS)
-    {
-	//rlist full
-	//Ensure all removals are visible before we read hazard pointers
-	smp_fence(StoreLoad);
-	//Try to reclaim objects
-	(void)garbage_collect();
-	//At least one object must have been reclaimed
-	assert(ts->rlist.nitems < MAXREFS);
+    for (uint32_t i = 0; i < num; i++)
+    {
+	ts->rlist.objs[ts->rlist.nitems  ].ptr = ptrs[i];
+	ts->rlist.objs[ts->rlist.nitems++].cb  = cb;
+	if (ts->rlist.nitems == ts->rlist.maxitems)
+	{
+	    //rlist full
+	    //Ensure all removals are visible before we read hazard pointers
+	    smp_fence(StoreLoad);
+	    //Try to reclaim objects
+	    (void)garbage_collect(ts);
+	}
     }
 }
 
 bool
 p64_hazptr_reclaim(void)
 {
+    if (UNLIKELY(TS == NULL))
+    {
+	p64_hazptr_register();
+    }
     //Try to reclaim objects
-    uint32_t nreclaimed = garbage_collect();
+    uint32_t nreclaimed = garbage_collect(TS);
     return nreclaimed != 0;
 }
+
+void
+p64_hazptr_unregister(void)
+{
+    struct thread_state *ts = TS;
+    if (ts == NULL)
+    {
+	return;
+    }
+    struct hazard_area *ha = ts->ha;
+    if (UNLIKELY(ha->free != ALL_FREE))
+    {
+	fprintf(stderr, "Hazard pointers still allocated\n");
+	p64_hazptr_dump(stderr);
+	fflush(stderr);
+	abort();
+    }
+    //Ensure all removals are visible before we read hazard pointers
+    smp_fence(StoreLoad);
+    (void)garbage_collect(ts);
+    if (ts->rlist.nitems != 0)
+    {
+	//Hand over still referenced objects to the remaining threads
+	struct orphans *ol = malloc(sizeof(struct orphans) +
+				    ts->rlist.nitems * sizeof(struct object));
+	if (ol == NULL)
+	{
+	    perror("malloc"), abort();
+	}
+	ol->nitems = ts->rlist.nitems;
+	memcpy(ol->objs, ts->rlist.objs, ol->nitems * sizeof(struct object));
+	ol->next = __atomic_load_n(&orphans, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&orphans,
+					    &ol->next,
+					    ol,
+					    /*weak=*/true,
+					    __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED))
+	{
+	    //Failed, ol->next updated, try again
+	}
+    }
+    free(ts->rlist.objs);
+    free(ts->refs);
+    free(ts->refset);
+    //Release our hazard area for reuse by other threads
+    __atomic_store_n(&ha->inuse, 0, __ATOMIC_RELEASE);
+    TS = NULL;
+}
@@ -11,10 +11,19 @@
 #include <string.h>
 
 #include "p64_laxrob.h"
+#include "p64_alloc.h"
 #include "build_config.h"
 
 #include "arch.h"
 #include "common.h"
+#include "stats.h"
+
+//Once 'tick' has aged, all slots before 'sn' are due for retirement
+struct aging
+{
+    uint32_t tick;
+    uint32_t sn;
+};
 
 struct p64_laxrob
 {
@@ -26,23 +35,55 @@ struct p64_laxrob
     uint32_t mask;
     uint32_t nvec;//Number of elems buffered in output vector
     uint32_t vecsz;//Size of output vector
+    uint32_t now;//Current time (tick), updated by p64_laxrob_tick()
+    uint32_t maxhold;//Max time an element is held in ROB
+    //Queue of arrival times, increasing in both tick and sn, so ticks only
+    //visit aged entries, NULL if no time-based retirement
+    struct aging *aging;
+    uint32_t aghead;
+    uint32_t agtail;
+    uint32_t next_off;//Offset of next pointer in element
+    uint32_t sn_off;//Offset of sequence number in element
     p64_laxrob_elem_t *ring[];//ROB ring buffer followed by output vector
 };
 
 //Address of output vector
 #define ROB_VEC(rob) ((rob)->ring + (rob)->size)
 
+//Element fields are accessed using the configured offsets, the actual type
+//of element fields is user defined
+typedef p64_laxrob_elem_t *elemptr_t __attribute__((__may_alias__));
+typedef uint32_t elemsn_t __attribute__((__may_alias__));
+
+static inline elemptr_t *
+NEXT(const p64_laxrob_t *rob, p64_laxrob_elem_t *elem)
+{
+    return (elemptr_t *)((char *)elem + rob->next_off);
+}
+
+static inline uint32_t
+SN(const p64_laxrob_t *rob, p64_laxrob_elem_t *elem)
+{
+    return *(const elemsn_t *)((const char *)elem + rob->sn_off);
+}
+
 #define IDLE 1
 #define BUSY NULL
 #define IS_IDLE(x) (((uintptr_t)(x) & IDLE) != 0)
 #define IS_BUSY(x) (((uintptr_t)(x) & IDLE) == 0)
 #define PEND_PTR(x) (p64_rob_elem_t *)((uintptr_t)(x) & ~IDLE)
 
-p64_laxrob_t *
-p64_laxrob_alloc(uint32_t nslots,
-		 uint32_t vecsz,
-		 p64_laxrob_cb cb,
-		 void *arg)
+static p64_laxrob_t *
+laxrob_alloc(uint32_t nslots,
+	     uint32_t vecsz,
+	     bool timeout,
+	     uint32_t maxhold,
+	     size_t next_off,
+	     size_t sn_off,
+	     p64_laxrob_cb cb,
+	     void *arg,
+	     int32_t numanode,
+	     uint32_t allocflags)
 {
     assert(IS_IDLE(IDLE));
     assert(!IS_IDLE(BUSY));
@@ -60,9 +101,10 @@ p64_laxrob_alloc(uint32_t nslots,
     }
     unsigned long ringsize = ROUNDUP_POW2(nslots);
     size_t nbytes = ROUNDUP(sizeof(p64_laxrob_t) +
-			    (ringsize + vecsz) * sizeof(p64_laxrob_elem_t *),
+			    (ringsize + vecsz) * sizeof(p64_laxrob_elem_t *) +
+			    (timeout ? ringsize * sizeof(struct aging) : 0),
 			    CACHE_LINE);
-    p64_laxrob_t *rob = aligned_alloc(CACHE_LINE, nbytes);
+    p64_laxrob_t *rob = p64_malloc(nbytes, CACHE_LINE, numanode, allocflags);
     if (rob != NULL)
     {
 	rob->pending = (p64_laxrob_elem_t *)IDLE;
@@ -73,6 +115,15 @@ p64_laxrob_alloc(uint32_t nslots,
 	rob->arg = arg;
 	rob->nvec = 0;
 	rob->vecsz = vecsz;
+	rob->now = 0;
+	rob->maxhold = maxhold;
+	rob->next_off = next_off;
+	rob->sn_off = sn_off;
+	//Arrival times follow the output vector
+	rob->aging = timeout ?
+		     (struct aging *)(rob->ring + ringsize + vecsz) : NULL;
+	rob->aghead = 0;
+	rob->agtail = 0;
 	for (uint32_t i = 0; i < ringsize; i++)
 	{
 	    rob->ring[i] = NULL;
@@ -84,6 +135,69 @@ p64_laxrob_alloc(uint32_t nslots,
     return NULL;
 }
 
+p64_laxrob_t *
+p64_laxrob_alloc(uint32_t nslots,
+		 uint32_t vecsz,
+		 p64_laxrob_cb cb,
+		 void *arg)
+{
+    return laxrob_alloc(nslots, vecsz, false, 0,
+			offsetof(p64_laxrob_elem_t, next),
+			offsetof(p64_laxrob_elem_t, sn),
+			cb, arg, P64_ALLOC_ANYNODE, 0);
+}
+
+p64_laxrob_t *
+p64_laxrob_alloc_ex(uint32_t nslots,
+		    uint32_t vecsz,
+		    p64_laxrob_cb cb,
+		    void *arg,
+		    int32_t numanode,
+		    uint32_t allocflags)
+{
+    return laxrob_alloc(nslots, vecsz, false, 0,
+			offsetof(p64_laxrob_elem_t, next),
+			offsetof(p64_laxrob_elem_t, sn),
+			cb, arg, numanode, allocflags);
+}
+
+p64_laxrob_t *
+p64_laxrob_alloc_layout(uint32_t nslots,
+			uint32_t vecsz,
+			size_t next_off,
+			size_t sn_off,
+			p64_laxrob_cb cb,
+			void *arg)
+{
+    if (next_off % sizeof(void *) != 0 || sn_off % sizeof(uint32_t) != 0 ||
+	next_off > UINT32_MAX || sn_off > UINT32_MAX)
+    {
+	fprintf(stderr, "Invalid laxrob element layout next %zu sn %zu\n",
+		next_off, sn_off);
+	abort();
+    }
+    return laxrob_alloc(nslots, vecsz, false, 0, next_off, sn_off, cb, arg,
+			P64_ALLOC_ANYNODE, 0);
+}
+
+p64_laxrob_t *
+p64_laxrob_alloc_timeout(uint32_t nslots,
+			 uint32_t vecsz,
+			 uint32_t maxhold,
+			 p64_laxrob_cb cb,
+			 void *arg)
+{
+    if (maxhold > 0x80000000)
+    {
+	fprintf(stderr, "Invalid laxrob max hold time %u\n", maxhold);
+	abort();
+    }
+    return laxrob_alloc(nslots, vecsz, true, maxhold,
+			offsetof(p64_laxrob_elem_t, next),
+			offsetof(p64_laxrob_elem_t, sn),
+			cb, arg, P64_ALLOC_ANYNODE, 0);
+}
+
 void
 p64_laxrob_free(p64_laxrob_t *rob)
 {
@@ -98,7 +212,7 @@ p64_laxrob_free(p64_laxrob_t *rob)
 		abort();
 	    }
 	}
-	free(rob);
+	p64_mfree(rob);
     }
 }
 
@@ -107,10 +221,9 @@ retire_list(p64_laxrob_t *rob, p64_laxrob_elem_t *list)
 {
     do
     {
-	assert(list->sn == rob->oldest);
 	p64_laxrob_elem_t *elem = list;
-	p64_laxrob_elem_t *next = list->next;
-	list->next = NULL;
+	p64_laxrob_elem_t *next = *NEXT(rob, list);
+	*NEXT(rob, list) = NULL;
 	//'elem' is single node
 	assert(rob->nvec < rob->vecsz);
 	ROB_VEC(rob)[rob->nvec++] = elem;
@@ -135,6 +248,7 @@ retire_slots(p64_laxrob_t *rob, uint32_t nslots)
 	p64_laxrob_elem_t *list = rob->ring[rob->oldest & rob->mask];
 	if (list != NULL)
 	{
+	    assert(SN(rob, list) == rob->oldest);
 	    rob->ring[rob->oldest & rob->mask] = NULL;
 	    retire_list(rob, list);
 	}
@@ -147,6 +261,61 @@ retire_slots(p64_laxrob_t *rob, uint32_t nslots)
 #define BEFORE(sn, h) ((int32_t)(sn) - (int32_t)(h) < 0)
 #define AFTER(sn, t) ((int32_t)(sn) - (int32_t)(t) >= 0)
 
+//Record arrival of element with sequence number 'sn' at the current tick
+static inline void
+aging_insert(p64_laxrob_t *rob, uint32_t sn)
+{
+    //Drop entries for slots which have already been retired
+    while (rob->aghead != rob->agtail &&
+	   !BEFORE(rob->oldest, rob->aging[rob->aghead & rob->mask].sn))
+    {
+	rob->aghead++;
+    }
+    if (rob->aghead != rob->agtail)
+    {
+	struct aging *tail = &rob->aging[(rob->agtail - 1) & rob->mask];
+	if (!BEFORE(tail->sn, sn + 1))
+	{
+	    //Slot already covered by an entry which is at least as old
+	    return;
+	}
+	if (tail->tick == rob->now)
+	{
+	    tail->sn = sn + 1;
+	    return;
+	}
+    }
+    //Entries have increasing sn inside the ring so the queue cannot overflow
+    assert(rob->agtail - rob->aghead < rob->size);
+    struct aging *neu = &rob->aging[rob->agtail++ & rob->mask];
+    neu->tick = rob->now;
+    neu->sn = sn + 1;
+}
+
+//Retire all slots (including holes) up to and including the last non-empty
+//slot which has been held for at least 'maxhold' ticks
+//Any younger elements before that slot are retired early to maintain order
+static void
+retire_aged(p64_laxrob_t *rob)
+{
+    //Only entries which have aged are visited
+    uint32_t end = rob->oldest;
+    while (rob->aghead != rob->agtail)
+    {
+	struct aging *head = &rob->aging[rob->aghead & rob->mask];
+	if ((int32_t)(rob->now - head->tick) < (int32_t)rob->maxhold)
+	{
+	    break;
+	}
+	if (BEFORE(end, head->sn))
+	{
+	    end = head->sn;
+	}
+	rob->aghead++;
+    }
+    retire_slots(rob, end - rob->oldest);
+}
+
 static void
 insert_elems(p64_laxrob_t *rob, p64_laxrob_elem_t *list)
 {
@@ -154,32 +323,42 @@ insert_elems(p64_laxrob_t *rob, p64_laxrob_elem_t *list)
     while (list != NULL)
     {
 	p64_laxrob_elem_t *elem = list;
-	p64_laxrob_elem_t *next = list->next;
-	list->next = NULL;
+	p64_laxrob_elem_t *next = *NEXT(rob, list);
+	*NEXT(rob, list) = NULL;
+	uint32_t sn = SN(rob, elem);
 	//'elem' is single node
-	if (UNLIKELY(BEFORE(elem->sn, rob->oldest)))
+	if (UNLIKELY(BEFORE(sn, rob->oldest)))
 	{
 	    //Element before oldest => straggler
 	    retire_list(rob, elem);
 	}
-	else if (AFTER(elem->sn, rob->oldest + rob->size))
+	else if (AFTER(sn, rob->oldest + rob->size))
 	{
 	    //Element beyond newest element
 	    //Move buffer to accomodate new element
-	    uint32_t delta = elem->sn - (rob->oldest + rob->size - 1);
+	    uint32_t delta = sn - (rob->oldest + rob->size - 1);
 	    retire_slots(rob, delta);
-	    assert(!BEFORE(elem->sn, rob->oldest));
-	    assert(!AFTER(elem->sn, rob->oldest + rob->size));
+	    assert(!BEFORE(sn, rob->oldest));
+	    assert(!AFTER(sn, rob->oldest + rob->size));
 	    //Insert element into ring
-	    assert(rob->ring[elem->sn & rob->mask] == NULL);
-	    rob->ring[elem->sn & rob->mask] = elem;
+	    assert(rob->ring[sn & rob->mask] == NULL);
+	    rob->ring[sn & rob->mask] = elem;
+	    if (rob->aging != NULL)
+	    {
+		aging_insert(rob, sn);
+	    }
 	}
 	else
 	{
 	    //Element inside buffer
 	    //Insert element at head of list at ROB slot
-	    elem->next = rob->ring[elem->sn & rob->mask];
-	    rob->ring[elem->sn & rob->mask] = elem;
+	    *NEXT(rob, elem) = rob->ring[sn & rob->mask];
+	    rob->ring[sn & rob->mask] = elem;
+	    if (rob->aging != NULL && *NEXT(rob, elem) == NULL)
+	    {
+		//First element in slot
+		aging_insert(rob, sn);
+	    }
 	}
 	list = next;
     }
@@ -194,7 +373,7 @@ insert_elems(p64_laxrob_t *rob, p64_laxrob_elem_t *list)
 static inline p64_laxrob_elem_t *
 acquire_rob_or_enqueue(p64_laxrob_t *rob,
 		       p64_laxrob_elem_t *list,
-		       p64_laxrob_elem_t **last)
+		       elemptr_t *last)
 {
     int ret;
     p64_laxrob_elem_t *old, *neu;
@@ -229,7 +408,7 @@ acquire_rob_or_enqueue(p64_laxrob_t *rob,
 	    *last = NULL;
 	}
     }
-    while (UNLIKELY(!ret));
+    while (UNLIKELY(!ret) && STAT_RETRY(STAT_LAXROB_RETRY));
     assert(rob->nvec == 0);
     return IS_BUSY(old) ? NULL /*enqueued*/: list /*acquired*/;
 }
@@ -269,7 +448,7 @@ release_rob_or_dequeue(p64_laxrob_t *rob)
 					      __ATOMIC_RELAXED);
 	}
     }
-    while (UNLIKELY(!ret));
+    while (UNLIKELY(!ret) && STAT_RETRY(STAT_LAXROB_RETRY));
     return old;
 }
 
@@ -300,7 +479,8 @@ acquire_rob(p64_laxrob_t *rob)
 						 neu,
 						 /*weak=*/true,
 						 __ATOMIC_RELAXED,
-						 __ATOMIC_RELAXED)));
+						 __ATOMIC_RELAXED)) &&
+	   STAT_RETRY(STAT_LAXROB_RETRY));
 }
 
 void
@@ -308,10 +488,10 @@ p64_laxrob_insert(p64_laxrob_t *rob,
 		  p64_laxrob_elem_t *list)
 {
     //Find last element in list
-    p64_laxrob_elem_t **last = &list;
+    elemptr_t *last = &list;
     while (*last != NULL)
     {
-	last = &(*last)->next;
+	last = NEXT(rob, *last);
     }
 
     //Acquire ROB or enqueue elements
@@ -329,15 +509,10 @@ p64_laxrob_insert(p64_laxrob_t *rob,
     }
 }
 
-//Retire in-order elements and invoke the callback
-void
-p64_laxrob_flush(p64_laxrob_t *rob,
-		 uint32_t nslots)
+//Flush buffered output and release ROB (or insert new elements)
+static void
+flush_and_release(p64_laxrob_t *rob)
 {
-    //Acquire ROB (may block)
-    acquire_rob(rob);
-
-    retire_slots(rob, nslots);
     //Flush any buffered output
     if (rob->nvec != 0)
     {
@@ -359,5 +534,33 @@ p64_laxrob_flush(p64_laxrob_t *rob,
     }
 }
 
+//Retire in-order elements and invoke the callback
+void
+p64_laxrob_flush(p64_laxrob_t *rob,
+		 uint32_t nslots)
+{
+    //Acquire ROB (may block)
+    acquire_rob(rob);
+
+    retire_slots(rob, nslots);
+    flush_and_release(rob);
+}
+
+void
+p64_laxrob_tick(p64_laxrob_t *rob,
+		uint32_t now)
+{
+    if (rob->aging == NULL)
+    {
+	fprintf(stderr, "Reorder buffer %p has no timeout\n", rob), abort();
+    }
+    //Acquire ROB (may block)
+    acquire_rob(rob);
+
+    rob->now = now;
+    retire_aged(rob);
+    flush_and_release(rob);
+}
+
 #undef BEFORE
 #undef AFTER
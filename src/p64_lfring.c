@@ -9,14 +9,22 @@
 #include <stdlib.h>
 
 #include "p64_lfring.h"
+#include "p64_alloc.h"
+#include "p64_hazardptr.h"
 #include "build_config.h"
 
 #include "arch.h"
 #include "common.h"
+#include "futex.h"
+#include "stats.h"
 #ifdef USE_LDXSTX
 #include "ldxstx.h"
 #endif
 
+#define SUPPORTED_FLAGS (P64_LFRING_F_WAITDEQ | P64_LFRING_F_STRICTFIFO)
+//Ring constructed in caller-supplied (possibly shared) memory
+#define FLAG_SHARED 0x80000000
+
 typedef uint32_t ringidx_t;
 
 struct p64_lfring
@@ -27,35 +35,124 @@ struct p64_lfring
 #else
     ringidx_t tail;
 #endif
+    uint32_t waiters;//Number of sleeping consumers
     ringidx_t mask;
+    uint32_t flags;
     void *ring[] ALIGNED(CACHE_LINE);
 } ALIGNED(CACHE_LINE);
 
-p64_lfring_t *
-p64_lfring_alloc(uint32_t nelems)
+//Ring slot in strict FIFO mode
+//seq == idx: slot is free for enqueue of element idx
+//seq == idx + 1: slot holds element idx
+struct fifo_slot
+{
+    ringidx_t seq;
+    void *elem;
+};
+
+static inline size_t
+slot_size(uint32_t flags)
+{
+    return (flags & P64_LFRING_F_STRICTFIFO) ? sizeof(struct fifo_slot) :
+					       sizeof(void *);
+}
+
+static unsigned long
+ring_size(uint32_t nelems, uint32_t flags)
 {
     unsigned long ringsz = ROUNDUP_POW2(nelems);
     if (nelems == 0 || ringsz == 0 || ringsz > 0x80000000)
     {
 	fprintf(stderr, "Invalid number of elements %u\n", nelems), abort();
     }
-    size_t nbytes = ROUNDUP(sizeof(p64_lfring_t) + ringsz * sizeof(void *),
-			    CACHE_LINE);
-    p64_lfring_t *lfr = aligned_alloc(CACHE_LINE, nbytes);
-    if (lfr != NULL)
+    if ((flags & ~SUPPORTED_FLAGS) != 0)
     {
-	lfr->head = 0;
-	lfr->tail = 0;
-	lfr->mask = ringsz - 1;
+	fprintf(stderr, "Invalid flags %x\n", flags), abort();
+    }
+    return ringsz;
+}
+
+static p64_lfring_t *
+lfring_init(p64_lfring_t *lfr, unsigned long ringsz, uint32_t flags)
+{
+    lfr->head = 0;
+    lfr->tail = 0;
+    lfr->waiters = 0;
+    lfr->mask = ringsz - 1;
+    lfr->flags = flags;
+    if (flags & P64_LFRING_F_STRICTFIFO)
+    {
+	struct fifo_slot *ring = (struct fifo_slot *)lfr->ring;
 	for (uint32_t i = 0; i < ringsz; i++)
 	{
-	    lfr->ring[i] = NULL;
+	    ring[i].seq = i;
+	    ring[i].elem = NULL;
 	}
 	return lfr;
     }
+    for (uint32_t i = 0; i < ringsz; i++)
+    {
+	lfr->ring[i] = NULL;
+    }
+    return lfr;
+}
+
+size_t
+p64_lfring_size(uint32_t nelems, uint32_t flags)
+{
+    unsigned long ringsz = ring_size(nelems, flags);
+    return ROUNDUP(sizeof(p64_lfring_t) + ringsz * slot_size(flags),
+		   CACHE_LINE);
+}
+
+p64_lfring_t *
+p64_lfring_alloc_ex(uint32_t nelems,
+		    uint32_t flags,
+		    int32_t numanode,
+		    uint32_t allocflags)
+{
+    unsigned long ringsz = ring_size(nelems, flags);
+    size_t nbytes = p64_lfring_size(nelems, flags);
+    p64_lfring_t *lfr = p64_malloc(nbytes, CACHE_LINE, numanode, allocflags);
+    if (lfr != NULL)
+    {
+	return lfring_init(lfr, ringsz, flags);
+    }
     return NULL;
 }
 
+p64_lfring_t *
+p64_lfring_alloc(uint32_t nelems)
+{
+    return p64_lfring_alloc_ex(nelems, 0, P64_ALLOC_ANYNODE, 0);
+}
+
+p64_lfring_t *
+p64_lfring_init(void *mem, size_t size, uint32_t nelems, uint32_t flags)
+{
+    unsigned long ringsz = ring_size(nelems, flags);
+    if ((uintptr_t)mem % CACHE_LINE != 0 || size < p64_lfring_size(nelems, flags))
+    {
+	fprintf(stderr, "Invalid memory %p size %zu\n", mem, size), abort();
+    }
+    //Memory may be shared between processes
+    return lfring_init(mem, ringsz, flags | FLAG_SHARED);
+}
+
+p64_lfring_t *
+p64_lfring_attach(void *mem)
+{
+    p64_lfring_t *lfr = mem;
+    if ((uintptr_t)mem % CACHE_LINE != 0 ||
+	!IS_POWER_OF_TWO(lfr->mask + 1UL) ||
+	(lfr->flags & FLAG_SHARED) == 0 ||
+	(lfr->flags & ~(SUPPORTED_FLAGS | FLAG_SHARED)) != 0)
+    {
+	fprintf(stderr, "Invalid lock-free ring %p\n", mem), abort();
+    }
+    return lfr;
+}
+
 void
 p64_lfring_free(p64_lfring_t *lfr)
 {
@@ -65,7 +162,7 @@ p64_lfring_free(p64_lfring_t *lfr)
 	{
 	    fprintf(stderr, "Lock-free ring %p is not empty\n", lfr);
 	}
-	free(lfr);
+	p64_mfree(lfr);
     }
 }
 
@@ -105,12 +202,138 @@ cond_update(ringidx_t *loc, ringidx_t neu)
 #endif
 }
 
+//Strict FIFO mode
+//Claim consecutive slots with a single CAS on tail (head), slot sequence
+//numbers tell if a slot is free (full) in the current lap of the ring
+static uint32_t
+enqueue_fifo(p64_lfring_t *lfr,
+	     void *const *restrict elems,
+	     uint32_t nelems)
+{
+    if (UNLIKELY(nelems == 0))
+    {
+	//Empty claim would be mistaken for a stale tail
+	return 0;
+    }
+    struct fifo_slot *ring = (struct fifo_slot *)lfr->ring;
+    ringidx_t mask = lfr->mask;
+    ringidx_t tail = __atomic_load_n(&lfr->tail, __ATOMIC_RELAXED);
+    uint32_t actual;
+    for (;;)
+    {
+	actual = 0;
+	while (actual < nelems &&
+	       __atomic_load_n(&ring[(tail + actual) & mask].seq,
+			       __ATOMIC_ACQUIRE) == tail + actual)
+	{
+	    actual++;
+	}
+	if (actual == 0)
+	{
+	    ringidx_t seq = __atomic_load_n(&ring[tail & mask].seq,
+					    __ATOMIC_ACQUIRE);
+	    if (before(seq, tail))
+	    {
+		//Slot still holds element from previous lap, ring full
+		return 0;
+	    }
+	    //Else our tail is stale
+	    tail = __atomic_load_n(&lfr->tail, __ATOMIC_RELAXED);
+	    continue;
+	}
+	if (__atomic_compare_exchange_n(&lfr->tail,
+					&tail,//Updated on failure
+					tail + actual,
+					/*weak=*/false,
+					__ATOMIC_RELAXED,
+					__ATOMIC_RELAXED))
+	{
+	    break;
+	}
+	STAT_INC(STAT_LFRING_RETRY);
+    }
+    //Write elements and release slots to consumers
+    for (uint32_t i = 0; i < actual; i++)
+    {
+	struct fifo_slot *slot = &ring[(tail + i) & mask];
+	slot->elem = elems[i];
+	__atomic_store_n(&slot->seq, tail + i + 1, __ATOMIC_RELEASE);
+    }
+    if (UNLIKELY(lfr->flags & P64_LFRING_F_WAITDEQ))
+    {
+	wake_waiters(&lfr->tail, &lfr->waiters,
+		     (lfr->flags & FLAG_SHARED) != 0);
+    }
+    return actual;
+}
+
+static uint32_t
+dequeue_fifo(p64_lfring_t *lfr,
+	     void **restrict elems,
+	     uint32_t nelems)
+{
+    if (UNLIKELY(nelems == 0))
+    {
+	//Empty claim would be mistaken for a stale head
+	return 0;
+    }
+    struct fifo_slot *ring = (struct fifo_slot *)lfr->ring;
+    ringidx_t mask = lfr->mask;
+    ringidx_t head = __atomic_load_n(&lfr->head, __ATOMIC_RELAXED);
+    uint32_t actual;
+    for (;;)
+    {
+	actual = 0;
+	while (actual < nelems &&
+	       __atomic_load_n(&ring[(head + actual) & mask].seq,
+			       __ATOMIC_ACQUIRE) == head + actual + 1)
+	{
+	    actual++;
+	}
+	if (actual == 0)
+	{
+	    ringidx_t seq = __atomic_load_n(&ring[head & mask].seq,
+					    __ATOMIC_ACQUIRE);
+	    if (before(seq, head + 1))
+	    {
+		//Slot not yet written, ring empty
+		return 0;
+	    }
+	    //Else our head is stale
+	    head = __atomic_load_n(&lfr->head, __ATOMIC_RELAXED);
+	    continue;
+	}
+	if (__atomic_compare_exchange_n(&lfr->head,
+					&head,//Updated on failure
+					head + actual,
+					/*weak=*/false,
+					__ATOMIC_RELAXED,
+					__ATOMIC_RELAXED))
+	{
+	    break;
+	}
+	STAT_INC(STAT_LFRING_RETRY);
+    }
+    //Read elements and release slots to producers in next lap
+    for (uint32_t i = 0; i < actual; i++)
+    {
+	struct fifo_slot *slot = &ring[(head + i) & mask];
+	elems[i] = slot->elem;
+	__atomic_store_n(&slot->seq, head + i + mask + 1, __ATOMIC_RELEASE);
+    }
+    return actual;
+}
+
 //Enqueue elements at tail
 uint32_t
 p64_lfring_enqueue(p64_lfring_t *lfr,
 		   void *const *restrict elems,
 		   uint32_t nelems)
 {
+    if (lfr->flags & P64_LFRING_F_STRICTFIFO)
+    {
+	return enqueue_fifo(lfr, elems, nelems);
+    }
     ringidx_t mask = lfr->mask;
     ringidx_t size = mask + 1;
     const ringidx_t org_tail = __atomic_load_n(&lfr->tail, __ATOMIC_RELAXED);
@@ -138,6 +361,7 @@ p64_lfring_enqueue(p64_lfring_t *lfr,
 	    else
 	    {
 		//Else CAS failed, someone else took the slot
+		STAT_INC(STAT_LFRING_RETRY);
 		//Active contention, re-read tail for a better index
 		ringidx_t tail = __atomic_load_n(&lfr->tail, __ATOMIC_RELAXED);
 		if (before(idx, tail))
@@ -158,6 +382,11 @@ p64_lfring_enqueue(p64_lfring_t *lfr,
 	//Either we or some other thread has unreleased updates
 	cond_update(&lfr->tail, idx);
     }
+    if (UNLIKELY(lfr->flags & P64_LFRING_F_WAITDEQ) && actual != 0)
+    {
+	wake_waiters(&lfr->tail, &lfr->waiters,
+		     (lfr->flags & FLAG_SHARED) != 0);
+    }
     return actual;
 }
 
@@ -167,6 +396,10 @@ p64_lfring_dequeue(p64_lfring_t *lfr,
 		   void **restrict elems,
 		   uint32_t nelems)
 {
+    if (lfr->flags & P64_LFRING_F_STRICTFIFO)
+    {
+	return dequeue_fifo(lfr, elems, nelems);
+    }
     ringidx_t mask = lfr->mask;
     const ringidx_t org_head = __atomic_load_n(&lfr->head, __ATOMIC_RELAXED);
     ringidx_t idx = org_head;
@@ -194,14 +427,16 @@ p64_lfring_dequeue(p64_lfring_t *lfr,
 #ifdef USE_LDXSTX
 	while (UNLIKELY(stx64((uint64_t *)&lfr->ring[idx & mask],
 			      (uint64_t)NULL,
-			      __ATOMIC_RELAXED)));
+			      __ATOMIC_RELAXED)) &&
+	       STAT_RETRY(STAT_LFRING_RETRY));
 #else
 	while (!__atomic_compare_exchange_n(&lfr->ring[idx & mask],
 					    &elem,//Updated on failure
 					    NULL,
 					    /*weak=*/false,
 					    __ATOMIC_ACQUIRE,
-					    __ATOMIC_RELAXED));
+					    __ATOMIC_RELAXED) &&
+	       STAT_RETRY(STAT_LFRING_RETRY));
 #endif
 	if (elem != NULL)
 	{
@@ -225,3 +460,273 @@ p64_lfring_dequeue(p64_lfring_t *lfr,
     }
     return actual;
 }
+
+uint32_t
+p64_lfring_dequeue_wait(p64_lfring_t *lfr,
+			void **restrict elems,
+			uint32_t nelems,
+			uint64_t timeout)
+{
+    static __thread uint32_t spin_budget = SPIN_MAX;
+    if (UNLIKELY(!(lfr->flags & P64_LFRING_F_WAITDEQ)))
+    {
+	fprintf(stderr, "Lock-free ring %p does not support waiting\n", lfr),
+	abort();
+    }
+    uint64_t deadline = 0;
+    for (;;)
+    {
+	uint32_t actual = p64_lfring_dequeue(lfr, elems, nelems);
+	if (actual != 0 || timeout == 0)
+	{
+	    return actual;
+	}
+	if (deadline == 0)
+	{
+	    deadline = deadline_ns(timeout);
+	}
+	if (!wait_nonempty(&lfr->tail, &lfr->head, &lfr->waiters,
+			   &spin_budget, deadline,
+			   (lfr->flags & FLAG_SHARED) != 0))
+	{
+	    return 0;
+	}
+    }
+}
+
+//Unbounded ring: a linked list of segments, each an array of slots indexed
+//by fetch-and-add counters
+//Enqueuers and dequeuers that race for the same slot are resolved by the
+//dequeuer swapping in TAKEN, the enqueuer then retries with another slot
+
+struct segment
+{
+    uint32_t enqidx ALIGNED(CACHE_LINE);
+    uint32_t deqidx ALIGNED(CACHE_LINE);
+    struct segment *next ALIGNED(CACHE_LINE);
+    void *slots[] ALIGNED(CACHE_LINE);
+};
+
+struct p64_lfring_seg
+{
+    struct segment *head ALIGNED(CACHE_LINE);
+    struct segment *tail ALIGNED(CACHE_LINE);
+    uint32_t segsize;
+};
+
+//Marks a slot as taken by a dequeuer
+static char taken_marker;
+#define TAKEN ((void *)&taken_marker)
+
+static struct segment *
+segment_alloc(uint32_t segsize)
+{
+    size_t nbytes = ROUNDUP(sizeof(struct segment) + segsize * sizeof(void *),
+			    CACHE_LINE);
+    struct segment *seg = p64_malloc(nbytes, CACHE_LINE, P64_ALLOC_ANYNODE, 0);
+    if (seg == NULL)
+    {
+	perror("p64_malloc"), abort();
+    }
+    seg->enqidx = 0;
+    seg->deqidx = 0;
+    seg->next = NULL;
+    for (uint32_t i = 0; i < segsize; i++)
+    {
+	seg->slots[i] = NULL;
+    }
+    return seg;
+}
+
+p64_lfring_seg_t *
+p64_lfring_seg_alloc(uint32_t segsize)
+{
+    if (segsize == 0)
+    {
+	fprintf(stderr, "Invalid segment size %u\n", segsize), abort();
+    }
+    p64_lfring_seg_t *lfs = p64_malloc(sizeof(p64_lfring_seg_t), CACHE_LINE,
+					P64_ALLOC_ANYNODE, 0);
+    if (lfs != NULL)
+    {
+	struct segment *seg = segment_alloc(segsize);
+	lfs->head = seg;
+	lfs->tail = seg;
+	lfs->segsize = segsize;
+	return lfs;
+    }
+    return NULL;
+}
+
+void
+p64_lfring_seg_free(p64_lfring_seg_t *lfs)
+{
+    if (lfs != NULL)
+    {
+	struct segment *seg = lfs->head;
+	if (seg->next != NULL ||
+	    MIN(seg->enqidx, lfs->segsize) > seg->deqidx)
+	{
+	    fprintf(stderr, "Unbounded ring %p is not empty\n", lfs);
+	}
+	while (seg != NULL)
+	{
+	    struct segment *next = seg->next;
+	    p64_mfree(seg);
+	    seg = next;
+	}
+	p64_mfree(lfs);
+    }
+}
+
+static void
+enqueue_seg(p64_lfring_seg_t *lfs,
+	    void *elem,
+	    p64_hazardptr_t *hp)
+{
+    uint32_t segsize = lfs->segsize;
+    for (;;)
+    {
+	struct segment *seg = p64_hazptr_acquire((void **)&lfs->tail, hp);
+	uint32_t idx = __atomic_fetch_add(&seg->enqidx, 1, __ATOMIC_RELAXED);
+	if (LIKELY(idx < segsize))
+	{
+	    void *old = NULL;
+	    if (__atomic_compare_exchange_n(&seg->slots[idx],
+					    &old,
+					    elem,
+					    /*weak=*/false,
+					    __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED))
+	    {
+		return;
+	    }
+	    //Else slot taken by dequeuer, try again
+	    STAT_INC(STAT_LFRING_RETRY);
+	    continue;
+	}
+	//Segment is full
+	struct segment *next = __atomic_load_n(&seg->next, __ATOMIC_ACQUIRE);
+	if (next == NULL)
+	{
+	    //Append new segment with our element in the first slot
+	    struct segment *neu = segment_alloc(segsize);
+	    neu->enqidx = 1;
+	    neu->slots[0] = elem;
+	    if (__atomic_compare_exchange_n(&seg->next,
+					    &next,//Updated on failure
+					    neu,
+					    /*weak=*/false,
+					    __ATOMIC_RELEASE,
+					    __ATOMIC_ACQUIRE))
+	    {
+		(void)__atomic_compare_exchange_n(&lfs->tail,
+						  &seg,
+						  neu,
+						  /*weak=*/false,
+						  __ATOMIC_RELEASE,
+						  __ATOMIC_RELAXED);
+		return;
+	    }
+	    //Else some other thread appended a segment
+	    STAT_INC(STAT_LFRING_RETRY);
+	    p64_mfree(neu);
+	}
+	//Help move tail to next segment
+	(void)__atomic_compare_exchange_n(&lfs->tail,
+					  &seg,
+					  next,
+					  /*weak=*/false,
+					  __ATOMIC_RELEASE,
+					  __ATOMIC_RELAXED);
+    }
+}
+
+void
+p64_lfring_seg_enqueue(p64_lfring_seg_t *lfs,
+		       void *const elems[],
+		       uint32_t nelems)
+{
+    p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+    for (uint32_t i = 0; i < nelems; i++)
+    {
+	enqueue_seg(lfs, elems[i], &hp);
+    }
+    p64_hazptr_release(&hp);
+}
+
+static void *
+dequeue_seg(p64_lfring_seg_t *lfs,
+	    p64_hazardptr_t *hp)
+{
+    uint32_t segsize = lfs->segsize;
+    for (;;)
+    {
+	struct segment *seg = p64_hazptr_acquire((void **)&lfs->head, hp);
+	uint32_t deqidx = __atomic_load_n(&seg->deqidx, __ATOMIC_RELAXED);
+	if (deqidx >= __atomic_load_n(&seg->enqidx, __ATOMIC_RELAXED) &&
+	    __atomic_load_n(&seg->next, __ATOMIC_ACQUIRE) == NULL)
+	{
+	    //Segment empty and no more segments
+	    return NULL;
+	}
+	uint32_t idx = __atomic_fetch_add(&seg->deqidx, 1, __ATOMIC_RELAXED);
+	if (LIKELY(idx < segsize))
+	{
+	    void *elem = __atomic_exchange_n(&seg->slots[idx],
+					     TAKEN,
+					     __ATOMIC_ACQUIRE);
+	    if (elem != NULL)
+	    {
+		return elem;
+	    }
+	    //Else enqueuer has not yet written slot, try again
+	    STAT_INC(STAT_LFRING_RETRY);
+	    continue;
+	}
+	//Segment is drained
+	struct segment *next = __atomic_load_n(&seg->next, __ATOMIC_ACQUIRE);
+	if (next == NULL)
+	{
+	    return NULL;
+	}
+	if (__atomic_compare_exchange_n(&lfs->head,
+					&seg,
+					next,
+					/*weak=*/false,
+					__ATOMIC_RELAXED,
+					__ATOMIC_RELAXED))
+	{
+	    //Tail might still point to drained segment, help move it
+	    struct segment *old = seg;
+	    (void)__atomic_compare_exchange_n(&lfs->tail,
+					      &old,
+					      next,
+					      /*weak=*/false,
+					      __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED);
+	    p64_hazptr_release(hp);
+	    p64_hazptr_retire(seg, p64_mfree);
+	}
+    }
+}
+
+uint32_t
+p64_lfring_seg_dequeue(p64_lfring_seg_t *lfs,
+		       void *elems[],
+		       uint32_t nelems)
+{
+    p64_hazardptr_t hp = P64_HAZARDPTR_NULL;
+    uint32_t actual = 0;
+    while (actual < nelems)
+    {
+	void *elem = dequeue_seg(lfs, &hp);
+	if (elem == NULL)
+	{
+	    break;
+	}
+	elems[actual++] = elem;
+    }
+    p64_hazptr_release(&hp);
+    return actual;
+}
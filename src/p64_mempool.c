@@ -0,0 +1,301 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p64_mempool.h"
+#include "p64_alloc.h"
+#include "build_config.h"
+
+#include "arch.h"
+#include "common.h"
+#include "lfstack.h"
+#include "stats.h"
+
+//Number of objects per magazine, a depot magazine fills two cache lines
+#define MAGSIZE ((2 * CACHE_LINE - 2 * sizeof(void *)) / sizeof(void *))
+//Max number of pools cached per thread
+#define MAXCACHES 8
+
+//Magazine in global depot
+struct magazine
+{
+    struct magazine *next;
+    void *objs[MAGSIZE];
+} ALIGNED(CACHE_LINE);
+
+//Magazine in per-thread cache
+struct lmagazine
+{
+    uint32_t nobjs;
+    void *objs[MAGSIZE];
+};
+
+struct p64_mempool
+{
+    struct lfstack full ALIGNED(CACHE_LINE);//Magazines with MAGSIZE objects
+    struct lfstack empty ALIGNED(CACHE_LINE);//Empty magazines
+    struct lfstack loose ALIGNED(CACHE_LINE);//Individual objects
+    char *base ALIGNED(CACHE_LINE);//First object
+    char *top;//Beyond last object
+    size_t objsize;
+    void *objmem;
+    uint64_t id;
+    struct magazine mags[] ALIGNED(CACHE_LINE);
+};
+
+//Per-thread cache of one pool
+struct cache
+{
+    p64_mempool_t *mp;
+    uint64_t id;//Detects reuse of a freed pool's address
+    uint32_t cur;//Index of current magazine
+    struct lmagazine mag[2];
+};
+
+static __thread struct cache caches[MAXCACHES];
+static uint64_t next_id = 1;
+
+p64_mempool_t *
+p64_mempool_alloc(uint32_t nobjs,
+		  size_t objsize,
+		  size_t align,
+		  int32_t numanode)
+{
+    if (nobjs == 0)
+    {
+	fprintf(stderr, "Invalid number of objects %u\n", nobjs), abort();
+    }
+    if (align == 0 || !IS_POWER_OF_TWO(align))
+    {
+	fprintf(stderr, "Invalid alignment %zu\n", align), abort();
+    }
+    //Free objects are linked through their first word
+    align = align < sizeof(void *) ? sizeof(void *) : align;
+    objsize = ROUNDUP(objsize < sizeof(void *) ? sizeof(void *) : objsize,
+		      align);
+    //Enough magazines for all objects to be stored in the depot
+    uint32_t nmags = (nobjs + MAGSIZE - 1) / MAGSIZE;
+    size_t sz = sizeof(p64_mempool_t) + nmags * sizeof(struct magazine);
+    p64_mempool_t *mp = p64_malloc(ROUNDUP(sz, CACHE_LINE), CACHE_LINE,
+				    P64_ALLOC_ANYNODE, 0);
+    if (mp == NULL)
+    {
+	return NULL;
+    }
+    size_t memsize = (size_t)nobjs * objsize;
+    //The allocator binds object memory to the NUMA node before it is touched
+    size_t a = align > CACHE_LINE ? align : CACHE_LINE;
+    mp->objmem = p64_malloc(ROUNDUP(memsize, a), a, numanode, 0);
+    if (mp->objmem == NULL)
+    {
+	p64_mfree(mp);
+	return NULL;
+    }
+    mp->base = mp->objmem;
+    mp->top = mp->base + memsize;
+    mp->objsize = objsize;
+    mp->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    lfstack_init(&mp->loose, NULL);
+    //Fill magazines with all objects, a last partial magazine is spread to
+    //the loose objects
+    struct magazine *full = NULL, *empty = NULL;
+    uint32_t obj = 0;
+    for (uint32_t m = 0; m < nmags; m++)
+    {
+	struct magazine *mag = &mp->mags[m];
+	if (nobjs - obj >= MAGSIZE)
+	{
+	    for (uint32_t i = 0; i < MAGSIZE; i++)
+	    {
+		mag->objs[i] = mp->base + (size_t)obj++ * objsize;
+	    }
+	    mag->next = full;
+	    full = mag;
+	}
+	else
+	{
+	    while (obj < nobjs)
+	    {
+		void *o = mp->base + (size_t)obj++ * objsize;
+		*(void **)o = mp->loose.head;
+		mp->loose.head = o;
+	    }
+	    mag->next = empty;
+	    empty = mag;
+	}
+    }
+    lfstack_init(&mp->full, full);
+    lfstack_init(&mp->empty, empty);
+    return mp;
+}
+
+//Return cache for pool, allocating a free cache if necessary
+//Return NULL if all caches are in use by other pools
+static inline struct cache *
+get_cache(p64_mempool_t *mp, bool alloc)
+{
+    struct cache *free = NULL;
+    for (uint32_t i = 0; i < MAXCACHES; i++)
+    {
+	struct cache *c = &caches[i];
+	if (c->mp == mp)
+	{
+	    if (LIKELY(c->id == mp->id))
+	    {
+		return c;
+	    }
+	    //Stale cache from freed pool at same address
+	    free = c;
+	    break;
+	}
+	if (c->mp == NULL && free == NULL)
+	{
+	    free = c;
+	}
+    }
+    if (free != NULL && alloc)
+    {
+	free->mp = mp;
+	free->id = mp->id;
+	free->cur = 0;
+	free->mag[0].nobjs = 0;
+	free->mag[1].nobjs = 0;
+	return free;
+    }
+    return NULL;
+}
+
+void
+p64_mempool_free(p64_mempool_t *mp)
+{
+    if (mp != NULL)
+    {
+	//Release calling thread's cache
+	struct cache *c = get_cache(mp, false);
+	if (c != NULL)
+	{
+	    c->mp = NULL;
+	}
+	p64_mfree(mp->objmem);
+	p64_mfree(mp);
+    }
+}
+
+void *
+p64_mempool_get(p64_mempool_t *mp)
+{
+    struct cache *c = get_cache(mp, true);
+    if (LIKELY(c != NULL))
+    {
+	struct lmagazine *lm = &c->mag[c->cur];
+	if (UNLIKELY(lm->nobjs == 0))
+	{
+	    if (c->mag[c->cur ^ 1].nobjs != 0)
+	    {
+		//Switch to other magazine
+		c->cur ^= 1;
+		lm = &c->mag[c->cur];
+	    }
+	    else
+	    {
+		//Both magazines empty, get a full magazine from the depot
+		struct magazine *mag = lfstack_pop(&mp->full,
+						   offsetof(struct magazine,
+							    next),
+						   STAT_MEMPOOL_RETRY);
+		if (mag != NULL)
+		{
+		    for (uint32_t i = 0; i < MAGSIZE; i++)
+		    {
+			lm->objs[i] = mag->objs[i];
+		    }
+		    lm->nobjs = MAGSIZE;
+		    lfstack_push(&mp->empty, mag,
+				 offsetof(struct magazine, next),
+				 STAT_MEMPOOL_RETRY);
+		}
+	    }
+	}
+	if (LIKELY(lm->nobjs != 0))
+	{
+	    return lm->objs[--lm->nobjs];
+	}
+    }
+    return lfstack_pop(&mp->loose, 0, STAT_MEMPOOL_RETRY);
+}
+
+void
+p64_mempool_put(p64_mempool_t *mp, void *obj)
+{
+    if (UNLIKELY((char *)obj < mp->base || (char *)obj >= mp->top ||
+		 ((char *)obj - mp->base) % mp->objsize != 0))
+    {
+	fprintf(stderr, "Invalid object %p in pool %p\n", obj, mp), abort();
+    }
+    struct cache *c = get_cache(mp, true);
+    if (LIKELY(c != NULL))
+    {
+	struct lmagazine *lm = &c->mag[c->cur];
+	if (UNLIKELY(lm->nobjs == MAGSIZE))
+	{
+	    struct lmagazine *other = &c->mag[c->cur ^ 1];
+	    if (other->nobjs == MAGSIZE)
+	    {
+		//Both magazines full, move one to the depot
+		struct magazine *mag = lfstack_pop(&mp->empty,
+						   offsetof(struct magazine,
+							    next),
+						   STAT_MEMPOOL_RETRY);
+		if (mag != NULL)
+		{
+		    for (uint32_t i = 0; i < MAGSIZE; i++)
+		    {
+			mag->objs[i] = other->objs[i];
+		    }
+		    other->nobjs = 0;
+		    lfstack_push(&mp->full, mag,
+				 offsetof(struct magazine, next),
+				 STAT_MEMPOOL_RETRY);
+		}
+	    }
+	    if (other->nobjs != MAGSIZE)
+	    {
+		//Switch to other magazine
+		c->cur ^= 1;
+		lm = other;
+	    }
+	}
+	if (LIKELY(lm->nobjs != MAGSIZE))
+	{
+	    lm->objs[lm->nobjs++] = obj;
+	    return;
+	}
+    }
+    lfstack_push(&mp->loose, obj, 0, STAT_MEMPOOL_RETRY);
+}
+
+void
+p64_mempool_flush(p64_mempool_t *mp)
+{
+    struct cache *c = get_cache(mp, false);
+    if (c != NULL)
+    {
+	for (uint32_t m = 0; m < 2; m++)
+	{
+	    struct lmagazine *lm = &c->mag[m];
+	    while (lm->nobjs != 0)
+	    {
+		lfstack_push(&mp->loose, lm->objs[--lm->nobjs], 0,
+			     STAT_MEMPOOL_RETRY);
+	    }
+	}
+	//Release cache
+	c->mp = NULL;
+    }
+}
@@ -0,0 +1,141 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Multi-producer single-consumer queue after Dmitry Vyukov's "Intrusive MPSC
+//node-based queue"
+//The stub element is permanently at the head of the list, stub.next is the
+//first element and 'tail' the last element (or the stub if empty)
+//A producer swaps itself into 'tail' and then links the previous tail to
+//its element, in between the list is temporarily broken
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p64_mpscq.h"
+#include "p64_alloc.h"
+#include "build_config.h"
+
+#include "arch.h"
+#include "common.h"
+#include "stats.h"
+
+struct p64_mpscq
+{
+    p64_mpscq_elem_t *tail ALIGNED(CACHE_LINE);//Written by producers
+    p64_mpscq_elem_t stub ALIGNED(CACHE_LINE);//Written by consumer
+};
+
+p64_mpscq_t *
+p64_mpscq_alloc(void)
+{
+    p64_mpscq_t *q = p64_malloc(sizeof(p64_mpscq_t), CACHE_LINE,
+				P64_ALLOC_ANYNODE, 0);
+    if (q != NULL)
+    {
+	q->tail = &q->stub;
+	q->stub.next = NULL;
+    }
+    return q;
+}
+
+void
+p64_mpscq_free(p64_mpscq_t *q)
+{
+    if (q != NULL)
+    {
+	if (q->tail != &q->stub)
+	{
+	    fprintf(stderr, "MPSC queue %p is not empty\n", q), abort();
+	}
+	p64_mfree(q);
+    }
+}
+
+void
+p64_mpscq_enqueue(p64_mpscq_t *q,
+		  p64_mpscq_elem_t *elem)
+{
+    __atomic_store_n(&elem->next, NULL, __ATOMIC_RELAXED);
+    //Acquire order so our link to 'prev' follows its removal by the consumer
+    //Release order so the consumer sees elem->next == NULL
+    p64_mpscq_elem_t *prev = __atomic_exchange_n(&q->tail, elem,
+						  __ATOMIC_ACQ_REL);
+    //Release order so that the consumer sees the element's contents
+    __atomic_store_n(&prev->next, elem, __ATOMIC_RELEASE);
+}
+
+//Wait for the producer which enqueued after 'elem' to link its element
+static p64_mpscq_elem_t *
+wait_next(p64_mpscq_elem_t *elem)
+{
+    p64_mpscq_elem_t *next;
+    uint64_t start = STAT_TIMESTAMP();
+    SEVL();
+    while (WFE() &&
+	   (next = (p64_mpscq_elem_t *)LDXR64((uintptr_t *)&elem->next,
+					      __ATOMIC_ACQUIRE)) == NULL)
+    {
+	DOZE();
+    }
+    STAT_ADD(STAT_MPSCQ_WAIT, STAT_TIMESTAMP() - start);
+    return next;
+}
+
+p64_mpscq_elem_t *
+p64_mpscq_dequeue(p64_mpscq_t *q)
+{
+    p64_mpscq_elem_t *first = __atomic_load_n(&q->stub.next, __ATOMIC_ACQUIRE);
+    if (first == NULL)
+    {
+	//Empty or the first producer has not yet linked its element, the
+	//element is not yet visible in either case
+	return NULL;
+    }
+    p64_mpscq_elem_t *next = __atomic_load_n(&first->next, __ATOMIC_ACQUIRE);
+    if (next == NULL)
+    {
+	//'first' might be the last element, try to make the queue empty
+	//No producer writes stub.next until 'tail' points to the stub
+	__atomic_store_n(&q->stub.next, NULL, __ATOMIC_RELAXED);
+	p64_mpscq_elem_t *last = first;
+	//Release order so that our reset of stub.next precedes the link from
+	//the next producer
+	if (__atomic_compare_exchange_n(&q->tail,
+					&last,
+					&q->stub,
+					/*weak=*/false,
+					__ATOMIC_RELEASE,
+					__ATOMIC_RELAXED))
+	{
+	    return first;
+	}
+	//Another producer has swapped in its element after 'first'
+	next = wait_next(first);
+    }
+    __atomic_store_n(&q->stub.next, next, __ATOMIC_RELAXED);
+    return first;
+}
+
+p64_mpscq_elem_t *
+p64_mpscq_dequeue_all(p64_mpscq_t *q)
+{
+    p64_mpscq_elem_t *first = __atomic_load_n(&q->stub.next, __ATOMIC_ACQUIRE);
+    if (first == NULL)
+    {
+	return NULL;
+    }
+    __atomic_store_n(&q->stub.next, NULL, __ATOMIC_RELAXED);
+    //Detach all elements, later producers link to the stub
+    //Acquire order so that last->next == NULL is seen
+    p64_mpscq_elem_t *last = __atomic_exchange_n(&q->tail, &q->stub,
+						  __ATOMIC_ACQ_REL);
+    //Wait for pending links between 'first' and 'last'
+    for (p64_mpscq_elem_t *elem = first; elem != last; )
+    {
+	p64_mpscq_elem_t *next = __atomic_load_n(&elem->next,
+						 __ATOMIC_ACQUIRE);
+	elem = next != NULL ? next : wait_next(elem);
+    }
+    return first;
+}
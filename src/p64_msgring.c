@@ -0,0 +1,294 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "p64_msgring.h"
+#include "p64_alloc.h"
+#include "build_config.h"
+
+#include "arch.h"
+#include "common.h"
+#include "stats.h"
+
+#if defined USE_SPLIT_HEADTAIL && !defined USE_SPLIT_PRODCONS
+#error USE_SPLIT_HEADTAIL not supported without USE_SPLIT_PRODCONS
+#endif
+
+#define SUPPORTED_FLAGS (P64_MSGRING_F_SPENQ | P64_MSGRING_F_MPENQ)
+
+#define FLAG_MTSAFE 0x0001
+
+//Length of padding which fills the ring until the end
+#define LEN_PAD (~(uint32_t)0)
+
+struct msghdr
+{
+    uint32_t len;
+    uint32_t pad;
+};
+
+#define MSG_ALIGN sizeof(struct msghdr)
+#define MSG_SIZE(len) ROUNDUP(sizeof(struct msghdr) + (len), MSG_ALIGN)
+
+typedef uint32_t ringidx_t;
+
+struct headtail
+{
+#if defined USE_SPLIT_PRODCONS
+    ringidx_t head ALIGNED(CACHE_LINE);//tail for consumer
+#else
+    ringidx_t head;//tail for consumer
+#endif
+#if defined USE_SPLIT_HEADTAIL
+    ringidx_t tail ALIGNED(CACHE_LINE);//head for consumer
+#else
+    ringidx_t tail;//head for consumer
+#endif
+    ringidx_t mask;
+    uint32_t flags;
+};
+
+//Indexes count bytes
+//prod.head: released by consumer, prod.tail: reserved by producers
+//cons.head: released by producers, cons.tail is not used (single consumer)
+struct p64_msgring
+{
+    struct headtail prod;
+    struct headtail cons;//NB head & tail are swapped for consumer metadata
+    uint8_t ring[] ALIGNED(CACHE_LINE);
+} ALIGNED(CACHE_LINE);
+
+p64_msgring_t *
+p64_msgring_alloc(uint32_t nbytes, uint32_t flags)
+{
+    //Room for at least an empty message of maximum size
+    unsigned long ringsz = nbytes > 2 * MSG_ALIGN ? ROUNDUP_POW2(nbytes) :
+						    2 * MSG_ALIGN;
+    if (nbytes == 0 || ringsz == 0 || ringsz > 0x80000000)
+    {
+	fprintf(stderr, "Invalid number of bytes %u\n", nbytes), abort();
+    }
+    if ((flags & ~SUPPORTED_FLAGS) != 0)
+    {
+	fprintf(stderr, "Invalid flags %x\n", flags), abort();
+    }
+    size_t sz = ROUNDUP(sizeof(p64_msgring_t) + ringsz, CACHE_LINE);
+    p64_msgring_t *mr = p64_malloc(sz, CACHE_LINE, P64_ALLOC_ANYNODE, 0);
+    if (mr != NULL)
+    {
+	mr->prod.head = 0;
+	mr->prod.tail = 0;
+	mr->prod.mask = ringsz - 1;
+	mr->prod.flags = (flags & P64_MSGRING_F_SPENQ) ? 0 : FLAG_MTSAFE;
+	mr->cons.head = 0;
+	mr->cons.tail = 0;
+	mr->cons.mask = ringsz - 1;
+	mr->cons.flags = 0;
+	return mr;
+    }
+    return NULL;
+}
+
+void
+p64_msgring_free(p64_msgring_t *mr)
+{
+    if (mr != NULL)
+    {
+	if (mr->prod.head != mr->cons.head)
+	{
+	    fprintf(stderr, "Message ring %p is not empty\n", mr);
+	}
+	p64_mfree(mr);
+    }
+}
+
+//Compute space needed for messages when starting at 'idx'
+//Messages which would wrap around the end of the ring are preceded by
+//padding to the end of the ring
+//Padding is smaller than the message so a message which needs at most half
+//the ring always fits in an empty ring, whatever the value of 'idx'
+//Return 0 if messages need more than 'avail' bytes
+static inline uint32_t
+layout(ringidx_t idx,
+       ringidx_t mask,
+       const uint32_t lens[],
+       uint32_t num,
+       uint32_t avail)
+{
+    ringidx_t pos = idx;
+    for (uint32_t i = 0; i < num; i++)
+    {
+	if (UNLIKELY(lens[i] > (mask + 1) / 2 - sizeof(struct msghdr)))
+	{
+	    //Message will never fit
+	    return 0;
+	}
+	uint32_t sz = MSG_SIZE(lens[i]);
+	uint32_t off = pos & mask;
+	if (off + sz > mask + 1)
+	{
+	    pos += mask + 1 - off;
+	}
+	pos += sz;
+	if (pos - idx > avail)
+	{
+	    return 0;
+	}
+    }
+    return pos - idx;
+}
+
+uint32_t
+p64_msgring_enqueue_reserve(p64_msgring_t *mr,
+			    const uint32_t lens[],
+			    uint32_t num,
+			    void *msgs[],
+			    p64_msgring_result_t *res)
+{
+    ringidx_t mask = mr->prod.mask;
+    ringidx_t tail = __atomic_load_n(&mr->prod.tail, __ATOMIC_RELAXED);
+    uint32_t size;
+    do
+    {
+	ringidx_t head = __atomic_load_n(&mr->prod.head, __ATOMIC_ACQUIRE);
+	size = layout(tail, mask, lens, num, mask + 1 - (tail - head));
+	if (UNLIKELY(size == 0))
+	{
+	    *res = (p64_msgring_result_t){ .actual = 0, .index = 0, .size = 0 };
+	    return 0;
+	}
+	if (!(mr->prod.flags & FLAG_MTSAFE))
+	{
+	    //Single producer
+	    __atomic_store_n(&mr->prod.tail, tail + size, __ATOMIC_RELAXED);
+	    break;
+	}
+    }
+    while (!__atomic_compare_exchange_n(&mr->prod.tail,
+					&tail,//Updated on failure
+					tail + size,
+					/*weak=*/true,
+					__ATOMIC_RELAXED,
+					__ATOMIC_RELAXED) &&
+	   STAT_RETRY(STAT_MSGRING_RETRY));
+    //Write message (and padding) headers
+    ringidx_t pos = tail;
+    for (uint32_t i = 0; i < num; i++)
+    {
+	uint32_t sz = MSG_SIZE(lens[i]);
+	uint32_t off = pos & mask;
+	if (off + sz > mask + 1)
+	{
+	    ((struct msghdr *)&mr->ring[off])->len = LEN_PAD;
+	    pos += mask + 1 - off;
+	    off = 0;
+	}
+	struct msghdr *hdr = (struct msghdr *)&mr->ring[off];
+	hdr->len = lens[i];
+	msgs[i] = hdr + 1;
+	pos += sz;
+    }
+    *res = (p64_msgring_result_t){ .actual = num, .index = tail, .size = size };
+    return num;
+}
+
+void
+p64_msgring_enqueue_commit(p64_msgring_t *mr,
+			   const p64_msgring_result_t *res)
+{
+    if (res->actual == 0)
+    {
+	return;
+    }
+    //Consumer metadata is swapped: cons.tail<->cons.head
+    ringidx_t *loc = &mr->cons.head/*cons.tail*/;
+    if (mr->prod.flags & FLAG_MTSAFE)
+    {
+	//Wait for our turn to signal consumer
+	if (UNLIKELY(__atomic_load_n(loc, __ATOMIC_RELAXED) != res->index))
+	{
+	    uint64_t start = STAT_TIMESTAMP();
+	    SEVL();
+	    while (WFE() && LDXR32(loc, __ATOMIC_RELAXED) != res->index)
+	    {
+		DOZE();
+	    }
+	    STAT_ADD(STAT_MSGRING_WAIT, STAT_TIMESTAMP() - start);
+	}
+    }
+    //Release messages to consumer
+    __atomic_store_n(loc, res->index + res->size, __ATOMIC_RELEASE);
+}
+
+bool
+p64_msgring_enqueue(p64_msgring_t *mr, const void *msg, uint32_t len)
+{
+    void *ptr;
+    p64_msgring_result_t res;
+    if (p64_msgring_enqueue_reserve(mr, &len, 1, &ptr, &res) != 0)
+    {
+	memcpy(ptr, msg, len);
+	p64_msgring_enqueue_commit(mr, &res);
+	return true;
+    }
+    return false;
+}
+
+uint32_t
+p64_msgring_dequeue_reserve(p64_msgring_t *mr,
+			    void *msgs[],
+			    uint32_t lens[],
+			    uint32_t num,
+			    p64_msgring_result_t *res)
+{
+    ringidx_t mask = mr->cons.mask;
+    ringidx_t head = __atomic_load_n(&mr->prod.head, __ATOMIC_RELAXED);
+    //Consumer metadata is swapped: cons.tail<->cons.head
+    ringidx_t tail = __atomic_load_n(&mr->cons.head/*cons.tail*/,
+				     __ATOMIC_ACQUIRE);
+    ringidx_t pos = head;
+    uint32_t n = 0;
+    while (n < num && pos != tail)
+    {
+	uint32_t off = pos & mask;
+	const struct msghdr *hdr = (const struct msghdr *)&mr->ring[off];
+	if (hdr->len == LEN_PAD)
+	{
+	    //Skip padding at end of ring
+	    pos += mask + 1 - off;
+	    continue;
+	}
+	msgs[n] = (void *)(hdr + 1);
+	lens[n] = hdr->len;
+	n++;
+	pos += MSG_SIZE(hdr->len);
+    }
+    if (UNLIKELY(n == 0 && pos != head))
+    {
+	//Only padding found, release it immediately
+	__atomic_store_n(&mr->prod.head, pos, __ATOMIC_RELEASE);
+	*res = (p64_msgring_result_t){ .actual = 0, .index = pos, .size = 0 };
+	return 0;
+    }
+    *res = (p64_msgring_result_t){ .actual = n, .index = head, .size = pos - head };
+    return n;
+}
+
+void
+p64_msgring_dequeue_commit(p64_msgring_t *mr,
+			   const p64_msgring_result_t *res)
+{
+    if (res->actual == 0)
+    {
+	return;
+    }
+    //Release space to producers, order our loads (and stores) of messages
+    //before producers may overwrite them
+    __atomic_store_n(&mr->prod.head, res->index + res->size, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,96 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p64_ordsched.h"
+#include "p64_alloc.h"
+#include "build_config.h"
+
+#include "common.h"
+
+struct p64_ordsched
+{
+    uint32_t nqueues;
+    //Each reorder buffer is a separate allocation with its metadata in
+    //separate cache lines
+    p64_reorder_t *queues[];
+};
+
+p64_ordsched_t *
+p64_ordsched_alloc(uint32_t nqueues,
+		   uint32_t nelems,
+		   p64_reorder_cb cb,
+		   void *arg)
+{
+    if (nqueues < 1)
+    {
+	fprintf(stderr, "Invalid number of queues %u\n", nqueues), abort();
+    }
+    size_t nbytes = ROUNDUP(sizeof(p64_ordsched_t) +
+			    nqueues * sizeof(p64_reorder_t *),
+			    CACHE_LINE);
+    p64_ordsched_t *os = p64_malloc(nbytes, CACHE_LINE, P64_ALLOC_ANYNODE, 0);
+    if (os != NULL)
+    {
+	os->nqueues = nqueues;
+	for (uint32_t i = 0; i < nqueues; i++)
+	{
+	    os->queues[i] = p64_reorder_alloc(nelems, false, cb, arg);
+	    if (os->queues[i] == NULL)
+	    {
+		while (i-- != 0)
+		{
+		    p64_reorder_free(os->queues[i]);
+		}
+		p64_mfree(os);
+		return NULL;
+	    }
+	}
+	return os;
+    }
+    return NULL;
+}
+
+void
+p64_ordsched_free(p64_ordsched_t *os)
+{
+    if (os != NULL)
+    {
+	for (uint32_t i = 0; i < os->nqueues; i++)
+	{
+	    p64_reorder_free(os->queues[i]);
+	}
+	p64_mfree(os);
+    }
+}
+
+uint32_t
+p64_ordsched_queue(const p64_ordsched_t *os, uint64_t flow)
+{
+    return (uint32_t)(flow % os->nqueues);
+}
+
+uint32_t
+p64_ordsched_acquire(p64_ordsched_t *os,
+		     uint64_t flow,
+		     uint32_t nelems,
+		     uint32_t *sn)
+{
+    p64_reorder_t *rob = os->queues[p64_ordsched_queue(os, flow)];
+    return p64_reorder_acquire(rob, nelems, sn);
+}
+
+void
+p64_ordsched_release(p64_ordsched_t *os,
+		     uint64_t flow,
+		     uint32_t sn,
+		     void *elems[],
+		     uint32_t nelems)
+{
+    p64_reorder_t *rob = os->queues[p64_ordsched_queue(os, flow)];
+    p64_reorder_release(rob, sn, elems, nelems);
+}
@@ -0,0 +1,212 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p64_qsbr.h"
+#include "build_config.h"
+
+#include "arch.h"
+#include "common.h"
+#include "stats.h"
+
+//Interval of threads which have unregistered
+#define INFINITE (~(uint64_t)0)
+
+struct qsbr_thread
+{
+    //Interval seen in last quiescent state, zero (blocking all reclamation)
+    //until the thread that has taken the slot has published its interval
+    uint64_t interval;
+} ALIGNED(CACHE_LINE);
+
+static struct
+{
+    uint64_t current ALIGNED(CACHE_LINE);//Current interval
+    uint32_t tidx_counter ALIGNED(CACHE_LINE);
+    struct qsbr_thread threads[MAXTHREADS] ALIGNED(CACHE_LINE);
+} qsbr = { .current = 1 };
+
+struct object
+{
+    void *ptr;
+    void (*cb)(void *);
+    uint64_t interval;//Interval when object was retired
+};
+
+struct thread_state
+{
+    uint32_t tidx;//Thread index
+    uint32_t nitems;
+    uint32_t maxitems;
+    struct object *objs;//Retired but not yet reclaimed objects
+};
+
+static __thread struct thread_state *TS;
+static __thread struct thread_state thread_state;
+
+void
+p64_qsbr_register(void)
+{
+    if (TS != NULL)
+    {
+	//Already registered
+	return;
+    }
+    uint32_t tidx = __atomic_fetch_add(&qsbr.tidx_counter, 1, __ATOMIC_RELAXED);
+    if (tidx >= MAXTHREADS)
+    {
+	fprintf(stderr, "Too many threads using QSBR\n"), abort();
+    }
+    struct thread_state *ts = &thread_state;
+    ts->tidx = tidx;
+    ts->nitems = 0;
+    ts->maxitems = 0;
+    ts->objs = NULL;
+    //Thread is online from the current interval
+    __atomic_store_n(&qsbr.threads[tidx].interval,
+		     __atomic_load_n(&qsbr.current, __ATOMIC_ACQUIRE),
+		     __ATOMIC_RELAXED);
+    //Ensure our thread index and interval are visible to garbage collection
+    //before we access any shared objects, pairs with the fence in
+    //garbage_collect()
+    smp_fence(StoreLoad);
+    TS = ts;
+}
+
+void
+p64_qsbr_quiescent(void)
+{
+    if (UNLIKELY(TS == NULL))
+    {
+	p64_qsbr_register();
+    }
+    //Release order so that all our accesses to shared objects are ordered
+    //before any reclamation of those objects
+    uint64_t cur = __atomic_load_n(&qsbr.current, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&qsbr.threads[TS->tidx].interval, cur, __ATOMIC_RELEASE);
+}
+
+//Return the earliest interval seen by any registered thread
+//Threads which have taken a thread index but not yet published their
+//interval are included (as interval zero)
+static uint64_t
+min_interval(void)
+{
+    uint64_t min = INFINITE;
+    uint32_t numthreads = __atomic_load_n(&qsbr.tidx_counter,
+					  __ATOMIC_ACQUIRE);
+    numthreads = MIN(numthreads, MAXTHREADS);
+    for (uint32_t t = 0; t < numthreads; t++)
+    {
+	uint64_t intv = __atomic_load_n(&qsbr.threads[t].interval,
+					__ATOMIC_ACQUIRE);
+	min = MIN(min, intv);
+    }
+    return min;
+}
+
+//Reclaim all retired objects which have been retired before the earliest
+//interval seen by any thread
+static uint32_t
+garbage_collect(struct thread_state *ts)
+{
+    //Order our removals and updates of the current interval before reading
+    //thread indexes and intervals, pairs with the fence in p64_qsbr_register()
+    smp_fence(StoreLoad);
+    uint64_t min = min_interval();
+    uint32_t nreclaimed = 0;
+    uint32_t n = 0;
+    for (uint32_t i = 0; i != ts->nitems; i++)
+    {
+	if (ts->objs[i].interval <= min)
+	{
+	    //All threads have passed a quiescent state after object was retired
+	    ts->objs[i].cb(ts->objs[i].ptr);
+	    nreclaimed++;
+	}
+	else
+	{
+	    //Retired object may still be referenced, keep it
+	    ts->objs[n++] = ts->objs[i];
+	}
+    }
+    ts->nitems = n;
+    STAT_INC(STAT_QSBR_RECLAIM);
+    STAT_ADD(STAT_QSBR_FREED, nreclaimed);
+    return nreclaimed;
+}
+
+void
+p64_qsbr_retire(void *ptr,
+		void (*cb)(void *ptr))
+{
+    if (UNLIKELY(TS == NULL))
+    {
+	p64_qsbr_register();
+    }
+    struct thread_state *ts = TS;
+    if (UNLIKELY(ts->nitems == ts->maxitems))
+    {
+	//Try to reclaim objects
+	(void)garbage_collect(ts);
+	if (ts->nitems >= ts->maxitems / 2)
+	{
+	    //At most half of the list free, grow it
+	    uint32_t maxitems = ts->maxitems != 0 ? 2 * ts->maxitems :
+						    QSBR_RETIRE_THRESHOLD;
+	    struct object *objs = realloc(ts->objs, maxitems * sizeof(*objs));
+	    if (objs == NULL)
+	    {
+		perror("realloc"), abort();
+	    }
+	    ts->objs = objs;
+	    ts->maxitems = maxitems;
+	}
+    }
+    //Release order so that the removal of the object is visible to threads
+    //which have seen the new interval
+    uint64_t intv = __atomic_add_fetch(&qsbr.current, 1, __ATOMIC_RELEASE);
+    ts->objs[ts->nitems].ptr = ptr;
+    ts->objs[ts->nitems].cb = cb;
+    ts->objs[ts->nitems].interval = intv;
+    ts->nitems++;
+}
+
+bool
+p64_qsbr_reclaim(void)
+{
+    if (UNLIKELY(TS == NULL))
+    {
+	return false;
+    }
+    return garbage_collect(TS) != 0;
+}
+
+void
+p64_qsbr_unregister(void)
+{
+    struct thread_state *ts = TS;
+    if (ts == NULL)
+    {
+	return;
+    }
+    //Don't delay reclamation by other threads
+    __atomic_store_n(&qsbr.threads[ts->tidx].interval, INFINITE,
+		     __ATOMIC_RELEASE);
+    //Wait for our retired objects to be reclaimed
+    while (garbage_collect(ts), ts->nitems != 0)
+    {
+	DOZE();
+    }
+    free(ts->objs);
+    ts->objs = NULL;
+    ts->maxitems = 0;
+    //Thread slot is not reused
+    TS = NULL;
+}
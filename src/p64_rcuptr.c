@@ -0,0 +1,80 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p64_rcuptr.h"
+#undef p64_rcu_acquire
+#include "p64_hazardptr.h"
+#include "p64_qsbr.h"
+
+#include "common.h"
+
+void
+p64_rcu_init(p64_rcu_ptr_t *rp,
+	     void *ptr,
+	     uint32_t flags)
+{
+    if (flags & ~P64_RCU_F_HAZPTR)
+    {
+	fprintf(stderr, "Invalid flags %x\n", flags), abort();
+    }
+    rp->flags = flags;
+    __atomic_store_n(&rp->ptr, ptr, __ATOMIC_RELEASE);
+}
+
+void *
+p64_rcu_acquire(p64_rcu_ptr_t *rp,
+		p64_hazardptr_t *hp)
+{
+    return p64_hazptr_acquire(&rp->ptr, hp);
+}
+
+static void
+retire(p64_rcu_ptr_t *rp,
+       void *old,
+       void (*reclaim)(void *))
+{
+    if (old != NULL && reclaim != NULL)
+    {
+	if (rp->flags & P64_RCU_F_HAZPTR)
+	{
+	    p64_hazptr_retire(old, reclaim);
+	}
+	else
+	{
+	    p64_qsbr_retire(old, reclaim);
+	}
+    }
+}
+
+void
+p64_rcu_assign(p64_rcu_ptr_t *rp,
+	       void *ptr,
+	       void (*reclaim)(void *))
+{
+    //Release order so that readers see the initialised object
+    void *old = __atomic_exchange_n(&rp->ptr, ptr, __ATOMIC_ACQ_REL);
+    retire(rp, old, reclaim);
+}
+
+bool
+p64_rcu_replace(p64_rcu_ptr_t *rp,
+		void *old,
+		void *ptr,
+		void (*reclaim)(void *))
+{
+    if (!__atomic_compare_exchange_n(&rp->ptr,
+				     &old,
+				     ptr,
+				     /*weak=*/false,
+				     __ATOMIC_ACQ_REL,
+				     __ATOMIC_RELAXED))
+    {
+	return false;
+    }
+    retire(rp, old, reclaim);
+    return true;
+}
@@ -9,13 +9,16 @@
 #include <stdlib.h>
 
 #include "p64_reassemble.h"
+#include "p64_alloc.h"
 #include "build_config.h"
 
 #include "common.h"
 #include "lockfree.h"
+#include "stats.h"
 
-//totsize=65535 => totsize_oct=8192 => 14 bits required
-#define OCT_SIZEMAX ((1U << 14U) - 1U)
+//IPv6 max offset 65528 + len 65535 => totsize_oct=16383 => 14 bits required
+//Use 16 bits so that OCT_SIZEMAX (unknown total size) is never a valid size
+#define OCT_SIZEMAX ((1U << 16U) - 1U)
 
 //IPv4 fragment info
 #define IP_FRAG_RESV 0x8000U  //Reserved fragment flag
@@ -27,6 +30,10 @@
 #define FI2MORE(fi) (((fi) & IP_FRAG_MORE) != 0)
 #define LEN2OCT(l) (((l) + 7U) / 8U)
 
+//Fragment list pointer is packed with the number of fragments in the list
+#define HEAD_BITS 48
+#define NUMFRAGS_MAX ((1U << (64 - HEAD_BITS)) - 1U)
+
 static inline uint32_t
 TOTSIZE_OCT(p64_fragment_t *f)
 {
@@ -110,11 +117,16 @@ restart: (void)0;
     uint32_t expected_off = 0;
     while (frag != NULL)
     {
-	if (FI2OFF(frag->fraginfo) != expected_off)
+	if (FI2OFF(frag->fraginfo) > expected_off)
 	{
 	    //Missing fragment
 	    return NULL;
 	}
+	//Compute end of data covered so far (fragments may overlap)
+	if (FI2OFF(frag->fraginfo) + frag->len > expected_off)
+	{
+	    expected_off = FI2OFF(frag->fraginfo) + frag->len;
+	}
 	if (frag->nextfrag == NULL || frag->nextfrag->hash != frag->hash)
 	{
 	    //Last segment should have MORE flag cleared
@@ -137,36 +149,38 @@ restart: (void)0;
 		   frag->nextfrag->hash == frag->hash);
 	    //TODO same hash, check whole key
 	    //Non-last fragment should have MORE flag set
-	    //TODO beware of duplicated last fragment
-	    //TODO check MORE flag after de-duplication?
 	    if (!FI2MORE(frag->fraginfo))
 	    {
-		//Premature MORE flag (duplicate last fragment?)
-		break;
+		//Premature MORE flag, a duplicate of the last fragment is
+		//covered by it (fragments are sorted on offset) and skipped
+		if (FI2OFF(frag->nextfrag->fraginfo) + frag->nextfrag->len >
+		    expected_off)
+		{
+		    //Data beyond the end of the datagram
+		    break;
+		}
 	    }
 
-	    if (FI2OFF(frag->nextfrag->fraginfo) >
-		FI2OFF(frag->fraginfo) + frag->len)
+	    if (FI2OFF(frag->nextfrag->fraginfo) > expected_off)
 	    {
 		//Hole between frag and frag->nextfrag
 		break;
 	    }
 
-	    if (FI2OFF(frag->nextfrag->fraginfo) <
-		FI2OFF(frag->fraginfo) + frag->len)
+	    if (FI2OFF(frag->nextfrag->fraginfo) < expected_off)
 	    {
 		//Overlap between frag and frag->nextfrag
 		//This is not our problem, caller must handle
+		//Scatter-gather completion trims overlapping data
 	    }
 	}
-	expected_off += frag->len;
 	frag = frag->nextfrag;
     }
     if (frag != NULL)
     {
 	//There is a discontinuity between frag and frag->nextfrag
 	//Find first fragment of next datagram (as identified by hash)
-	uint32_t hash = frag->hash;
+	uint64_t hash = frag->hash;
 	while (frag->nextfrag != NULL && frag->nextfrag->hash == hash)
 	{
 	    frag = frag->nextfrag;
@@ -183,47 +197,83 @@ union fraglist
     struct
     {
 	uint32_t earliest;
-	unsigned accsize:14;
-	unsigned totsize:14;
-	p64_fragment_t *head; //A list of related fragments awaiting reassembly
+	unsigned accsize:16;
+	unsigned totsize:16;
+	uint64_t head:HEAD_BITS; //A list of related fragments awaiting reassembly
+	uint64_t numfrags:64 - HEAD_BITS; //Saturating
     } st;
     __int128 ui;
 } ALIGNED(sizeof(__int128));
 
+static inline p64_fragment_t *
+fl_head(union fraglist fl)
+{
+    return (p64_fragment_t *)(uintptr_t)fl.st.head;
+}
+
 struct p64_reassemble
 {
     p64_reassemble_cb complete_cb;
     p64_reassemble_cb stale_cb;
+    p64_reassemble_sg_cb complete_sg_cb;//Replaces complete_cb if not NULL
     void *arg;
-    uint32_t nentries;
+    uint32_t nentries;//Total number of entries in all shards
+    uint32_t nshards;
+    uint32_t shardsize;//Number of entries per shard
+    uint32_t stride;//Distance between shards, a multiple of cache line size
+    uint32_t maxfrags;//Max number of fragments per entry, 0 if no limit
+    uint32_t maxoct;//Max number of octets per entry, 0 if no limit
+    uint64_t maxbytes;//Max number of bytes in table, 0 if no limit
+    uint64_t buffered ALIGNED(CACHE_LINE);//Bytes in table (if maxbytes != 0)
+    uint32_t evictidx;//Next entry to sample for eviction
+    uint32_t expireidx;//Next entry to scan for incremental expiration
     union fraglist fragtbl[] ALIGNED(CACHE_LINE);
 };
 
+#define FL_PER_LINE (CACHE_LINE / sizeof(union fraglist))
+
 p64_reassemble_t *
-p64_reassemble_alloc(uint32_t nentries,
-		     p64_reassemble_cb complete_cb,
-		     p64_reassemble_cb stale_cb,
-		     void *arg)
+p64_reassemble_alloc_ex(uint32_t nentries,
+			uint32_t nshards,
+			p64_reassemble_cb complete_cb,
+			p64_reassemble_cb stale_cb,
+			void *arg,
+			int32_t numanode,
+			uint32_t allocflags)
 {
-    if (nentries < 1)
+    if (nentries < 1 || nshards < 1 ||
+	(uint64_t)nentries * nshards > UINT32_MAX)
     {
         fprintf(stderr, "Invalid fragment table size %u\n", nentries), abort();
     }
+    uint32_t stride = nshards > 1 ? ROUNDUP(nentries, FL_PER_LINE) : nentries;
     size_t nbytes = ROUNDUP(sizeof(p64_reassemble_t) +
-			    nentries * sizeof(union fraglist), CACHE_LINE);
-    p64_reassemble_t *fl = aligned_alloc(CACHE_LINE, nbytes);
+			    (size_t)nshards * stride * sizeof(union fraglist),
+			    CACHE_LINE);
+    p64_reassemble_t *fl = p64_malloc(nbytes, CACHE_LINE, numanode, allocflags);
     if (fl != NULL)
     {
 	fl->complete_cb = complete_cb;
 	fl->stale_cb = stale_cb;
+	fl->complete_sg_cb = NULL;
 	fl->arg = arg;
-	fl->nentries = nentries;
-	for (uint32_t i = 0; i < nentries; i++)
+	fl->nentries = nentries * nshards;
+	fl->nshards = nshards;
+	fl->shardsize = nentries;
+	fl->stride = stride;
+	fl->maxfrags = 0;
+	fl->maxoct = 0;
+	fl->maxbytes = 0;
+	fl->buffered = 0;
+	fl->evictidx = 0;
+	fl->expireidx = 0;
+	for (uint32_t i = 0; i < nshards * stride; i++)
 	{
 	    fl->fragtbl[i].st.earliest = 0;//Not used for null fraglists
 	    fl->fragtbl[i].st.totsize = OCT_SIZEMAX;
 	    fl->fragtbl[i].st.accsize = 0U;
-	    fl->fragtbl[i].st.head = NULL;
+	    fl->fragtbl[i].st.head = 0;
+	    fl->fragtbl[i].st.numfrags = 0;
 	}
 
 	return fl;
@@ -231,22 +281,153 @@ p64_reassemble_alloc(uint32_t nentries,
     return NULL;
 }
 
+p64_reassemble_t *
+p64_reassemble_alloc_sharded(uint32_t nentries,
+			     uint32_t nshards,
+			     p64_reassemble_cb complete_cb,
+			     p64_reassemble_cb stale_cb,
+			     void *arg)
+{
+    return p64_reassemble_alloc_ex(nentries, nshards, complete_cb, stale_cb,
+				   arg, P64_ALLOC_ANYNODE, 0);
+}
+
+p64_reassemble_t *
+p64_reassemble_alloc(uint32_t nentries,
+		     p64_reassemble_cb complete_cb,
+		     p64_reassemble_cb stale_cb,
+		     void *arg)
+{
+    return p64_reassemble_alloc_sharded(nentries, 1, complete_cb, stale_cb,
+					arg);
+}
+
+uint32_t
+p64_reassemble_shard(const p64_reassemble_t *re, uint64_t hash)
+{
+    return (uint32_t)hash % re->nentries / re->shardsize;
+}
+
+//Return first entry of a shard
+static inline union fraglist *
+shard_base(p64_reassemble_t *re, uint32_t shard)
+{
+    return &re->fragtbl[(size_t)shard * re->stride];
+}
+
+//Return entry 'idx' (0..nentries-1) in the (possibly sharded) table
+static inline union fraglist *
+table_entry(p64_reassemble_t *re, uint32_t idx)
+{
+    return &shard_base(re, idx / re->shardsize)[idx % re->shardsize];
+}
+
+void
+p64_reassemble_set_limits(p64_reassemble_t *re,
+			  const p64_reassemble_limits_t *lim)
+{
+    //Limits must be below saturation values so that saturation is detected
+    re->maxfrags = lim->maxfrags < NUMFRAGS_MAX ? lim->maxfrags :
+						  NUMFRAGS_MAX - 1;
+    re->maxoct = lim->maxbytes_bucket / 8U < OCT_SIZEMAX ?
+		 lim->maxbytes_bucket / 8U : OCT_SIZEMAX - 1;
+    if (lim->maxbytes_bucket != 0 && re->maxoct == 0)
+    {
+	re->maxoct = 1;
+    }
+    re->maxbytes = lim->maxbytes;
+}
+
+void
+p64_reassemble_set_complete_sg(p64_reassemble_t *re,
+			       p64_reassemble_sg_cb complete_sg_cb)
+{
+    re->complete_sg_cb = complete_sg_cb;
+}
+
 void
 p64_reassemble_free(p64_reassemble_t *fl)
 {
     if (fl != NULL)
     {
-	for (uint32_t i = 0; i < fl->nentries; i++)
+	for (uint32_t s = 0; s < fl->nshards; s++)
 	{
-	    if (fl->fragtbl[i].st.head != NULL)
+	    union fraglist *tbl = shard_base(fl, s);
+	    for (uint32_t i = 0; i < fl->shardsize; i++)
 	    {
-		fl->stale_cb(fl->arg, fl->fragtbl[i].st.head);
+		if (tbl[i].st.head != 0)
+		{
+		    fl->stale_cb(fl->arg, fl_head(tbl[i]));
+		}
 	    }
 	}
-	free(fl);
+	p64_mfree(fl);
     }
 }
 
+//Update number of buffered bytes for fragments returned to the user
+static inline void
+release(p64_reassemble_t *re,
+	p64_fragment_t *frag)
+{
+    if (re->maxbytes != 0)
+    {
+	uint64_t len = 0;
+	for (p64_fragment_t *f = frag; f != NULL; f = f->nextfrag)
+	{
+	    len += f->len;
+	}
+	__atomic_fetch_sub(&re->buffered, len, __ATOMIC_RELAXED);
+    }
+}
+
+//Pass a list of fragments to the user
+static void
+deliver(p64_reassemble_t *re,
+	p64_reassemble_cb cb,
+	p64_fragment_t *frag)
+{
+    release(re, frag);
+    cb(re->arg, frag);
+}
+
+//Pass a complete datagram (sorted list of fragments) to the user as a
+//scatter-gather list with overlapping data trimmed
+//The segment list is built on the stack, a datagram with too many segments
+//is passed to the stale callback
+static void
+deliver_sg(p64_reassemble_t *re,
+	   p64_fragment_t *dg)
+{
+    p64_reassemble_seg_t segs[P64_REASSEMBLE_SG_MAXSEGS];
+    uint32_t nsegs = 0;
+    uint32_t end = 0;//End of data covered so far
+    for (p64_fragment_t *f = dg; f != NULL; f = f->nextfrag)
+    {
+	uint32_t off = FI2OFF(f->fraginfo);
+	if (off + f->len <= end)
+	{
+	    //Duplicate or completely overlapped fragment
+	    continue;
+	}
+	if (UNLIKELY(nsegs == P64_REASSEMBLE_SG_MAXSEGS))
+	{
+	    deliver(re, re->stale_cb, dg);
+	    return;
+	}
+	uint32_t skip = off < end ? end - off : 0;
+	segs[nsegs].frag = f;
+	segs[nsegs].offset = off + skip;
+	segs[nsegs].skip = skip;
+	segs[nsegs].len = f->len - skip;
+	nsegs++;
+	end = off + f->len;
+    }
+    release(re, dg);
+    //Datagram of zero length has no segments
+    re->complete_sg_cb(re->arg, dg, nsegs != 0 ? segs : NULL, nsegs);
+}
+
 static uint32_t
 reassemble(p64_reassemble_t *fl,
 	   p64_fragment_t **head)
@@ -259,7 +440,14 @@ reassemble(p64_reassemble_t *fl,
 	{
 	    break;
 	}
-	fl->complete_cb(fl->arg, dg);
+	if (fl->complete_sg_cb != NULL)
+	{
+	    deliver_sg(fl, dg);
+	}
+	else
+	{
+	    deliver(fl, fl->complete_cb, dg);
+	}
 	numdg++;
     }
     return numdg;
@@ -287,18 +475,21 @@ static inline p64_fragment_t **
 recompute(p64_fragment_t **head,
 	  uint16_t *fragsize,
 	  uint16_t *totsize,
+	  uint32_t *numfrags,
 	  uint32_t *earliest,
 	  uint32_t now)
 {
     p64_fragment_t **last = head;
     *fragsize = 0;
     *totsize = OCT_SIZEMAX;
+    *numfrags = 0;
     *earliest = now;
     //Find the last fragment in the list
     //Compute accumulated size of fragments and expected total size
     while (*last != NULL)
     {
 	*fragsize = umin(OCT_SIZEMAX, *fragsize + LEN2OCT((*last)->len));
+	*numfrags = umin(NUMFRAGS_MAX, *numfrags + 1);
 	*totsize = umin(*totsize, TOTSIZE_OCT(*last));
 	*earliest = min_earliest(*earliest, (*last)->arrival, now);
 	last = &(*last)->nextfrag;
@@ -306,6 +497,66 @@ recompute(p64_fragment_t **head,
     return last;
 }
 
+static inline bool
+over_limits(const p64_reassemble_t *re,
+	    uint32_t accsize,
+	    uint32_t numfrags)
+{
+    return (re->maxoct != 0 && accsize > re->maxoct) ||
+	   (re->maxfrags != 0 && numfrags > re->maxfrags);
+}
+
+//Evict datagrams (fragments with the same hash) with the earliest arrival
+//time until the remaining fragments are within the per-entry limits
+//The list of fragments must be sorted
+static void
+evict_oldest(p64_reassemble_t *re,
+	     p64_fragment_t **head,
+	     uint32_t now)
+{
+    for (;;)
+    {
+	uint32_t accsize = 0;
+	uint32_t numfrags = 0;
+	p64_fragment_t **oldest = NULL;
+	uint32_t oldest_time = now;
+	p64_fragment_t **pfrag = head;
+	while (*pfrag != NULL)
+	{
+	    p64_fragment_t **first = pfrag;
+	    uint64_t hash = (*pfrag)->hash;
+	    uint32_t earliest = (*pfrag)->arrival;
+	    while (*pfrag != NULL && (*pfrag)->hash == hash)
+	    {
+		accsize = umin(OCT_SIZEMAX, accsize + LEN2OCT((*pfrag)->len));
+		numfrags++;
+		earliest = min_earliest(earliest, (*pfrag)->arrival, now);
+		pfrag = &(*pfrag)->nextfrag;
+	    }
+	    if (oldest == NULL || (int32_t)(earliest - oldest_time) < 0)
+	    {
+		oldest = first;
+		oldest_time = earliest;
+	    }
+	}
+	if (!over_limits(re, accsize, numfrags))
+	{
+	    return;
+	}
+	//Snip the oldest datagram from the list and return it to the user
+	p64_fragment_t *dg = *oldest;
+	p64_fragment_t *last = dg;
+	while (last->nextfrag != NULL && last->nextfrag->hash == dg->hash)
+	{
+	    last = last->nextfrag;
+	}
+	*oldest = last->nextfrag;
+	last->nextfrag = NULL;
+	STAT_INC(STAT_REASSEMBLE_EVICT);
+	deliver(re, re->stale_cb, dg);
+    }
+}
+
 static void
 insert_fraglist(p64_reassemble_t *re,
 		union fraglist *fl,
@@ -316,31 +567,35 @@ insert_fraglist(p64_reassemble_t *re,
     bool false_positive = false;
     uint16_t fragsize;
     uint16_t totsize;
+    uint32_t numfrags;
     uint32_t earliest;
     //Where to insert existing fragment list
     p64_fragment_t **last;
-    last = recompute(&frag, &fragsize, &totsize, &earliest, now);
+    last = recompute(&frag, &fragsize, &totsize, &numfrags, &earliest, now);
 
     union fraglist old, neu;
 restart:
     //Prefetch-for-store before we read the line to update
     old.ui = fl->ui;
-    if (old.st.head != NULL)
+    if (old.st.head != 0)
     {
 	false_positive = false;
     }
     //Merge lists of fragments, insert previous head fragment at end of new list
-    *last = old.st.head;
-    neu.st.head = frag;
+    *last = fl_head(old);
+    neu.st.head = (uintptr_t)frag;
     //Use min to implement saturating add, don't overflow the allocated bits
     neu.st.accsize = umin(OCT_SIZEMAX, old.st.accsize + fragsize);
+    neu.st.numfrags = umin(NUMFRAGS_MAX, old.st.numfrags + numfrags);
     //Replace previous totsize if smaller
     neu.st.totsize = umin(old.st.totsize, totsize);
+    //Check if limits are exceeded, then take ownership and evict fragments
+    bool overflow = over_limits(re, neu.st.accsize, neu.st.numfrags);
     //Check if we have all fragments
-    if (neu.st.accsize < neu.st.totsize || false_positive)
+    if (!overflow && (neu.st.accsize < neu.st.totsize || false_positive))
     {
 	//Still missing fragment, write back updated fraglist
-	if (old.st.head != NULL)
+	if (old.st.head != 0)
 	{
 	    neu.st.earliest = min_earliest(old.st.earliest, earliest, now);
 	}
@@ -356,6 +611,7 @@ restart:
 					  __ATOMIC_RELAXED))
 	{
 	    //CAS failed, restart from beginning
+	    STAT_INC(STAT_REASSEMBLE_RETRY);
 	    PREFETCH_FOR_WRITE(&fl->ui);
 	    goto restart;
 	}
@@ -363,9 +619,10 @@ restart:
     }
     else
     {
-	//We seem to have all fragments
+	//We seem to have all fragments or have exceeded the limits
 	//Write a null element to the fraglist slot
-	neu.st.head = NULL;
+	neu.st.head = 0;
+	neu.st.numfrags = 0;
 	neu.st.accsize = 0;
 	neu.st.totsize = OCT_SIZEMAX;
 	neu.st.earliest = 0;
@@ -377,6 +634,7 @@ restart:
 					  __ATOMIC_RELAXED))
 	{
 	    //CAS failed, restart from beginning
+	    STAT_INC(STAT_REASSEMBLE_RETRY);
 	    PREFETCH_FOR_WRITE(&fl->ui);
 	    goto restart;
 	}
@@ -385,13 +643,18 @@ restart:
 	frag = sort_frags(frag);//Includes old.st.head fraglist
 	//Attempt to reassemble fragments into complete datagrams
 	false_positive = reassemble(re, &frag) == 0;
+	if (frag != NULL && overflow)
+	{
+	    evict_oldest(re, &frag, now);
+	}
 	//Check if there are fragments left (for different datagram)
 	if (frag != NULL)
 	{
 	    assert(reassemble(re, &frag) == 0);
 	    //Find the last fragment in the list
 	    //Compute accumulated size of fragments and expected total size
-	    last = recompute(&frag, &fragsize, &totsize, &earliest, now);
+	    last = recompute(&frag, &fragsize, &totsize, &numfrags, &earliest,
+			     now);
 	    //Update fraglist again
 	    PREFETCH_FOR_WRITE(&fl->ui);
 	    goto restart;
@@ -400,12 +663,93 @@ restart:
     }
 }
 
+//Swap out a fragment list and return all its fragments as stale
+static void
+evict_list(p64_reassemble_t *re,
+	   union fraglist *fl)
+{
+    union fraglist old, neu;
+    old.ui = fl->ui;
+    neu.st.head = 0;
+    neu.st.numfrags = 0;
+    neu.st.accsize = 0;
+    neu.st.totsize = OCT_SIZEMAX;
+    neu.st.earliest = 0;
+    do
+    {
+	if (old.st.head == 0)
+	{
+	    return;
+	}
+    }
+    while (!lockfree_compare_exchange_16(&fl->ui,
+					 &old.ui,//Updated on failure
+					 neu.ui,
+					 /*weak=*/false,
+					 __ATOMIC_ACQUIRE,
+					 __ATOMIC_RELAXED) &&
+	   STAT_RETRY(STAT_REASSEMBLE_RETRY));
+    STAT_INC(STAT_REASSEMBLE_EVICT);
+    deliver(re, re->stale_cb, fl_head(old));
+}
+
+//Number of table entries sampled when looking for the oldest fragment list
+#define EVICT_SAMPLES 8
+
+//Evict the oldest (by earliest arrival) fragment list among a sample of
+//table entries, repeat until the number of bytes in table is within the limit
+//Bounded to one pass over the table
+static void
+evict_table(p64_reassemble_t *re,
+	    uint32_t now)
+{
+    uint32_t rounds = re->nentries / EVICT_SAMPLES + 1;
+    while (__atomic_load_n(&re->buffered, __ATOMIC_RELAXED) > re->maxbytes &&
+	   rounds-- != 0)
+    {
+	uint32_t idx = __atomic_fetch_add(&re->evictidx, EVICT_SAMPLES,
+					  __ATOMIC_RELAXED);
+	union fraglist *oldest = NULL;
+	uint32_t oldest_time = now;
+	for (uint32_t i = 0; i < EVICT_SAMPLES; i++)
+	{
+	    union fraglist *fl = table_entry(re, (idx + i) % re->nentries);
+	    union fraglist cur;
+	    cur.ui = fl->ui;
+	    if (cur.st.head != 0 &&
+		(oldest == NULL ||
+		 (int32_t)(cur.st.earliest - oldest_time) < 0))
+	    {
+		oldest = fl;
+		oldest_time = cur.st.earliest;
+	    }
+	}
+	if (oldest != NULL)
+	{
+	    evict_list(re, oldest);
+	}
+    }
+}
+
 void
 p64_reassemble_insert(p64_reassemble_t *re,
 		      p64_fragment_t *frag)
 {
-    union fraglist *fl = &re->fragtbl[(uint32_t)frag->hash % re->nentries];
+    if (UNLIKELY((uintptr_t)frag >> HEAD_BITS != 0))
+    {
+	fprintf(stderr, "Fragment address %p too large\n", frag), abort();
+    }
+    union fraglist *fl = table_entry(re, (uint32_t)frag->hash % re->nentries);
     frag->nextfrag = NULL;
+    if (re->maxbytes != 0)
+    {
+	uint32_t now = frag->arrival;
+	__atomic_fetch_add(&re->buffered, frag->len, __ATOMIC_RELAXED);
+	//Fragment may be returned to user during insert
+	insert_fraglist(re, fl, frag);
+	evict_table(re, now);
+	return;
+    }
     insert_fraglist(re, fl, frag);
 }
 
@@ -442,7 +786,7 @@ expire_one(p64_reassemble_t *re,
     old.ui = fl->ui;
     do
     {
-	if (old.st.head == NULL ||
+	if (old.st.head == 0 ||
 		(int32_t)old.st.earliest - (int32_t)time >= 0)
 	{
 	    //Null fraglist or no stale fragments
@@ -450,7 +794,8 @@ expire_one(p64_reassemble_t *re,
 	}
 	//Found fraglist with at least one stale fragment
 	//Swap in a null fraglist in its place
-	neu.st.head = NULL;
+	neu.st.head = 0;
+	neu.st.numfrags = 0;
 	neu.st.accsize = 0;
 	neu.st.totsize = OCT_SIZEMAX;
 	neu.st.earliest = 0;
@@ -460,19 +805,37 @@ expire_one(p64_reassemble_t *re,
 					 neu.ui,
 					 /*weak=*/false,
 					 __ATOMIC_ACQUIRE,
-					 __ATOMIC_RELAXED));
+					 __ATOMIC_RELAXED) &&
+	   STAT_RETRY(STAT_REASSEMBLE_RETRY));
     //CAS succeeded, we own the fraglist
     //Find the stale fragments
-    p64_fragment_t *stale = find_stale(&old.st.head, time);
-    if (old.st.head != NULL)
+    p64_fragment_t *head = fl_head(old);
+    p64_fragment_t *stale = find_stale(&head, time);
+    if (head != NULL)
     {
 	//Fresh fragments remain, insert back into table
-	insert_fraglist(re, fl, old.st.head);
+	insert_fraglist(re, fl, head);
     }
     if (stale != NULL)
     {
 	//Return list with stale fragments to user
-	re->stale_cb(re->arg, stale);
+	deliver(re, re->stale_cb, stale);
+    }
+}
+
+void
+p64_reassemble_expire_shard(p64_reassemble_t *re,
+			    uint32_t shard,
+			    uint32_t time)
+{
+    if (shard >= re->nshards)
+    {
+	fprintf(stderr, "Invalid shard %u\n", shard), abort();
+    }
+    union fraglist *tbl = shard_base(re, shard);
+    for (uint32_t i = 0; i < re->shardsize; i++)
+    {
+	expire_one(re, &tbl[i], time);
     }
 }
 
@@ -480,9 +843,47 @@ void
 p64_reassemble_expire(p64_reassemble_t *re,
 		      uint32_t time)
 {
-    for (uint32_t i = 0; i < re->nentries; i++)
+    for (uint32_t s = 0; s < re->nshards; s++)
+    {
+	p64_reassemble_expire_shard(re, s, time);
+    }
+}
+
+bool
+p64_reassemble_expire_incr(p64_reassemble_t *re,
+			   uint32_t time,
+			   uint32_t budget)
+{
+    if (budget > re->nentries)
     {
-	union fraglist *fl = &re->fragtbl[i];
-	expire_one(re, fl, time);
+	budget = re->nentries;
+    }
+    //Claim the next slice of the table
+    uint32_t old = __atomic_load_n(&re->expireidx, __ATOMIC_RELAXED);
+    uint32_t neu;
+    do
+    {
+	neu = old + budget;
+	if (neu >= re->nentries)
+	{
+	    neu -= re->nentries;
+	}
+    }
+    while (!__atomic_compare_exchange_n(&re->expireidx,
+					&old,//Updated on failure
+					neu,
+					/*weak=*/true,
+					__ATOMIC_RELAXED,
+					__ATOMIC_RELAXED));
+    for (uint32_t i = 0; i < budget; i++)
+    {
+	uint32_t idx = old + i;
+	if (idx >= re->nentries)
+	{
+	    idx -= re->nentries;
+	}
+	expire_one(re, table_entry(re, idx), time);
     }
+    //Return true if the scan reached the end of the table
+    return old + budget >= re->nentries;
 }
@@ -11,10 +11,12 @@
 #include <string.h>
 
 #include "p64_reorder.h"
+#include "p64_alloc.h"
 #include "build_config.h"
 
 #include "arch.h"
 #include "common.h"
+#include "stats.h"
 
 struct hi
 {
@@ -30,27 +32,37 @@ struct p64_reorder
     uint32_t mask;
     bool user_acquire;
     p64_reorder_cb cb;
+    p64_reorder_vec_cb vec_cb;//Used instead of cb if not NULL
+    uint32_t vecsz;//Size of output vector
     void *arg;
     //Written by p64_reorder_acquire()
     uint32_t tail ALIGNED(CACHE_LINE);
     //Written by p64_reorder_release()
-    void *ring[] ALIGNED(CACHE_LINE);
+    void *ring[] ALIGNED(CACHE_LINE);//Ring buffer followed by output vector
 };
 
-p64_reorder_t *
-p64_reorder_alloc(uint32_t nelems,
-		  bool user_acquire,
-		  p64_reorder_cb cb,
-		  void *arg)
+//Address of output vector, only accessed by the thread retiring elements
+#define ROB_VEC(rob) ((rob)->ring + (rob)->mask + 1)
+
+static p64_reorder_t *
+reorder_alloc(uint32_t nelems,
+	      uint32_t vecsz,
+	      bool user_acquire,
+	      p64_reorder_cb cb,
+	      p64_reorder_vec_cb vec_cb,
+	      void *arg,
+	      int32_t numanode,
+	      uint32_t allocflags)
 {
     if (nelems < 1 || nelems > 0x80000000)
     {
 	fprintf(stderr, "Invalid reorder buffer size %u\n", nelems), abort();
     }
     unsigned long ringsize = ROUNDUP_POW2(nelems);
-    size_t nbytes = ROUNDUP(sizeof(p64_reorder_t) + ringsize * sizeof(void *),
+    size_t nbytes = ROUNDUP(sizeof(p64_reorder_t) +
+			    (ringsize + vecsz) * sizeof(void *),
 			    CACHE_LINE);
-    p64_reorder_t *rob = aligned_alloc(CACHE_LINE, nbytes);
+    p64_reorder_t *rob = p64_malloc(nbytes, CACHE_LINE, numanode, allocflags);
     if (rob != NULL)
     {
 	//Clear the ring pointers
@@ -60,6 +72,8 @@ p64_reorder_alloc(uint32_t nelems,
 	rob->mask = ringsize - 1;
 	rob->user_acquire = user_acquire;
 	rob->cb = cb;
+	rob->vec_cb = vec_cb;
+	rob->vecsz = vecsz;
 	rob->arg = arg;
 	rob->tail = 0;
 	for (unsigned long i = 0; i < ringsize; i++)
@@ -71,6 +85,44 @@ p64_reorder_alloc(uint32_t nelems,
     return NULL;
 }
 
+p64_reorder_t *
+p64_reorder_alloc(uint32_t nelems,
+		  bool user_acquire,
+		  p64_reorder_cb cb,
+		  void *arg)
+{
+    return reorder_alloc(nelems, 0, user_acquire, cb, NULL, arg,
+			 P64_ALLOC_ANYNODE, 0);
+}
+
+p64_reorder_t *
+p64_reorder_alloc_ex(uint32_t nelems,
+		     bool user_acquire,
+		     p64_reorder_cb cb,
+		     void *arg,
+		     int32_t numanode,
+		     uint32_t allocflags)
+{
+    return reorder_alloc(nelems, 0, user_acquire, cb, NULL, arg,
+			 numanode, allocflags);
+}
+
+p64_reorder_t *
+p64_reorder_alloc_vec(uint32_t nelems,
+		      uint32_t vecsz,
+		      bool user_acquire,
+		      p64_reorder_vec_cb vec_cb,
+		      void *arg)
+{
+    if (vecsz < 1 || vecsz > 0x80000000)
+    {
+	fprintf(stderr, "Invalid reorder output vector size %u\n", vecsz);
+	abort();
+    }
+    return reorder_alloc(nelems, vecsz, user_acquire, NULL, vec_cb, arg,
+			 P64_ALLOC_ANYNODE, 0);
+}
+
 void
 p64_reorder_free(p64_reorder_t *rob)
 {
@@ -80,7 +132,7 @@ p64_reorder_free(p64_reorder_t *rob)
 	{
 	    fprintf(stderr, "Reorder buffer %p is not empty\n", rob), abort();
 	}
-	free(rob);
+	p64_mfree(rob);
     }
 }
 
@@ -110,7 +162,8 @@ p64_reorder_acquire(p64_reorder_t *rob,
 					tail + actual,
 					/*weak=*/true,
 					__ATOMIC_RELAXED,
-					__ATOMIC_RELAXED));
+					__ATOMIC_RELAXED) &&
+	   STAT_RETRY(STAT_REORDER_RETRY));
     *sn = tail;
     return actual;
 }
@@ -135,6 +188,7 @@ p64_reorder_release(p64_reorder_t *rob,
 {
     uint32_t mask = rob->mask;
     p64_reorder_cb cb = rob->cb;
+    p64_reorder_vec_cb vec_cb = rob->vec_cb;
     void *arg = rob->arg;
     if (rob->user_acquire)
     {
@@ -193,10 +247,11 @@ p64_reorder_release(p64_reorder_t *rob,
 	    return;
 	}
 	//CAS failed => head and/or chgi changed
+	STAT_INC(STAT_REORDER_RETRY);
 	//We might not be out-of-order anymore
     }
 
-    assert(!BEFORE(sn, old.head) && !AFTER(sn + nelems - 1, old.head));
+    assert(!BEFORE(old.head, sn) && BEFORE(old.head, sn + nelems));
     //We are in-order so our responsibility to retire elements
     struct hi new;
     new.head = old.head;
@@ -211,15 +266,35 @@ p64_reorder_release(p64_reorder_t *rob,
 	    rob->ring[new.head & mask] = NULL;
 	    if (LIKELY((uintptr_t)elem > (uintptr_t)P64_REORDER_DUMMY))
 	    {
-		cb(arg, elem, new.head);
-		npending++;
+		if (vec_cb != NULL)
+		{
+		    //Gather elements, one call per full output vector
+		    ROB_VEC(rob)[npending++] = elem;
+		    if (npending == rob->vecsz)
+		    {
+			vec_cb(arg, ROB_VEC(rob), npending);
+			npending = 0;
+		    }
+		}
+		else
+		{
+		    cb(arg, elem, new.head);
+		    npending++;
+		}
 	    }
 	    new.head++;
 	}
 	assert(new.head != old.head);
 	if (LIKELY(npending != 0))
 	{
-	    cb(arg, NULL, new.head);
+	    if (vec_cb != NULL)
+	    {
+		vec_cb(arg, ROB_VEC(rob), npending);
+	    }
+	    else
+	    {
+		cb(arg, NULL, new.head);
+	    }
 	    npending = 0;
 	}
 	new.chgi = old.chgi;
@@ -230,5 +305,6 @@ p64_reorder_release(p64_reorder_t *rob,
 				      &new,
 				      /*weak=*/true,
 				      __ATOMIC_RELEASE,//Release ring updates
-				      __ATOMIC_ACQUIRE));
+				      __ATOMIC_ACQUIRE) &&
+	   STAT_RETRY(STAT_REORDER_RETRY));
 }
@@ -9,10 +9,13 @@
 #include <stdlib.h>
 
 #include "p64_ringbuf.h"
+#include "p64_alloc.h"
 #include "build_config.h"
 
 #include "arch.h"
 #include "common.h"
+#include "futex.h"
+#include "stats.h"
 #ifdef USE_LDXSTX
 #include "ldxstx.h"
 #endif
@@ -23,10 +26,12 @@
 
 #define SUPPORTED_FLAGS (P64_RINGBUF_F_SPENQ | P64_RINGBUF_F_MPENQ | \
 			 P64_RINGBUF_F_SCDEQ | P64_RINGBUF_F_MCDEQ | \
-			 P64_RINGBUF_F_LFDEQ)
+			 P64_RINGBUF_F_LFDEQ | P64_RINGBUF_F_WAITDEQ)
 
 #define FLAG_MTSAFE   0x0001
 #define FLAG_LOCKFREE 0x0002
+#define FLAG_WAKEUP   0x0004
+#define FLAG_SHARED   0x0008//Constructed in caller-supplied memory
 
 typedef uint32_t ringidx_t;
 
@@ -44,6 +49,7 @@ struct headtail
 #endif
     ringidx_t mask;
     uint32_t flags;
+    uint32_t waiters;//Number of sleeping consumers (cons only)
 };
 
 struct p64_ringbuf
@@ -53,8 +59,8 @@ struct p64_ringbuf
     void *ring[] ALIGNED(CACHE_LINE);
 } ALIGNED(CACHE_LINE);
 
-p64_ringbuf_t *
-p64_ringbuf_alloc(uint32_t nelems, uint32_t flags, size_t esize)
+static unsigned long
+ring_size(uint32_t nelems, uint32_t flags)
 {
     unsigned long ringsz = ROUNDUP_POW2(nelems);
     if (nelems == 0 || ringsz == 0 || ringsz > 0x80000000)
@@ -65,24 +71,90 @@ p64_ringbuf_alloc(uint32_t nelems, uint32_t flags, size_t esize)
     {
 	fprintf(stderr, "Invalid flags %x\n", flags), abort();
     }
+    return ringsz;
+}
+
+static p64_ringbuf_t *
+ringbuf_init(p64_ringbuf_t *rb, unsigned long ringsz, uint32_t flags,
+	     uint32_t shared)
+{
+    rb->prod.head = 0;
+    rb->prod.tail = 0;
+    rb->prod.mask = ringsz - 1;
+    rb->prod.flags = (flags & P64_RINGBUF_F_SPENQ) ? 0 : FLAG_MTSAFE;
+    rb->prod.flags |= (flags & P64_RINGBUF_F_WAITDEQ) ? FLAG_WAKEUP : 0;
+    rb->prod.flags |= shared;
+    rb->prod.waiters = 0;
+    rb->cons.head = 0;
+    rb->cons.tail = 0;
+    rb->cons.mask = ringsz - 1;
+    rb->cons.flags = (flags & P64_RINGBUF_F_SCDEQ) ? 0 : FLAG_MTSAFE;
+    rb->cons.flags |= (flags & P64_RINGBUF_F_LFDEQ) ? FLAG_LOCKFREE : 0;
+    rb->cons.flags |= (flags & P64_RINGBUF_F_WAITDEQ) ? FLAG_WAKEUP : 0;
+    rb->cons.flags |= shared;
+    rb->cons.waiters = 0;
+    return rb;
+}
+
+size_t
+p64_ringbuf_size(uint32_t nelems, size_t esize)
+{
+    unsigned long ringsz = ring_size(nelems, 0);
+    return ROUNDUP(sizeof(p64_ringbuf_t) + ringsz * esize, CACHE_LINE);
+}
+
+p64_ringbuf_t *
+p64_ringbuf_alloc_ex(uint32_t nelems,
+		     uint32_t flags,
+		     size_t esize,
+		     int32_t numanode,
+		     uint32_t allocflags)
+{
+    unsigned long ringsz = ring_size(nelems, flags);
     size_t nbytes = ROUNDUP(sizeof(p64_ringbuf_t) + ringsz * esize, CACHE_LINE);
-    p64_ringbuf_t *rb = aligned_alloc(CACHE_LINE, nbytes);
+    p64_ringbuf_t *rb = p64_malloc(nbytes, CACHE_LINE, numanode, allocflags);
     if (rb != NULL)
     {
-	rb->prod.head = 0;
-	rb->prod.tail = 0;
-	rb->prod.mask = ringsz - 1;
-	rb->prod.flags = (flags & P64_RINGBUF_F_SPENQ) ? 0 : FLAG_MTSAFE;
-	rb->cons.head = 0;
-	rb->cons.tail = 0;
-	rb->cons.mask = ringsz - 1;
-	rb->cons.flags = (flags & P64_RINGBUF_F_SCDEQ) ? 0 : FLAG_MTSAFE;
-	rb->cons.flags |= (flags & P64_RINGBUF_F_LFDEQ) ? FLAG_LOCKFREE : 0;
-	return rb;
+	return ringbuf_init(rb, ringsz, flags, 0);
     }
     return NULL;
 }
 
+p64_ringbuf_t *
+p64_ringbuf_alloc(uint32_t nelems, uint32_t flags, size_t esize)
+{
+    return p64_ringbuf_alloc_ex(nelems, flags, esize, P64_ALLOC_ANYNODE, 0);
+}
+
+p64_ringbuf_t *
+p64_ringbuf_init(void *mem, size_t size, uint32_t nelems, uint32_t flags,
+		 size_t esize)
+{
+    unsigned long ringsz = ring_size(nelems, flags);
+    if ((uintptr_t)mem % CACHE_LINE != 0 ||
+	size < p64_ringbuf_size(nelems, esize))
+    {
+	fprintf(stderr, "Invalid memory %p size %zu\n", mem, size), abort();
+    }
+    //Memory may be shared between processes
+    return ringbuf_init(mem, ringsz, flags, FLAG_SHARED);
+}
+
+p64_ringbuf_t *
+p64_ringbuf_attach(void *mem)
+{
+    p64_ringbuf_t *rb = mem;
+    if ((uintptr_t)mem % CACHE_LINE != 0 ||
+	!IS_POWER_OF_TWO(rb->prod.mask + 1UL) ||
+	rb->prod.mask != rb->cons.mask ||
+	(rb->prod.flags & FLAG_SHARED) == 0 ||
+	(rb->cons.flags & FLAG_SHARED) == 0)
+    {
+	fprintf(stderr, "Invalid ring buffer %p\n", mem), abort();
+    }
+    return rb;
+}
+
 void *
 p64_ringbuf_alloc_(uint32_t nelems, uint32_t flags, size_t esize)
 {
@@ -103,7 +175,7 @@ p64_ringbuf_free(p64_ringbuf_t *rb)
 	{
 	    fprintf(stderr, "Ring buffer %p is not empty\n", rb);
 	}
-	free(rb);
+	p64_mfree(rb);
     }
 }
 
@@ -124,6 +196,7 @@ static inline p64_ringbuf_result_t
 acquire_slots(const ringidx_t *headp,
 	      ringidx_t *tailp,
 	      ringidx_t mask,
+	      int min,
 	      int n,
 	      bool enqueue)
 {
@@ -131,7 +204,7 @@ acquire_slots(const ringidx_t *headp,
     ringidx_t tail = __atomic_load_n(tailp, __ATOMIC_RELAXED);
     ringidx_t head = __atomic_load_n(headp, __ATOMIC_ACQUIRE);
     int actual = MIN(n, (int)(ring_size + head - tail));
-    if (UNLIKELY(actual <= 0))
+    if (UNLIKELY(actual < min || actual <= 0))
     {
 	return (p64_ringbuf_result_t){ .index = 0, .actual = 0, .mask = mask };
     }
@@ -141,6 +214,7 @@ acquire_slots(const ringidx_t *headp,
 //MT-safe multi producer/consumer code
 static inline p64_ringbuf_result_t
 acquire_slots_mtsafe(struct headtail *rb,
+		     int min,
 		     int n,
 		     bool enqueue)
 {
@@ -157,20 +231,22 @@ acquire_slots_mtsafe(struct headtail *rb,
 	tail = ldx32(&rb->tail, __ATOMIC_RELAXED);
 #endif
 	actual = MIN(n, (int)(ring_size + head - tail));
-	if (UNLIKELY(actual <= 0))
+	if (UNLIKELY(actual < min || actual <= 0))
 	{
 	    return (p64_ringbuf_result_t){ .index = 0, .actual = 0, .mask = rb->mask };
 	}
     }
 #ifdef USE_LDXSTX
-    while (UNLIKELY(stx32(&rb->tail, tail + actual, __ATOMIC_RELAXED)));
+    while (UNLIKELY(stx32(&rb->tail, tail + actual, __ATOMIC_RELAXED)) &&
+	   STAT_RETRY(STAT_RINGBUF_RETRY));
 #else
     while (!__atomic_compare_exchange_n(&rb->tail,
 					&tail,//Updated on failure
 					tail + actual,
 					/*weak=*/true,
 					__ATOMIC_RELAXED,
-					__ATOMIC_RELAXED));
+					__ATOMIC_RELAXED) &&
+	   STAT_RETRY(STAT_RINGBUF_RETRY));
 #endif
     return (p64_ringbuf_result_t){ .index = tail, .actual = actual, .mask = rb->mask };
 }
@@ -187,11 +263,13 @@ release_slots(ringidx_t *loc,
 	//Wait for our turn to signal consumers (producers)
 	if (UNLIKELY(__atomic_load_n(loc, __ATOMIC_RELAXED) != idx))
 	{
+	    uint64_t start = STAT_TIMESTAMP();
 	    SEVL();
 	    while (WFE() && LDXR32(loc, __ATOMIC_RELAXED) != idx)
 	    {
 		DOZE();
 	    }
+	    STAT_ADD(STAT_RINGBUF_WAIT, STAT_TIMESTAMP() - start);
 	}
     }
 
@@ -230,12 +308,12 @@ p64_ringbuf_acquire_(void *ptr,
 	    //MT-unsafe single producer code
 	    //Consumer metadata is swapped: cons.tail<->cons.head
 	    r = acquire_slots(&rb->prod.head, &rb->cons.head/*cons.tail*/,
-			      mask, num, true);
+			      mask, 1, num, true);
 	}
 	else
 	{
 	    //MT-safe multi producer code
-	    r = acquire_slots_mtsafe(&rb->prod, num, true);
+	    r = acquire_slots_mtsafe(&rb->prod, 1, num, true);
 	}
     }
     else //dequeue
@@ -266,12 +344,12 @@ p64_ringbuf_acquire_(void *ptr,
 	    //MT-unsafe single consumer code
 	    //Consumer metadata is swapped: cons.tail<->cons.head
 	    r = acquire_slots(&rb->cons.head/*cons.tail*/, &rb->prod.head,
-			      mask, num, false);
+			      mask, 1, num, false);
 	}
 	else
 	{
 	    //MT-safe multi consumer code
-	    r = acquire_slots_mtsafe(&rb->cons, num, false);
+	    r = acquire_slots_mtsafe(&rb->cons, 1, num, false);
 	}
     }
     return r;
@@ -289,6 +367,11 @@ p64_ringbuf_release_(void *ptr,
 	//Consumer metadata is swapped: cons.tail<->cons.head
 	release_slots(&rb->cons.head/*cons.tail*/, r.index, r.actual,
 		      /*loads_only=*/false, rb->prod.flags);
+	if (UNLIKELY(rb->prod.flags & FLAG_WAKEUP))
+	{
+	    wake_waiters(&rb->cons.head/*cons.tail*/, &rb->cons.waiters,
+			 (rb->prod.flags & FLAG_SHARED) != 0);
+	}
 	return true;//Success
     }
     else //dequeue
@@ -311,10 +394,11 @@ p64_ringbuf_release_(void *ptr,
 
 //Enqueue elements at tail
 UNROLL_LOOPS
-uint32_t
-p64_ringbuf_enqueue(p64_ringbuf_t *rb,
-		    void *const *restrict ev,
-		    uint32_t num)
+static inline uint32_t
+enqueue(p64_ringbuf_t *rb,
+	void *const *restrict ev,
+	uint32_t min,
+	uint32_t num)
 {
     //Step 1: acquire slots
     uint32_t mask = rb->prod.mask;
@@ -326,12 +410,12 @@ p64_ringbuf_enqueue(p64_ringbuf_t *rb,
 	//MT-unsafe single producer code
 	//Consumer metadata is swapped: cons.tail<->cons.head
 	r = acquire_slots(&rb->prod.head, &rb->cons.head/*cons.tail*/,
-			  mask, num, true);
+			  mask, min, num, true);
     }
     else
     {
 	//MT-safe multi producer code
-	r = acquire_slots_mtsafe(&rb->prod, num, true);
+	r = acquire_slots_mtsafe(&rb->prod, min, num, true);
     }
     if (UNLIKELY(r.actual == 0))
     {
@@ -348,17 +432,23 @@ p64_ringbuf_enqueue(p64_ringbuf_t *rb,
     //Consumer metadata is swapped: cons.tail<->cons.head
     release_slots(&rb->cons.head/*cons.tail*/, r.index, r.actual,
 		  /*loads_only=*/false, prod_flags);
+    if (UNLIKELY(prod_flags & FLAG_WAKEUP))
+    {
+	wake_waiters(&rb->cons.head/*cons.tail*/, &rb->cons.waiters,
+		     (rb->prod.flags & FLAG_SHARED) != 0);
+    }
 
     return r.actual;
 }
 
 //Dequeue elements from head
 UNROLL_LOOPS
-uint32_t
-p64_ringbuf_dequeue(p64_ringbuf_t *rb,
-		    void **restrict ev,
-		    uint32_t num,
-		    uint32_t *index)
+static inline uint32_t
+dequeue(p64_ringbuf_t *rb,
+	void **restrict ev,
+	uint32_t min,
+	uint32_t num,
+	uint32_t *index)
 {
     uint32_t mask = rb->cons.mask;
     uint32_t cons_flags = rb->cons.flags;
@@ -375,7 +465,7 @@ p64_ringbuf_dequeue(p64_ringbuf_t *rb,
 	do
 	{
 	    actual = MIN((int)num, (int)(tail - head));
-	    if (UNLIKELY(actual <= 0))
+	    if (UNLIKELY(actual < (int)min || actual <= 0))
 	    {
 		return 0;
 	    }
@@ -393,7 +483,8 @@ p64_ringbuf_dequeue(p64_ringbuf_t *rb,
 					    head + actual,
 					    /*weak=*/true,
 					    __ATOMIC_RELEASE,
-					    __ATOMIC_RELAXED));
+					    __ATOMIC_RELAXED) &&
+	       STAT_RETRY(STAT_RINGBUF_RETRY));
 	*index = head;
 	return actual;
     }
@@ -405,12 +496,12 @@ p64_ringbuf_dequeue(p64_ringbuf_t *rb,
 	//MT-unsafe single consumer code
 	//Consumer metadata is swapped: cons.tail<->cons.head
 	r = acquire_slots(&rb->cons.head/*cons.tail*/, &rb->prod.head,
-			  mask, num, false);
+			  mask, min, num, false);
     }
     else
     {
 	//MT-safe multi consumer code
-	r = acquire_slots_mtsafe(&rb->cons, num, false);
+	r = acquire_slots_mtsafe(&rb->cons, min, num, false);
     }
     if (UNLIKELY(r.actual == 0))
     {
@@ -430,3 +521,236 @@ p64_ringbuf_dequeue(p64_ringbuf_t *rb,
     *index = r.index;
     return r.actual;
 }
+
+UNROLL_LOOPS
+uint32_t
+p64_ringbuf_enqueue(p64_ringbuf_t *rb,
+		    void *const *restrict ev,
+		    uint32_t num)
+{
+    return enqueue(rb, ev, 1, num);
+}
+
+UNROLL_LOOPS
+uint32_t
+p64_ringbuf_enqueue_bulk(p64_ringbuf_t *rb,
+			 void *const *restrict ev,
+			 uint32_t min,
+			 uint32_t num)
+{
+    return enqueue(rb, ev, min, num);
+}
+
+UNROLL_LOOPS
+uint32_t
+p64_ringbuf_dequeue(p64_ringbuf_t *rb,
+		    void **restrict ev,
+		    uint32_t num,
+		    uint32_t *index)
+{
+    return dequeue(rb, ev, 1, num, index);
+}
+
+UNROLL_LOOPS
+uint32_t
+p64_ringbuf_dequeue_bulk(p64_ringbuf_t *rb,
+			 void **restrict ev,
+			 uint32_t min,
+			 uint32_t num,
+			 uint32_t *index)
+{
+    return dequeue(rb, ev, min, num, index);
+}
+
+uint32_t
+p64_ringbuf_dequeue_wait(p64_ringbuf_t *rb,
+			 void **ev,
+			 uint32_t num,
+			 uint32_t *index,
+			 uint64_t timeout)
+{
+    static __thread uint32_t spin_budget = SPIN_MAX;
+    if (UNLIKELY(!(rb->cons.flags & FLAG_WAKEUP)))
+    {
+	fprintf(stderr, "Ring buffer %p does not support waiting\n", rb), abort();
+    }
+    //Consumer metadata is swapped: cons.tail<->cons.head
+    //Single and lock-free consumers use prod.head
+    const ringidx_t *headp = (rb->cons.flags & (FLAG_MTSAFE | FLAG_LOCKFREE)) ==
+			     FLAG_MTSAFE ? &rb->cons.tail : &rb->prod.head;
+    uint64_t deadline = 0;
+    for (;;)
+    {
+	uint32_t actual = p64_ringbuf_dequeue(rb, ev, num, index);
+	if (actual != 0 || timeout == 0)
+	{
+	    return actual;
+	}
+	if (deadline == 0)
+	{
+	    deadline = deadline_ns(timeout);
+	}
+	if (!wait_nonempty(&rb->cons.head/*cons.tail*/, headp,
+			   &rb->cons.waiters, &spin_budget, deadline,
+			   (rb->cons.flags & FLAG_SHARED) != 0))
+	{
+	    return 0;
+	}
+    }
+}
+
+static inline uint32_t
+make_spans(void **ring,
+	   p64_ringbuf_result_t r,
+	   p64_ringbuf_span_t *sp)
+{
+    uint32_t idx = r.index & r.mask;
+    uint32_t num0 = MIN(r.actual, r.mask + 1 - idx);
+    sp->ev[0] = &ring[idx];
+    sp->num[0] = num0;
+    sp->ev[1] = &ring[0];
+    sp->num[1] = r.actual - num0;
+    sp->r = r;
+    return r.actual;
+}
+
+uint32_t
+p64_ringbuf_enqueue_reserve(p64_ringbuf_t *rb,
+			    uint32_t num,
+			    p64_ringbuf_span_t *sp)
+{
+    p64_ringbuf_result_t r = p64_ringbuf_acquire_(&rb->ring, num, true);
+    return make_spans(rb->ring, r, sp);
+}
+
+void
+p64_ringbuf_enqueue_commit(p64_ringbuf_t *rb,
+			   const p64_ringbuf_span_t *sp)
+{
+    if (sp->r.actual != 0)
+    {
+	(void)p64_ringbuf_release_(&rb->ring, sp->r, true);
+    }
+}
+
+uint32_t
+p64_ringbuf_dequeue_reserve(p64_ringbuf_t *rb,
+			    uint32_t num,
+			    p64_ringbuf_span_t *sp)
+{
+    p64_ringbuf_result_t r = p64_ringbuf_acquire_(&rb->ring, num, false);
+    return make_spans(rb->ring, r, sp);
+}
+
+bool
+p64_ringbuf_dequeue_commit(p64_ringbuf_t *rb,
+			   const p64_ringbuf_span_t *sp)
+{
+    if (sp->r.actual != 0)
+    {
+	return p64_ringbuf_release_(&rb->ring, sp->r, false);
+    }
+    return true;
+}
+
+//Staged ring
+//stage[k].head is written when stage k-1 releases slots (limit for stage k)
+//stage[k].tail is the next slot to acquire for MT-safe stage k
+//A single thread stage acquires slots from the next stage's head, which it
+//is the only writer of
+struct p64_stagering
+{
+    uint32_t nstages;
+    uint32_t mask;
+    void **ring;//Follows stage metadata
+    struct headtail stage[] ALIGNED(CACHE_LINE);
+};
+
+#define MAXSTAGES 32
+
+p64_stagering_t *
+p64_stagering_alloc(uint32_t nelems, uint32_t nstages, uint32_t single)
+{
+    unsigned long ringsz = ring_size(nelems, 0);
+    if (nstages < 2 || nstages > MAXSTAGES)
+    {
+	fprintf(stderr, "Invalid number of stages %u\n", nstages), abort();
+    }
+    size_t sz = ROUNDUP(sizeof(p64_stagering_t) +
+			nstages * sizeof(struct headtail), CACHE_LINE);
+    size_t nbytes = ROUNDUP(sz + ringsz * sizeof(void *), CACHE_LINE);
+    p64_stagering_t *sr = p64_malloc(nbytes, CACHE_LINE, P64_ALLOC_ANYNODE, 0);
+    if (sr != NULL)
+    {
+	sr->nstages = nstages;
+	sr->mask = ringsz - 1;
+	sr->ring = (void **)((char *)sr + sz);
+	for (uint32_t k = 0; k < nstages; k++)
+	{
+	    sr->stage[k].head = 0;
+	    sr->stage[k].tail = 0;
+	    sr->stage[k].mask = ringsz - 1;
+	    sr->stage[k].flags = (single & (1U << k)) ? 0 : FLAG_MTSAFE;
+	    sr->stage[k].waiters = 0;
+	}
+    }
+    return sr;
+}
+
+void
+p64_stagering_free(p64_stagering_t *sr)
+{
+    if (sr != NULL)
+    {
+	for (uint32_t k = 1; k < sr->nstages; k++)
+	{
+	    if (sr->stage[k].head != sr->stage[0].head)
+	    {
+		fprintf(stderr, "Staged ring %p is not empty\n", sr);
+		break;
+	    }
+	}
+	p64_mfree(sr);
+    }
+}
+
+uint32_t
+p64_stagering_acquire(p64_stagering_t *sr,
+		      uint32_t stage,
+		      uint32_t num,
+		      p64_ringbuf_span_t *sp)
+{
+    struct headtail *st = &sr->stage[stage];
+    uint32_t next = stage + 1 < sr->nstages ? stage + 1 : 0;
+    //Slots are empty for stage 0, the first stage can acquire slots up to
+    //a ring size ahead of the last stage
+    bool first = stage == 0;
+    p64_ringbuf_result_t r;
+    if (!(st->flags & FLAG_MTSAFE))
+    {
+	//MT-unsafe single thread stage
+	r = acquire_slots(&st->head, &sr->stage[next].head,
+			  st->mask, 1, num, first);
+    }
+    else
+    {
+	//MT-safe stage
+	r = acquire_slots_mtsafe(st, 1, num, first);
+    }
+    return make_spans(sr->ring, r, sp);
+}
+
+void
+p64_stagering_release(p64_stagering_t *sr,
+		      uint32_t stage,
+		      const p64_ringbuf_span_t *sp)
+{
+    if (sp->r.actual != 0)
+    {
+	uint32_t next = stage + 1 < sr->nstages ? stage + 1 : 0;
+	//The last stage returns empty slots to the first stage, elements have
+	//only been read by it
+	release_slots(&sr->stage[next].head, sp->r.index, sp->r.actual,
+		      /*loads_only=*/next == 0, sr->stage[stage].flags);
+    }
+}
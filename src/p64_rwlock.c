@@ -13,6 +13,7 @@
 
 #include "arch.h"
 #include "common.h"
+#include "stats.h"
 
 #define RWLOCK_WRITER (1U << 31)
 #define RWLOCK_READERS (~RWLOCK_WRITER)
@@ -31,12 +32,14 @@ p64_rwlock_t wait_for_no(p64_rwlock_t *lock,
     p64_rwlock_t l;
     if (((l = __atomic_load_n(lock, mo)) & mask) != 0)
     {
+	uint64_t start = STAT_TIMESTAMP();
 	SEVL();
 	while (WFE() &&
 	       ((l = LDXR32(lock, mo)) & mask) != 0)
 	{
 	    DOZE();
 	}
+	STAT_ADD(STAT_RWLOCK_WAIT, STAT_TIMESTAMP() - start);
     }
     assert((l & mask) == 0);//No threads present
     return l;
@@ -55,7 +58,8 @@ p64_rwlock_acquire_rd(p64_rwlock_t *lock)
     }
     while (!__atomic_compare_exchange_n(lock, &l, l + 1,
 					/*weak=*/true,
-					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED) &&
+	   STAT_RETRY(STAT_RWLOCK_RETRY));
 }
 
 void
@@ -66,31 +70,96 @@ p64_rwlock_release_rd(p64_rwlock_t *lock)
     //Decrement number of readers
     prevl = __atomic_fetch_sub(lock, 1, __ATOMIC_RELAXED);
     //Check after lock is released but use pre-release lock value
-    if (UNLIKELY((prevl & RWLOCK_WRITER) != 0 || prevl == 0))
+    //A pending writer may have set the writer flag
+    if (UNLIKELY((prevl & RWLOCK_READERS) == 0))
     {
 	fprintf(stderr, "Invalid read release of RW lock %p\n", lock), abort();
     }
 }
 
+bool
+p64_rwlock_try_acquire_rd(p64_rwlock_t *lock)
+{
+    p64_rwlock_t l = __atomic_load_n(lock, __ATOMIC_RELAXED);
+    do
+    {
+	if ((l & RWLOCK_WRITER) != 0)
+	{
+	    //Writer present or pending
+	    return false;
+	}
+	//Attempt to increment number of readers
+    }
+    while (!__atomic_compare_exchange_n(lock, &l, l + 1,
+					/*weak=*/true,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED) &&
+	   STAT_RETRY(STAT_RWLOCK_RETRY));
+    return true;
+}
+
 void
 p64_rwlock_acquire_wr(p64_rwlock_t *lock)
 {
-    p64_rwlock_t l;
     do
     {
 	//Wait for any present writer to go away
-	l = wait_for_no(lock, RWLOCK_WRITER, __ATOMIC_RELAXED);
+	(void)wait_for_no(lock, RWLOCK_WRITER, __ATOMIC_RELAXED);
 
-	//Attempt to set writer flag
+	//Attempt to set writer flag, does not fail due to changes in the
+	//number of readers so a stream of readers cannot starve the writer
     }
-    while (!__atomic_compare_exchange_n(lock, &l, l | RWLOCK_WRITER,
-					/*weak=*/true,
-					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    while ((__atomic_fetch_or(lock, RWLOCK_WRITER, __ATOMIC_ACQUIRE) &
+	    RWLOCK_WRITER) != 0 &&
+	   STAT_RETRY(STAT_RWLOCK_RETRY));
 
+    //Writer flag set, new readers will wait
     //Wait for any present readers to go away
     (void)wait_for_no(lock, RWLOCK_READERS, __ATOMIC_RELAXED);
 }
 
+bool
+p64_rwlock_try_acquire_wr(p64_rwlock_t *lock)
+{
+    p64_rwlock_t l = 0;
+    //Only succeed if there are no readers or writer present
+    return __atomic_compare_exchange_n(lock, &l, RWLOCK_WRITER,
+				       /*weak=*/false,
+				       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+bool
+p64_rwlock_upgrade(p64_rwlock_t *lock)
+{
+    p64_rwlock_t prevl = __atomic_fetch_or(lock, RWLOCK_WRITER,
+					   __ATOMIC_ACQUIRE);
+    if (UNLIKELY((prevl & RWLOCK_READERS) == 0))
+    {
+	fprintf(stderr, "Invalid upgrade of RW lock %p\n", lock), abort();
+    }
+    if ((prevl & RWLOCK_WRITER) != 0)
+    {
+	//Other writer pending, it waits for us to release our read lock
+	return false;
+    }
+    //Writer flag set, new readers will wait
+    //Wait for any other present readers to go away
+    p64_rwlock_t l;
+    if (((l = __atomic_load_n(lock, __ATOMIC_ACQUIRE)) & RWLOCK_READERS) != 1)
+    {
+	uint64_t start = STAT_TIMESTAMP();
+	SEVL();
+	while (WFE() &&
+	       ((l = LDXR32(lock, __ATOMIC_ACQUIRE)) & RWLOCK_READERS) != 1)
+	{
+	    DOZE();
+	}
+	STAT_ADD(STAT_RWLOCK_WAIT, STAT_TIMESTAMP() - start);
+    }
+    //Remove ourselves as reader
+    __atomic_fetch_sub(lock, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
 void
 p64_rwlock_release_wr(p64_rwlock_t *lock)
 {
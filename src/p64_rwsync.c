@@ -13,6 +13,7 @@
 
 #include "common.h"
 #include "arch.h"
+#include "stats.h"
 
 #define RWSYNC_WRITER 1U
 
@@ -28,12 +29,14 @@ wait_for_no_writer(const p64_rwsync_t *sync, int mo)
     p64_rwsync_t l;
     if (((l = __atomic_load_n(sync, mo)) & RWSYNC_WRITER) != 0)
     {
+	uint64_t start = STAT_TIMESTAMP();
 	SEVL();
 	while (WFE() &&
 	       ((l = LDXR32(sync, mo)) & RWSYNC_WRITER) != 0)
 	{
 	    DOZE();
 	}
+	STAT_ADD(STAT_RWSYNC_WAIT, STAT_TIMESTAMP() - start);
     }
     assert((l & RWSYNC_WRITER) == 0);//No writer in progress
     return l;
@@ -51,7 +54,13 @@ p64_rwsync_release_rd(const p64_rwsync_t *sync, p64_rwsync_t prv)
 {
     smp_fence(LoadLoad);//Load-only barrier due to reader-sync
     //Test if sync is unchanged => success
-    return __atomic_load_n(sync, __ATOMIC_RELAXED) == prv;
+    if (UNLIKELY(__atomic_load_n(sync, __ATOMIC_RELAXED) != prv))
+    {
+	//Reader must retry
+	STAT_INC(STAT_RWSYNC_RETRY);
+	return false;
+    }
+    return true;
 }
 
 void
@@ -66,7 +75,10 @@ p64_rwsync_acquire_wr(p64_rwsync_t *sync)
     }
     while (!__atomic_compare_exchange_n(sync, &l, l + RWSYNC_WRITER,
 					/*weak=*/true,
-					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED) &&
+	   STAT_RETRY(STAT_RWSYNC_RETRY));
+    //Data stores must not become visible before the writer flag
+    smp_fence(StoreStore);
 }
 
 void
@@ -97,6 +109,8 @@ p64_rwsync_read(p64_rwsync_t *sync,
     do
     {
 	prv = p64_rwsync_acquire_rd(sync);
+	//Ordered by the acquire load and the LoadLoad fence, a torn copy is
+	//detected by p64_rwsync_release_rd() and discarded
 	memcpy(dst, data, len);
     }
     while (!p64_rwsync_release_rd(sync, prv));
@@ -109,6 +123,49 @@ p64_rwsync_write(p64_rwsync_t *sync,
 		 size_t len)
 {
     p64_rwsync_acquire_wr(sync);
+    //Ordered by the StoreStore fence and the release store
     memcpy(data, src, len);
     p64_rwsync_release_wr(sync);
 }
+
+//Double buffered data, sync increments twice per write
+//Data written by write N (N = sync / 2) is stored in buffer N % 2
+//A write in progress updates the inactive buffer, readers use the other
+static inline const void *
+dbuf_ptr(const void *data, size_t len, p64_rwsync_t seq)
+{
+    return (const char *)data + ((seq / 2) % 2) * len;
+}
+
+void
+p64_rwsync_read_dbuf(const p64_rwsync_t *sync,
+		     void *dst,
+		     const void *data,
+		     size_t len)
+{
+    p64_rwsync_t prv, cur;
+    do
+    {
+	//No need to wait for any present writer, it writes the other buffer
+	prv = __atomic_load_n(sync, __ATOMIC_ACQUIRE) & ~RWSYNC_WRITER;
+	memcpy(dst, dbuf_ptr(data, len, prv), len);
+	smp_fence(LoadLoad);//Load-only barrier due to reader-sync
+	cur = __atomic_load_n(sync, __ATOMIC_RELAXED);
+	//The buffer read is only overwritten when the next write after the
+	//write (if any) in progress when the read started is begun
+    }
+    while (UNLIKELY(cur - prv > 2) && STAT_RETRY(STAT_RWSYNC_RETRY));
+}
+
+void
+p64_rwsync_write_dbuf(p64_rwsync_t *sync,
+		      const void *src,
+		      void *data,
+		      size_t len)
+{
+    p64_rwsync_acquire_wr(sync);
+    p64_rwsync_t cur = __atomic_load_n(sync, __ATOMIC_RELAXED);
+    //Write to the inactive buffer
+    memcpy((void *)dbuf_ptr(data, len, cur + 1), src, len);
+    p64_rwsync_release_wr(sync);
+}
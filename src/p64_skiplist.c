@@ -0,0 +1,390 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Removal marks the next pointers of an element top-down, marking the bottom
+//level next pointer removes the element, marked elements are unlinked by
+//any traversing thread
+//Insertion links an element bottom-up, linking a higher level fails if the
+//element has been marked
+//Both the inserting and the removing thread hold a reference to an element,
+//whoever releases the last reference unlinks the element from all levels
+//(marked elements always precede any live element with the same key so a
+//lower-bound search will unlink them) and then retires it
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p64_skiplist.h"
+#include "p64_alloc.h"
+#undef p64_skiplist_lookup
+#undef p64_skiplist_lower_bound
+#undef p64_skiplist_next
+#undef p64_skiplist_remove
+#include "p64_hazardptr.h"
+#include "build_config.h"
+
+#include "arch.h"
+#include "common.h"
+#include "stats.h"
+
+#define MAXLEVELS P64_SKIPLIST_MAXLEVELS
+
+#define MARK_REMOVE 1UL
+#define HAS_MARK(ptr) (((uintptr_t)(ptr) & MARK_REMOVE) != 0)
+#define SET_MARK(ptr) (void *)((uintptr_t)(ptr) | MARK_REMOVE)
+#define REM_MARK(ptr) (void *)((uintptr_t)(ptr) & ~MARK_REMOVE)
+
+struct p64_skiplist
+{
+    p64_skipelem_t head ALIGNED(CACHE_LINE);
+    p64_skiplist_compare cf;
+};
+
+p64_skiplist_t *
+p64_skiplist_alloc(p64_skiplist_compare cf)
+{
+    p64_skiplist_t *sl = p64_malloc(ROUNDUP(sizeof(p64_skiplist_t),
+					       CACHE_LINE),
+				       CACHE_LINE, P64_ALLOC_ANYNODE, 0);
+    if (sl != NULL)
+    {
+	for (uint32_t l = 0; l < MAXLEVELS; l++)
+	{
+	    sl->head.next[l] = NULL;
+	}
+	sl->head.callback = NULL;
+	sl->head.height = MAXLEVELS;
+	sl->head.refs = 0;
+	sl->cf = cf;
+	return sl;
+    }
+    return NULL;
+}
+
+void
+p64_skiplist_free(p64_skiplist_t *sl)
+{
+    if (sl != NULL)
+    {
+	if (sl->head.next[0] != NULL)
+	{
+	    fprintf(stderr, "Skip list %p is not empty\n", sl), abort();
+	}
+	p64_mfree(sl);
+    }
+}
+
+//Return random height, each level has 1/4 of the elements of the level below
+static uint32_t
+random_height(void)
+{
+    static __thread uint32_t seed = 0;
+    if (UNLIKELY(seed == 0))
+    {
+	seed = (uint32_t)(uintptr_t)&seed | 1;
+    }
+    //xorshift32
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    uint32_t h = 1 + __builtin_ctz(seed | (1U << (2 * (MAXLEVELS - 1)))) / 2;
+    return h;
+}
+
+//Search for first element with key greater than or equal to (or greater than
+//if 'upper') 'key', down to level 'level'
+//Removed elements encountered are unlinked
+//Return the found element (or NULL) protected by *hpc and write the
+//preceding element (protected by *hpp unless it is the head) to *predp
+static p64_skipelem_t *
+find(p64_skiplist_t *sl,
+     const void *key,
+     bool upper,
+     uint32_t level,
+     p64_skipelem_t **predp,
+     p64_hazardptr_t *hpp,
+     p64_hazardptr_t *hpc)
+{
+    p64_skipelem_t *pred, *cur = NULL;
+retry:
+    pred = &sl->head;
+    for (int32_t l = MAXLEVELS - 1; l >= (int32_t)level; l--)
+    {
+	cur = p64_hazptr_acquire((void **)&pred->next[l], hpc);
+	for (;;)
+	{
+	    if (UNLIKELY(HAS_MARK(cur)))
+	    {
+		//Predecessor removed, 'cur' may also have been removed and
+		//cannot be safely dereferenced
+		STAT_INC(STAT_SKIPLIST_RETRY);
+		goto retry;
+	    }
+	    if (cur == NULL)
+	    {
+		break;
+	    }
+	    p64_skipelem_t *succ = __atomic_load_n(&cur->next[l],
+						   __ATOMIC_ACQUIRE);
+	    if (UNLIKELY(HAS_MARK(succ)))
+	    {
+		//'cur' removed, unlink it from this level
+		p64_skipelem_t *exp = cur;
+		if (!__atomic_compare_exchange_n(&pred->next[l],
+						 &exp,
+						 REM_MARK(succ),
+						 /*weak=*/false,
+						 __ATOMIC_RELEASE,
+						 __ATOMIC_RELAXED))
+		{
+		    STAT_INC(STAT_SKIPLIST_RETRY);
+		    goto retry;
+		}
+		cur = p64_hazptr_acquire((void **)&pred->next[l], hpc);
+		continue;
+	    }
+	    int c = sl->cf(cur, key);
+	    if (c < 0 || (upper && c == 0))
+	    {
+		//Continue search on this level
+		pred = cur;
+		SWAP(*hpp, *hpc);
+		cur = p64_hazptr_acquire((void **)&pred->next[l], hpc);
+		continue;
+	    }
+	    break;
+	}
+	//Continue search on the level below from 'pred'
+    }
+    *predp = pred;
+    return cur;
+}
+
+p64_skipelem_t *
+p64_skiplist_lower_bound(p64_skiplist_t *sl,
+			 const void *key,
+			 p64_hazardptr_t *hp)
+{
+    p64_hazardptr_t hpp = P64_HAZARDPTR_NULL;
+    p64_skipelem_t *pred;
+    p64_skipelem_t *cur = find(sl, key, false, 0, &pred, &hpp, hp);
+    p64_hazptr_release_ro(&hpp);
+    if (cur == NULL)
+    {
+	p64_hazptr_release_ro(hp);
+    }
+    return cur;
+}
+
+p64_skipelem_t *
+p64_skiplist_lookup(p64_skiplist_t *sl,
+		    const void *key,
+		    p64_hazardptr_t *hp)
+{
+    p64_skipelem_t *cur = p64_skiplist_lower_bound(sl, key, hp);
+    if (cur != NULL && sl->cf(cur, key) != 0)
+    {
+	p64_hazptr_release_ro(hp);
+	return NULL;
+    }
+    return cur;
+}
+
+p64_skipelem_t *
+p64_skiplist_next(p64_skiplist_t *sl,
+		  p64_skipelem_t *elem,
+		  const void *key,
+		  p64_hazardptr_t *hp)
+{
+    p64_hazardptr_t hpn = P64_HAZARDPTR_NULL;
+    p64_skipelem_t *next = p64_hazptr_acquire((void **)&elem->next[0], &hpn);
+    if (LIKELY(!HAS_MARK(next)))
+    {
+	//'elem' not removed so 'next' is still in the list
+	p64_hazptr_release_ro(hp);
+	*hp = hpn;
+	if (next == NULL)
+	{
+	    p64_hazptr_release_ro(hp);
+	}
+	return next;
+    }
+    //'elem' removed, search for the element following its key
+    p64_skipelem_t *pred;
+    next = find(sl, key, true, 0, &pred, hp, &hpn);
+    p64_hazptr_release_ro(hp);
+    *hp = hpn;
+    if (next == NULL)
+    {
+	p64_hazptr_release_ro(hp);
+    }
+    return next;
+}
+
+//Release reference to element, the last reference unlinks and retires it
+static void
+release_ref(p64_skiplist_t *sl,
+	    p64_skipelem_t *elem,
+	    const void *key,
+	    p64_hazardptr_t *hpp,
+	    p64_hazardptr_t *hpc)
+{
+    if (__atomic_fetch_sub(&elem->refs, 1, __ATOMIC_ACQ_REL) == 1)
+    {
+	//Other thread has released its reference, all links and marks made
+	//are visible
+	//A lower-bound search unlinks the element from all levels
+	p64_skipelem_t *pred;
+	(void)find(sl, key, false, 0, &pred, hpp, hpc);
+	p64_hazptr_release_ro(hpp);
+	p64_hazptr_release_ro(hpc);
+	if (elem->callback != NULL)
+	{
+	    p64_hazptr_retire(elem, elem->callback);
+	}
+    }
+}
+
+bool
+p64_skiplist_insert(p64_skiplist_t *sl,
+		    p64_skipelem_t *elem,
+		    const void *key)
+{
+    uint32_t height = random_height();
+    for (uint32_t l = 0; l < MAXLEVELS; l++)
+    {
+	elem->next[l] = NULL;
+    }
+    elem->callback = NULL;
+    elem->height = height;
+    //One reference for the inserting and one for the removing thread
+    elem->refs = 2;
+    p64_hazardptr_t hpp = P64_HAZARDPTR_NULL;
+    p64_hazardptr_t hpc = P64_HAZARDPTR_NULL;
+    p64_skipelem_t *pred, *cur = NULL;
+    //Insert on bottom level
+    for (;;)
+    {
+	cur = find(sl, key, false, 0, &pred, &hpp, &hpc);
+	if (cur != NULL && sl->cf(cur, key) == 0)
+	{
+	    //Element with same key already present
+	    p64_hazptr_release_ro(&hpp);
+	    p64_hazptr_release_ro(&hpc);
+	    return false;
+	}
+	elem->next[0] = cur;
+	if (__atomic_compare_exchange_n(&pred->next[0],
+					&cur,
+					elem,
+					/*weak=*/false,
+					__ATOMIC_RELEASE,
+					__ATOMIC_RELAXED))
+	{
+	    break;
+	}
+	STAT_INC(STAT_SKIPLIST_RETRY);
+    }
+    //Insert on higher levels, bottom-up
+    for (uint32_t l = 1; l < height; l++)
+    {
+	for (;;)
+	{
+	    cur = find(sl, key, false, l, &pred, &hpp, &hpc);
+	    p64_skipelem_t *old = __atomic_load_n(&elem->next[l],
+						  __ATOMIC_RELAXED);
+	    if (HAS_MARK(old))
+	    {
+		//Element removed, stop linking
+		goto done;
+	    }
+	    if (old != cur &&
+		!__atomic_compare_exchange_n(&elem->next[l],
+					     &old,
+					     cur,
+					     /*weak=*/false,
+					     __ATOMIC_RELAXED,
+					     __ATOMIC_RELAXED))
+	    {
+		//Element marked
+		goto done;
+	    }
+	    if (__atomic_compare_exchange_n(&pred->next[l],
+					    &cur,
+					    elem,
+					    /*weak=*/false,
+					    __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED))
+	    {
+		break;
+	    }
+	    STAT_INC(STAT_SKIPLIST_RETRY);
+	}
+    }
+done:
+    //Reuse our hazard pointers
+    release_ref(sl, elem, key, &hpp, &hpc);
+    p64_hazptr_release_ro(&hpp);
+    p64_hazptr_release(&hpc);
+    return true;
+}
+
+//Set removal mark on next pointer, return false if already marked
+static inline bool
+set_mark(p64_skipelem_t **loc)
+{
+    p64_skipelem_t *old = __atomic_load_n(loc, __ATOMIC_RELAXED);
+    do
+    {
+	if (HAS_MARK(old))
+	{
+	    return false;
+	}
+    }
+    while (!__atomic_compare_exchange_n(loc,
+					&old,
+					SET_MARK(old),
+					/*weak=*/true,
+					__ATOMIC_RELAXED,
+					__ATOMIC_RELAXED));
+    return true;
+}
+
+p64_skipelem_t *
+p64_skiplist_remove(p64_skiplist_t *sl,
+		    const void *key,
+		    void (*callback)(void *),
+		    p64_hazardptr_t *hp)
+{
+    p64_hazardptr_t hpp = P64_HAZARDPTR_NULL;
+    for (;;)
+    {
+	p64_skipelem_t *pred;
+	p64_skipelem_t *cur = find(sl, key, false, 0, &pred, &hpp, hp);
+	if (cur == NULL || sl->cf(cur, key) != 0)
+	{
+	    p64_hazptr_release_ro(&hpp);
+	    p64_hazptr_release_ro(hp);
+	    return NULL;
+	}
+	//Mark higher levels, top-down
+	for (uint32_t l = cur->height - 1; l > 0; l--)
+	{
+	    (void)set_mark(&cur->next[l]);
+	}
+	//Mark bottom level, the thread which succeeds has removed the element
+	if (set_mark(&cur->next[0]))
+	{
+	    cur->callback = callback;
+	    p64_hazardptr_t hpc = P64_HAZARDPTR_NULL;
+	    release_ref(sl, cur, key, &hpp, &hpc);
+	    p64_hazptr_release_ro(&hpp);
+	    return cur;
+	}
+	//Element concurrently removed by other thread, retry
+	STAT_INC(STAT_SKIPLIST_RETRY);
+    }
+}
@@ -10,6 +10,8 @@
 
 #include "common.h"
 #include "arch.h"
+#include "backoff.h"
+#include "stats.h"
 
 void
 p64_spinlock_init(p64_spinlock_t *lock)
@@ -34,15 +36,20 @@ p64_spinlock_acquire(p64_spinlock_t *lock)
     {
 	if (__atomic_load_n(lock, __ATOMIC_RELAXED) != 0)
 	{
+	    uint64_t start = STAT_TIMESTAMP();
+	    struct backoff bo;
+	    backoff_init(&bo);
 	    SEVL();
 	    while (WFE() && LDXR8(lock, __ATOMIC_RELAXED) != 0)
 	    {
-		DOZE();
+		STAT_INC(STAT_SPINLOCK_SPIN);
+		backoff_wait(&bo);
 	    }
+	    STAT_ADD(STAT_SPINLOCK_WAIT, STAT_TIMESTAMP() - start);
 	}
 	//*lock == 0
     }
-    while (!try_lock(lock, /*weak=*/true));
+    while (!try_lock(lock, /*weak=*/true) && STAT_RETRY(STAT_SPINLOCK_SPIN));
 }
 
 bool
@@ -76,3 +83,57 @@ p64_spinlock_release_ro(p64_spinlock_t *lock)
     smp_fence(LoadStore);
     __atomic_store_n(lock, 0, __ATOMIC_RELAXED);
 }
+
+void
+p64_tktlock_init(p64_tktlock_t *lock)
+{
+    lock->enter = 0;
+    lock->leave = 0;
+}
+
+void
+p64_tktlock_acquire(p64_tktlock_t *lock)
+{
+    //Get a ticket
+    uint16_t tkt = __atomic_fetch_add(&lock->enter, 1, __ATOMIC_RELAXED);
+    //Wait until our ticket is served
+    if (__atomic_load_n(&lock->leave, __ATOMIC_ACQUIRE) != tkt)
+    {
+	uint64_t start = STAT_TIMESTAMP();
+	struct backoff bo;
+	backoff_init(&bo);
+	SEVL();
+	while (WFE() && LDXR16(&lock->leave, __ATOMIC_ACQUIRE) != tkt)
+	{
+	    STAT_INC(STAT_SPINLOCK_SPIN);
+	    backoff_wait(&bo);
+	}
+	STAT_ADD(STAT_SPINLOCK_WAIT, STAT_TIMESTAMP() - start);
+    }
+}
+
+bool
+p64_tktlock_try_acquire(p64_tktlock_t *lock)
+{
+    //Lock is available only if there are no outstanding tickets
+    //'leave' cannot pass 'enter' so if 'enter' equals the read value of
+    //'leave', the lock is still available
+    uint16_t tkt = __atomic_load_n(&lock->leave, __ATOMIC_RELAXED);
+    return __atomic_compare_exchange_n(&lock->enter, &tkt, tkt + 1,
+				       /*weak=*/false,
+				       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void
+p64_tktlock_release(p64_tktlock_t *lock)
+{
+    //Only the lock owner updates 'leave'
+    uint16_t tkt = __atomic_load_n(&lock->leave, __ATOMIC_RELAXED);
+    //Serve the next ticket
+#ifdef USE_DMB
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&lock->leave, tkt + 1, __ATOMIC_RELAXED);
+#else
+    __atomic_store_n(&lock->leave, tkt + 1, __ATOMIC_RELEASE);
+#endif
+}
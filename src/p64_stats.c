@@ -0,0 +1,150 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "p64_stats.h"
+#include "build_config.h"
+
+#include "stats.h"
+
+#ifdef P64_STATS
+
+static const char *const names[STAT_NUM] =
+{
+    [STAT_RINGBUF_RETRY] = "ringbuf retries",
+    [STAT_RINGBUF_WAIT] = "ringbuf wait cycles",
+    [STAT_MSGRING_RETRY] = "msgring retries",
+    [STAT_MSGRING_WAIT] = "msgring wait cycles",
+    [STAT_LFRING_RETRY] = "lfring retries",
+    [STAT_FUTEX_SLEEP] = "futex sleeps",
+    [STAT_BACKOFF_YIELD] = "backoff yields",
+    [STAT_SPINLOCK_SPIN] = "spinlock spins",
+    [STAT_SPINLOCK_WAIT] = "spinlock wait cycles",
+    [STAT_RWLOCK_RETRY] = "rwlock retries",
+    [STAT_RWLOCK_WAIT] = "rwlock wait cycles",
+    [STAT_BRLOCK_RETRY] = "brlock retries",
+    [STAT_BRLOCK_WAIT] = "brlock wait cycles",
+    [STAT_CLHLOCK_WAIT] = "clhlock wait cycles",
+    [STAT_BARRIER_WAIT] = "barrier wait cycles",
+    [STAT_RWSYNC_RETRY] = "rwsync retries",
+    [STAT_RWSYNC_WAIT] = "rwsync wait cycles",
+    [STAT_HASHTABLE_RETRY] = "hashtable retries",
+    [STAT_SKIPLIST_RETRY] = "skiplist retries",
+    [STAT_CUCKOOHT_RETRY] = "cuckooht retries",
+    [STAT_CUCKOOHT_MOVE] = "cuckooht moves",
+    [STAT_WSDEQUE_RETRY] = "wsdeque retries",
+    [STAT_MPSCQ_WAIT] = "mpscq wait cycles",
+    [STAT_HAZPTR_GC] = "hazptr reclaim runs",
+    [STAT_HAZPTR_FREED] = "hazptr objects freed",
+    [STAT_QSBR_RECLAIM] = "qsbr reclaim runs",
+    [STAT_QSBR_FREED] = "qsbr objects freed",
+    [STAT_TIMER_RETRY] = "timer retries",
+    [STAT_MEMPOOL_RETRY] = "mempool retries",
+    [STAT_REORDER_RETRY] = "reorder retries",
+    [STAT_LAXROB_RETRY] = "laxrob retries",
+    [STAT_REASSEMBLE_RETRY] = "reassemble retries",
+    [STAT_REASSEMBLE_EVICT] = "reassemble evictions",
+};
+
+//List of all per-thread counter blocks, blocks are never freed so that
+//counts of exited threads are retained
+static struct p64_stats *all_stats = NULL;
+
+__thread struct p64_stats *p64_stats_tls = NULL;
+
+struct p64_stats *
+p64_stats_register(void)
+{
+    struct p64_stats *st = aligned_alloc(CACHE_LINE,
+				  ROUNDUP(sizeof(struct p64_stats), CACHE_LINE));
+    if (st == NULL)
+    {
+	perror("aligned_alloc"), abort();
+    }
+    memset(st, 0, sizeof(struct p64_stats));
+    struct p64_stats *old = __atomic_load_n(&all_stats, __ATOMIC_RELAXED);
+    do
+    {
+	st->next = old;
+    }
+    while (!__atomic_compare_exchange_n(&all_stats,
+					&old,
+					st,
+					/*weak=*/true,
+					__ATOMIC_RELEASE,
+					__ATOMIC_RELAXED));
+    p64_stats_tls = st;
+    return st;
+}
+
+bool
+p64_stats_enabled(void)
+{
+    return true;
+}
+
+void
+p64_stats_dump(FILE *fp)
+{
+    uint64_t sum[STAT_NUM] = { 0 };
+    uint32_t nthreads = 0;
+    for (struct p64_stats *st = __atomic_load_n(&all_stats, __ATOMIC_ACQUIRE);
+	 st != NULL;
+	 st = st->next)
+    {
+	for (uint32_t i = 0; i < STAT_NUM; i++)
+	{
+	    sum[i] += __atomic_load_n(&st->cnt[i], __ATOMIC_RELAXED);
+	}
+	nthreads++;
+    }
+    fprintf(fp, "p64_stats: %u threads\n", nthreads);
+    for (uint32_t i = 0; i < STAT_NUM; i++)
+    {
+	if (sum[i] != 0)
+	{
+	    fprintf(fp, "%-24s %" PRIu64 "\n", names[i], sum[i]);
+	}
+    }
+}
+
+void
+p64_stats_reset(void)
+{
+    for (struct p64_stats *st = __atomic_load_n(&all_stats, __ATOMIC_ACQUIRE);
+	 st != NULL;
+	 st = st->next)
+    {
+	for (uint32_t i = 0; i < STAT_NUM; i++)
+	{
+	    __atomic_store_n(&st->cnt[i], 0, __ATOMIC_RELAXED);
+	}
+    }
+}
+
+#else
+
+bool
+p64_stats_enabled(void)
+{
+    return false;
+}
+
+void
+p64_stats_dump(FILE *fp)
+{
+    fprintf(fp, "p64_stats: not enabled (build with P64_STATS)\n");
+}
+
+void
+p64_stats_reset(void)
+{
+}
+
+#endif
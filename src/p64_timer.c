@@ -4,70 +4,182 @@
 
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "p64_timer.h"
+#include "p64_alloc.h"
 #include "build_config.h"
+#ifdef USE_TIMER_WHEEL
+#include "p64_spinlock.h"
+#endif
 
 #include "arch.h"
 #include "lockfree.h"
+#include "lfstack.h"
 #include "common.h"
+#include "stats.h"
+
+#ifndef USE_TIMER_WHEEL
+#if defined __x86_64__
+#include <immintrin.h>
+#elif defined __aarch64__
+#include <arm_neon.h>
+#ifdef __ARM_FEATURE_SVE
+#include <arm_sve.h>
+#endif
+#endif
+#endif
 
 struct timer
 {
     p64_timer_cb cb;//User-defined call-back
     void *arg;//User-defined argument to call-back
+#ifdef USE_TIMER_WHEEL
+    p64_timer_t next;//Next timer in wheel slot
+    p64_timer_t prev;//Previous timer in wheel slot or P64_TIMER_NULL
+    uint32_t slot;//Wheel slot where timer is linked
+#endif
 };
 
-struct freelist
+#ifdef USE_TIMER_WHEEL
+//Hierarchical timer wheel, each level has 64 slots and covers 64 times the
+//range of the level below
+//A timer is filed at the highest level where its expiration tick differs
+//from the current wheel tick (and at level 0 if it is equal) and in the slot
+//given by the expiration tick's digit for that level
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1U << WHEEL_BITS)
+#define WHEEL_LEVELS ((64 + WHEEL_BITS - 1) / WHEEL_BITS)
+//Maximum number of expired timers collected before call-backs are invoked
+#define WHEEL_BATCH 32
+
+struct wheel
 {
-    struct timer *head;
-    uintptr_t count;//For ABA protection
+    p64_spinlock_t lock;//Serialises all wheel operations
+    p64_tick_t now;//All ticks before 'now' have been processed
+    uint64_t occupied[WHEEL_LEVELS];//Bit mask of non-empty slots per level
+    p64_timer_t slots[WHEEL_LEVELS * WHEEL_SLOTS];//Head of timer list per slot
 };
+#endif
 
-static struct
+struct p64_timer_group
 {
     p64_tick_t earliest ALIGNED(CACHE_LINE);
     p64_tick_t current;
     uint32_t hiwmark;
-    p64_tick_t expirations[MAXTIMERS + 4] ALIGNED(CACHE_LINE);//+4 for sentinels
-    struct timer timers[MAXTIMERS] ALIGNED(CACHE_LINE);
-    struct freelist freelist;
-} g_timer;
+    uint32_t ntimers;
+    p64_tick_t *expirations;//ntimers + 4 sentinels
+    struct timer *timers;
+    //Built-in clock, ticks = (counter - clk_base) * clk_mult >> clk_shift
+    uint64_t clk_base;
+    uint64_t clk_mult;//0 when not using the built-in clock
+    uint32_t clk_shift;
+    struct lfstack freelist ALIGNED(CACHE_LINE);
+#ifdef USE_TIMER_WHEEL
+    struct wheel wheel ALIGNED(CACHE_LINE);
+#endif
+};
 
-INIT_FUNCTION
-static void
-init_timers(void)
+//Timer group used by the p64_timer functions without group argument
+static p64_timer_group_t *g_timer;
+
+p64_timer_group_t *
+p64_timer_group_alloc(uint32_t ntimers)
 {
-    g_timer.earliest = P64_TIMER_TICK_INVALID;
-    g_timer.current = 0;
-    g_timer.hiwmark = 0;
-    for (uint32_t i = 0; i < MAXTIMERS; i++)
+    if (ntimers == 0 || ntimers > (uint32_t)INT32_MAX)
+    {
+	fprintf(stderr, "Invalid number of timers %u\n", ntimers), abort();
+    }
+    size_t sz = ROUNDUP(sizeof(p64_timer_group_t), CACHE_LINE);
+    //+4 for sentinels
+    size_t sz_exp = ROUNDUP((ntimers + 4) * sizeof(p64_tick_t), CACHE_LINE);
+    size_t sz_tim = ROUNDUP(ntimers * sizeof(struct timer), CACHE_LINE);
+    p64_timer_group_t *tg = p64_malloc(sz + sz_exp + sz_tim, CACHE_LINE,
+				       P64_ALLOC_ANYNODE, 0);
+    if (tg == NULL)
+    {
+	return NULL;
+    }
+    //Memory is initialised (first touched) by the calling thread
+    tg->earliest = P64_TIMER_TICK_INVALID;
+    tg->current = 0;
+    tg->hiwmark = 0;
+    tg->clk_base = 0;
+    tg->clk_mult = 0;
+    tg->clk_shift = 0;
+    tg->ntimers = ntimers;
+    tg->expirations = (p64_tick_t *)((char *)tg + sz);
+    tg->timers = (struct timer *)((char *)tg + sz + sz_exp);
+    for (uint32_t i = 0; i < ntimers; i++)
     {
-	g_timer.expirations[i] = 0;//All timers beyond hiwmark <= now
-	g_timer.timers[i].cb = NULL;
-	g_timer.timers[i].arg = &g_timer.timers[i + 1];
+	tg->expirations[i] = 0;//All timers beyond hiwmark <= now
+	tg->timers[i].cb = NULL;
+	tg->timers[i].arg = &tg->timers[i + 1];
     }
     //Ensure sentinels trigger expiration compare and loop termination
-    g_timer.expirations[MAXTIMERS + 0] = 0;
-    g_timer.expirations[MAXTIMERS + 1] = 0;
-    g_timer.expirations[MAXTIMERS + 2] = 0;
-    g_timer.expirations[MAXTIMERS + 3] = 0;
+    tg->expirations[ntimers + 0] = 0;
+    tg->expirations[ntimers + 1] = 0;
+    tg->expirations[ntimers + 2] = 0;
+    tg->expirations[ntimers + 3] = 0;
     //Last timer must end freelist
-    g_timer.timers[MAXTIMERS - 1].arg = NULL;
+    tg->timers[ntimers - 1].arg = NULL;
     //Initialise head of freelist
-    g_timer.freelist.head = g_timer.timers;
-    g_timer.freelist.count = 0;
+    lfstack_init(&tg->freelist, tg->timers);
+#ifdef USE_TIMER_WHEEL
+    p64_spinlock_init(&tg->wheel.lock);
+    tg->wheel.now = 0;
+    for (uint32_t l = 0; l < WHEEL_LEVELS; l++)
+    {
+	tg->wheel.occupied[l] = 0;
+    }
+    for (uint32_t i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++)
+    {
+	tg->wheel.slots[i] = P64_TIMER_NULL;
+    }
+#endif
+    return tg;
+}
+
+void
+p64_timer_group_free(p64_timer_group_t *tg)
+{
+    if (tg != NULL)
+    {
+	for (uint32_t i = 0; i < tg->hiwmark; i++)
+	{
+	    if (tg->expirations[i] != P64_TIMER_TICK_INVALID &&
+		tg->timers[i].cb != NULL)
+	    {
+		fprintf(stderr, "Timer group has active timer %u\n", i);
+		abort();
+	    }
+	}
+	p64_mfree(tg);
+    }
+}
+
+INIT_FUNCTION
+static void
+init_timers(void)
+{
+    g_timer = p64_timer_group_alloc(MAXTIMERS);
+    if (g_timer == NULL)
+    {
+	perror("p64_malloc"), exit(EXIT_FAILURE);
+    }
 }
 
+#ifndef USE_TIMER_WHEEL
 //There might be user-defined data associated with a timer
 //(e.g. accessed through the user-defined argument to the call-back)
 //Set (and reset) a timer has release semantics wrt this data
 //Expire a timer thus needs acquire semantics
 static void
-expire_one_timer(p64_tick_t now,
+expire_one_timer(p64_timer_group_t *tg,
+		 p64_tick_t now,
 		 p64_tick_t *ptr)
 {
     p64_tick_t exp;
@@ -78,7 +190,7 @@ expire_one_timer(p64_tick_t now,
 	if (!(exp <= now))//exp > now
 	{
 	    //If timer does not expire anymore it means some thread has
-	    //(re-)set the timer and then also updated g_timer.earliest
+	    //(re-)set the timer and then also updated tg->earliest
 	    return;
 	}
     }
@@ -87,9 +199,10 @@ expire_one_timer(p64_tick_t now,
 					P64_TIMER_TICK_INVALID,
 					/*weak=*/true,
 					__ATOMIC_RELAXED,
-					__ATOMIC_RELAXED));
-    uint32_t tim = ptr - &g_timer.expirations[0];
-    g_timer.timers[tim].cb(tim, exp, g_timer.timers[tim].arg);
+					__ATOMIC_RELAXED) &&
+	   STAT_RETRY(STAT_TIMER_RETRY));
+    uint32_t tim = ptr - &tg->expirations[0];
+    tg->timers[tim].cb(tim, exp, tg->timers[tim].arg);
 }
 
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
@@ -102,7 +215,8 @@ expire_one_timer(p64_tick_t now,
 
 //__attribute_noinline__
 static p64_tick_t
-scan_timers(p64_tick_t now,
+scan_timers(p64_timer_group_t *tg,
+	    p64_tick_t now,
 	    p64_tick_t *cur,
 	    p64_tick_t *top)
 {
@@ -125,9 +239,9 @@ scan_timers(p64_tick_t now,
 	    {
 		break;
 	    }
-	    expire_one_timer(now, pw0);
+	    expire_one_timer(tg, now, pw0);
 	    //If timer didn't actually expire, it was reset by some thread and
-	    //g_timer.earliest updated which means we don't have to include it
+	    //tg->earliest updated which means we don't have to include it
 	    //in our update of earliest
 	}
 	else//'w0' > 'now'
@@ -141,7 +255,7 @@ scan_timers(p64_tick_t now,
 	    {
 		break;
 	    }
-	    expire_one_timer(now, pw1);
+	    expire_one_timer(tg, now, pw1);
 	}
 	else//'w1' > 'now'
 	{
@@ -157,7 +271,7 @@ scan_timers(p64_tick_t now,
 	    {
 		break;
 	    }
-	    expire_one_timer(now, pw0);
+	    expire_one_timer(tg, now, pw0);
 	}
 	else//'w0' > 'now'
 	{
@@ -170,7 +284,7 @@ scan_timers(p64_tick_t now,
 	    {
 		break;
 	    }
-	    expire_one_timer(now, pw1);
+	    expire_one_timer(tg, now, pw1);
 	}
 	else//'w1' > 'now'
 	{
@@ -180,15 +294,269 @@ scan_timers(p64_tick_t now,
     return earliest;
 }
 
-//Perform an atomic-min operation on g_timer.earliest
+//Vectorised scan kernels
+//Compare a vector of expiration ticks with 'now' and track the minimum of
+//non-expired ticks, vectors with expired timers are handled by scan_block()
+//Vectors may extend beyond 'top' but never beyond the end of the (cache line
+//aligned and padded) expiration array
+
+//Scalar handling of vector with at least one expired timer
+static inline p64_tick_t
+scan_block(p64_timer_group_t *tg,
+	   p64_tick_t now,
+	   p64_tick_t *ptr,
+	   uint32_t num,
+	   p64_tick_t *top,
+	   p64_tick_t earliest)
+{
+    for (uint32_t i = 0; i < num && ptr + i < top; i++)
+    {
+	p64_tick_t w = __atomic_load_n(&ptr[i], __ATOMIC_RELAXED);
+	if (w <= now)
+	{
+	    expire_one_timer(tg, now, &ptr[i]);
+	}
+	else
+	{
+	    earliest = MIN(earliest, w);
+	}
+    }
+    return earliest;
+}
+
+#if defined __x86_64__
+__attribute__((target("avx2")))
+static p64_tick_t
+scan_timers_avx2(p64_timer_group_t *tg,
+		 p64_tick_t now,
+		 p64_tick_t *cur,
+		 p64_tick_t *top)
+{
+    p64_tick_t earliest = P64_TIMER_TICK_INVALID;
+    //AVX2 only has signed 64-bit compare, flip sign bits for unsigned compare
+    const __m256i bias = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i vnow = _mm256_xor_si256(_mm256_set1_epi64x(now), bias);
+    __m256i vmin = _mm256_set1_epi64x(INT64_MAX);//Biased TICK_INVALID
+    for (p64_tick_t *ptr = cur; ptr < top; ptr += 4)
+    {
+	__m256i w = _mm256_xor_si256(_mm256_load_si256((__m256i *)ptr), bias);
+	__m256i gt = _mm256_cmpgt_epi64(w, vnow);
+	if (UNLIKELY(_mm256_movemask_pd(_mm256_castsi256_pd(gt)) != 0xF))
+	{
+	    //At least one 'w' <= 'now'
+	    earliest = scan_block(tg, now, ptr, 4, top, earliest);
+	}
+	else
+	{
+	    vmin = _mm256_blendv_epi8(vmin, w, _mm256_cmpgt_epi64(vmin, w));
+	}
+    }
+    int64_t m[4];
+    _mm256_storeu_si256((__m256i *)m, vmin);
+    for (uint32_t i = 0; i < 4; i++)
+    {
+	earliest = MIN(earliest, (p64_tick_t)m[i] ^ (p64_tick_t)INT64_MIN);
+    }
+    return earliest;
+}
+
+__attribute__((target("avx512f")))
+static p64_tick_t
+scan_timers_avx512(p64_timer_group_t *tg,
+		   p64_tick_t now,
+		   p64_tick_t *cur,
+		   p64_tick_t *top)
+{
+    p64_tick_t earliest = P64_TIMER_TICK_INVALID;
+    const __m512i vnow = _mm512_set1_epi64(now);
+    __m512i vmin = _mm512_set1_epi64(P64_TIMER_TICK_INVALID);
+    for (p64_tick_t *ptr = cur; ptr < top; ptr += 8)
+    {
+	__m512i w = _mm512_load_si512(ptr);
+	if (UNLIKELY(_mm512_cmple_epu64_mask(w, vnow) != 0))
+	{
+	    earliest = scan_block(tg, now, ptr, 8, top, earliest);
+	}
+	else
+	{
+	    vmin = _mm512_min_epu64(vmin, w);
+	}
+    }
+    return MIN(earliest, (p64_tick_t)_mm512_reduce_min_epu64(vmin));
+}
+
+static bool
+has_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+static bool
+has_avx512(void)
+{
+    return __builtin_cpu_supports("avx512f");
+}
+
+#elif defined __aarch64__
+static p64_tick_t
+scan_timers_neon(p64_timer_group_t *tg,
+		 p64_tick_t now,
+		 p64_tick_t *cur,
+		 p64_tick_t *top)
+{
+    p64_tick_t earliest = P64_TIMER_TICK_INVALID;
+    const uint64x2_t vnow = vdupq_n_u64(now);
+    uint64x2_t vmin = vdupq_n_u64(P64_TIMER_TICK_INVALID);
+    for (p64_tick_t *ptr = cur; ptr < top; ptr += 4)
+    {
+	uint64x2_t w0 = vld1q_u64(ptr);
+	uint64x2_t w1 = vld1q_u64(ptr + 2);
+	uint64x2_t le = vorrq_u64(vcleq_u64(w0, vnow), vcleq_u64(w1, vnow));
+	if (UNLIKELY(vmaxvq_u32(vreinterpretq_u32_u64(le)) != 0))
+	{
+	    earliest = scan_block(tg, now, ptr, 4, top, earliest);
+	}
+	else
+	{
+	    //No unsigned 64-bit min instruction, use compare and select
+	    vmin = vbslq_u64(vcltq_u64(w0, vmin), w0, vmin);
+	    vmin = vbslq_u64(vcltq_u64(w1, vmin), w1, vmin);
+	}
+    }
+    earliest = MIN(earliest, vgetq_lane_u64(vmin, 0));
+    earliest = MIN(earliest, vgetq_lane_u64(vmin, 1));
+    return earliest;
+}
+
+#ifdef __ARM_FEATURE_SVE
+static p64_tick_t
+scan_timers_sve(p64_timer_group_t *tg,
+		p64_tick_t now,
+		p64_tick_t *cur,
+		p64_tick_t *top)
+{
+    p64_tick_t earliest = P64_TIMER_TICK_INVALID;
+    uint64_t num = top - cur;
+    svuint64_t vmin = svdup_n_u64(P64_TIMER_TICK_INVALID);
+    //Predicated loads, vectors do not extend beyond 'top'
+    for (uint64_t i = 0; i < num; i += svcntd())
+    {
+	svbool_t pg = svwhilelt_b64_u64(i, num);
+	svuint64_t w = svld1_u64(pg, cur + i);
+	if (UNLIKELY(svptest_any(pg, svcmple_n_u64(pg, w, now))))
+	{
+	    earliest = scan_block(tg, now, cur + i, svcntd(), top, earliest);
+	}
+	else
+	{
+	    vmin = svmin_u64_m(pg, vmin, w);
+	}
+    }
+    return MIN(earliest, svminv_u64(svptrue_b64(), vmin));
+}
+#endif
+#endif
+
+typedef p64_tick_t (*scan_func)(p64_timer_group_t *tg,
+				p64_tick_t now,
+				p64_tick_t *cur,
+				p64_tick_t *top);
+
+static bool
+always(void)
+{
+    return true;
+}
+
+//Available scan kernels, in order of preference (best last)
+static const struct
+{
+    const char *name;
+    scan_func func;
+    bool (*supported)(void);
+} scan_kernels[] =
+{
+    { "scalar", scan_timers, always },
+#if defined __x86_64__
+    { "avx2", scan_timers_avx2, has_avx2 },
+    { "avx512", scan_timers_avx512, has_avx512 },
+#elif defined __aarch64__
+    { "neon", scan_timers_neon, always },
+#ifdef __ARM_FEATURE_SVE
+    { "sve", scan_timers_sve, always },
+#endif
+#endif
+};
+
+#define NUM_KERNELS (sizeof(scan_kernels) / sizeof(scan_kernels[0]))
+
+static scan_func scan_kernel = scan_timers;
+
+INIT_FUNCTION
+static void
+init_scan_kernel(void)
+{
+#if defined __x86_64__
+    //Required before __builtin_cpu_supports() in constructors
+    __builtin_cpu_init();
+#endif
+    for (uint32_t i = 0; i < NUM_KERNELS; i++)
+    {
+	if (scan_kernels[i].supported())
+	{
+	    scan_kernel = scan_kernels[i].func;
+	}
+    }
+}
+#endif
+
+const char *
+p64_timer_scan_kernel(uint32_t idx)
+{
+#ifndef USE_TIMER_WHEEL
+    if (idx < NUM_KERNELS && scan_kernels[idx].supported())
+    {
+	scan_kernel = scan_kernels[idx].func;
+	return scan_kernels[idx].name;
+    }
+#else
+    if (idx == 0)
+    {
+	return "wheel";
+    }
+#endif
+    return NULL;
+}
+
+//Return the current tick of the group
+//With the built-in clock, every thread computes the tick from its own read of
+//the counter so no shared tick is written or read
+static inline p64_tick_t
+current_tick(const p64_timer_group_t *tg)
+{
+    if (tg->clk_mult != 0)
+    {
+	uint64_t cnt = counter_read() - tg->clk_base;
+	//The counter of another CPU may lag slightly behind the base
+	if (UNLIKELY((int64_t)cnt < 0))
+	{
+	    return 0;
+	}
+	return (unsigned __int128)cnt * tg->clk_mult >> tg->clk_shift;
+    }
+    return __atomic_load_n(&tg->current, __ATOMIC_RELAXED);
+}
+
+//Perform an atomic-min operation on tg->earliest
 static inline void
-update_earliest(p64_tick_t exp)
+update_earliest(p64_timer_group_t *tg,
+		p64_tick_t exp)
 {
     p64_tick_t old;
     do
     {
 	//Explicit reloading => smaller code
-	old = __atomic_load_n(&g_timer.earliest, __ATOMIC_RELAXED);
+	old = __atomic_load_n(&tg->earliest, __ATOMIC_RELAXED);
 	if (exp >= old)
 	{
 	    //Our expiration time is same or later => no update
@@ -196,48 +564,206 @@ update_earliest(p64_tick_t exp)
 	}
 	//Else our expiration time is earlier than the previous 'earliest'
     }
-    while (UNLIKELY(!__atomic_compare_exchange_n(&g_timer.earliest,
+    while (UNLIKELY(!__atomic_compare_exchange_n(&tg->earliest,
 						 &old,
 						 exp,
 						 /*weak=*/true,
 						 __ATOMIC_RELEASE,
-						 __ATOMIC_RELAXED)));
+						 __ATOMIC_RELAXED)) &&
+	   STAT_RETRY(STAT_TIMER_RETRY));
+}
+
+#ifdef USE_TIMER_WHEEL
+//Link timer into the wheel slot corresponding to its expiration tick
+static void
+wheel_link(p64_timer_group_t *tg,
+	   p64_timer_t idx,
+	   p64_tick_t exp)
+{
+    struct wheel *wh = &tg->wheel;
+    //Timers which are already due are filed at the current wheel tick
+    p64_tick_t key = exp > wh->now ? exp : wh->now;
+    uint32_t lvl = 0;
+    if (key != wh->now)
+    {
+	//Highest level where digits of 'key' and 'now' differ
+	lvl = (63 - __builtin_clzll(key ^ wh->now)) / WHEEL_BITS;
+    }
+    uint32_t sl = (key >> (lvl * WHEEL_BITS)) % WHEEL_SLOTS;
+    uint32_t slot = lvl * WHEEL_SLOTS + sl;
+    struct timer *tim = &tg->timers[idx];
+    tim->slot = slot;
+    tim->prev = P64_TIMER_NULL;
+    tim->next = wh->slots[slot];
+    if (tim->next != P64_TIMER_NULL)
+    {
+	tg->timers[tim->next].prev = idx;
+    }
+    wh->slots[slot] = idx;
+    wh->occupied[lvl] |= 1UL << sl;
 }
 
+static void
+wheel_unlink(p64_timer_group_t *tg,
+	     p64_timer_t idx)
+{
+    struct wheel *wh = &tg->wheel;
+    struct timer *tim = &tg->timers[idx];
+    if (tim->prev != P64_TIMER_NULL)
+    {
+	tg->timers[tim->prev].next = tim->next;
+    }
+    else
+    {
+	wh->slots[tim->slot] = tim->next;
+	if (tim->next == P64_TIMER_NULL)
+	{
+	    //Slot now empty
+	    wh->occupied[tim->slot / WHEEL_SLOTS] &=
+		~(1UL << (tim->slot % WHEEL_SLOTS));
+	}
+    }
+    if (tim->next != P64_TIMER_NULL)
+    {
+	tg->timers[tim->next].prev = tim->prev;
+    }
+}
+
+//Return first tick covered by the earliest non-empty slot and the slot index
+//Return P64_TIMER_TICK_INVALID if the wheel is empty
+static p64_tick_t
+wheel_next(const struct wheel *wh,
+	   uint32_t *slot)
+{
+    //Timers at lower levels always expire before timers at higher levels
+    for (uint32_t lvl = 0; lvl < WHEEL_LEVELS; lvl++)
+    {
+	if (wh->occupied[lvl] != 0)
+	{
+	    uint32_t sl = __builtin_ctzll(wh->occupied[lvl]);
+	    uint32_t shift = lvl * WHEEL_BITS;
+	    //Keep digits of higher levels from current wheel tick
+	    p64_tick_t base = 0;
+	    if (shift + WHEEL_BITS < 64)
+	    {
+		base = wh->now & (~(p64_tick_t)0 << (shift + WHEEL_BITS));
+	    }
+	    *slot = lvl * WHEEL_SLOTS + sl;
+	    return base | ((p64_tick_t)sl << shift);
+	}
+    }
+    return P64_TIMER_TICK_INVALID;
+}
+
+//Move all timers in a higher level slot to lower levels
+static void
+wheel_cascade(p64_timer_group_t *tg,
+	      uint32_t slot)
+{
+    struct wheel *wh = &tg->wheel;
+    p64_timer_t idx = wh->slots[slot];
+    wh->slots[slot] = P64_TIMER_NULL;
+    wh->occupied[slot / WHEEL_SLOTS] &= ~(1UL << (slot % WHEEL_SLOTS));
+    while (idx != P64_TIMER_NULL)
+    {
+	p64_timer_t next = tg->timers[idx].next;
+	wheel_link(tg, idx, tg->expirations[idx]);
+	idx = next;
+    }
+}
+
+//Cost is proportional to the number of expired timers (plus cascading of
+//timers from higher levels), not to the number of allocated timers
 void
-p64_timer_expire(void)
+p64_timer_group_expire(p64_timer_group_t *tg)
+{
+    struct wheel *wh = &tg->wheel;
+    p64_tick_t now = current_tick(tg);
+    p64_tick_t earliest = __atomic_load_n(&tg->earliest, __ATOMIC_RELAXED);
+    while (earliest <= now)
+    {
+	//There might exist at least one timer that is due for expiration
+	p64_timer_t tims[WHEEL_BATCH];
+	p64_tick_t exps[WHEEL_BATCH];
+	uint32_t num = 0;
+	uint32_t slot;
+	p64_tick_t tck;
+	p64_spinlock_acquire(&wh->lock);
+	while (num < WHEEL_BATCH && (tck = wheel_next(wh, &slot)) <= now)
+	{
+	    //Ticks before start of earliest slot have been processed
+	    wh->now = tck;
+	    if (slot < WHEEL_SLOTS)
+	    {
+		//Level 0 slot, all timers in slot have expired
+		p64_timer_t idx = wh->slots[slot];
+		wheel_unlink(tg, idx);
+		tims[num] = idx;
+		exps[num] = tg->expirations[idx];
+		__atomic_store_n(&tg->expirations[idx],
+				 P64_TIMER_TICK_INVALID,
+				 __ATOMIC_RELAXED);
+		num++;
+	    }
+	    else
+	    {
+		wheel_cascade(tg, slot);
+	    }
+	}
+	//Lower bound of remaining expiration ticks
+	earliest = wheel_next(wh, &slot);
+	__atomic_store_n(&tg->earliest, earliest, __ATOMIC_RELAXED);
+	//Release lock before invoking call-backs which may (re-)set timers
+	p64_spinlock_release(&wh->lock);
+	for (uint32_t i = 0; i < num; i++)
+	{
+	    p64_timer_t idx = tims[i];
+	    tg->timers[idx].cb(idx, exps[i], tg->timers[idx].arg);
+	}
+    }
+    //Else no timers due for expiration
+}
+#else
+void
+p64_timer_group_expire(p64_timer_group_t *tg)
 {
-    p64_tick_t now = __atomic_load_n(&g_timer.current, __ATOMIC_RELAXED);
-    p64_tick_t earliest = __atomic_load_n(&g_timer.earliest, __ATOMIC_RELAXED);
+    p64_tick_t now = current_tick(tg);
+    p64_tick_t earliest = __atomic_load_n(&tg->earliest, __ATOMIC_RELAXED);
     if (earliest <= now)
     {
 	//There exists at least one timer that is due for expiration
-	PREFETCH_FOR_READ(       &g_timer.expirations[0]                 );
-	PREFETCH_FOR_READ((char*)&g_timer.expirations[0] + 1 * CACHE_LINE);
-	PREFETCH_FOR_READ((char*)&g_timer.expirations[0] + 2 * CACHE_LINE);
-	PREFETCH_FOR_READ((char*)&g_timer.expirations[0] + 3 * CACHE_LINE);
+	PREFETCH_FOR_READ(       &tg->expirations[0]                 );
+	PREFETCH_FOR_READ((char*)&tg->expirations[0] + 1 * CACHE_LINE);
+	PREFETCH_FOR_READ((char*)&tg->expirations[0] + 2 * CACHE_LINE);
+	PREFETCH_FOR_READ((char*)&tg->expirations[0] + 3 * CACHE_LINE);
 	//Reset 'earliest'
-	__atomic_store_n(&g_timer.earliest, P64_TIMER_TICK_INVALID,
+	__atomic_store_n(&tg->earliest, P64_TIMER_TICK_INVALID,
 			 __ATOMIC_RELAXED);
-	//We need our g_timer.earliest reset to be visible before we start to
+	//We need our tg->earliest reset to be visible before we start to
 	//scan the timer array
 	smp_fence(StoreLoad);
 	//Scan expiration ticks looking for expired timers
-	earliest = scan_timers(now, &g_timer.expirations[0],
-			       &g_timer.expirations[g_timer.hiwmark]);
-	update_earliest(earliest);
+	earliest = scan_kernel(tg, now, &tg->expirations[0],
+			       &tg->expirations[tg->hiwmark]);
+	update_earliest(tg, earliest);
     }
     //Else no timers due for expiration
 }
+#endif
 
 void
-p64_timer_tick_set(p64_tick_t tck)
+p64_timer_group_tick_set(p64_timer_group_t *tg,
+			 p64_tick_t tck)
 {
     if (tck == P64_TIMER_TICK_INVALID)
     {
 	fprintf(stderr, "End of time reached\n"), abort();
     }
-    p64_tick_t old = __atomic_load_n(&g_timer.current, __ATOMIC_RELAXED);
+    if (tg->clk_mult != 0)
+    {
+	fprintf(stderr, "Timer group uses built-in clock\n"), abort();
+    }
+    p64_tick_t old = __atomic_load_n(&tg->current, __ATOMIC_RELAXED);
     do
     {
 	if (tck <= old)
@@ -246,105 +772,128 @@ p64_timer_tick_set(p64_tick_t tck)
 	    return;
 	}
     }
-    while (UNLIKELY(!__atomic_compare_exchange_n(&g_timer.current,
+    while (UNLIKELY(!__atomic_compare_exchange_n(&tg->current,
 						 &old,//Updated on failure
 						 tck,
 						 /*weak=*/true,
 						 __ATOMIC_RELAXED,
-						 __ATOMIC_RELAXED)));
+						 __ATOMIC_RELAXED)) &&
+	   STAT_RETRY(STAT_TIMER_RETRY));
 }
 
 p64_tick_t
-p64_timer_tick_get(void)
+p64_timer_group_tick_get(p64_timer_group_t *tg)
 {
-    return __atomic_load_n(&g_timer.current, __ATOMIC_RELAXED);
+    return current_tick(tg);
 }
 
-p64_timer_t
-p64_timer_alloc(p64_timer_cb cb,
-		void *arg)
+void
+p64_timer_group_clock_enable(p64_timer_group_t *tg,
+			     uint64_t tick_ns)
 {
-    union
+    if (tick_ns == 0)
     {
-	struct freelist fl;
-	__int128 ui;
-    } old, neu;
-    do
+	fprintf(stderr, "Invalid tick length %"PRIu64"\n", tick_ns), abort();
+    }
+    unsigned __int128 div = (unsigned __int128)counter_freq() * tick_ns;
+    //Use the largest shift for which the multiplier fits in 64 bits
+    uint32_t shift = 64;
+    while (((unsigned __int128)1000000000 << shift) / div > UINT64_MAX)
+    {
+	shift--;
+    }
+    uint64_t mult = ((unsigned __int128)1000000000 << shift) / div;
+    if (mult == 0)
     {
-	old.fl.count = __atomic_load_n(&g_timer.freelist.count, __ATOMIC_ACQUIRE);
-	//count will be read before head, torn read will be detected by CAS
-	old.fl.head = __atomic_load_n(&g_timer.freelist.head, __ATOMIC_ACQUIRE);
-	if (UNLIKELY(old.fl.head == NULL))
-	{
-	    return P64_TIMER_NULL;
-	}
-	neu.fl.head = old.fl.head->arg;//Dereferencing old.head => need acquire
-	neu.fl.count = old.fl.count + 1;
-    }
-    while (UNLIKELY(!lockfree_compare_exchange_16((__int128*)&g_timer.freelist,
-						  &old.ui,
-						  neu.ui,
-						  /*weak=*/true,
-						  __ATOMIC_RELAXED,
-						  __ATOMIC_RELAXED)));
-    uint32_t idx = old.fl.head - g_timer.timers;
-    g_timer.expirations[idx] = P64_TIMER_TICK_INVALID;
-    g_timer.timers[idx].cb = cb;
-    g_timer.timers[idx].arg = arg;
+	fprintf(stderr, "Invalid tick length %"PRIu64"\n", tick_ns), abort();
+    }
+    tg->clk_base = counter_read();
+    tg->clk_shift = shift;
+    tg->clk_mult = mult;
+}
+
+p64_timer_t
+p64_timer_group_timer_alloc(p64_timer_group_t *tg,
+			    p64_timer_cb cb,
+			    void *arg)
+{
+    //Free timers are linked through the arg field
+    struct timer *tim = lfstack_pop(&tg->freelist,
+				    offsetof(struct timer, arg),
+				    STAT_TIMER_RETRY);
+    if (UNLIKELY(tim == NULL))
+    {
+	return P64_TIMER_NULL;
+    }
+    uint32_t idx = tim - tg->timers;
+    tg->expirations[idx] = P64_TIMER_TICK_INVALID;
+    tg->timers[idx].cb = cb;
+    tg->timers[idx].arg = arg;
     //Update high watermark of allocated timers
-    lockfree_fetch_umax_4(&g_timer.hiwmark, idx + 1, __ATOMIC_RELEASE);
+    lockfree_fetch_umax_4(&tg->hiwmark, idx + 1, __ATOMIC_RELEASE);
     return idx;
 }
 
 void
-p64_timer_free(p64_timer_t idx)
+p64_timer_group_timer_free(p64_timer_group_t *tg,
+			   p64_timer_t idx)
 {
-    if (UNLIKELY((uint32_t)idx >= g_timer.hiwmark))
+    if (UNLIKELY((uint32_t)idx >= tg->hiwmark))
     {
 	fprintf(stderr, "Invalid timer %d\n", idx), abort();
     }
-    if (__atomic_load_n(&g_timer.expirations[idx], __ATOMIC_ACQUIRE) !=
+    if (__atomic_load_n(&tg->expirations[idx], __ATOMIC_ACQUIRE) !=
 	P64_TIMER_TICK_INVALID)
     {
 	fprintf(stderr, "Cannot free active timer %u\n", idx), abort();
     }
-    struct timer *tim = &g_timer.timers[idx];
-    union
+    struct timer *tim = &tg->timers[idx];
+    tim->cb = NULL;
+    lfstack_push(&tg->freelist, tim, offsetof(struct timer, arg),
+		 STAT_TIMER_RETRY);
+}
+
+#ifdef USE_TIMER_WHEEL
+//Update expiration tick of timer, wheel lock must be held
+static inline bool
+swap_expiration(p64_timer_group_t *tg,
+		p64_timer_t idx,
+		p64_tick_t exp,
+		bool active,
+		int mo)
+{
+    (void)mo;//Lock release has release order
+    p64_tick_t old = tg->expirations[idx];
+    if (active ?
+	    old == P64_TIMER_TICK_INVALID ://Timer inactive/expired
+	    old != P64_TIMER_TICK_INVALID) //Timer already active
     {
-	struct freelist fl;
-	__int128 ui;
-    } old, neu;
-    do
+	return false;
+    }
+    if (old != P64_TIMER_TICK_INVALID)
     {
-	old.fl = g_timer.freelist;
-	tim->cb = NULL;
-	tim->arg = old.fl.head;
-	neu.fl.head = tim;
-	neu.fl.count = old.fl.count + 1;
+	wheel_unlink(tg, idx);
     }
-    while (UNLIKELY(!lockfree_compare_exchange_16((__int128*)&g_timer.freelist,
-						  &old.ui,
-						  neu.ui,
-						  /*weak=*/true,
-						  __ATOMIC_RELEASE,
-						  __ATOMIC_RELAXED)));
+    __atomic_store_n(&tg->expirations[idx], exp, __ATOMIC_RELAXED);
+    if (exp != P64_TIMER_TICK_INVALID)
+    {
+	wheel_link(tg, idx, exp);
+    }
+    return true;
 }
-
+#else
 static inline bool
-update_expiration(p64_timer_t idx,
-		  p64_tick_t exp,
-		  bool active,
-		  int mo)
+swap_expiration(p64_timer_group_t *tg,
+		p64_timer_t idx,
+		p64_tick_t exp,
+		bool active,
+		int mo)
 {
     p64_tick_t old;
-    if (UNLIKELY((uint32_t)idx >= g_timer.hiwmark))
-    {
-	fprintf(stderr, "Invalid timer %d\n", idx), abort();
-    }
     do
     {
 	//Explicit reloading => smaller code
-	old = __atomic_load_n(&g_timer.expirations[idx], __ATOMIC_RELAXED);
+	old = __atomic_load_n(&tg->expirations[idx], __ATOMIC_RELAXED);
 	if (active ?
 		old == P64_TIMER_TICK_INVALID ://Timer inactive/expired
 		old != P64_TIMER_TICK_INVALID) //Timer already active
@@ -352,48 +901,181 @@ update_expiration(p64_timer_t idx,
 	    return false;
 	}
     }
-    while (UNLIKELY(!__atomic_compare_exchange_n(&g_timer.expirations[idx],
+    while (UNLIKELY(!__atomic_compare_exchange_n(&tg->expirations[idx],
 						 &old,
 						 exp,
 						 /*weak=*/true,
-						 mo, __ATOMIC_RELAXED)));
-    if (exp != P64_TIMER_TICK_INVALID)
+						 mo, __ATOMIC_RELAXED)) &&
+	   STAT_RETRY(STAT_TIMER_RETRY));
+    return true;
+}
+#endif
+
+//Update expiration ticks of 'num' timers, cancel timers if 'exps' is NULL
+//tg->earliest is updated once with the earliest of all expiration ticks
+//Return number of updated timers
+static inline uint32_t
+update_expirations(p64_timer_group_t *tg,
+		   const p64_timer_t tims[],
+		   const p64_tick_t exps[],
+		   uint32_t num,
+		   bool active,
+		   int mo)
+{
+    p64_tick_t earliest = P64_TIMER_TICK_INVALID;
+    uint32_t nupdated = 0;
+#ifdef USE_TIMER_WHEEL
+    p64_spinlock_acquire(&tg->wheel.lock);
+#endif
+    for (uint32_t i = 0; i < num; i++)
+    {
+	p64_timer_t idx = tims[i];
+	p64_tick_t exp = exps != NULL ? exps[i] : P64_TIMER_TICK_INVALID;
+	if (UNLIKELY((uint32_t)idx >= tg->hiwmark))
+	{
+	    fprintf(stderr, "Invalid timer %d\n", idx), abort();
+	}
+	if (UNLIKELY(exps != NULL && exp == P64_TIMER_TICK_INVALID))
+	{
+	    fprintf(stderr, "Invalid expiration time %"PRIu64" for timer %d\n",
+		    exp, idx);
+	    abort();
+	}
+	if (swap_expiration(tg, idx, exp, active, mo))
+	{
+	    earliest = MIN(earliest, exp);
+	    nupdated++;
+	}
+    }
+    if (earliest != P64_TIMER_TICK_INVALID)
     {
-	update_earliest(exp);
+	update_earliest(tg, earliest);
     }
-    return true;
+#ifdef USE_TIMER_WHEEL
+    if (nupdated != 0)
+    {
+	p64_spinlock_release(&tg->wheel.lock);
+    }
+    else
+    {
+	p64_spinlock_release_ro(&tg->wheel.lock);
+    }
+#endif
+    return nupdated;
 }
 
 //Setting a timer has release order (with regards to user-defined data
 //associated with the timer)
 bool
-p64_timer_set(p64_timer_t idx,
-	      p64_tick_t exp)
+p64_timer_group_set(p64_timer_group_t *tg,
+		    p64_timer_t idx,
+		    p64_tick_t exp)
 {
-    if (UNLIKELY(exp == P64_TIMER_TICK_INVALID))
-    {
-	fprintf(stderr, "Invalid expiration time %"PRIu64" for timer %d\n",
-		exp, idx);
-	abort();
-    }
-    return update_expiration(idx, exp, false, __ATOMIC_RELEASE);
+    return update_expirations(tg, &idx, &exp, 1, false, __ATOMIC_RELEASE);
 }
 
 bool
-p64_timer_reset(p64_timer_t idx,
-		p64_tick_t exp)
+p64_timer_group_reset(p64_timer_group_t *tg,
+		      p64_timer_t idx,
+		      p64_tick_t exp)
 {
-    if (UNLIKELY(exp == P64_TIMER_TICK_INVALID))
-    {
-	fprintf(stderr, "Invalid expiration time %"PRIu64" for timer %d\n",
-		exp, idx);
-	abort();
-    }
-    return update_expiration(idx, exp, true, __ATOMIC_RELEASE);
+    return update_expirations(tg, &idx, &exp, 1, true, __ATOMIC_RELEASE);
+}
+
+bool
+p64_timer_group_cancel(p64_timer_group_t *tg,
+		       p64_timer_t idx)
+{
+    return update_expirations(tg, &idx, NULL, 1, true, __ATOMIC_RELAXED);
+}
+
+uint32_t
+p64_timer_group_set_vec(p64_timer_group_t *tg,
+			const p64_timer_t tims[],
+			const p64_tick_t tmos[],
+			uint32_t num)
+{
+    return update_expirations(tg, tims, tmos, num, false, __ATOMIC_RELEASE);
+}
+
+uint32_t
+p64_timer_group_cancel_vec(p64_timer_group_t *tg,
+			   const p64_timer_t tims[],
+			   uint32_t num)
+{
+    return update_expirations(tg, tims, NULL, num, true, __ATOMIC_RELAXED);
+}
+
+//Functions operating on the default timer group
+
+p64_timer_t
+p64_timer_alloc(p64_timer_cb cb,
+		void *arg)
+{
+    return p64_timer_group_timer_alloc(g_timer, cb, arg);
+}
+
+void
+p64_timer_free(p64_timer_t tim)
+{
+    p64_timer_group_timer_free(g_timer, tim);
+}
+
+bool
+p64_timer_set(p64_timer_t tim,
+	      p64_tick_t tmo)
+{
+    return p64_timer_group_set(g_timer, tim, tmo);
+}
+
+bool
+p64_timer_reset(p64_timer_t tim,
+		p64_tick_t tmo)
+{
+    return p64_timer_group_reset(g_timer, tim, tmo);
 }
 
 bool
-p64_timer_cancel(p64_timer_t idx)
+p64_timer_cancel(p64_timer_t tim)
+{
+    return p64_timer_group_cancel(g_timer, tim);
+}
+
+uint32_t
+p64_timer_set_vec(const p64_timer_t tims[],
+		  const p64_tick_t tmos[],
+		  uint32_t num)
+{
+    return p64_timer_group_set_vec(g_timer, tims, tmos, num);
+}
+
+uint32_t
+p64_timer_cancel_vec(const p64_timer_t tims[],
+		     uint32_t num)
+{
+    return p64_timer_group_cancel_vec(g_timer, tims, num);
+}
+
+p64_tick_t
+p64_timer_tick_get(void)
+{
+    return p64_timer_group_tick_get(g_timer);
+}
+
+void
+p64_timer_tick_set(p64_tick_t now)
+{
+    p64_timer_group_tick_set(g_timer, now);
+}
+
+void
+p64_timer_clock_enable(uint64_t tick_ns)
+{
+    p64_timer_group_clock_enable(g_timer, tick_ns);
+}
+
+void
+p64_timer_expire(void)
 {
-    return update_expiration(idx, P64_TIMER_TICK_INVALID, true, __ATOMIC_RELAXED);
+    p64_timer_group_expire(g_timer);
 }
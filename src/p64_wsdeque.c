@@ -0,0 +1,166 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+//Chase-Lev work-stealing deque with a fixed size ring
+//Memory orderings follow "Correct and Efficient Work-Stealing for Weak
+//Memory Models" (Le, Pop, Cohen, Zappa Nardelli, PPoPP 2013)
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p64_wsdeque.h"
+#include "p64_alloc.h"
+#include "build_config.h"
+
+#include "arch.h"
+#include "common.h"
+#include "stats.h"
+
+typedef uint32_t ringidx_t;
+
+struct p64_wsdeque
+{
+    ringidx_t top;//Next element to steal, updated by thieves and owner
+    ringidx_t bottom ALIGNED(CACHE_LINE);//Next free slot, written by owner
+    ringidx_t mask;
+    void *ring[] ALIGNED(CACHE_LINE);
+} ALIGNED(CACHE_LINE);
+
+p64_wsdeque_t *
+p64_wsdeque_alloc(uint32_t nelems)
+{
+    unsigned long ringsz = ROUNDUP_POW2(nelems);
+    if (nelems == 0 || ringsz == 0 || ringsz > 0x40000000)
+    {
+	fprintf(stderr, "Invalid number of elements %u\n", nelems), abort();
+    }
+    size_t nbytes = ROUNDUP(sizeof(p64_wsdeque_t) + ringsz * sizeof(void *),
+			    CACHE_LINE);
+    p64_wsdeque_t *wsd = p64_malloc(nbytes, CACHE_LINE, P64_ALLOC_ANYNODE, 0);
+    if (wsd != NULL)
+    {
+	wsd->top = 0;
+	wsd->bottom = 0;
+	wsd->mask = ringsz - 1;
+	for (uint32_t i = 0; i < ringsz; i++)
+	{
+	    wsd->ring[i] = NULL;
+	}
+    }
+    return wsd;
+}
+
+void
+p64_wsdeque_free(p64_wsdeque_t *wsd)
+{
+    if (wsd != NULL)
+    {
+	if (wsd->top != wsd->bottom)
+	{
+	    fprintf(stderr, "Work-stealing deque %p is not empty\n", wsd),
+	    abort();
+	}
+	p64_mfree(wsd);
+    }
+}
+
+bool
+p64_wsdeque_push(p64_wsdeque_t *wsd, void *elem)
+{
+    ringidx_t b = __atomic_load_n(&wsd->bottom, __ATOMIC_RELAXED);
+    //Acquire top so that the slot is no longer read by the thief which
+    //stole it
+    ringidx_t t = __atomic_load_n(&wsd->top, __ATOMIC_ACQUIRE);
+    if (UNLIKELY((int32_t)(b - t) > (int32_t)wsd->mask))
+    {
+	//Deque full
+	return false;
+    }
+    //Thieves may read the slot concurrently (and fail their CAS)
+    __atomic_store_n(&wsd->ring[b & wsd->mask], elem, __ATOMIC_RELAXED);
+    //Release MO: element must be written before it becomes visible
+#ifdef USE_DMB
+    smp_fence(StoreStore);
+    __atomic_store_n(&wsd->bottom, b + 1, __ATOMIC_RELAXED);
+#else
+    __atomic_store_n(&wsd->bottom, b + 1, __ATOMIC_RELEASE);
+#endif
+    return true;
+}
+
+void *
+p64_wsdeque_pop(p64_wsdeque_t *wsd)
+{
+    ringidx_t b = __atomic_load_n(&wsd->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&wsd->bottom, b, __ATOMIC_RELAXED);
+    //Our update of bottom must be visible to thieves before we read top
+    smp_fence(StoreLoad);
+    ringidx_t t = __atomic_load_n(&wsd->top, __ATOMIC_RELAXED);
+    if (UNLIKELY((int32_t)(b - t) < 0))
+    {
+	//Deque empty, restore bottom
+	__atomic_store_n(&wsd->bottom, b + 1, __ATOMIC_RELAXED);
+	return NULL;
+    }
+    void *elem = __atomic_load_n(&wsd->ring[b & wsd->mask], __ATOMIC_RELAXED);
+    if (b != t)
+    {
+	//More than one element, thieves cannot reach this one
+	return elem;
+    }
+    //Last element, race against thieves
+    if (!__atomic_compare_exchange_n(&wsd->top,
+				     &t,
+				     t + 1,
+				     /*weak=*/false,
+				     __ATOMIC_SEQ_CST,
+				     __ATOMIC_RELAXED))
+    {
+	//Lost the race, a thief took the element
+	elem = NULL;
+    }
+    __atomic_store_n(&wsd->bottom, b + 1, __ATOMIC_RELAXED);
+    return elem;
+}
+
+void *
+p64_wsdeque_steal(p64_wsdeque_t *wsd)
+{
+    ringidx_t t = __atomic_load_n(&wsd->top, __ATOMIC_ACQUIRE);
+    do
+    {
+	//Read top before bottom, sequential consistency with owner's pop
+	smp_fence(StoreLoad);
+	//Acquire MO: read element written before bottom was updated
+	ringidx_t b = __atomic_load_n(&wsd->bottom, __ATOMIC_ACQUIRE);
+	if ((int32_t)(b - t) <= 0)
+	{
+	    //Deque empty
+	    return NULL;
+	}
+	void *elem = __atomic_load_n(&wsd->ring[t & wsd->mask],
+				     __ATOMIC_RELAXED);
+	if (__atomic_compare_exchange_n(&wsd->top,
+					&t,//Updated on failure
+					t + 1,
+					/*weak=*/false,
+					__ATOMIC_SEQ_CST,
+					__ATOMIC_ACQUIRE))
+	{
+	    return elem;
+	}
+	//Lost race against other thief or owner, retry
+    }
+    while (STAT_RETRY(STAT_WSDEQUE_RETRY));
+    return NULL;
+}
+
+uint32_t
+p64_wsdeque_size(p64_wsdeque_t *wsd)
+{
+    ringidx_t t = __atomic_load_n(&wsd->top, __ATOMIC_RELAXED);
+    ringidx_t b = __atomic_load_n(&wsd->bottom, __ATOMIC_RELAXED);
+    int32_t n = (int32_t)(b - t);
+    return n > 0 ? n : 0;
+}
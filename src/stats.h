@@ -0,0 +1,98 @@
+//Copyright (c) 2018, ARM Limited. All rights reserved.
+//
+//SPDX-License-Identifier:        BSD-3-Clause
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "build_config.h"
+
+#include "arch.h"
+#include "common.h"
+
+//Contention counters, retries count failed atomic updates, spins count
+//iterations of wait loops and wait counts cycles of the arch counter
+enum stat
+{
+    STAT_RINGBUF_RETRY,
+    STAT_RINGBUF_WAIT,
+    STAT_MSGRING_RETRY,
+    STAT_MSGRING_WAIT,
+    STAT_LFRING_RETRY,
+    STAT_FUTEX_SLEEP,
+    STAT_BACKOFF_YIELD,
+    STAT_SPINLOCK_SPIN,
+    STAT_SPINLOCK_WAIT,
+    STAT_RWLOCK_RETRY,
+    STAT_RWLOCK_WAIT,
+    STAT_BRLOCK_RETRY,
+    STAT_BRLOCK_WAIT,
+    STAT_CLHLOCK_WAIT,
+    STAT_BARRIER_WAIT,
+    STAT_RWSYNC_RETRY,
+    STAT_RWSYNC_WAIT,
+    STAT_HASHTABLE_RETRY,
+    STAT_SKIPLIST_RETRY,
+    STAT_CUCKOOHT_RETRY,
+    STAT_CUCKOOHT_MOVE,
+    STAT_WSDEQUE_RETRY,
+    STAT_MPSCQ_WAIT,
+    STAT_HAZPTR_GC,
+    STAT_HAZPTR_FREED,
+    STAT_QSBR_RECLAIM,
+    STAT_QSBR_FREED,
+    STAT_TIMER_RETRY,
+    STAT_MEMPOOL_RETRY,
+    STAT_REORDER_RETRY,
+    STAT_LAXROB_RETRY,
+    STAT_REASSEMBLE_RETRY,
+    STAT_REASSEMBLE_EVICT,
+    STAT_NUM
+};
+
+#ifdef P64_STATS
+
+//Per-thread counters, only updated by the owning thread
+struct p64_stats
+{
+    uint64_t cnt[STAT_NUM];
+    struct p64_stats *next;
+} ALIGNED(CACHE_LINE);
+
+extern __thread struct p64_stats *p64_stats_tls;
+
+struct p64_stats *p64_stats_register(void);
+
+static inline void
+stat_add(enum stat id, uint64_t n)
+{
+    struct p64_stats *st = p64_stats_tls;
+    if (UNLIKELY(st == NULL))
+    {
+	st = p64_stats_register();
+    }
+    //Not an atomic RMW, only atomic with regards to p64_stats_dump()
+    __atomic_store_n(&st->cnt[id],
+		     __atomic_load_n(&st->cnt[id], __ATOMIC_RELAXED) + n,
+		     __ATOMIC_RELAXED);
+}
+
+#define STAT_ADD(id, n) stat_add((id), (n))
+#define STAT_TIMESTAMP() counter_read()
+
+#else
+
+//No code generated, sizeof() avoids unused variable warnings
+#define STAT_ADD(id, n) ((void)sizeof(n))
+#define STAT_TIMESTAMP() 0
+
+#endif
+
+#define STAT_INC(id) STAT_ADD((id), 1)
+//Count a retry and evaluate to true, for use in loop conditions
+#define STAT_RETRY(id) (STAT_INC(id), true)
+
+#endif